@@ -0,0 +1,497 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*
+ * Running many whole-file operations on a pool of threads.
+ *
+ * When a batch is run its tasks are dealt out to the workers in
+ * contiguous runs.  Each worker takes tasks from the front of its own
+ * run, and when that is empty steals from the back of whichever other
+ * run has most left, so a worker that gets a few large files doesn't
+ * hold up the rest.  Every queue has its own lock, which is only taken
+ * once per task.
+ *
+ * Workers keep their file buffers, basis cache and signature and patch
+ * jobs from one task to the next, resetting rather than recreating
+ * them, so small files cost little more than opening them.  They are
+ * kept between runs of the same batch too.
+ */
+
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "librsync.h"
+#include "util.h"
+#include "trace.h"
+#include "job.h"
+#include "buf.h"
+
+/* Size of each worker's basis cache. */
+#define RS_BATCH_BASIS_LEN      (256 << 10)
+
+
+typedef struct rs_batch_task {
+    rs_batch_op         op;
+    char                *names[3];
+    rs_result           result;
+} rs_batch_task_t;
+
+
+/* A worker's share of the tasks: those from head up to but not
+ * including tail are still to do. */
+typedef struct rs_batch_queue {
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t     lock;
+#endif
+    int                 head, tail;
+} rs_batch_queue_t;
+
+
+typedef struct rs_batch_worker {
+    struct rs_batch     *batch;
+    rs_batch_queue_t    queue;
+    rs_job_t            *sig_job, *patch_job;
+    rs_filebuf_t        *in_fb, *out_fb;
+    rs_basisbuf_t       *basis;
+    rs_stats_t          stats;
+#ifdef HAVE_PTHREAD
+    pthread_t           thread;
+#endif
+} rs_batch_worker_t;
+
+
+struct rs_batch {
+    size_t              block_len, strong_len;
+    rs_magic_number     sig_magic;
+
+    rs_batch_task_t     *tasks;
+    int                 count, alloc;
+    int                 done;           /**< Tasks already run. */
+
+    rs_batch_worker_t   *workers;
+    int                 nworkers;
+};
+
+
+static void rs_batch_lock(rs_batch_queue_t *q)
+{
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&q->lock);
+#endif
+}
+
+
+static void rs_batch_unlock(rs_batch_queue_t *q)
+{
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&q->lock);
+#endif
+}
+
+
+/*
+ * Return the next task for W from its own queue, or stolen from
+ * another, or -1 if there are none left anywhere.
+ */
+static int rs_batch_take(rs_batch_worker_t *w)
+{
+    rs_batch_t          *batch = w->batch;
+    rs_batch_queue_t    *q;
+    int                 i, left, most, task = -1;
+
+    rs_batch_lock(&w->queue);
+    if (w->queue.head < w->queue.tail)
+        task = w->queue.head++;
+    rs_batch_unlock(&w->queue);
+
+    while (task < 0) {
+        q = NULL;
+        most = 0;
+        for (i = 0; i < batch->nworkers; i++) {
+            rs_batch_lock(&batch->workers[i].queue);
+            left = batch->workers[i].queue.tail
+                - batch->workers[i].queue.head;
+            rs_batch_unlock(&batch->workers[i].queue);
+            if (left > most) {
+                most = left;
+                q = &batch->workers[i].queue;
+            }
+        }
+        if (!q)
+            break;
+        /* Someone else may have got there first, in which case look
+         * again. */
+        rs_batch_lock(q);
+        if (q->head < q->tail)
+            task = --q->tail;
+        rs_batch_unlock(q);
+    }
+    return task;
+}
+
+
+static void rs_batch_add_stats(rs_stats_t *to, rs_stats_t const *from)
+{
+    to->lit_cmds += from->lit_cmds;
+    to->lit_bytes += from->lit_bytes;
+    to->lit_cmdbytes += from->lit_cmdbytes;
+    to->copy_cmds += from->copy_cmds;
+    to->copy_bytes += from->copy_bytes;
+    to->copy_cmdbytes += from->copy_cmdbytes;
+    to->sig_cmds += from->sig_cmds;
+    to->sig_bytes += from->sig_bytes;
+    to->false_matches += from->false_matches;
+    to->sig_blocks += from->sig_blocks;
+    to->in_bytes += from->in_bytes;
+    to->out_bytes += from->out_bytes;
+    to->basis_wait_ns += from->basis_wait_ns;
+    to->copy_direct_bytes += from->copy_direct_bytes;
+    to->in_wait_ns += from->in_wait_ns;
+    to->out_wait_ns += from->out_wait_ns;
+    to->weak_sum_ns += from->weak_sum_ns;
+    to->probe_ns += from->probe_ns;
+    to->strong_sum_ns += from->strong_sum_ns;
+    to->emit_ns += from->emit_ns;
+    to->find_count += from->find_count;
+    to->match_count += from->match_count;
+    to->hashcmp_count += from->hashcmp_count;
+    to->entrycmp_count += from->entrycmp_count;
+    to->calc_strong_count += from->calc_strong_count;
+    to->iter_count += from->iter_count;
+    to->blocked_in_count += from->blocked_in_count;
+    to->blocked_out_count += from->blocked_out_count;
+    to->scoop_allocs += from->scoop_allocs;
+    to->scoop_moved_bytes += from->scoop_moved_bytes;
+    to->tube_catchups += from->tube_catchups;
+    to->tube_buffered_bytes += from->tube_buffered_bytes;
+    to->tube_direct_bytes += from->tube_direct_bytes;
+    if (!to->start || (from->start && from->start < to->start))
+        to->start = from->start;
+    if (from->end > to->end)
+        to->end = from->end;
+}
+
+
+/* Run JOB from IN to OUT through W's buffers. */
+static rs_result rs_batch_drive(rs_batch_worker_t *w, rs_job_t *job,
+                                FILE *in, FILE *out)
+{
+    rs_buffers_t        buf;
+    rs_result           result;
+
+    rs_filebuf_reset(w->in_fb, in);
+    rs_filebuf_reset(w->out_fb, out);
+    result = rs_job_drive(job, &buf, rs_infilebuf_fill, w->in_fb,
+                          out ? rs_outfilebuf_drain : NULL, w->out_fb);
+    rs_batch_add_stats(&w->stats, &job->stats);
+    return result;
+}
+
+
+static rs_result rs_batch_sig(rs_batch_worker_t *w, FILE *basis, FILE *sig)
+{
+    rs_batch_t          *batch = w->batch;
+
+    if (!w->sig_job) {
+        w->sig_job = rs_sig_begin(batch->block_len, batch->strong_len,
+                                  batch->sig_magic);
+        rs_sig_set_levels(w->sig_job, rs_sig_levels, rs_sig_level_factor);
+    } else {
+        rs_job_reset(w->sig_job);
+    }
+    return rs_batch_drive(w, w->sig_job, basis, sig);
+}
+
+
+static rs_result rs_batch_delta(rs_batch_worker_t *w, FILE *sig, FILE *new,
+                                FILE *delta)
+{
+    rs_signature_t      *sumset;
+    rs_job_t            *job;
+    rs_result           result;
+
+    job = rs_loadsig_begin(&sumset);
+    result = rs_batch_drive(w, job, sig, NULL);
+    rs_job_free(job);
+    if (result == RS_DONE)
+        result = rs_build_hash_table(sumset);
+    if (result == RS_DONE) {
+        job = rs_delta_begin(sumset);
+        result = rs_batch_drive(w, job, new, delta);
+        rs_job_free(job);
+    }
+    rs_free_sumset(sumset);
+    return result;
+}
+
+
+static rs_result rs_batch_patch(rs_batch_worker_t *w, FILE *basis,
+                                FILE *delta, FILE *new)
+{
+    rs_basisbuf_reset(w->basis, fileno(basis));
+    if (!w->patch_job)
+        w->patch_job = rs_patch_begin(rs_basisbuf_copy_cb, w->basis);
+    else
+        rs_job_reset(w->patch_job);
+    return rs_batch_drive(w, w->patch_job, delta, new);
+}
+
+
+static rs_result rs_batch_do(rs_batch_worker_t *w, rs_batch_task_t *t)
+{
+    static char const   *modes[3][3] = {
+        { "rb", "wb", NULL },   /* signature: basis, signature */
+        { "rb", "rb", "wb" },   /* delta: signature, new, delta */
+        { "rb", "rb", "wb" },   /* patch: basis, delta, new */
+    };
+    FILE                *f[3] = { NULL, NULL, NULL };
+    rs_result           result = RS_DONE;
+    int                 i;
+
+    for (i = 0; i < 3 && modes[t->op][i]; i++) {
+        if (!(f[i] = fopen(t->names[i], modes[t->op][i]))) {
+            rs_error("can't open \"%s\": %s", t->names[i], strerror(errno));
+            result = RS_IO_ERROR;
+            goto out;
+        }
+    }
+
+    if (t->op == RS_BATCH_SIGNATURE)
+        result = rs_batch_sig(w, f[0], f[1]);
+    else if (t->op == RS_BATCH_DELTA)
+        result = rs_batch_delta(w, f[0], f[1], f[2]);
+    else
+        result = rs_batch_patch(w, f[0], f[1], f[2]);
+
+  out:
+    for (i = 0; i < 3; i++) {
+        if (!f[i])
+            continue;
+        if (fclose(f[i]) && result == RS_DONE) {
+            rs_error("error closing \"%s\": %s", t->names[i],
+                     strerror(errno));
+            result = RS_IO_ERROR;
+        }
+    }
+    return result;
+}
+
+
+static void *rs_batch_worker(void *arg)
+{
+    rs_batch_worker_t   *w = (rs_batch_worker_t *) arg;
+    rs_batch_task_t     *t;
+    int                 task;
+
+    while ((task = rs_batch_take(w)) >= 0) {
+        t = &w->batch->tasks[task];
+        t->result = rs_batch_do(w, t);
+    }
+    return NULL;
+}
+
+
+rs_batch_t *rs_batch_new(int nthreads, size_t block_len, size_t strong_len,
+                         rs_magic_number sig_magic)
+{
+    rs_batch_t          *batch = rs_alloc_struct(rs_batch_t);
+    rs_batch_worker_t   *w;
+    int                 i;
+
+#ifdef HAVE_PTHREAD
+    if (nthreads <= 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (nthreads <= 0)
+        nthreads = 1;
+#ifndef HAVE_PTHREAD
+    nthreads = 1;
+#endif
+
+    batch->block_len = block_len;
+    batch->strong_len = strong_len;
+    batch->sig_magic = sig_magic;
+    batch->nworkers = nthreads;
+    batch->workers = rs_alloc(nthreads * sizeof *batch->workers,
+                              "batch workers");
+    for (i = 0; i < nthreads; i++) {
+        w = &batch->workers[i];
+        rs_bzero(w, sizeof *w);
+        w->batch = batch;
+#ifdef HAVE_PTHREAD
+        pthread_mutex_init(&w->queue.lock, NULL);
+#endif
+        w->in_fb = rs_filebuf_new(NULL, rs_inbuflen);
+        w->out_fb = rs_filebuf_new(NULL, rs_outbuflen);
+        w->basis = rs_basisbuf_new(-1, RS_BATCH_BASIS_LEN);
+    }
+    return batch;
+}
+
+
+static char *rs_batch_strdup(char const *s)
+{
+    size_t      len = strlen(s) + 1;
+
+    return memcpy(rs_alloc(len, "batch file name"), s, len);
+}
+
+
+int rs_batch_add(rs_batch_t *batch, rs_batch_op op, char const *file1,
+                 char const *file2, char const *file3)
+{
+    rs_batch_task_t     *t;
+    char const          *names[3];
+    int                 i, nnames;
+
+    names[0] = file1;
+    names[1] = file2;
+    names[2] = file3;
+    if (op == RS_BATCH_SIGNATURE)
+        nnames = 2;
+    else if (op == RS_BATCH_DELTA || op == RS_BATCH_PATCH)
+        nnames = 3;
+    else {
+        rs_error("unknown batch operation %d", (int) op);
+        return -1;
+    }
+    for (i = 0; i < nnames; i++) {
+        if (!names[i]) {
+            rs_error("batch task is missing file %d", i + 1);
+            return -1;
+        }
+    }
+
+    if (batch->count == batch->alloc) {
+        batch->alloc = batch->alloc ? 2 * batch->alloc : 64;
+        batch->tasks = rs_realloc(batch->tasks,
+                                  batch->alloc * sizeof *batch->tasks,
+                                  "batch tasks");
+    }
+    t = &batch->tasks[batch->count];
+    rs_bzero(t, sizeof *t);
+    t->op = op;
+    t->result = RS_RUNNING;
+    for (i = 0; i < nnames; i++)
+        t->names[i] = rs_batch_strdup(names[i]);
+    return batch->count++;
+}
+
+
+rs_result rs_batch_run(rs_batch_t *batch, rs_stats_t *stats)
+{
+    rs_batch_worker_t   *w;
+    int                 n = batch->count - batch->done;
+    int                 nworkers, started = 0, i;
+    rs_result           result = RS_DONE;
+    rs_long_t           start = rs_clock_ns();
+
+    nworkers = batch->nworkers < n ? batch->nworkers : n;
+    for (i = 0; i < batch->nworkers; i++) {
+        w = &batch->workers[i];
+        rs_bzero(&w->stats, sizeof w->stats);
+        w->queue.head = batch->done + (i < nworkers ? i * n / nworkers : n);
+        w->queue.tail = batch->done
+            + (i < nworkers ? (i + 1) * n / nworkers : n);
+    }
+
+#ifdef HAVE_PTHREAD
+    if (nworkers > 1) {
+        for (started = 0; started < nworkers; started++)
+            if (pthread_create(&batch->workers[started].thread, NULL,
+                               rs_batch_worker, &batch->workers[started]))
+                break;
+        rs_trace("started %d batch threads", started);
+    }
+#endif
+    /* Without threads, the one worker here steals everything. */
+    if (!started)
+        rs_batch_worker(&batch->workers[0]);
+#ifdef HAVE_PTHREAD
+    for (i = 0; i < started; i++)
+        pthread_join(batch->workers[i].thread, NULL);
+#endif
+
+    if (stats) {
+        rs_bzero(stats, sizeof *stats);
+        stats->op = "batch";
+        stats->block_len = batch->block_len;
+        for (i = 0; i < batch->nworkers; i++)
+            rs_batch_add_stats(stats, &batch->workers[i].stats);
+        /* The jobs overlap, so their times would add up to more than
+         * the run took. */
+        stats->elapsed_ns = rs_clock_ns() - start;
+    }
+    for (i = batch->done; i < batch->count; i++) {
+        if (batch->tasks[i].result != RS_DONE) {
+            result = batch->tasks[i].result;
+            break;
+        }
+    }
+    batch->done = batch->count;
+    return result;
+}
+
+
+rs_result rs_batch_result(rs_batch_t const *batch, int task)
+{
+    assert(task >= 0 && task < batch->count);
+    return batch->tasks[task].result;
+}
+
+
+void rs_batch_free(rs_batch_t *batch)
+{
+    rs_batch_worker_t   *w;
+    int                 i, j;
+
+    for (i = 0; i < batch->nworkers; i++) {
+        w = &batch->workers[i];
+        if (w->sig_job)
+            rs_job_free(w->sig_job);
+        if (w->patch_job)
+            rs_job_free(w->patch_job);
+        rs_filebuf_free(w->in_fb);
+        rs_filebuf_free(w->out_fb);
+        rs_basisbuf_free(w->basis);
+#ifdef HAVE_PTHREAD
+        pthread_mutex_destroy(&w->queue.lock);
+#endif
+    }
+    rs_free(batch->workers);
+    for (i = 0; i < batch->count; i++)
+        for (j = 0; j < 3; j++)
+            rs_free(batch->tasks[i].names[j]);
+    rs_free(batch->tasks);
+    rs_free(batch);
+}
@@ -46,6 +46,19 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <sys/stat.h>
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_IOCTL_H
+#include <sys/ioctl.h>
+#endif
+#ifdef HAVE_LINUX_FS_H
+#include <linux/fs.h>
+#endif
 
 #include "librsync.h"
 #include "trace.h"
@@ -65,9 +78,20 @@
  */
 int rs_inbuflen = 16000, rs_outbuflen = 16000;
 
+/**
+ * Patch readahead depth for the whole-file functions.
+ */
+int rs_patch_lookahead = 16;
+
+/**
+ * Multi-level signature settings for the whole-file functions.
+ */
+int rs_sig_levels = 1, rs_sig_level_factor = 32;
+
 
 struct rs_filebuf {
         FILE *f;
+        int             fd;     /* used instead of f by the fdbuf functions */
         char            *buf;
         size_t          buf_len;
 };
@@ -85,11 +109,28 @@ rs_filebuf_t *rs_filebuf_new(FILE *f, size_t buf_len)
 }
 
 
+rs_filebuf_t *rs_fdbuf_new(int fd, size_t buf_len)
+{
+    rs_filebuf_t *pf = rs_filebuf_new(NULL, buf_len);
+
+    pf->fd = fd;
+
+    return pf;
+}
+
+
+/* Use FB for another file, keeping its buffer. */
+void rs_filebuf_reset(rs_filebuf_t *fb, FILE *f)
+{
+    fb->f = f;
+}
+
+
 void rs_filebuf_free(rs_filebuf_t *fb)
 {
-	free(fb->buf);
+	rs_free(fb->buf);
         rs_bzero(fb, sizeof *fb);
-        free(fb);
+        rs_free(fb);
 }
 
 
@@ -225,3 +266,361 @@ rs_result rs_file_copy_cb(void *arg, rs_long_t pos, size_t *len, void **buf)
         return RS_DONE;
     }
 }
+
+
+
+/*
+ * Like rs_infilebuf_fill(), but reading from a file descriptor.
+ */
+rs_result rs_infdbuf_fill(rs_job_t *job, rs_buffers_t *buf, void *opaque)
+{
+    ssize_t                 len;
+    rs_filebuf_t            *fb = (rs_filebuf_t *) opaque;
+
+    if (buf->eof_in || buf->avail_in)
+        return RS_DONE;
+
+    do {
+        len = read(fb->fd, fb->buf, fb->buf_len);
+    } while (len < 0 && errno == EINTR);
+
+    if (len < 0) {
+        rs_error("error filling buf from fd%d: %s", fb->fd, strerror(errno));
+        return RS_IO_ERROR;
+    } else if (len == 0) {
+        rs_trace("seen end of file on input");
+        buf->eof_in = 1;
+        return RS_DONE;
+    }
+    buf->avail_in = len;
+    buf->next_in = fb->buf;
+
+    job->stats.in_bytes += len;
+
+    return RS_DONE;
+}
+
+
+/* Write all of LEN bytes at P to FD, retrying after short writes. */
+static rs_result rs_fd_write_all(int fd, char const *p, size_t len)
+{
+    ssize_t done;
+
+    while (len) {
+        done = write(fd, p, len);
+        if (done < 0) {
+            if (errno == EINTR)
+                continue;
+            rs_error("error draining buf to fd%d: %s", fd, strerror(errno));
+            return RS_IO_ERROR;
+        }
+        p += done;
+        len -= done;
+    }
+    return RS_DONE;
+}
+
+
+/*
+ * Like rs_outfilebuf_drain(), but writing to a file descriptor.
+ */
+rs_result rs_outfdbuf_drain(rs_job_t *job, rs_buffers_t *buf, void *opaque)
+{
+    size_t present;
+    rs_result result;
+    rs_filebuf_t *fb = (rs_filebuf_t *) opaque;
+
+    if (buf->next_out == NULL) {
+        assert(buf->avail_out == 0);
+
+        buf->next_out = fb->buf;
+        buf->avail_out = fb->buf_len;
+
+        return RS_DONE;
+    }
+
+    assert(buf->next_out >= fb->buf);
+    assert(buf->next_out <= fb->buf + fb->buf_len);
+
+    present = buf->next_out - fb->buf;
+    if (present > 0) {
+        if ((result = rs_fd_write_all(fb->fd, fb->buf, present)) != RS_DONE)
+            return result;
+
+        buf->next_out = fb->buf;
+        buf->avail_out = fb->buf_len;
+
+        job->stats.out_bytes += present;
+    }
+
+    return RS_DONE;
+}
+
+
+/**
+ * ::rs_copy_cb that reads from a file descriptor.  \p arg must point
+ * to an int.
+ */
+rs_result rs_fd_copy_cb(void *arg, rs_long_t pos, size_t *len, void **buf)
+{
+    int         fd = *(int *) arg;
+    ssize_t     got;
+
+#ifdef HAVE_PREAD
+    do {
+        got = pread(fd, *buf, *len, pos);
+    } while (got < 0 && errno == EINTR);
+#else
+    if (lseek(fd, pos, SEEK_SET) < 0) {
+        rs_log(RS_LOG_ERR, "seek failed: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    got = read(fd, *buf, *len);
+#endif
+    if (got < 0) {
+        rs_error("read error: %s", strerror(errno));
+        return RS_IO_ERROR;
+    } else if (got == 0) {
+        rs_error("unexpected eof on fd%d", fd);
+        return RS_INPUT_ENDED;
+    }
+    *len = got;
+    return RS_DONE;
+}
+
+
+/* Basis reads are aligned to this, to suit direct IO and the page
+ * cache. */
+#define RS_BASISBUF_ALIGN       4096
+
+
+rs_basisbuf_t *rs_basisbuf_new(int fd, size_t buf_len)
+{
+    rs_basisbuf_t *bb = rs_alloc_struct(rs_basisbuf_t);
+
+    bb->fd = fd;
+    bb->buf_len = buf_len;
+    bb->buf = rs_alloc(buf_len, "basis buffer");
+    bb->fd_pos = -1;
+    return bb;
+}
+
+
+/* Read another basis through BB, dropping what's cached. */
+void rs_basisbuf_reset(rs_basisbuf_t *bb, int fd)
+{
+    bb->fd = fd;
+    bb->buf_pos = 0;
+    bb->avail = 0;
+    bb->fd_pos = -1;
+}
+
+
+void rs_basisbuf_free(rs_basisbuf_t *bb)
+{
+    rs_free(bb->buf);
+    rs_bzero(bb, sizeof *bb);
+    rs_free(bb);
+}
+
+
+/* Fill the cache with the aligned block containing POS. */
+static rs_result rs_basisbuf_fill(rs_basisbuf_t *bb, rs_long_t pos)
+{
+    ssize_t     got;
+    rs_long_t   start = pos - pos % RS_BASISBUF_ALIGN;
+
+    bb->avail = 0;
+#ifdef HAVE_PREAD
+    do {
+        got = pread(bb->fd, bb->buf, bb->buf_len, start);
+    } while (got < 0 && errno == EINTR);
+#else
+    if (bb->fd_pos != start) {
+        if (lseek(bb->fd, start, SEEK_SET) < 0) {
+            bb->fd_pos = -1;
+            rs_log(RS_LOG_ERR, "seek failed: %s", strerror(errno));
+            return RS_IO_ERROR;
+        }
+        bb->fd_pos = start;
+    }
+    do {
+        got = read(bb->fd, bb->buf, bb->buf_len);
+    } while (got < 0 && errno == EINTR);
+    bb->fd_pos = got < 0 ? -1 : start + got;
+#endif
+    if (got < 0) {
+        rs_error("read error: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    bb->buf_pos = start;
+    bb->avail = got;
+    return RS_DONE;
+}
+
+
+/**
+ * ::rs_copy_cb that reads the basis through an rs_basisbuf_t.
+ *
+ * COPY commands mostly carry on from where the last one stopped, so
+ * rather than seeking and reading for every call the file is read in
+ * large aligned blocks and requests are answered from the cache,
+ * returning a pointer into it without copying.
+ */
+rs_result rs_basisbuf_copy_cb(void *arg, rs_long_t pos, size_t *len,
+                              void **buf)
+{
+    rs_basisbuf_t       *bb = (rs_basisbuf_t *) arg;
+    size_t              off;
+    rs_result           result;
+
+    if (pos < bb->buf_pos || pos >= bb->buf_pos + (rs_long_t) bb->avail) {
+        if ((result = rs_basisbuf_fill(bb, pos)) != RS_DONE)
+            return result;
+        if (pos >= bb->buf_pos + (rs_long_t) bb->avail) {
+            rs_error("unexpected eof on fd%d", bb->fd);
+            return RS_INPUT_ENDED;
+        }
+    }
+
+    off = pos - bb->buf_pos;
+    if (*len > bb->avail - off)
+        *len = bb->avail - off;
+    *buf = bb->buf + off;
+    return RS_DONE;
+}
+
+
+/**
+ * ::rs_prefetch_cb that asks the kernel to start reading part of a
+ * file.  \p arg must point to an int file descriptor.
+ */
+rs_result rs_fd_prefetch_cb(void *arg, rs_long_t pos, rs_long_t len)
+{
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+    int fd = *(int *) arg;
+    int err;
+
+    if ((err = posix_fadvise(fd, pos, len, POSIX_FADV_WILLNEED)) != 0) {
+        rs_trace("posix_fadvise failed: %s", strerror(err));
+        return RS_IO_ERROR;
+    }
+    return RS_DONE;
+#else
+    return RS_UNIMPLEMENTED;
+#endif
+}
+
+
+/**
+ * Set up \p dc to copy from \p basis_fd into the file being written
+ * through \p out_fb.
+ */
+void rs_fd_direct_copy_init(rs_fd_direct_copy_t *dc, int basis_fd,
+                            rs_filebuf_t *out_fb)
+{
+    struct stat st;
+
+    rs_bzero(dc, sizeof *dc);
+    dc->basis_fd = basis_fd;
+    dc->out_fb = out_fb;
+    dc->can_clone = dc->can_copy_range = 1;
+
+    /* Only regular files have an offset to copy to. */
+    if (fstat(out_fb->fd, &st) || !S_ISREG(st.st_mode)) {
+        dc->can_clone = dc->can_copy_range = 0;
+        return;
+    }
+    dc->blksize = st.st_blksize;
+    if (fstat(basis_fd, &st) || !S_ISREG(st.st_mode))
+        dc->can_clone = dc->can_copy_range = 0;
+    else if ((rs_long_t) st.st_blksize > dc->blksize)
+        dc->blksize = st.st_blksize;
+}
+
+
+/**
+ * ::rs_direct_copy_cb that copies from the basis into the output file
+ * inside the kernel.
+ *
+ * Anything already in the output buffer is written out first, so that
+ * the output file offset is where this COPY belongs.  Ranges that start
+ * on filesystem block boundaries in both files are shared with
+ * FICLONERANGE, which on btrfs or XFS costs no data IO and no extra disk
+ * space.  Everything else goes through copy_file_range().  If neither
+ * works the job falls back to copying through the buffers.
+ */
+rs_result rs_fd_direct_copy_cb(rs_job_t *job, void *opaque, rs_long_t pos,
+                               rs_long_t *len)
+{
+    rs_fd_direct_copy_t *dc = (rs_fd_direct_copy_t *) opaque;
+    int                 out_fd = dc->out_fb->fd;
+    rs_long_t           want = *len, done = 0;
+    off_t               out_pos;
+    rs_result           result;
+
+    *len = 0;
+    if (!dc->can_clone && !dc->can_copy_range)
+        return RS_DONE;
+
+    if ((result = rs_outfdbuf_drain(job, job->stream, dc->out_fb)) != RS_DONE)
+        return result;
+    if ((out_pos = lseek(out_fd, 0, SEEK_CUR)) < 0) {
+        dc->can_clone = dc->can_copy_range = 0;
+        return RS_DONE;
+    }
+
+#if defined(FICLONERANGE) && defined(HAVE_SYS_IOCTL_H)
+    if (dc->can_clone && dc->blksize
+        && pos % dc->blksize == 0 && out_pos % dc->blksize == 0
+        && want >= dc->blksize) {
+        struct file_clone_range fcr;
+
+        fcr.src_fd = dc->basis_fd;
+        fcr.src_offset = pos;
+        fcr.src_length = want - want % dc->blksize;
+        fcr.dest_offset = out_pos;
+        if (ioctl(out_fd, FICLONERANGE, &fcr) == 0) {
+            done = fcr.src_length;
+            if (lseek(out_fd, done, SEEK_CUR) < 0) {
+                rs_error("seek failed: %s", strerror(errno));
+                return RS_IO_ERROR;
+            }
+            rs_trace("cloned " PRINTF_FORMAT_U64 " bytes from basis",
+                     PRINTF_CAST_U64(done));
+        } else if (errno != EINVAL) {
+            /* Not supported here, or the files are on different
+             * filesystems; don't try again. */
+            rs_trace("FICLONERANGE failed: %s", strerror(errno));
+            dc->can_clone = 0;
+        }
+    }
+#else
+    dc->can_clone = 0;
+#endif
+
+#ifdef HAVE_COPY_FILE_RANGE
+    while (done < want && dc->can_copy_range) {
+        off_t   in_pos = pos + done;
+        ssize_t n;
+
+        n = copy_file_range(dc->basis_fd, &in_pos, out_fd, NULL,
+                            want - done, 0);
+        if (n > 0) {
+            done += n;
+        } else if (n == 0) {
+            /* Short basis; let the buffered copy report it. */
+            break;
+        } else if (errno != EINTR) {
+            rs_trace("copy_file_range failed: %s", strerror(errno));
+            dc->can_copy_range = 0;
+        }
+    }
+#else
+    dc->can_copy_range = 0;
+#endif
+
+    job->stats.out_bytes += done;
+    *len = done;
+    return RS_DONE;
+}
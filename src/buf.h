@@ -23,8 +23,54 @@ typedef struct rs_filebuf rs_filebuf_t;
 
 rs_filebuf_t *rs_filebuf_new(FILE *f, size_t buf_len);
 
+rs_filebuf_t *rs_fdbuf_new(int fd, size_t buf_len);
+
+void rs_filebuf_reset(rs_filebuf_t *fb, FILE *f);
+
 void rs_filebuf_free(rs_filebuf_t *fb);
 
 rs_result rs_infilebuf_fill(rs_job_t *, rs_buffers_t *buf, void *fb);
 
 rs_result rs_outfilebuf_drain(rs_job_t *, rs_buffers_t *, void *fb);
+
+rs_result rs_infdbuf_fill(rs_job_t *, rs_buffers_t *buf, void *fb);
+
+rs_result rs_outfdbuf_drain(rs_job_t *, rs_buffers_t *, void *fb);
+
+rs_result rs_fd_copy_cb(void *arg, rs_long_t pos, size_t *len, void **buf);
+
+/* A cached, position-tracking reader for the basis of a patch. */
+typedef struct rs_basisbuf {
+    int                 fd;
+    char                *buf;
+    size_t              buf_len;
+    rs_long_t           buf_pos;        /* File offset of buf[0]. */
+    size_t              avail;          /* Bytes of the file in buf. */
+    rs_long_t           fd_pos;         /* Offset of fd, or -1 if unknown;
+                                         * used only without pread(). */
+} rs_basisbuf_t;
+
+rs_basisbuf_t *rs_basisbuf_new(int fd, size_t buf_len);
+
+void rs_basisbuf_reset(rs_basisbuf_t *bb, int fd);
+
+void rs_basisbuf_free(rs_basisbuf_t *bb);
+
+rs_result rs_basisbuf_copy_cb(void *arg, rs_long_t pos, size_t *len,
+                              void **buf);
+
+rs_result rs_fd_prefetch_cb(void *arg, rs_long_t pos, rs_long_t len);
+
+/* State for rs_fd_direct_copy_cb(). */
+typedef struct rs_fd_direct_copy {
+    int                 basis_fd;
+    rs_filebuf_t        *out_fb;
+    rs_long_t           blksize;
+    int                 can_clone, can_copy_range;
+} rs_fd_direct_copy_t;
+
+void rs_fd_direct_copy_init(rs_fd_direct_copy_t *dc, int basis_fd,
+                            rs_filebuf_t *out_fb);
+
+rs_result rs_fd_direct_copy_cb(rs_job_t *job, void *opaque, rs_long_t pos,
+                               rs_long_t *len);
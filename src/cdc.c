@@ -0,0 +1,221 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * cdc -- content-defined chunking for librsync signatures
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Chunk boundaries are found with FastCDC's gear hash: each byte shifts
+ * the hash left and adds a random number for the byte, so the top bits
+ * depend only on the last 64 bytes and a boundary is wherever they are
+ * all zero.  Between min and avg a mask with one more bit than the
+ * average needs is used, and after avg one with one fewer, which keeps
+ * most chunks near the average ("normalized chunking").
+ *
+ * Boundaries only depend on the data since the last one, so the
+ * signature and delta sides find the same ones wherever the data has
+ * moved to.  The gear table is part of the signature format and must
+ * never change.
+ */
+
+#include "config.h"
+
+#include "cdc.h"
+
+static const uint64_t rs_cdc_gear[256] = {
+    0xf31d41cf539cd849ULL, 0x9656b36d48f0a67dULL,
+    0xe6529f47ca95993dULL, 0xc7fb71e1e16769a8ULL,
+    0xc59d5d5671b822baULL, 0x14ae5343b73eecf3ULL,
+    0x5729396ceba84477ULL, 0xc6b62e6736f60b3eULL,
+    0xb0bf1bbb21885c27ULL, 0xe2ba9c86a53f8742ULL,
+    0xef148f29933da322ULL, 0xb8ca156d7eede4fbULL,
+    0x8b712310658f7775ULL, 0xb38c492c546fd4b9ULL,
+    0xcc369d8c05565764ULL, 0x160f3d8c73f8e45cULL,
+    0x90c5b666207d0928ULL, 0xa821e498bbfcc1dfULL,
+    0x2ff75ac6d504220cULL, 0xf201926c00a50018ULL,
+    0x4c0ba97dfd2e7ccaULL, 0x837d5f3700b9bb4eULL,
+    0x01e5cec337977859ULL, 0x7087c8325d0f0d15ULL,
+    0xa8fe805c55e4d7ebULL, 0xbfad4e379b69dfacULL,
+    0xf7f50706ab935281ULL, 0x6fb3318096c3b7ecULL,
+    0xb6df9cc3724256ccULL, 0x1c5895ed1fb32d42ULL,
+    0x87a8359fed0d460dULL, 0x940bcb042a33a386ULL,
+    0x3721372250e16435ULL, 0x7a6f0cb62983c90eULL,
+    0xb1fca57a4f19f296ULL, 0x2b852466ebb56baaULL,
+    0x11180362cb23c50cULL, 0xf5832d7b578b5ad7ULL,
+    0x44f9b14b9eab74d6ULL, 0x5967033b092140a3ULL,
+    0xb94b79ed2c84a7e8ULL, 0x6cd9172cc2cb1704ULL,
+    0x8d5b53965b867cf7ULL, 0xa71291afde0a8061ULL,
+    0xd089989da1282caeULL, 0xbc9f45e852296996ULL,
+    0xeb828aef9d3f1066ULL, 0x698493bb4f2254beULL,
+    0x5e4d0a5055f58f60ULL, 0x7b22eeb75e0451feULL,
+    0x709e333aea7dcf92ULL, 0xbfcd98d24af20757ULL,
+    0xd62ffe949543abd9ULL, 0x36262bce2885f9b7ULL,
+    0x60b9b5b83fd48161ULL, 0xdf0e7295bb9d4316ULL,
+    0xb196f2dcb28563f9ULL, 0x4ea76fd270c7f7e0ULL,
+    0xf19fbfca4933ef8bULL, 0xad6811de0176d634ULL,
+    0x6d77383b6e826938ULL, 0x09c53671ae95f42eULL,
+    0xe58e6178b9ac606fULL, 0x2bc431e516de7af6ULL,
+    0x0131fe5001ba7ce9ULL, 0x39d11bde1df126c1ULL,
+    0x6d961fde33bb08a7ULL, 0xe811ce737e0513beULL,
+    0x1363b6bd73b89ccdULL, 0x68d654f3e525edefULL,
+    0xf2711e89cdfd4168ULL, 0x3e05bd281512a6acULL,
+    0x2c6cd25427350024ULL, 0x9275f65e10087f1aULL,
+    0xf8cfa186cb2ee996ULL, 0x2d6a0a502860076dULL,
+    0x09bcf79afa2679a6ULL, 0x042847f36804c4a6ULL,
+    0xb60f4bea61d0a4d4ULL, 0xbe607fba2a36ed60ULL,
+    0x235e5073d80b318bULL, 0x7b97662629561970ULL,
+    0xf144a49f1c383cc2ULL, 0x98dafdce61993645ULL,
+    0x7c6340251ab74bd2ULL, 0x96596dbdfe75bb4dULL,
+    0x4215eb98c6008d0eULL, 0xb516a9b12d991ab0ULL,
+    0x7efdb7444092887fULL, 0x8a018c175798d6a5ULL,
+    0x5b96a0ed5a9950a9ULL, 0x194a1837f6910436ULL,
+    0xd75c40a0b8bd1f62ULL, 0x4cc5e1f2db0c39f1ULL,
+    0xfccfdc6f4c0caa79ULL, 0x13ca37bbb9bb5da1ULL,
+    0xbf29322e59e49f3eULL, 0xbe4ff7d72b06f3e3ULL,
+    0x34cffbb02367ff77ULL, 0xd2a632d70c887bdaULL,
+    0x0d76f1f718ab0d72ULL, 0x938557ac3460ffa1ULL,
+    0x44fac50e7ecac37eULL, 0x730d4524d7271215ULL,
+    0xf46d43f480d01705ULL, 0x0de064774cf2e838ULL,
+    0xd164cf780f121811ULL, 0x6010c623a2ff60bdULL,
+    0xd888ef5eded3c86cULL, 0xf6f824c34f60fd76ULL,
+    0x374766a4ee4217f0ULL, 0x2a3a8c2fdc7a111cULL,
+    0x6c1ab6eec08d4f1eULL, 0xf0de9fcb653cdbe8ULL,
+    0x2e1ae79628358855ULL, 0x96a44a76c4eddc56ULL,
+    0xb2647be5d18aa7f7ULL, 0x1ea2c541afb46505ULL,
+    0x4aae2f9dcf9bb48cULL, 0x220439b3124eef11ULL,
+    0x1782750d2c16392cULL, 0x809a337b7c38b5c3ULL,
+    0xa0691c56e3547d8eULL, 0xcfefceb240fee35cULL,
+    0xc1e645ad10cfa8b8ULL, 0x025a88d5bdd8dcfbULL,
+    0xa639ce90dcaa890fULL, 0x5fbdfeccf3919a7eULL,
+    0xc9ae0731da2d0a25ULL, 0x5faec5a95997c77fULL,
+    0x752d8cb1ea4122dbULL, 0x69b15b2cb94b7e47ULL,
+    0xba03e690297ccf6dULL, 0xc6ac6fca8d89e090ULL,
+    0xe9c61985bdca7254ULL, 0xab7fdfd1ca63679fULL,
+    0x1287a97615b2135dULL, 0x377a4be376bf4908ULL,
+    0x4d19330f962d71a5ULL, 0x4fa819f3ed970030ULL,
+    0xd0e4502d7117d49aULL, 0x470fef942f9048d8ULL,
+    0x5d7c5d2108b2369fULL, 0xd9942b0b8734026fULL,
+    0x3db79f417f32c705ULL, 0x562cdeb3b9c7d9e9ULL,
+    0x38b56cd377c4f979ULL, 0xb25b1235925f699aULL,
+    0xaa0a0a9ccb666757ULL, 0x835b984d332cb8d4ULL,
+    0x5d0e291b9d1f7e56ULL, 0x2cf786162a3c7439ULL,
+    0xec480e6e30fb008aULL, 0x2ed76fe9d6e21c67ULL,
+    0xeff4075f69361c64ULL, 0x86caf02f299b6255ULL,
+    0xcbe4ec7c143d6560ULL, 0xe5c73bd3a2ad4565ULL,
+    0x0c8e977878f4804cULL, 0x8954f425d612b895ULL,
+    0xb800a7f117d84215ULL, 0x8b80fafc15484e39ULL,
+    0xd3e383c6b92ca95dULL, 0x25cd1e17a838f97dULL,
+    0x84e95f874c211ff2ULL, 0xc14b1de5defc666bULL,
+    0x8b80178fd09c0efbULL, 0xf85dd34c1787bc8cULL,
+    0x35587475a67ec271ULL, 0xed9c81b318073dccULL,
+    0xc38ec3234d5344b1ULL, 0xa4f9165bf7fea3beULL,
+    0x581c5b3f73d8df09ULL, 0x09e4d0e0d24c653eULL,
+    0x69ef173902c9d843ULL, 0xf900a82f302d9f7dULL,
+    0x7cf39a89883d1d66ULL, 0x0912d264663d6dd8ULL,
+    0xdde58dc53a842f45ULL, 0xc128890e58ee6810ULL,
+    0x5db86a2f5c296174ULL, 0xf527a68f874330d5ULL,
+    0x45ff2f5cdfb20c85ULL, 0xf96bca6db242b212ULL,
+    0x8abe43e8d175b3f6ULL, 0x6157bfe223989811ULL,
+    0xaa76234d419cb8c9ULL, 0xb5a76eae7ac2b71eULL,
+    0x191db8c294f37236ULL, 0x2c9117feca4a2e23ULL,
+    0x4f6d28f8c76af49eULL, 0x27bfd1ba0ea5b319ULL,
+    0x0902d4cf4d335167ULL, 0x19f671385406c157ULL,
+    0x50a160d35912251fULL, 0x0ee88a14552a1e14ULL,
+    0x53e5d8b70ac13b1dULL, 0x36752a69a7b781eeULL,
+    0xe80c8a1fcea0dee8ULL, 0xb767e42b5de54be8ULL,
+    0x65bd45dddcfa276bULL, 0x997dff08f8d563e1ULL,
+    0x8ec931a35ef5de77ULL, 0xf8f61bb53e2af9d4ULL,
+    0x48f8b3d6bb501d61ULL, 0x2f450a7bdd3479afULL,
+    0xc967e378dade15b2ULL, 0xd81dd85b7cbc4b19ULL,
+    0x575efe2dfe18e3a9ULL, 0x7df0a41327e67966ULL,
+    0x2e7192d4844ab507ULL, 0x26e3c388d4d34d62ULL,
+    0x6c2fa98071083291ULL, 0x0f376e0d34b8959aULL,
+    0xf3a828d48af9a666ULL, 0x7a6b5df5a623d16aULL,
+    0xef46b5348f65e369ULL, 0x13c0dae969d6b962ULL,
+    0x0d479c752cc19d42ULL, 0x61a302ae497cf2a6ULL,
+    0xb637ad1c8a5915d0ULL, 0x82468e182b0441baULL,
+    0xcc9d0fa82d2ce033ULL, 0xa57632344f240c59ULL,
+    0x08da924c69d0fb6fULL, 0x5241bd5857279f45ULL,
+    0x1fe3e4a381971dd7ULL, 0x5b15fff1838da6e1ULL,
+    0x60882133ac957b25ULL, 0x9e147060fa283763ULL,
+    0x4c11e74a713de95eULL, 0xfcb6886d05ee976cULL,
+    0x26b4337a83e9aca7ULL, 0x0dbbc78d800e4730ULL,
+    0x4345a9b23e9d65a8ULL, 0xac550d87c13e4cb6ULL,
+    0x9aff2742980e9c9dULL, 0x8b70fe931ac6b08aULL,
+    0x02423d40d6430f4fULL, 0xecee982e3b1590c1ULL,
+    0xca14c30d7d386ef2ULL, 0x4b3e49b651666a18ULL,
+    0xc28572791bf7c416ULL, 0xb79eac53797b355eULL,
+    0xdf5b80c8d5696ca5ULL, 0xc7c0d68e9fb7c441ULL,
+    0xd59a895cccb0e6b9ULL, 0xd0b8829c21237fe8ULL,
+    0x4b4f4d9b8d20cfd7ULL, 0x01468850f7f531b3ULL,
+    0xe15b6f1292c60356ULL, 0xe082694be2ae98f2ULL,
+    0xbecb0326582d9f66ULL, 0x915a530d86e0326eULL,
+    0xf4fceda1b7abd769ULL, 0xd200630dda6bc31bULL,
+};
+
+
+/* A mask of the top BITS bits. */
+static uint64_t rs_cdc_mask(int bits)
+{
+    return ~(uint64_t) 0 << (64 - bits);
+}
+
+
+void rs_cdc_init(rs_cdc_t *cdc, size_t avg)
+{
+    int bits;
+
+    for (bits = 0; ((size_t) 2 << bits) <= avg; bits++)
+        ;
+    cdc->min = avg / 4;
+    cdc->avg = avg;
+    cdc->max = avg * 8;
+    cdc->mask_s = rs_cdc_mask(bits + 1);
+    cdc->mask_l = rs_cdc_mask(bits - 1);
+}
+
+
+/*
+ * Find the length of the chunk starting at BUF, which has LEN bytes
+ * available.  If FINAL the data ends there, so the rest is a chunk if
+ * there's no boundary in it; otherwise return 0 if more data is needed
+ * to tell.
+ */
+size_t rs_cdc_cut(rs_cdc_t const *cdc, unsigned char const *buf, size_t len,
+                  int final)
+{
+    uint64_t hash = 0;
+    size_t i, normal;
+
+    if (len >= cdc->max) {
+        len = cdc->max;
+        final = 1;
+    }
+    if (len <= cdc->min)
+        return final ? len : 0;
+    normal = len < cdc->avg ? len : cdc->avg;
+    for (i = cdc->min; i < normal; i++) {
+        hash = (hash << 1) + rs_cdc_gear[buf[i]];
+        if (!(hash & cdc->mask_s))
+            return i + 1;
+    }
+    for (; i < len; i++) {
+        hash = (hash << 1) + rs_cdc_gear[buf[i]];
+        if (!(hash & cdc->mask_l))
+            return i + 1;
+    }
+    return final ? len : 0;
+}
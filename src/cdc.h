@@ -0,0 +1,44 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * cdc -- content-defined chunking for librsync signatures
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+#ifndef _CDC_H_
+#define _CDC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** The smallest and largest average chunk lengths allowed. */
+#define RS_CDC_MIN_AVG  64
+#define RS_CDC_MAX_AVG  (1 << 24)
+
+/** Chunk boundary settings, from the signature's block length.
+ * \private */
+typedef struct rs_cdc {
+    size_t min;                 /* no boundary before this */
+    size_t avg;                 /* the block length */
+    size_t max;                 /* always a boundary here */
+    uint64_t mask_s;            /* harder mask used before avg */
+    uint64_t mask_l;            /* easier mask used after avg */
+} rs_cdc_t;
+
+void rs_cdc_init(rs_cdc_t *cdc, size_t avg);
+
+size_t rs_cdc_cut(rs_cdc_t const *cdc, unsigned char const *buf, size_t len,
+                  int final);
+
+#endif                          /* _CDC_H_ */
@@ -0,0 +1,362 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*
+ * Delta composition.
+ *
+ * Given a delta from A to B and one from B to C, we want a delta from
+ * A to C without ever building B.  The first delta is indexed, which
+ * says for each range of B whether it was copied from A or came from
+ * literal data.  The compose job then streams through the second
+ * delta: its literals are passed through, and each of its COPY
+ * commands is looked up in the index and split into COPYs from A and
+ * literals taken out of the first delta.  Adjacent COPYs that turn out
+ * to be contiguous in A are merged.
+ */
+
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "librsync.h"
+#include "util.h"
+#include "trace.h"
+#include "netint.h"
+#include "command.h"
+#include "prototab.h"
+#include "emit.h"
+#include "stream.h"
+#include "job.h"
+#include "whole.h"
+#include "dindex.h"
+
+/* use fseeko instead of fseek for long file support if we have it */
+#ifdef HAVE_FSEEKO
+#define ftell ftello
+#elif defined HAVE_FSEEKO64
+#define ftell ftello64
+#endif
+
+/* Longest LITERAL command emitted at once. */
+#define RS_COMPOSE_MAX_LITERAL  (1 << 30)
+
+
+typedef struct rs_compose {
+    rs_dindex_t         index;          /**< Commands of the first delta. */
+    FILE                *first;         /**< The first delta. */
+    rs_long_t           first_base;     /**< Offset of it in \p first. */
+
+    /** COPY from A that has not been emitted yet, in case the next one
+     * continues it. */
+    rs_long_t           copy_pos, copy_len;
+
+    /** Literal data from the first delta being copied to the output. */
+    rs_long_t           lit_pos, lit_len;
+} rs_compose_t;
+
+
+static rs_result rs_compose_s_cmdbyte(rs_job_t *);
+static rs_result rs_compose_s_params(rs_job_t *);
+static rs_result rs_compose_s_run(rs_job_t *);
+static rs_result rs_compose_s_literal(rs_job_t *);
+static rs_result rs_compose_s_copy(rs_job_t *);
+static rs_result rs_compose_s_copying(rs_job_t *);
+
+
+/*
+ * Emit the pending COPY, if any.  Returns true if anything was written,
+ * in which case the caller should let the tube drain before writing
+ * more.
+ */
+static int rs_compose_flush(rs_job_t *job)
+{
+    rs_compose_t *c = job->compose;
+
+    if (!c->copy_len)
+        return 0;
+    rs_emit_copy_cmd(job, c->copy_pos, c->copy_len);
+    c->copy_len = 0;
+    return 1;
+}
+
+
+static rs_result rs_compose_s_cmdbyte(rs_job_t *job)
+{
+    rs_result result;
+
+    if ((result = rs_suck_byte(job, &job->op)) != RS_DONE)
+        return result;
+
+    job->cmd = &rs_prototab[job->op];
+
+    if (job->cmd->len_1)
+        job->statefn = rs_compose_s_params;
+    else {
+        job->param1 = job->cmd->immediate;
+        job->statefn = rs_compose_s_run;
+    }
+
+    return RS_RUNNING;
+}
+
+
+static rs_result rs_compose_s_params(rs_job_t *job)
+{
+    rs_result result;
+    int len = job->cmd->len_1 + job->cmd->len_2;
+    void *p;
+
+    result = rs_scoop_readahead(job, len, &p);
+    if (result != RS_DONE)
+        return result;
+
+    result = rs_suck_netint(job, &job->param1, job->cmd->len_1);
+    assert(result == RS_DONE);
+
+    if (job->cmd->len_2) {
+        result = rs_suck_netint(job, &job->param2, job->cmd->len_2);
+        assert(result == RS_DONE);
+    }
+
+    job->statefn = rs_compose_s_run;
+
+    return RS_RUNNING;
+}
+
+
+static rs_result rs_compose_s_run(rs_job_t *job)
+{
+    switch (job->cmd->kind) {
+    case RS_KIND_LITERAL:
+        if (job->param1 < 0) {
+            rs_error("invalid length " PRINTF_FORMAT_U64 " on LITERAL command",
+                     PRINTF_CAST_U64(job->param1));
+            return RS_CORRUPT;
+        }
+        if (rs_compose_flush(job))
+            return RS_RUNNING;
+        job->basis_len = job->param1;
+        job->statefn = rs_compose_s_literal;
+        return RS_RUNNING;
+
+    case RS_KIND_COPY:
+        if (job->param1 < 0 || job->param2 < 0) {
+            rs_error("invalid COPY(where=" PRINTF_FORMAT_U64
+                     ", len=" PRINTF_FORMAT_U64 ")",
+                     PRINTF_CAST_U64(job->param1),
+                     PRINTF_CAST_U64(job->param2));
+            return RS_CORRUPT;
+        }
+        job->basis_pos = job->param1;
+        job->basis_len = job->param2;
+        job->statefn = rs_compose_s_copy;
+        return RS_RUNNING;
+
+    case RS_KIND_END:
+        if (rs_compose_flush(job))
+            return RS_RUNNING;
+        rs_emit_end_cmd(job);
+        return RS_DONE;
+
+    default:
+        rs_error("bogus command 0x%02x", job->op);
+        return RS_CORRUPT;
+    }
+}
+
+
+/* Pass a LITERAL from the second delta through to the output. */
+static rs_result rs_compose_s_literal(rs_job_t *job)
+{
+    rs_long_t len = job->basis_len;
+
+    if (len > RS_COMPOSE_MAX_LITERAL)
+        len = RS_COMPOSE_MAX_LITERAL;
+    if (len) {
+        rs_emit_literal_cmd(job, len);
+        rs_tube_copy(job, len);
+        job->basis_len -= len;
+    }
+
+    if (!job->basis_len)
+        job->statefn = rs_compose_s_cmdbyte;
+    return RS_RUNNING;
+}
+
+
+/*
+ * Translate a COPY from B, at basis_pos/basis_len, into commands on A.
+ */
+static rs_result rs_compose_s_copy(rs_job_t *job)
+{
+    rs_compose_t        *c = job->compose;
+    rs_dcmd_t const     *cmd;
+    size_t              i;
+    rs_long_t           skip, len, src;
+    int                 flushed;
+
+    while (job->basis_len) {
+        i = rs_dindex_find(&c->index, job->basis_pos);
+        if (i == c->index.count) {
+            rs_error("COPY(where=" PRINTF_FORMAT_U64 ", len="
+                     PRINTF_FORMAT_U64 ") is beyond the end of the "
+                     PRINTF_FORMAT_U64 " byte intermediate file",
+                     PRINTF_CAST_U64(job->basis_pos),
+                     PRINTF_CAST_U64(job->basis_len),
+                     PRINTF_CAST_U64(c->index.out_len));
+            return RS_CORRUPT;
+        }
+        cmd = &c->index.cmds[i];
+        skip = job->basis_pos - cmd->out_pos;
+        len = cmd->len - skip;
+        if (len > job->basis_len)
+            len = job->basis_len;
+
+        if (cmd->kind == RS_KIND_COPY) {
+            src = cmd->src + skip;
+            flushed = 0;
+            if (c->copy_len && c->copy_pos + c->copy_len == src) {
+                c->copy_len += len;
+            } else {
+                flushed = rs_compose_flush(job);
+                c->copy_pos = src;
+                c->copy_len = len;
+            }
+            job->basis_pos += len;
+            job->basis_len -= len;
+            if (flushed)
+                return RS_RUNNING;
+        } else {
+            if (rs_compose_flush(job))
+                return RS_RUNNING;
+            if (len > RS_COMPOSE_MAX_LITERAL)
+                len = RS_COMPOSE_MAX_LITERAL;
+            rs_emit_literal_cmd(job, len);
+            c->lit_pos = c->first_base + cmd->src + skip;
+            c->lit_len = len;
+            job->basis_pos += len;
+            job->basis_len -= len;
+            job->statefn = rs_compose_s_copying;
+            return RS_RUNNING;
+        }
+    }
+
+    job->statefn = rs_compose_s_cmdbyte;
+    return RS_RUNNING;
+}
+
+
+/*
+ * Copy literal data out of the first delta, straight into the output
+ * buffer.
+ */
+static rs_result rs_compose_s_copying(rs_job_t *job)
+{
+    rs_compose_t    *c = job->compose;
+    rs_buffers_t    *buffs = job->stream;
+    rs_result       result;
+    size_t          desired_len, len;
+    void            *ptr;
+
+    desired_len = len = (buffs->avail_out < c->lit_len) ?
+        buffs->avail_out : c->lit_len;
+    if (!len)
+        return RS_BLOCKED;
+
+    ptr = buffs->next_out;
+    result = rs_file_copy_cb(c->first, c->lit_pos, &len, &ptr);
+    if (result != RS_DONE)
+        return result;
+    if (len > desired_len)
+        len = desired_len;
+
+    buffs->next_out += len;
+    buffs->avail_out -= len;
+    c->lit_pos += len;
+    c->lit_len -= len;
+
+    if (!c->lit_len)
+        job->statefn = rs_compose_s_copy;
+    return RS_RUNNING;
+}
+
+
+static rs_result rs_compose_s_header(rs_job_t *job)
+{
+    int       v;
+    rs_result result;
+
+    if ((result = rs_suck_n4(job, &v)) != RS_DONE)
+        return result;
+
+    if (v != RS_DELTA_MAGIC) {
+        rs_log(RS_LOG_ERR,
+               "got magic number %#x rather than expected value %#x",
+               v, RS_DELTA_MAGIC);
+        return RS_BAD_MAGIC;
+    }
+
+    rs_emit_delta_header(job);
+    job->statefn = rs_compose_s_cmdbyte;
+
+    return RS_RUNNING;
+}
+
+
+rs_result rs_delta_compose(FILE *first_file, FILE *second_file,
+                           FILE *delta_file, rs_stats_t *stats)
+{
+    rs_compose_t        c;
+    rs_job_t            *job;
+    rs_result           r;
+    FILE                *first_copy;
+
+    rs_bzero(&c, sizeof c);
+
+    if ((r = rs_dindex_seekable(first_file, &first_copy)) != RS_DONE)
+        goto out;
+    c.first = first_copy ? first_copy : first_file;
+    c.first_base = ftell(c.first);
+
+    job = rs_dindex_begin(&c.index);
+    r = rs_whole_run(job, c.first, NULL);
+    rs_job_free(job);
+    if (r != RS_DONE)
+        goto out;
+
+    job = rs_job_new("compose", rs_compose_s_header);
+    job->compose = &c;
+    r = rs_whole_run(job, second_file, delta_file);
+    if (stats)
+        memcpy(stats, &job->stats, sizeof *stats);
+    rs_job_free(job);
+
+  out:
+    if (first_copy)
+        fclose(first_copy);
+    rs_dindex_free(&c.index);
+    return r;
+}
@@ -15,6 +15,9 @@
 /* Define this to enable trace code  */
 #cmakedefine DO_RS_TRACE
 
+/* Define this to time the phases of jobs */
+#cmakedefine DO_RS_TIMING
+
 /* Define to 1 if you have `alloca', as a function or macro. */
 #cmakedefine HAVE_ALLOCA 1
 
@@ -24,12 +27,21 @@
 /* Define to 1 if you have the <bzlib.h> header file.  */
 #cmakedefine HAVE_BZLIB_H 1
 
+/* Define to 1 if you have the `clock_gettime' function. */
+#cmakedefine HAVE_CLOCK_GETTIME 1
+
+/* Define to 1 if you have the `copy_file_range' function. */
+#cmakedefine HAVE_COPY_FILE_RANGE 1
+
 /* Define to 1 if you have the <dlfcn.h> header file. */
 #cmakedefine HAVE_DLFCN_H 1
 
 /* Define to 1 if you have the <fcntl.h> header file. */
 #cmakedefine HAVE_FCNTL_H 1
 
+/* Define to 1 if you have the `fmemopen' function. */
+#cmakedefine HAVE_FMEMOPEN 1
+
 /* Define to 1 if fseeko (and presumably ftello) exists and is declared. */
 #cmakedefine HAVE_FSEEKO 1
 
@@ -48,12 +60,21 @@
 /* Define to 1 if you have the `z' library (-lz). */
 #cmakedefine HAVE_LIBZ ${ZLIB_FOUND}
 
+/* Define to 1 if you have the <linux/fs.h> header file. */
+#cmakedefine HAVE_LINUX_FS_H 1
+
+/* Define to 1 if you have the <linux/io_uring.h> header file. */
+#cmakedefine HAVE_LINUX_IO_URING_H 1
+
 /* Define to 1 if you have the <malloc.h> header file. */
 #cmakedefine HAVE_MALLOC_H 1
 
 /* Define to 1 if you have the <mcheck.h> header file. */
 #cmakedefine HAVE_MCHECK_H 1
 
+/* Define to 1 if you have the `memfd_create' function. */
+#cmakedefine HAVE_MEMFD_CREATE 1
+
 /* Define to 1 if you have the `memmove' function. */
 #cmakedefine HAVE_MEMMOVE 1
 
@@ -63,9 +84,21 @@
 /* Define to 1 if you have the `memset' function. */
 #cmakedefine HAVE_MEMSET 1
 
+/* Define to 1 if you have POSIX threads. */
+#cmakedefine HAVE_PTHREAD 1
+
+/* Define to 1 if you have the `posix_fadvise' function. */
+#cmakedefine HAVE_POSIX_FADVISE 1
+
+/* Define to 1 if you have the `pread' function. */
+#cmakedefine HAVE_PREAD 1
+
 /* GNU extension of saving argv[0] to program_invocation_short_name */
 #cmakedefine HAVE_PROGRAM_INVOCATION_NAME
 
+/* Define to 1 if you have the `setrlimit' function. */
+#cmakedefine HAVE_SETRLIMIT 1
+
 /* Define to 1 if you have the `snprintf' function. */
 #cmakedefine HAVE_SNPRINTF 1
 
@@ -90,15 +123,27 @@
 /* Define to 1 if you have the <sys/file.h> header file. */
 #cmakedefine HAVE_SYS_FILE_H 1
 
+/* Define to 1 if you have the <sys/ioctl.h> header file. */
+#cmakedefine HAVE_SYS_IOCTL_H 1
+
+/* Define to 1 if you have the <sys/mman.h> header file. */
+#cmakedefine HAVE_SYS_MMAN_H 1
+
 /* Define to 1 if you have the <sys/stat.h> header file. */
 #cmakedefine HAVE_SYS_STAT_H 1
 
+/* Define to 1 if you have the <sys/syscall.h> header file. */
+#cmakedefine HAVE_SYS_SYSCALL_H 1
+
 /* Define to 1 if you have the <sys/types.h> header file. */
 #cmakedefine HAVE_SYS_TYPES_H 1
 
 /* Define to 1 if you have the <unistd.h> header file. */
 #cmakedefine HAVE_UNISTD_H 1
 
+/* Define to 1 if the compiler supports `__thread' variables. */
+#cmakedefine HAVE___THREAD 1
+
 /* Define if your cpp has vararg macros */
 #cmakedefine HAVE_VARARG_MACROS
 
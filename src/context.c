@@ -0,0 +1,79 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*
+ * Per-job settings.
+ *
+ * The process-wide variables stay the defaults: rs_context_init()
+ * copies them, and jobs without a context read them directly.
+ */
+
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "librsync.h"
+#include "util.h"
+#include "trace.h"
+#include "context.h"
+
+
+void rs_context_init(rs_context_t *ctx)
+{
+    rs_bzero(ctx, sizeof *ctx);
+    ctx->inbuflen = rs_inbuflen;
+    ctx->outbuflen = rs_outbuflen;
+    ctx->roll_paranoia = rs_roll_paranoia;
+    ctx->trace_level = rs_trace_level;
+    ctx->trace_fn = rs_trace_impl;
+    ctx->event_log = rs_job_event_log;
+}
+
+
+void *rs_ctx_alloc(rs_context_t const *ctx, size_t size, char const *name)
+{
+    void        *p;
+
+    if (!ctx || !ctx->allocator)
+        return rs_alloc(size, name);
+    if (!(p = ctx->allocator->alloc(ctx->allocator->opaque, size)))
+        rs_fatal("couldn't allocate instance of %s", name);
+    return p;
+}
+
+
+void rs_ctx_free(rs_context_t const *ctx, void *ptr)
+{
+    if (!ctx || !ctx->allocator)
+        rs_free(ptr);
+    else if (ptr)
+        ctx->allocator->free(ctx->allocator->opaque, ptr);
+}
+
+
+/* Tell the stats hook about a finished run of a job. */
+void rs_ctx_report(rs_context_t const *ctx, rs_result result,
+                   rs_stats_t const *stats)
+{
+    if (ctx && ctx->stats_cb)
+        ctx->stats_cb(ctx->stats_opaque, result, stats);
+}
@@ -0,0 +1,44 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/**
+ * \file context.h
+ * Looking up job settings.
+ *
+ * A job started without a context has a NULL \p ctx, and gets the
+ * process-wide settings, read at the time they're used.
+ */
+
+extern int rs_roll_paranoia;
+
+#define rs_ctx_inbuflen(ctx)    ((ctx) ? (ctx)->inbuflen : rs_inbuflen)
+#define rs_ctx_outbuflen(ctx)   ((ctx) ? (ctx)->outbuflen : rs_outbuflen)
+#define rs_ctx_roll_paranoia(ctx) \
+        ((ctx) ? (ctx)->roll_paranoia : rs_roll_paranoia)
+#define rs_ctx_event_log(ctx)   ((ctx) ? (ctx)->event_log : rs_job_event_log)
+
+void *rs_ctx_alloc(rs_context_t const *ctx, size_t size, char const *name);
+
+void rs_ctx_free(rs_context_t const *ctx, void *ptr);
+
+void rs_ctx_report(rs_context_t const *ctx, rs_result result,
+                   rs_stats_t const *stats);
+
+rs_context_t const *rs_trace_use(rs_context_t const *ctx);
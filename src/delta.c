@@ -49,6 +49,10 @@
  * Therefore, when we emit a COPY command, we have to send it with a
  * length that is the same as the block matched, and not the block
  * length from the signature.
+ *
+ * Signatures of content-defined chunks are matched differently: the
+ * new file is cut into chunks the same way as the basis was, and each
+ * chunk is looked up once, so there's no per-byte search at all.
  */
 
 /*
@@ -75,6 +79,7 @@
 #include "sumset.h"
 #include "job.h"
 #include "trace.h"
+#include "context.h"
 #include "search.h"
 #include "rollsum.h"
 
@@ -119,10 +124,12 @@
 int rs_roll_paranoia = 0;
 
 static rs_result rs_delta_s_scan(rs_job_t *job);
+static rs_result rs_delta_s_chunk(rs_job_t *job);
 static rs_result rs_delta_s_flush(rs_job_t *job);
 static rs_result rs_delta_s_end(rs_job_t *job);
 void rs_getinput(rs_job_t *job);
 static inline int rs_findmatch(rs_job_t *job, rs_long_t *match_pos, size_t *match_len);
+static int rs_findcoarse(rs_job_t *job, rs_long_t *match_pos, size_t *match_len);
 static inline rs_result rs_appendmatch(rs_job_t *job, rs_long_t match_pos, size_t match_len);
 static inline rs_result rs_appendmiss(rs_job_t *job, size_t miss_len);
 static inline rs_result rs_appendflush(rs_job_t *job);
@@ -141,15 +148,28 @@ static rs_result rs_delta_s_scan(rs_job_t *job)
     size_t         match_len;
     rs_result      result;
     Rollsum        test;
+    rs_long_t      start;
+    int            found;
 
     rs_job_check(job);
     /* read the input into the scoop */
     rs_getinput(job);
     /* output any pending output from the tube */
     result=rs_tube_catchup(job);
+    start = rs_timing_now();
     /* while output is not blocked and there is a block of data */
     while ((result==RS_DONE) &&
            ((job->scoop_pos + block_len) < job->scoop_avail)) {
+        /* where a block starts, try the coarser levels first */
+        if (job->weak_sum.count == 0 && job->signature->coarse) {
+            found = rs_findcoarse(job,&match_pos,&match_len);
+            if (found < 0)
+                break;
+            if (found) {
+                result=rs_appendmatch(job,match_pos,match_len);
+                continue;
+            }
+        }
         /* check if this block matches */
         if (rs_findmatch(job,&match_pos,&match_len)) {
             /* append the match and reset the weak_sum */
@@ -160,7 +180,7 @@ static rs_result rs_delta_s_scan(rs_job_t *job)
             RollsumRotate(&job->weak_sum, job->scoop_next[job->scoop_pos],
                           job->scoop_next[job->scoop_pos + block_len]);
             result=rs_appendmiss(job,1);
-            if (rs_roll_paranoia) {
+            if (rs_ctx_roll_paranoia(job->ctx)) {
                 RollsumInit(&test);
                 RollsumUpdate(&test, job->scoop_next + job->scoop_pos, block_len);
                 if (RollsumDigest(&test) != RollsumDigest(&job->weak_sum)) {
@@ -172,6 +192,7 @@ static rs_result rs_delta_s_scan(rs_job_t *job)
             }
         }
     }
+    job->scan_ns += rs_timing_now() - start;
     /* if we completed OK */
     if (result==RS_DONE) {
         /* if we reached eof, we can flush the last fragment */
@@ -187,17 +208,76 @@ static rs_result rs_delta_s_scan(rs_job_t *job)
 }
 
 
+/**
+ * \brief Cut the input into content-defined chunks and look each one up.
+ *
+ * Like rs_delta_s_scan() this processes all the input it can on each
+ * call, but a chunk is only cut once the boundary after it is seen, or
+ * at the end of the input, which also finishes the delta. */
+static rs_result rs_delta_s_chunk(rs_job_t *job)
+{
+    rs_signature_t const *sig = job->signature;
+    const int      final = job->stream->eof_in;
+    rs_byte_t      *chunk;
+    size_t         len;
+    rs_weak_sum_t  weak;
+    rs_long_t      match_pos, start, probe, strong;
+    rs_result      result;
+
+    rs_job_check(job);
+    /* read the input into the scoop */
+    rs_getinput(job);
+    /* output any pending output from the tube */
+    result=rs_tube_catchup(job);
+    start = rs_timing_now();
+    /* while output is not blocked and there is a whole chunk */
+    while ((result==RS_DONE) && (job->scoop_pos < job->scoop_avail)) {
+        chunk = job->scoop_next + job->scoop_pos;
+        len = rs_cdc_cut(&sig->cdc, chunk, job->scoop_avail - job->scoop_pos,
+                         final);
+        if (!len)
+            break;
+        weak = rs_calc_weak_sum(chunk, len);
+        strong = job->sig_stats.strong_sum_ns;
+        probe = rs_timing_now();
+        match_pos = rs_signature_find_match(sig, &job->sig_stats, weak,
+                                            chunk, len);
+        job->stats.probe_ns += rs_timing_now() - probe
+            - (job->sig_stats.strong_sum_ns - strong);
+        if (match_pos != -1)
+            result=rs_appendmatch(job,match_pos,len);
+        else
+            result=rs_appendmiss(job,len);
+    }
+    /* if we are not blocked and have used all the input, flush and set
+     * end statefn. */
+    if ((result==RS_DONE) && final && (job->scoop_pos == job->scoop_avail)) {
+        result=rs_appendflush(job);
+        job->statefn=rs_delta_s_end;
+        if (result==RS_DONE)
+            result=RS_RUNNING;
+    } else if (result==RS_DONE) {
+        /* we are blocked waiting for more data */
+        result=RS_BLOCKED;
+    }
+    job->scan_ns += rs_timing_now() - start;
+    return result;
+}
+
+
 static rs_result rs_delta_s_flush(rs_job_t *job)
 {
     rs_long_t      match_pos;
     size_t         match_len;
     rs_result      result;
+    rs_long_t      start;
 
     rs_job_check(job);
     /* read the input into the scoop */
     rs_getinput(job);
     /* output any pending output */
     result=rs_tube_catchup(job);
+    start = rs_timing_now();
     /* while output is not blocked and there is any remaining data */
     while ((result==RS_DONE) && (job->scoop_pos < job->scoop_avail)) {
         /* check if this block matches */
@@ -217,6 +297,7 @@ static rs_result rs_delta_s_flush(rs_job_t *job)
         result=rs_appendflush(job);
         job->statefn=rs_delta_s_end;
     }
+    job->scan_ns += rs_timing_now() - start;
     if (result==RS_DONE) {
         return RS_RUNNING;
     }
@@ -226,6 +307,15 @@ static rs_result rs_delta_s_flush(rs_job_t *job)
 
 static rs_result rs_delta_s_end(rs_job_t *job)
 {
+    rs_stats_t *stats = &job->stats;
+    rs_long_t  weak;
+
+    rs_signature_add_stats(stats, &job->sig_stats);
+    /* Whatever part of scanning wasn't spent searching the signature or
+     * emitting was spent on the weak sums. */
+    weak = job->scan_ns - stats->probe_ns - stats->strong_sum_ns
+        - stats->emit_ns;
+    stats->weak_sum_ns += weak > 0 ? weak : 0;
     rs_emit_end_cmd(job);
     return RS_DONE;
 }
@@ -253,6 +343,9 @@ void rs_getinput(rs_job_t *job) {
  */
 inline int rs_findmatch(rs_job_t *job, rs_long_t *match_pos, size_t *match_len) {
     const size_t block_len = job->signature->block_len;
+#ifdef DO_RS_TIMING
+    rs_long_t start, strong;
+#endif
 
     /* calculate the weak_sum if we don't have one */
     if (job->weak_sum.count == 0) {
@@ -268,7 +361,23 @@ inline int rs_findmatch(rs_job_t *job, rs_long_t *match_pos, size_t *match_len)
         /* set the match_len to the weak_sum count */
         *match_len=job->weak_sum.count;
     }
-    *match_pos = rs_signature_find_match(job->signature,
+#ifdef DO_RS_TIMING
+    /* Time a sample of the searches, leaving out any strong sum, which
+     * is timed on its own. */
+    if (++job->timing_tick % RS_TIMING_SAMPLE == 0) {
+        strong = job->sig_stats.strong_sum_ns;
+        start = rs_timing_now();
+        *match_pos = rs_signature_find_match(job->signature, &job->sig_stats,
+                                             RollsumDigest(&job->weak_sum),
+                                             job->scoop_next+job->scoop_pos,
+                                             *match_len);
+        job->stats.probe_ns += (rs_timing_now() - start
+                                - (job->sig_stats.strong_sum_ns - strong))
+            * RS_TIMING_SAMPLE;
+        return *match_pos != -1;
+    }
+#endif
+    *match_pos = rs_signature_find_match(job->signature, &job->sig_stats,
 					 RollsumDigest(&job->weak_sum),
 					 job->scoop_next+job->scoop_pos,
 					 *match_len);
@@ -276,6 +385,45 @@ inline int rs_findmatch(rs_job_t *job, rs_long_t *match_pos, size_t *match_len)
 }
 
 
+/**
+ * Try to match a whole block of the coarser levels of a multi-level
+ * signature at scoop_pos, coarsest first, returning 1 if one matched,
+ * or -1 if a level needs more input than has arrived yet.
+ *
+ * A coarse block is only looked for where it would carry on the last
+ * match, or at the start, so a run of them follows the basis and the
+ * fine blocks find where to pick it up again after a change.  Waiting
+ * for input rather than skipping a level keeps the delta the same
+ * however the input is split up.
+ */
+static int rs_findcoarse(rs_job_t *job, rs_long_t *match_pos, size_t *match_len)
+{
+    rs_byte_t      *p = job->scoop_next + job->scoop_pos;
+    const size_t   avail = job->scoop_avail - job->scoop_pos;
+    rs_signature_t *level;
+    int            n;
+
+    for (n = rs_signature_levels(job->signature); n > 0; n--) {
+        level = rs_signature_level(job->signature, n);
+        *match_len = level->block_len;
+        if (job->basis_len
+            && (job->basis_pos + job->basis_len) % level->block_len)
+            continue;
+        if (avail < *match_len) {
+            if (!job->stream->eof_in)
+                return -1;
+            continue;
+        }
+        *match_pos = rs_signature_find_match(level, &job->sig_stats,
+                                             rs_calc_weak_sum(p, *match_len),
+                                             p, *match_len);
+        if (*match_pos != -1)
+            return 1;
+    }
+    return 0;
+}
+
+
 /**
  * Append a match at match_pos of length match_len to the delta, extending
  * a previous match if possible, or flushing any previous miss/match. */
@@ -297,8 +445,11 @@ inline rs_result rs_appendmatch(rs_job_t *job, rs_long_t match_pos, size_t match
     job->scoop_pos+=match_len;
     /* we can only process from the scoop if output is not blocked */
     if (result==RS_DONE) {
+        rs_long_t start = rs_timing_now();
+
         /* process the match data off the scoop*/
         result=rs_processmatch(job);
+        job->stats.emit_ns += rs_timing_now() - start;
     }
     return result;
 }
@@ -308,14 +459,15 @@ inline rs_result rs_appendmatch(rs_job_t *job, rs_long_t match_pos, size_t match
  * Append a miss of length miss_len to the delta, extending a previous miss
  * if possible, or flushing any previous match.
  *
- * This also breaks misses up into rs_outbuflen segments to avoid accumulating
- * too much in memory. */
+ * This also breaks misses up into segments of the job's output buffer length
+ * to avoid accumulating too much in memory. */
 inline rs_result rs_appendmiss(rs_job_t *job, size_t miss_len)
 {
     rs_result result=RS_DONE;
 
-    /* If last was a match, or rs_outbuflen misses, appendflush it. */
-    if (job->basis_len || (job->scoop_pos >= rs_outbuflen)) {
+    /* If last was a match, or outbuflen misses, appendflush it. */
+    if (job->basis_len
+        || job->scoop_pos >= (size_t) rs_ctx_outbuflen(job->ctx)) {
         result=rs_appendflush(job);
     }
     /* increment scoop_pos */
@@ -329,6 +481,9 @@ inline rs_result rs_appendmiss(rs_job_t *job, size_t miss_len)
  */
 inline rs_result rs_appendflush(rs_job_t *job)
 {
+    rs_long_t start = rs_timing_now();
+    rs_result result = RS_DONE;
+
     /* if last is a match, emit it and reset last by resetting basis_len */
     if (job->basis_len) {
         rs_trace("matched " PRINTF_FORMAT_U64 " bytes at " PRINTF_FORMAT_U64 "!",
@@ -336,15 +491,16 @@ inline rs_result rs_appendflush(rs_job_t *job)
                  PRINTF_CAST_U64(job->basis_pos));
         rs_emit_copy_cmd(job, job->basis_pos, job->basis_len);
         job->basis_len=0;
-        return rs_processmatch(job);
+        result = rs_processmatch(job);
     /* else if last is a miss, emit and process it*/
     } else if (job->scoop_pos) {
         rs_trace("got %ld bytes of literal data", (long) job->scoop_pos);
         rs_emit_literal_cmd(job, job->scoop_pos);
-        return rs_processmiss(job);
+        result = rs_processmiss(job);
     }
     /* otherwise, nothing to flush so we are done */
-    return RS_DONE;
+    job->stats.emit_ns += rs_timing_now() - start;
+    return result;
 }
 
 
@@ -417,7 +573,9 @@ static rs_result rs_delta_s_slack(rs_job_t *job)
 static rs_result rs_delta_s_header(rs_job_t *job)
 {
     rs_emit_delta_header(job);
-    if (job->signature) {
+    if (job->signature && rs_signature_is_cdc(job->signature)) {
+        job->statefn = rs_delta_s_chunk;
+    } else if (job->signature) {
         job->statefn = rs_delta_s_scan;
     } else {
         rs_trace("no signature provided for delta, using slack deltas");
@@ -428,10 +586,16 @@ static rs_result rs_delta_s_header(rs_job_t *job)
 
 
 rs_job_t *rs_delta_begin(rs_signature_t *sig)
+{
+    return rs_delta_begin_ctx(NULL, sig);
+}
+
+
+rs_job_t *rs_delta_begin_ctx(rs_context_t const *ctx, rs_signature_t *sig)
 {
     rs_job_t *job;
 
-    job = rs_job_new("delta", rs_delta_s_header);
+    job = rs_job_new_ctx(ctx, "delta", rs_delta_s_header);
     /* Caller can pass NULL sig for "slack deltas". */
     if (sig) {
         rs_signature_check(sig);
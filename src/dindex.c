@@ -0,0 +1,290 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*
+ * The index job reads a delta the same way as the patch job, but
+ * rather than executing commands it records them, and skips over
+ * literal data keeping track of where it was.
+ */
+
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "librsync.h"
+#include "util.h"
+#include "trace.h"
+#include "netint.h"
+#include "command.h"
+#include "prototab.h"
+#include "stream.h"
+#include "job.h"
+#include "dindex.h"
+
+/* use fseeko instead of fseek for long file support if we have it */
+#ifdef HAVE_FSEEKO
+#define fseek fseeko
+#elif defined HAVE_FSEEKO64
+#define fseek fseeko64
+#endif
+
+
+static rs_result rs_dindex_s_cmdbyte(rs_job_t *);
+static rs_result rs_dindex_s_params(rs_job_t *);
+static rs_result rs_dindex_s_run(rs_job_t *);
+static rs_result rs_dindex_s_skip(rs_job_t *);
+
+
+/**
+ * Append a command producing the next \p len bytes of output.
+ */
+void rs_dindex_add(rs_dindex_t *index, int kind, rs_long_t src,
+                   rs_long_t len)
+{
+    rs_dcmd_t *cmd;
+
+    if (index->count == index->alloc) {
+        index->alloc = index->alloc ? 2 * index->alloc : 64;
+        index->cmds = rs_realloc(index->cmds,
+                                 index->alloc * sizeof *index->cmds,
+                                 "delta index");
+    }
+    cmd = &index->cmds[index->count++];
+    cmd->kind = kind;
+    cmd->out_pos = index->out_len;
+    cmd->src = src;
+    cmd->len = len;
+    index->out_len += len;
+}
+
+
+static rs_result rs_dindex_s_cmdbyte(rs_job_t *job)
+{
+    rs_result result;
+
+    if ((result = rs_suck_byte(job, &job->op)) != RS_DONE)
+        return result;
+
+    job->cmd = &rs_prototab[job->op];
+
+    if (job->cmd->len_1)
+        job->statefn = rs_dindex_s_params;
+    else {
+        job->param1 = job->cmd->immediate;
+        job->statefn = rs_dindex_s_run;
+    }
+
+    return RS_RUNNING;
+}
+
+
+static rs_result rs_dindex_s_params(rs_job_t *job)
+{
+    rs_result result;
+    int len = job->cmd->len_1 + job->cmd->len_2;
+    void *p;
+
+    result = rs_scoop_readahead(job, len, &p);
+    if (result != RS_DONE)
+        return result;
+
+    result = rs_suck_netint(job, &job->param1, job->cmd->len_1);
+    assert(result == RS_DONE);
+
+    if (job->cmd->len_2) {
+        result = rs_suck_netint(job, &job->param2, job->cmd->len_2);
+        assert(result == RS_DONE);
+    }
+
+    job->statefn = rs_dindex_s_run;
+
+    return RS_RUNNING;
+}
+
+
+static rs_result rs_dindex_s_run(rs_job_t *job)
+{
+    rs_dindex_t *index = job->dindex;
+    int         cmdbytes = 1 + job->cmd->len_1 + job->cmd->len_2;
+
+    index->delta_len += cmdbytes;
+
+    switch (job->cmd->kind) {
+    case RS_KIND_LITERAL:
+        if (job->param1 < 0) {
+            rs_error("invalid length " PRINTF_FORMAT_U64 " on LITERAL command",
+                     PRINTF_CAST_U64(job->param1));
+            return RS_CORRUPT;
+        }
+        job->stats.lit_cmds++;
+        job->stats.lit_bytes += job->param1;
+        job->stats.lit_cmdbytes += cmdbytes;
+        rs_dindex_add(index, RS_KIND_LITERAL, index->delta_len, job->param1);
+        index->delta_len += job->param1;
+        job->basis_len = job->param1;
+        job->statefn = rs_dindex_s_skip;
+        return RS_RUNNING;
+
+    case RS_KIND_COPY:
+        if (job->param1 < 0 || job->param2 < 0) {
+            rs_error("invalid COPY(where=" PRINTF_FORMAT_U64
+                     ", len=" PRINTF_FORMAT_U64 ")",
+                     PRINTF_CAST_U64(job->param1),
+                     PRINTF_CAST_U64(job->param2));
+            return RS_CORRUPT;
+        }
+        job->stats.copy_cmds++;
+        job->stats.copy_bytes += job->param2;
+        job->stats.copy_cmdbytes += cmdbytes;
+        if (job->param2)
+            rs_dindex_add(index, RS_KIND_COPY, job->param1, job->param2);
+        job->statefn = rs_dindex_s_cmdbyte;
+        return RS_RUNNING;
+
+    case RS_KIND_END:
+        return RS_DONE;
+
+    default:
+        rs_error("bogus command 0x%02x", job->op);
+        return RS_CORRUPT;
+    }
+}
+
+
+/* Pass over the data of a LITERAL command. */
+static rs_result rs_dindex_s_skip(rs_job_t *job)
+{
+    rs_buffers_t    *stream = job->stream;
+    size_t          len;
+
+    while (job->basis_len) {
+        len = job->scoop_avail ? job->scoop_avail : stream->avail_in;
+        if (!len)
+            return stream->eof_in ? RS_INPUT_ENDED : RS_BLOCKED;
+        if ((rs_long_t) len > job->basis_len)
+            len = job->basis_len;
+        rs_scoop_advance(job, len);
+        job->basis_len -= len;
+    }
+
+    job->statefn = rs_dindex_s_cmdbyte;
+    return RS_RUNNING;
+}
+
+
+static rs_result rs_dindex_s_header(rs_job_t *job)
+{
+    int       v;
+    rs_result result;
+
+    if ((result = rs_suck_n4(job, &v)) != RS_DONE)
+        return result;
+
+    if (v != RS_DELTA_MAGIC) {
+        rs_log(RS_LOG_ERR,
+               "got magic number %#x rather than expected value %#x",
+               v, RS_DELTA_MAGIC);
+        return RS_BAD_MAGIC;
+    }
+    job->dindex->delta_len = 4;
+
+    job->statefn = rs_dindex_s_cmdbyte;
+
+    return RS_RUNNING;
+}
+
+
+/**
+ * Start a job that reads a delta and fills in \p index, which should
+ * be zeroed.
+ */
+rs_job_t *rs_dindex_begin(rs_dindex_t *index)
+{
+    rs_job_t *job = rs_job_new("index", rs_dindex_s_header);
+
+    job->dindex = index;
+    job->start_fn = NULL;
+
+    return job;
+}
+
+
+/**
+ * Find the first command whose output extends beyond \p pos, or
+ * index->count if there is none.
+ */
+size_t rs_dindex_find(rs_dindex_t const *index, rs_long_t pos)
+{
+    size_t lo = 0, hi = index->count, mid;
+
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (index->cmds[mid].out_pos + index->cmds[mid].len <= pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+
+/**
+ * Make sure the delta can be read again at random, by copying it to a
+ * temporary file if it isn't seekable.  The copy, if any, is returned
+ * in \p copy and should be closed by the caller.
+ */
+rs_result rs_dindex_seekable(FILE *delta_file, FILE **copy)
+{
+    char        buf[4096];
+    size_t      len;
+
+    *copy = NULL;
+    if (fseek(delta_file, 0, SEEK_CUR) == 0)
+        return RS_DONE;
+
+    rs_trace("delta isn't seekable; copying it to a temporary file");
+    if (!(*copy = tmpfile())) {
+        rs_error("can't create temporary file: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    while ((len = fread(buf, 1, sizeof buf, delta_file)) > 0) {
+        if (fwrite(buf, 1, len, *copy) != len) {
+            rs_error("error copying delta: %s", strerror(errno));
+            return RS_IO_ERROR;
+        }
+    }
+    if (ferror(delta_file) || fseek(*copy, 0, SEEK_SET)) {
+        rs_error("error copying delta: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    return RS_DONE;
+}
+
+
+void rs_dindex_free(rs_dindex_t *index)
+{
+    rs_free(index->cmds);
+    rs_bzero(index, sizeof *index);
+}
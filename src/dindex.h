@@ -0,0 +1,60 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/**
+ * \file dindex.h
+ * An index of the commands in a delta.
+ *
+ * Patching normally streams through the delta once.  Anything that
+ * wants to apply it out of order, such as in-place patching, first
+ * reads it into one of these, which says where each command's output
+ * goes and where its data comes from.
+ */
+
+
+/** One command from a delta. */
+typedef struct rs_dcmd {
+    int                 kind;   /**< RS_KIND_COPY or RS_KIND_LITERAL. */
+    rs_long_t           out_pos; /**< Offset of the output. */
+    rs_long_t           src;    /**< Basis offset for a COPY, or offset
+                                 * of the data in the delta for a
+                                 * LITERAL. */
+    rs_long_t           len;
+} rs_dcmd_t;
+
+
+typedef struct rs_dindex {
+    rs_dcmd_t           *cmds;
+    size_t              count, alloc;
+    rs_long_t           out_len;        /**< Length of the new file. */
+    rs_long_t           delta_len;      /**< Length of the delta. */
+} rs_dindex_t;
+
+
+rs_job_t *rs_dindex_begin(rs_dindex_t *index);
+
+void rs_dindex_free(rs_dindex_t *index);
+
+void rs_dindex_add(rs_dindex_t *index, int kind, rs_long_t src,
+                   rs_long_t len);
+
+size_t rs_dindex_find(rs_dindex_t const *index, rs_long_t pos);
+
+rs_result rs_dindex_seekable(FILE *delta_file, FILE **copy);
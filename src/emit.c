@@ -44,6 +44,7 @@
 #include "netint.h"
 #include "sumset.h"
 #include "job.h"
+#include "events.h"
 
 
 /*
@@ -82,6 +83,7 @@ rs_emit_literal_cmd(rs_job_t *job, int len)
     rs_trace("emit LITERAL_N%d(len=%d), cmd_byte=%#x", param_len, len, cmd);
     rs_squirt_byte(job, cmd);
     rs_squirt_netint(job, len, param_len);
+    rs_job_event(job, RS_EVENT_LITERAL, 0, 0, len);
 
     job->stats.lit_cmds++;
     job->stats.lit_bytes += len;
@@ -134,6 +136,7 @@ rs_emit_copy_cmd(rs_job_t *job, rs_long_t where, rs_long_t len)
     rs_squirt_byte(job, cmd);
     rs_squirt_netint(job, where, where_bytes);
     rs_squirt_netint(job, len, len_bytes);
+    rs_job_event(job, RS_EVENT_COPY, 0, where, len);
 
     stats->copy_cmds++;
     stats->copy_bytes += len;
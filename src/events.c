@@ -0,0 +1,204 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*
+ * Job event recording.
+ *
+ * Events go into a fixed array, claimed by atomically bumping the
+ * count, so recording never takes a lock or allocates and jobs in many
+ * threads can share a log.  Once the array is full the count keeps
+ * going, to say how many were dropped.  Nothing is formatted until the
+ * log is written out.
+ */
+
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "librsync.h"
+#include "util.h"
+#include "trace.h"
+#include "job.h"
+#include "events.h"
+
+
+struct rs_event_log {
+    rs_long_t           start_ns;       /**< Time zero for the trace. */
+    size_t              max_events;
+    size_t              count;          /**< Events claimed, even if
+                                         * dropped. */
+    int                 jobs;           /**< Job ids handed out. */
+    rs_event_t          events[];
+};
+
+
+rs_event_log_t *rs_job_event_log = NULL;
+
+
+rs_event_log_t *rs_event_log_new(size_t max_events)
+{
+    rs_event_log_t *log;
+
+    log = rs_alloc(sizeof *log + max_events * sizeof(rs_event_t),
+                   "rs_event_log_t");
+    log->start_ns = rs_clock_ns();
+    log->max_events = max_events;
+    log->count = 0;
+    log->jobs = 0;
+    return log;
+}
+
+
+void rs_event_log_free(rs_event_log_t *log)
+{
+    rs_free(log);
+}
+
+
+size_t rs_event_log_count(rs_event_log_t const *log, size_t *dropped)
+{
+    size_t      n = log->count;
+
+    if (dropped)
+        *dropped = n > log->max_events ? n - log->max_events : 0;
+    return n < log->max_events ? n : log->max_events;
+}
+
+
+/* Number a new job recording into LOG, from 1.  Jobs are told apart by
+ * this rather than their address, which is reused once one is freed. */
+int rs_event_job_id(rs_event_log_t *log)
+{
+#if defined(__GNUC__)
+    return __atomic_add_fetch(&log->jobs, 1, __ATOMIC_RELAXED);
+#else
+    return ++log->jobs;
+#endif
+}
+
+
+void rs_event_add(rs_job_t const *job, int type, int arg, rs_long_t a,
+                  rs_long_t b)
+{
+    rs_event_log_t *log = job->events;
+    rs_event_t  *e;
+    size_t      i;
+
+#if defined(__GNUC__)
+    i = __atomic_fetch_add(&log->count, 1, __ATOMIC_RELAXED);
+#else
+    i = log->count++;
+#endif
+    if (i >= log->max_events)
+        return;
+    e = &log->events[i];
+    e->ts_ns = rs_clock_ns();
+    e->job_id = job->event_id;
+    e->op = job->job_name;
+    e->type = type;
+    e->arg = arg;
+    e->a = a;
+    e->b = b;
+}
+
+
+rs_result rs_event_log_write_json(rs_event_log_t const *log, FILE *file)
+{
+    rs_event_t const *e;
+    char const  **ops;          /* The name of each job, by id. */
+    size_t      i, n, dropped;
+    int         tid, sep;
+    double      ts;
+
+    n = rs_event_log_count(log, &dropped);
+    ops = rs_alloc((log->jobs + 1) * sizeof *ops, "event job names");
+    for (tid = 0; tid <= log->jobs; tid++)
+        ops[tid] = NULL;
+    fprintf(file, "{\"displayTimeUnit\": \"ns\", "
+            "\"otherData\": {\"dropped_events\": %lu},\n"
+            "\"traceEvents\": [\n", (unsigned long) dropped);
+    for (i = 0; i < n; i++) {
+        e = &log->events[i];
+        ts = (e->ts_ns - log->start_ns) / 1e3;
+        tid = e->job_id;
+        ops[tid] = e->op;
+        fprintf(file, "{\"pid\": 1, \"tid\": %d, \"ts\": %.3f, ", tid, ts);
+        switch (e->type) {
+        case RS_EVENT_ITER_BEGIN:
+            fprintf(file, "\"ph\": \"B\", \"name\": \"%s\", \"args\": "
+                    "{\"avail_in\": " PRINTF_FORMAT_U64 ", \"avail_out\": "
+                    PRINTF_FORMAT_U64 "}", e->op, PRINTF_CAST_U64(e->a),
+                    PRINTF_CAST_U64(e->b));
+            break;
+        case RS_EVENT_ITER_END:
+            fprintf(file, "\"ph\": \"E\", \"args\": {\"read\": "
+                    PRINTF_FORMAT_U64 ", \"written\": " PRINTF_FORMAT_U64
+                    ", \"result\": \"%s\"}", PRINTF_CAST_U64(e->a),
+                    PRINTF_CAST_U64(e->b), rs_strerror(e->arg));
+            break;
+        case RS_EVENT_STATE:
+            fprintf(file, "\"ph\": \"i\", \"s\": \"t\", \"name\": \"state\", "
+                    "\"args\": {\"fn\": \"%#lx\"}", (unsigned long) e->a);
+            break;
+        case RS_EVENT_BLOCKED:
+            fprintf(file, "\"ph\": \"i\", \"s\": \"t\", \"name\": "
+                    "\"blocked on %s\", \"args\": {\"avail_in\": "
+                    PRINTF_FORMAT_U64 ", \"avail_out\": " PRINTF_FORMAT_U64
+                    "}", e->arg ? "output" : "input", PRINTF_CAST_U64(e->a),
+                    PRINTF_CAST_U64(e->b));
+            break;
+        case RS_EVENT_LITERAL:
+            fprintf(file, "\"ph\": \"i\", \"s\": \"t\", \"name\": \"literal\", "
+                    "\"args\": {\"len\": " PRINTF_FORMAT_U64 "}",
+                    PRINTF_CAST_U64(e->b));
+            break;
+        case RS_EVENT_IO_BEGIN:
+            fprintf(file, "\"ph\": \"B\", \"name\": \"%s\"",
+                    e->arg ? "drain output" : "fill input");
+            break;
+        case RS_EVENT_IO_END:
+            fprintf(file, "\"ph\": \"E\", \"args\": {\"avail_in\": "
+                    PRINTF_FORMAT_U64 ", \"avail_out\": " PRINTF_FORMAT_U64
+                    "}", PRINTF_CAST_U64(e->a), PRINTF_CAST_U64(e->b));
+            break;
+        case RS_EVENT_COPY:
+            fprintf(file, "\"ph\": \"i\", \"s\": \"t\", \"name\": \"copy\", "
+                    "\"args\": {\"pos\": " PRINTF_FORMAT_U64 ", \"len\": "
+                    PRINTF_FORMAT_U64 "}", PRINTF_CAST_U64(e->a),
+                    PRINTF_CAST_U64(e->b));
+            break;
+        }
+        fprintf(file, "},\n");
+    }
+    /* Name each job's thread after its operation. */
+    sep = 0;
+    for (tid = 1; tid <= log->jobs; tid++) {
+        if (!ops[tid])
+            continue;
+        fprintf(file, "%s{\"pid\": 1, \"tid\": %d, \"ph\": \"M\", "
+                "\"name\": \"thread_name\", \"args\": {\"name\": "
+                "\"%s job %d\"}}", sep++ ? ",\n" : "", tid, ops[tid], tid);
+    }
+    fprintf(file, "\n]}\n");
+    rs_free(ops);
+    return ferror(file) ? RS_IO_ERROR : RS_DONE;
+}
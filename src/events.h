@@ -0,0 +1,58 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/**
+ * \file events.h
+ * Recording job events into an ::rs_event_log_t.
+ */
+
+typedef enum {
+    RS_EVENT_ITER_BEGIN,        /**< a = avail_in, b = avail_out */
+    RS_EVENT_ITER_END,          /**< a = bytes read, b = bytes written */
+    RS_EVENT_STATE,             /**< a = the state function */
+    RS_EVENT_BLOCKED,           /**< a = avail_in, b = avail_out, arg =
+                                 * true if waiting for output space */
+    RS_EVENT_LITERAL,           /**< b = length */
+    RS_EVENT_COPY,              /**< a = basis position, b = length */
+    RS_EVENT_IO_BEGIN,          /**< arg = true for rs_job_drive()'s
+                                 * output callback, else its input one */
+    RS_EVENT_IO_END             /**< a = avail_in, b = avail_out, arg as
+                                 * for RS_EVENT_IO_BEGIN */
+} rs_event_type;
+
+typedef struct rs_event {
+    rs_long_t           ts_ns;  /**< When, by rs_clock_ns(). */
+    int                 job_id; /**< From rs_event_job_id(). */
+    char const          *op;    /**< The job's name. */
+    int                 type;   /**< An ::rs_event_type. */
+    int                 arg;    /**< Result or flag, by type. */
+    rs_long_t           a, b;
+} rs_event_t;
+
+int rs_event_job_id(rs_event_log_t *log);
+
+void rs_event_add(rs_job_t const *job, int type, int arg, rs_long_t a,
+                  rs_long_t b);
+
+/** Record an event if the job has an event log. */
+#define rs_job_event(job, type, arg, a, b) do {                         \
+        if ((job)->events)                                              \
+            rs_event_add((job), (type), (arg), (a), (b));               \
+    } while (0)
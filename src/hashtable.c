@@ -23,6 +23,16 @@
 #include <stdio.h>
 #include "hashtable.h"
 
+/* Tables are allocated zeroed through the library's allocator, so that
+ * rs_set_allocator() covers them.  hashtable_test, which is built
+ * without the rest of the library, defines these as calloc and free. */
+#ifndef HASHTABLE_ALLOC
+#  include "librsync.h"
+#  include "util.h"
+#  define HASHTABLE_ALLOC(n, size) rs_alloc_struct0((n) * (size), "hashtable")
+#  define HASHTABLE_FREE(p) rs_free(p)
+#endif
+
 /* Open addressing works best if it can take advantage of memory caches using
  * locality for probes of adjacent buckets on collisions. So we pack the keys
  * tightly together in their own key table and avoid referencing the element
@@ -43,27 +53,24 @@ hashtable_t *hashtable_new(int size, hash_f hash, cmp_f cmp)
     size = 1 + size * HASHTABLE_LOADFACTOR_DEN / HASHTABLE_LOADFACTOR_NUM;
     /* Use next power of 2 larger than the requested size. */
     for (size2 = 1; size2 < size; size2 <<= 1) ;
-    if (!(t = calloc(1, sizeof(hashtable_t)+ size2 * sizeof(unsigned))))
+    if (!(t = HASHTABLE_ALLOC(1, sizeof(hashtable_t)+ size2 * sizeof(unsigned))))
         return NULL;
-    if (!(t->etable = calloc(size2, sizeof(void *)))) {
-        free(t);
+    if (!(t->etable = HASHTABLE_ALLOC(size2, sizeof(void *)))) {
+        HASHTABLE_FREE(t);
         return NULL;
     }
     t->size = size2;
     t->count = 0;
     t->hash = hash;
     t->cmp = cmp;
-#ifndef HASHTABLE_NSTATS
-    t->find_count = t->match_count = t->hashcmp_count = t->entrycmp_count = 0;
-#endif
     return t;
 }
 
 void hashtable_free(hashtable_t *t)
 {
     if (t) {
-        free(t->etable);
-        free(t);
+        HASHTABLE_FREE(t->etable);
+        HASHTABLE_FREE(t);
     }
 }
 
@@ -110,35 +117,64 @@ void *hashtable_add(hashtable_t *t, void *e)
     return NULL;
 }
 
-/* Conditional macro for incrementing stats counters. */
+/* Get the probe_hist bucket for a probe length. */
+#define hist_index(n) ((n) < HASHTABLE_HIST_LEN ? (n) : HASHTABLE_HIST_LEN - 1)
+
+/* Conditional macros for incrementing stats counters. */
 #ifndef HASHTABLE_NSTATS
-#define stats_inc(c) (c++)
+#define stats_inc(c) do { if (stats) stats->c++; } while (0)
+#define stats_hist(n) do { if (stats && stats->probe_hist) stats->probe_hist[hist_index(n)]++; } while (0)
 #else
 #define stats_inc(c)
+#define stats_hist(n)
 #endif
 
-void *hashtable_find(hashtable_t *t, void *m)
+void *hashtable_find(const hashtable_t *t, void *m, hashtable_stats_t *stats)
 {
     assert(m != NULL);
     void *e;
     unsigned ke;
 
-    stats_inc(t->find_count);
+    stats_inc(find_count);
     do_probe(t, m, km) {
-        if (!(ke = t->ktable[i]))
+        if (!(ke = t->ktable[i])) {
+            stats_hist(s);
             return NULL;
-        stats_inc(t->hashcmp_count);
+        }
+        stats_inc(hashcmp_count);
         if (km == ke) {
-            stats_inc(t->entrycmp_count);
+            stats_inc(entrycmp_count);
             if (!t->cmp(m, e = t->etable[i])) {
-                stats_inc(t->match_count);
+                stats_inc(match_count);
+                stats_hist(s);
                 return e;
             }
         }
     } while_probe;
+    stats_hist(s);
     return NULL;
 }
 
+void hashtable_probe_hist(const hashtable_t *t, long add_hist[HASHTABLE_HIST_LEN],
+                          long miss_hist[HASHTABLE_HIST_LEN])
+{
+    const unsigned mask = t->size - 1;
+    unsigned b, i, s;
+
+    for (b = 0; b < (unsigned)t->size; b++) {
+        /* Entries can't be removed, so the buckets skipped to reach an
+         * entry are the ones that were filled when it was added. */
+        if (t->ktable[b]) {
+            i = mix32(t->ktable[b]) & mask;
+            for (s = 0; i != b; i = (i + ++s) & mask) ;
+            add_hist[hist_index(s)]++;
+        }
+        /* A find for a missing key stops at the first empty bucket. */
+        for (i = b, s = 0; t->ktable[i] && s < (unsigned)t->size; i = (i + ++s) & mask) ;
+        miss_hist[hist_index(s)]++;
+    }
+}
+
 void *hashtable_iter(hashtable_iter_t *i, hashtable_t *t)
 {
     assert(i != NULL);
@@ -40,8 +40,11 @@
  * you can use a fancy cmp() function to find particular entries by
  * more than just their key. There is an iterator for iterating
  * through all entries in the hashtable. There are optional
- * hashtable_find() find/match/hashcmp/entrycmp stats counters that
- * can be disabled by defining HASHTABLE_NSTATS.
+ * hashtable_find() find/match/hashcmp/entrycmp stats counters, and a
+ * probe length histogram for callers that give one, that can be
+ * disabled by defining HASHTABLE_NSTATS. They are kept by the
+ * caller rather than in the hashtable, so a table that has been filled
+ * is never written again and can be searched by many threads at once.
  *
  * Example:
  *
@@ -64,7 +67,7 @@
  *   entry_init(&entries[5], ...);
  *   hashtable_add(t, &entries[5]);
  *   k = ...;
- *   e = hashtable_find(t, &k);
+ *   e = hashtable_find(t, &k, NULL);
  *
  *   hashtable_iter i;
  *   for (e = hashtable_iter(&i, t); e != NULL; e = hashtable_next(&i))
@@ -92,7 +95,7 @@
  *   t = hashtable_new(300, &key_hash, &match_cmp);
  *   ...
  *   m = ...;
- *   e = hashtable_find(t, &m);
+ *   e = hashtable_find(t, &m, NULL);
  *
  * The cmp() function is only called for finding hashtable entries
  * and can mutate the match_t object for doing things like deferred
@@ -119,19 +122,29 @@ typedef unsigned (*hash_f) (const void *k);
  *   -1, 0, or 1 if *e is less, equal, or more that *o. */
 typedef int (*cmp_f) (void *k, const void *o);
 
+/** The number of buckets in probe length histograms.
+ *
+ * Probes are counted by the number of filled buckets skipped before
+ * the one they stop at, so 0 is a probe that stops at the key's own
+ * bucket.  The last bucket counts all probes this long or longer. */
+#define HASHTABLE_HIST_LEN 16
+
+/** The hashtable_find() stats type. */
+typedef struct _hashtable_stats {
+    long find_count;            /* The count of finds tried. */
+    long match_count;           /* The count of matches found. */
+    long hashcmp_count;         /* The count of hash compares done. */
+    long entrycmp_count;        /* The count of entry compares done. */
+    long *probe_hist;           /* If not NULL, HASHTABLE_HIST_LEN counts
+                                 * of finds by buckets skipped. */
+} hashtable_stats_t;
+
 /** The hashtable type. */
 typedef struct _hashtable {
     int size;                   /* Size of allocated hashtable. */
     int count;                  /* Number of entries in hashtable. */
     hash_f hash;                /* Function for hashing entries. */
     cmp_f cmp;                  /* Function for comparing entries. */
-#ifndef HASHTABLE_NSTATS
-    /* The following are for accumulating hashtable_find() stats. */
-    long find_count;            /* The count of finds tried. */
-    long match_count;           /* The count of matches found. */
-    long hashcmp_count;         /* The count of hash compares done. */
-    long entrycmp_count;        /* The count of entry compares done. */
-#endif
     void **etable;              /* Table of pointers to entries. */
     unsigned ktable[];          /* Table of hash keys. */
 } hashtable_t;
@@ -188,15 +201,30 @@ void *hashtable_add(hashtable_t *t, void *e);
 /** Find an entry in a hashtable.
  *
  * Uses cmp() to find the first matching entry in the table in the
- * same hash() bucket.
+ * same hash() bucket. The table isn't modified.
  *
  * Args:
  *   *t - The hashtable to search.
  *   *m - The key or match object to search for.
+ *   *stats - The stats to add this find to, or NULL.
  *
  * Returns:
  *   The first found entry, or NULL if nothing was found. */
-void *hashtable_find(hashtable_t *t, void *m);
+void *hashtable_find(const hashtable_t *t, void *m, hashtable_stats_t *stats);
+
+/** Get probe length histograms for a hashtable.
+ *
+ * The probe length is the number of filled buckets looked at, which is
+ * the number of hash compares hashtable_find() does.
+ *
+ * Args:
+ *   *t - The hashtable to measure.
+ *   add_hist - Added to with the probe length of adding each entry.
+ *   miss_hist - Added to with the probe length of a missing find
+ *     starting at each bucket.
+ */
+void hashtable_probe_hist(const hashtable_t *t, long add_hist[HASHTABLE_HIST_LEN],
+                          long miss_hist[HASHTABLE_HIST_LEN]);
 
 /** Initialize a hashtable_iter_t and return the first entry.
  *
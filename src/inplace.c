@@ -0,0 +1,916 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*
+ * Patching a file in place.
+ *
+ * The delta is indexed first.  Each COPY command reads one range of
+ * the basis and writes another, and must run before any command that
+ * writes over what it reads: if A reads what B writes, there is an
+ * edge A -> B.  COPYs are run in topological order.  When everything
+ * left is part of a cycle, the shortest COPY that is holding others up
+ * has its data saved aside, in memory, in a spill file or in the
+ * journal, which removes its outgoing edges; it's written out later
+ * from the saved copy.  LITERAL commands don't read the basis so they
+ * all go last.  This is the approach of Burns and Long's in-place
+ * reconstruction, with the cheapest-node cycle breaker.
+ *
+ * A COPY whose source and destination overlap is done in chunks,
+ * working from whichever end doesn't clobber data it still needs.
+ *
+ * With a journal, the file can be brought to a consistent state after
+ * a crash by running the same patch again.  The journal records the
+ * number of steps known to be on disk, data saved to break cycles, and
+ * the original contents of the chunk being written by an overlapping
+ * COPY.  It also records a checksum of the delta and the identity,
+ * size and mtime the basis had when the patch started, so that it
+ * isn't replayed with another delta or over a file that has since
+ * been replaced.  Progress only needs to be synced before a step that
+ * overwrites data read by a step since the last sync, because until
+ * then the steps can be replayed.
+ */
+
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "librsync.h"
+#include "util.h"
+#include "trace.h"
+#include "command.h"
+#include "job.h"
+#include "whole.h"
+#include "dindex.h"
+#include "blake2.h"
+
+/* use fseeko instead of fseek for long file support if we have it */
+#ifdef HAVE_FSEEKO
+#define fseek fseeko
+#define ftell ftello
+#elif defined HAVE_FSEEKO64
+#define fseek fseeko64
+#define ftell ftello64
+#endif
+
+/* Size of IO buffer. */
+#define RS_INPLACE_CHUNK        (1 << 20)
+
+
+/* Journal layout: a header, a scratch area for one chunk, then data
+ * saved to break cycles.  The progress fields fit in one sector so
+ * that they're updated atomically. */
+#define RS_JOURNAL_MAGIC        0x72730249      /* "rs\002I" */
+#define RS_JOURNAL_DELTA_LEN    4
+#define RS_JOURNAL_BASIS_LEN    12
+#define RS_JOURNAL_OUT_LEN      20
+#define RS_JOURNAL_NSTEPS       28
+#define RS_JOURNAL_STEP         36
+#define RS_JOURNAL_CHUNK_OFF    44
+#define RS_JOURNAL_CHUNK_LEN    52
+#define RS_JOURNAL_BASIS_MTIME  60
+#define RS_JOURNAL_BASIS_DEV    68
+#define RS_JOURNAL_BASIS_INO    76
+#define RS_JOURNAL_DELTA_SUM    84
+#define RS_JOURNAL_SUM_LEN      16
+#define RS_JOURNAL_HEADER_LEN   128
+#define RS_JOURNAL_SCRATCH      RS_JOURNAL_HEADER_LEN
+#define RS_JOURNAL_DATA         (RS_JOURNAL_SCRATCH + RS_INPLACE_CHUNK)
+
+
+enum {
+    RS_STEP_SAVE, RS_STEP_COPY, RS_STEP_LITERAL
+};
+
+
+typedef struct rs_inplace_step {
+    int                 type;
+    size_t              n;      /* copy node, or index command */
+} rs_inplace_step_t;
+
+
+typedef struct rs_inplace_node {
+    rs_dcmd_t           *cmd;
+    size_t              indeg;
+    int                 saved, done;
+    size_t              read_step;      /* when the basis was read */
+    rs_long_t           save_pos;       /* in the spill file or journal */
+    char                *save_mem;
+} rs_inplace_node_t;
+
+
+typedef struct rs_inplace_range {
+    rs_long_t           start, end;
+    size_t              node;
+} rs_inplace_range_t;
+
+
+typedef struct rs_inplace {
+    int                 fd;
+    FILE                *delta;
+    rs_long_t           delta_base;
+    rs_long_t           basis_len;
+    rs_dindex_t         index;
+
+    rs_inplace_node_t   *nodes;
+    size_t              nnodes;
+    /* edges in both directions, as offsets into a shared array */
+    size_t              *succ_start, *succ;
+    size_t              *pred_start, *pred;
+
+    rs_inplace_step_t   *steps;
+    size_t              nsteps, first_literal;
+
+    int                 jfd;            /* journal, or -1 */
+    size_t              synced_step;    /* steps before this are safe */
+    FILE                *spill;
+    rs_long_t           store_len;      /* bytes in spill file or journal */
+    rs_long_t           mem_used;
+
+    char                *buf;
+    rs_stats_t          *stats;
+} rs_inplace_t;
+
+
+rs_long_t rs_inplace_mem_limit = 64 << 20;
+
+
+/* Journal fields are big-endian, like the rest of librsync's formats. */
+static void rs_inplace_put(unsigned char *p, rs_long_t v, int len)
+{
+    int i;
+
+    for (i = len - 1; i >= 0; i--) {
+        p[i] = (unsigned char) v;
+        v >>= 8;
+    }
+}
+
+
+static rs_long_t rs_inplace_get(unsigned char const *p, int len)
+{
+    rs_long_t v = 0;
+    int i;
+
+    for (i = 0; i < len; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+
+static rs_result rs_inplace_pread(int fd, void *buf, size_t len, rs_long_t pos)
+{
+    ssize_t n;
+
+    while (len) {
+        n = pread(fd, buf, len, pos);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            rs_error("read failed: %s", strerror(errno));
+            return RS_IO_ERROR;
+        } else if (n == 0) {
+            rs_error("unexpected eof at " PRINTF_FORMAT_U64,
+                     PRINTF_CAST_U64(pos));
+            return RS_INPUT_ENDED;
+        }
+        buf = (char *) buf + n;
+        len -= n;
+        pos += n;
+    }
+    return RS_DONE;
+}
+
+
+static rs_result rs_inplace_pwrite(int fd, void const *buf, size_t len,
+                                   rs_long_t pos)
+{
+    ssize_t n;
+
+    while (len) {
+        n = pwrite(fd, buf, len, pos);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            rs_error("write failed: %s", strerror(errno));
+            return RS_IO_ERROR;
+        }
+        buf = (char const *) buf + n;
+        len -= n;
+        pos += n;
+    }
+    return RS_DONE;
+}
+
+
+static rs_result rs_inplace_fsync(int fd)
+{
+    if (fsync(fd)) {
+        rs_error("fsync failed: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    return RS_DONE;
+}
+
+
+static int rs_inplace_range_cmp(const void *a, const void *b)
+{
+    rs_inplace_range_t const *ra = a, *rb = b;
+
+    if (ra->start != rb->start)
+        return ra->start < rb->start ? -1 : 1;
+    return ra->node < rb->node ? -1 : ra->node > rb->node;
+}
+
+
+/*
+ * Find the edges between COPY commands.  Reads are sorted by start
+ * with a running maximum of their ends, so for each write we can skip
+ * straight to the first read that might overlap it.
+ */
+static void rs_inplace_graph(rs_inplace_t *ip)
+{
+    size_t              n = ip->nnodes, i, j, lo, hi, nedges;
+    rs_inplace_range_t  *reads;
+    rs_long_t           *maxend, ws, we;
+    size_t              *fill;
+    int                 pass;
+
+    reads = rs_alloc((n + 1) * sizeof *reads, "in-place reads");
+    maxend = rs_alloc((n + 1) * sizeof *maxend, "in-place reads");
+    for (i = 0; i < n; i++) {
+        reads[i].start = ip->nodes[i].cmd->src;
+        reads[i].end = reads[i].start + ip->nodes[i].cmd->len;
+        reads[i].node = i;
+    }
+    qsort(reads, n, sizeof *reads, rs_inplace_range_cmp);
+    for (i = 0; i < n; i++)
+        maxend[i] = (i && maxend[i - 1] > reads[i].end) ?
+            maxend[i - 1] : reads[i].end;
+
+    ip->succ_start = rs_alloc((n + 1) * sizeof(size_t), "in-place graph");
+    ip->pred_start = rs_alloc((n + 1) * sizeof(size_t), "in-place graph");
+    fill = rs_alloc((n + 1) * sizeof(size_t), "in-place graph");
+    rs_bzero(ip->succ_start, (n + 1) * sizeof(size_t));
+    rs_bzero(ip->pred_start, (n + 1) * sizeof(size_t));
+
+    /* Count the edges, then fill them in. */
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < n; i++) {
+            ws = ip->nodes[i].cmd->out_pos;
+            we = ws + ip->nodes[i].cmd->len;
+            lo = 0;
+            hi = n;
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if (maxend[mid] > ws)
+                    hi = mid;
+                else
+                    lo = mid + 1;
+            }
+            for (j = lo; j < n && reads[j].start < we; j++) {
+                size_t a = reads[j].node;
+                if (a == i || reads[j].end <= ws)
+                    continue;
+                /* a reads what i writes, so a goes first */
+                if (pass == 0) {
+                    ip->succ_start[a + 1]++;
+                    ip->pred_start[i + 1]++;
+                } else {
+                    ip->succ[fill[a]++] = i;
+                    ip->pred[ip->pred_start[i] + ip->nodes[i].indeg++] = a;
+                }
+            }
+        }
+        if (pass == 0) {
+            for (i = 0; i < n; i++) {
+                ip->succ_start[i + 1] += ip->succ_start[i];
+                ip->pred_start[i + 1] += ip->pred_start[i];
+            }
+            nedges = ip->succ_start[n];
+            ip->succ = rs_alloc((nedges + 1) * sizeof(size_t), "in-place graph");
+            ip->pred = rs_alloc((nedges + 1) * sizeof(size_t), "in-place graph");
+            memcpy(fill, ip->succ_start, n * sizeof(size_t));
+            rs_trace("in-place graph has " PRINTF_FORMAT_U64 " copies and "
+                     PRINTF_FORMAT_U64 " edges", PRINTF_CAST_U64(n),
+                     PRINTF_CAST_U64(nedges));
+        }
+    }
+
+    rs_free(fill);
+    rs_free(maxend);
+    rs_free(reads);
+}
+
+
+static int rs_inplace_len_cmp(const void *a, const void *b)
+{
+    rs_inplace_range_t const *ra = a, *rb = b;
+
+    if (ra->end - ra->start != rb->end - rb->start)
+        return ra->end - ra->start < rb->end - rb->start ? -1 : 1;
+    return ra->node < rb->node ? -1 : ra->node > rb->node;
+}
+
+
+static void rs_inplace_add_step(rs_inplace_t *ip, int type, size_t n)
+{
+    ip->steps[ip->nsteps].type = type;
+    ip->steps[ip->nsteps].n = n;
+    ip->nsteps++;
+}
+
+
+/* A node has run or saved its data, so it's no longer in the way. */
+static void rs_inplace_release(rs_inplace_t *ip, size_t a, size_t *queue,
+                               size_t *tail)
+{
+    size_t e, b;
+
+    for (e = ip->succ_start[a]; e < ip->succ_start[a + 1]; e++) {
+        b = ip->succ[e];
+        if (--ip->nodes[b].indeg == 0)
+            queue[(*tail)++] = b;
+    }
+}
+
+
+/*
+ * Order the COPY commands, saving data where there are cycles, then
+ * put the LITERALs at the end.  The indegrees are used up here.
+ */
+static void rs_inplace_schedule(rs_inplace_t *ip)
+{
+    size_t              n = ip->nnodes, i, head = 0, tail = 0, cand = 0;
+    size_t              *queue;
+    rs_inplace_range_t  *bylen;
+    size_t              a;
+
+    queue = rs_alloc((n + 1) * sizeof *queue, "in-place queue");
+    bylen = rs_alloc((n + 1) * sizeof *bylen, "in-place queue");
+    for (i = 0; i < n; i++) {
+        bylen[i].start = 0;
+        bylen[i].end = ip->nodes[i].cmd->len;
+        bylen[i].node = i;
+        if (!ip->nodes[i].indeg)
+            queue[tail++] = i;
+    }
+    qsort(bylen, n, sizeof *bylen, rs_inplace_len_cmp);
+
+    ip->steps = rs_alloc((2 * n + ip->index.count + 1) * sizeof *ip->steps,
+                         "in-place steps");
+    while (head < n) {
+        if (head < tail) {
+            a = queue[head++];
+            ip->nodes[a].done = 1;
+            if (!ip->nodes[a].saved) {
+                ip->nodes[a].read_step = ip->nsteps;
+                rs_inplace_release(ip, a, queue, &tail);
+            }
+            rs_inplace_add_step(ip, RS_STEP_COPY, a);
+            continue;
+        }
+
+        /* Stuck in a cycle: save the smallest COPY that's holding up
+         * another one.  Nodes only stop being candidates, so one pass
+         * over them is enough for the whole schedule. */
+        while (cand < n) {
+            a = bylen[cand].node;
+            if (!ip->nodes[a].saved && !ip->nodes[a].done
+                && ip->succ_start[a + 1] > ip->succ_start[a])
+                break;
+            cand++;
+        }
+        assert(cand < n);
+        ip->nodes[a].saved = 1;
+        ip->nodes[a].read_step = ip->nsteps;
+        rs_inplace_add_step(ip, RS_STEP_SAVE, a);
+        rs_inplace_release(ip, a, queue, &tail);
+    }
+
+    ip->first_literal = ip->nsteps;
+    for (i = 0; i < ip->index.count; i++)
+        if (ip->index.cmds[i].kind == RS_KIND_LITERAL && ip->index.cmds[i].len)
+            rs_inplace_add_step(ip, RS_STEP_LITERAL, i);
+
+    rs_free(bylen);
+    rs_free(queue);
+}
+
+
+static rs_result rs_inplace_write_progress(rs_inplace_t *ip, size_t step,
+                                           rs_long_t chunk_off,
+                                           rs_long_t chunk_len)
+{
+    unsigned char       p[24];
+    rs_result           result;
+
+    rs_inplace_put(p, step, 8);
+    rs_inplace_put(p + 8, chunk_off, 8);
+    rs_inplace_put(p + 16, chunk_len, 8);
+    if ((result = rs_inplace_pwrite(ip->jfd, p, sizeof p, RS_JOURNAL_STEP))
+        != RS_DONE)
+        return result;
+    return rs_inplace_fsync(ip->jfd);
+}
+
+
+/*
+ * Make everything up to STEP durable and record that in the journal.
+ */
+static rs_result rs_inplace_sync(rs_inplace_t *ip, size_t step)
+{
+    rs_result result;
+
+    if ((result = rs_inplace_fsync(ip->fd)) != RS_DONE
+        || (result = rs_inplace_fsync(ip->jfd)) != RS_DONE
+        || (result = rs_inplace_write_progress(ip, step, 0, 0)) != RS_DONE)
+        return result;
+    ip->synced_step = step;
+    return RS_DONE;
+}
+
+
+/*
+ * Set aside the basis data for node A, where it won't be overwritten.
+ * If RESUMING, it's already in the journal.
+ */
+static rs_result rs_inplace_save(rs_inplace_t *ip, size_t a, int resuming)
+{
+    rs_inplace_node_t   *node = &ip->nodes[a];
+    rs_long_t           len = node->cmd->len, done;
+    size_t              this_len;
+    rs_result           result;
+
+    ip->stats->inplace_buffered += len;
+
+    if (ip->jfd < 0 && ip->mem_used + len <= rs_inplace_mem_limit) {
+        node->save_mem = rs_alloc(len, "in-place saved data");
+        ip->mem_used += len;
+        return rs_inplace_pread(ip->fd, node->save_mem, len, node->cmd->src);
+    }
+
+    if (ip->jfd < 0 && !ip->spill) {
+        if (!(ip->spill = tmpfile())) {
+            rs_error("can't create spill file: %s", strerror(errno));
+            return RS_IO_ERROR;
+        }
+    }
+
+    node->save_pos = ip->store_len;
+    ip->store_len += len;
+    if (resuming)
+        return RS_DONE;
+
+    for (done = 0; done < len; done += this_len) {
+        this_len = RS_INPLACE_CHUNK;
+        if ((rs_long_t) this_len > len - done)
+            this_len = len - done;
+        result = rs_inplace_pread(ip->fd, ip->buf, this_len,
+                                  node->cmd->src + done);
+        if (result != RS_DONE)
+            return result;
+        if (ip->jfd >= 0)
+            result = rs_inplace_pwrite(ip->jfd, ip->buf, this_len,
+                                       RS_JOURNAL_DATA + node->save_pos + done);
+        else
+            result = rs_inplace_pwrite(fileno(ip->spill), ip->buf, this_len,
+                                       node->save_pos + done);
+        if (result != RS_DONE)
+            return result;
+    }
+    return RS_DONE;
+}
+
+
+/* Write out a COPY whose data was saved. */
+static rs_result rs_inplace_copy_saved(rs_inplace_t *ip, size_t a)
+{
+    rs_inplace_node_t   *node = &ip->nodes[a];
+    rs_long_t           len = node->cmd->len, done;
+    size_t              this_len;
+    rs_result           result;
+    int                 from;
+
+    if (node->save_mem) {
+        result = rs_inplace_pwrite(ip->fd, node->save_mem, len,
+                                   node->cmd->out_pos);
+        rs_free(node->save_mem);
+        node->save_mem = NULL;
+        ip->mem_used -= len;
+        return result;
+    }
+
+    from = ip->jfd >= 0 ? ip->jfd : fileno(ip->spill);
+    for (done = 0; done < len; done += this_len) {
+        this_len = RS_INPLACE_CHUNK;
+        if ((rs_long_t) this_len > len - done)
+            this_len = len - done;
+        result = rs_inplace_pread(from, ip->buf, this_len,
+                                  (ip->jfd >= 0 ? RS_JOURNAL_DATA : 0)
+                                  + node->save_pos + done);
+        if (result != RS_DONE
+            || (result = rs_inplace_pwrite(ip->fd, ip->buf, this_len,
+                                           node->cmd->out_pos + done))
+            != RS_DONE)
+            return result;
+    }
+    return RS_DONE;
+}
+
+
+/*
+ * Copy within the file.  If the ranges overlap, go backwards when
+ * moving data up so that nothing is overwritten before it's read.
+ *
+ * With a journal, each chunk of an overlapping copy is saved in the
+ * scratch area first, since a partly written chunk may have clobbered
+ * its own source.  RESUME_OFF and RESUME_LEN give the chunk that was
+ * in progress when the patch was interrupted.
+ */
+static rs_result rs_inplace_copy(rs_inplace_t *ip, size_t step, size_t a,
+                                 rs_long_t resume_off, rs_long_t resume_len)
+{
+    rs_dcmd_t   *cmd = ip->nodes[a].cmd;
+    rs_long_t   len = cmd->len, off, this_len, left;
+    int         overlap, backwards;
+    rs_result   result;
+
+    if (cmd->src == cmd->out_pos)
+        return RS_DONE;
+
+    overlap = cmd->src < cmd->out_pos + len && cmd->out_pos < cmd->src + len;
+    backwards = cmd->out_pos > cmd->src;
+
+    for (left = len; left > 0; left -= this_len) {
+        this_len = left < RS_INPLACE_CHUNK ? left : RS_INPLACE_CHUNK;
+        off = backwards ? left - this_len : len - left;
+
+        if (resume_len) {
+            /* Skip chunks finished before the interruption, then
+             * redo the one that was in progress from the journal. */
+            if (off != resume_off) {
+                continue;
+            }
+            this_len = resume_len;
+            resume_len = 0;
+            if ((result = rs_inplace_pread(ip->jfd, ip->buf, this_len,
+                                           RS_JOURNAL_SCRATCH)) != RS_DONE)
+                return result;
+        } else {
+            if ((result = rs_inplace_pread(ip->fd, ip->buf, this_len,
+                                           cmd->src + off)) != RS_DONE)
+                return result;
+            if (overlap && ip->jfd >= 0) {
+                if ((result = rs_inplace_pwrite(ip->jfd, ip->buf, this_len,
+                                                RS_JOURNAL_SCRATCH)) != RS_DONE
+                    || (result = rs_inplace_fsync(ip->fd)) != RS_DONE
+                    || (result = rs_inplace_fsync(ip->jfd)) != RS_DONE
+                    || (result = rs_inplace_write_progress(ip, step, off,
+                                                           this_len)) != RS_DONE)
+                    return result;
+                ip->synced_step = step;
+            }
+        }
+
+        if ((result = rs_inplace_pwrite(ip->fd, ip->buf, this_len,
+                                        cmd->out_pos + off)) != RS_DONE)
+            return result;
+    }
+    return RS_DONE;
+}
+
+
+static rs_result rs_inplace_literal(rs_inplace_t *ip, rs_dcmd_t *cmd)
+{
+    rs_long_t   done;
+    size_t      this_len;
+
+    if (fseek(ip->delta, ip->delta_base + cmd->src, SEEK_SET)) {
+        rs_error("seek failed: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    for (done = 0; done < cmd->len; done += this_len) {
+        this_len = RS_INPLACE_CHUNK;
+        if ((rs_long_t) this_len > cmd->len - done)
+            this_len = cmd->len - done;
+        if (fread(ip->buf, 1, this_len, ip->delta) != this_len) {
+            rs_error("error reading literal data from delta");
+            return RS_IO_ERROR;
+        }
+        if (rs_inplace_pwrite(ip->fd, ip->buf, this_len,
+                              cmd->out_pos + done) != RS_DONE)
+            return RS_IO_ERROR;
+    }
+    return RS_DONE;
+}
+
+
+/* Does step S overwrite anything read since the journal was synced? */
+static int rs_inplace_needs_sync(rs_inplace_t *ip, size_t s)
+{
+    rs_inplace_step_t   *step = &ip->steps[s];
+    size_t              e, a;
+
+    if (step->type == RS_STEP_SAVE)
+        return 0;
+    if (step->type == RS_STEP_LITERAL)
+        return ip->synced_step < ip->first_literal;
+    for (e = ip->pred_start[step->n]; e < ip->pred_start[step->n + 1]; e++) {
+        a = ip->pred[e];
+        if (ip->nodes[a].read_step >= ip->synced_step)
+            return 1;
+    }
+    return 0;
+}
+
+
+/* Checksum the delta, which the journal is only good for. */
+static rs_result rs_inplace_delta_sum(rs_inplace_t *ip,
+                                      unsigned char sum[RS_JOURNAL_SUM_LEN])
+{
+    blake2b_state       ctx;
+    rs_long_t           done;
+    size_t              this_len;
+
+    if (fseek(ip->delta, ip->delta_base, SEEK_SET)) {
+        rs_error("seek failed: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    blake2b_init(&ctx, RS_JOURNAL_SUM_LEN);
+    for (done = 0; done < ip->index.delta_len; done += this_len) {
+        this_len = RS_INPLACE_CHUNK;
+        if ((rs_long_t) this_len > ip->index.delta_len - done)
+            this_len = ip->index.delta_len - done;
+        if (fread(ip->buf, 1, this_len, ip->delta) != this_len) {
+            rs_error("error reading delta");
+            return RS_IO_ERROR;
+        }
+        blake2b_update(&ctx, (const uint8_t *) ip->buf, this_len);
+    }
+    blake2b_final(&ctx, sum, RS_JOURNAL_SUM_LEN);
+    return RS_DONE;
+}
+
+
+/*
+ * Open the journal, and either start it or check that it's for this
+ * patch and find out how far the last attempt got.
+ *
+ * The basis can't be checked against exactly what the journal saw,
+ * since steps after the last sync may have written to it.  Until the
+ * final truncation it only grows, from its original length up to at
+ * most the new length, and its mtime only moves forward, so anything
+ * else means it was changed or replaced by something other than this
+ * patch.
+ */
+static rs_result rs_inplace_journal(rs_inplace_t *ip, const char *path,
+                                    size_t *step, rs_long_t *chunk_off,
+                                    rs_long_t *chunk_len)
+{
+    unsigned char       h[RS_JOURNAL_HEADER_LEN];
+    unsigned char       sum[RS_JOURNAL_SUM_LEN];
+    struct stat         st;
+    rs_result           result;
+    rs_long_t           max_len;
+    ssize_t             got;
+
+    *step = 0;
+    *chunk_off = *chunk_len = 0;
+
+    if ((result = rs_inplace_delta_sum(ip, sum)) != RS_DONE)
+        return result;
+    if (fstat(ip->fd, &st)) {
+        rs_error("can't stat basis: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    if ((ip->jfd = open(path, O_RDWR | O_CREAT, 0600)) < 0) {
+        rs_error("can't open journal %s: %s", path, strerror(errno));
+        return RS_IO_ERROR;
+    }
+    got = pread(ip->jfd, h, sizeof h, 0);
+    if (got == (ssize_t) sizeof h) {
+        if (rs_inplace_get(h, 4) != RS_JOURNAL_MAGIC
+            || rs_inplace_get(h + RS_JOURNAL_DELTA_LEN, 8) != ip->index.delta_len
+            || rs_inplace_get(h + RS_JOURNAL_OUT_LEN, 8) != ip->index.out_len
+            || rs_inplace_get(h + RS_JOURNAL_NSTEPS, 8) != (rs_long_t) ip->nsteps
+            || memcmp(h + RS_JOURNAL_DELTA_SUM, sum, RS_JOURNAL_SUM_LEN)) {
+            rs_error("journal %s is not for this patch", path);
+            return RS_BAD_MAGIC;
+        }
+        ip->basis_len = rs_inplace_get(h + RS_JOURNAL_BASIS_LEN, 8);
+        max_len = ip->basis_len > ip->index.out_len ?
+            ip->basis_len : ip->index.out_len;
+        if (rs_inplace_get(h + RS_JOURNAL_BASIS_DEV, 8) != (rs_long_t) st.st_dev
+            || rs_inplace_get(h + RS_JOURNAL_BASIS_INO, 8) != (rs_long_t) st.st_ino
+            || rs_inplace_get(h + RS_JOURNAL_BASIS_MTIME, 8) > (rs_long_t) st.st_mtime
+            || st.st_size > max_len
+            || (st.st_size < ip->basis_len && st.st_size != ip->index.out_len)) {
+            rs_error("basis has changed since journal %s was started", path);
+            return RS_BAD_MAGIC;
+        }
+        *step = rs_inplace_get(h + RS_JOURNAL_STEP, 8);
+        *chunk_off = rs_inplace_get(h + RS_JOURNAL_CHUNK_OFF, 8);
+        *chunk_len = rs_inplace_get(h + RS_JOURNAL_CHUNK_LEN, 8);
+        rs_trace("resuming in-place patch at step " PRINTF_FORMAT_U64,
+                 PRINTF_CAST_U64(*step));
+        return RS_DONE;
+    }
+
+    /* A new or incomplete journal: the file hasn't been touched. */
+    ip->basis_len = st.st_size;
+    rs_bzero(h, sizeof h);
+    rs_inplace_put(h, RS_JOURNAL_MAGIC, 4);
+    rs_inplace_put(h + RS_JOURNAL_DELTA_LEN, ip->index.delta_len, 8);
+    rs_inplace_put(h + RS_JOURNAL_BASIS_LEN, ip->basis_len, 8);
+    rs_inplace_put(h + RS_JOURNAL_OUT_LEN, ip->index.out_len, 8);
+    rs_inplace_put(h + RS_JOURNAL_NSTEPS, ip->nsteps, 8);
+    rs_inplace_put(h + RS_JOURNAL_BASIS_MTIME, st.st_mtime, 8);
+    rs_inplace_put(h + RS_JOURNAL_BASIS_DEV, st.st_dev, 8);
+    rs_inplace_put(h + RS_JOURNAL_BASIS_INO, st.st_ino, 8);
+    memcpy(h + RS_JOURNAL_DELTA_SUM, sum, RS_JOURNAL_SUM_LEN);
+    if ((result = rs_inplace_pwrite(ip->jfd, h, sizeof h, 0)) != RS_DONE)
+        return result;
+    return rs_inplace_fsync(ip->jfd);
+}
+
+
+static rs_result rs_inplace_run(rs_inplace_t *ip, const char *journal_path)
+{
+    size_t              i, s, start = 0;
+    rs_long_t           chunk_off = 0, chunk_len = 0;
+    rs_result           result;
+    struct stat         st;
+
+    ip->nnodes = 0;
+    ip->nodes = rs_alloc((ip->index.count + 1) * sizeof *ip->nodes,
+                         "in-place nodes");
+    rs_bzero(ip->nodes, (ip->index.count + 1) * sizeof *ip->nodes);
+    for (i = 0; i < ip->index.count; i++)
+        if (ip->index.cmds[i].kind == RS_KIND_COPY)
+            ip->nodes[ip->nnodes++].cmd = &ip->index.cmds[i];
+
+    rs_inplace_graph(ip);
+    rs_inplace_schedule(ip);
+    ip->buf = rs_alloc(RS_INPLACE_CHUNK, "in-place buffer");
+
+    if (journal_path) {
+        result = rs_inplace_journal(ip, journal_path, &start, &chunk_off,
+                                    &chunk_len);
+        if (result != RS_DONE)
+            return result;
+        ip->synced_step = start;
+    } else {
+        if (fstat(ip->fd, &st)) {
+            rs_error("can't stat basis: %s", strerror(errno));
+            return RS_IO_ERROR;
+        }
+        ip->basis_len = st.st_size;
+    }
+
+    for (i = 0; i < ip->nnodes; i++) {
+        if (ip->nodes[i].cmd->src + ip->nodes[i].cmd->len > ip->basis_len) {
+            rs_error("COPY beyond end of basis");
+            return RS_INPUT_ENDED;
+        }
+    }
+
+    for (s = 0; s < ip->nsteps; s++) {
+        rs_inplace_step_t *step = &ip->steps[s];
+
+        if (step->type == RS_STEP_SAVE) {
+            result = rs_inplace_save(ip, step->n, s < start);
+        } else if (s < start) {
+            continue;
+        } else {
+            if (ip->jfd >= 0 && s > start && rs_inplace_needs_sync(ip, s)
+                && (result = rs_inplace_sync(ip, s)) != RS_DONE)
+                return result;
+            if (step->type == RS_STEP_LITERAL)
+                result = rs_inplace_literal(ip, &ip->index.cmds[step->n]);
+            else if (ip->nodes[step->n].saved)
+                result = rs_inplace_copy_saved(ip, step->n);
+            else
+                result = rs_inplace_copy(ip, s, step->n,
+                                         s == start ? chunk_off : 0,
+                                         s == start ? chunk_len : 0);
+        }
+        if (result != RS_DONE)
+            return result;
+    }
+
+    if (ftruncate(ip->fd, ip->index.out_len)) {
+        rs_error("can't truncate: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    if (ip->jfd >= 0) {
+        if ((result = rs_inplace_fsync(ip->fd)) != RS_DONE)
+            return result;
+        close(ip->jfd);
+        ip->jfd = -1;
+        if (unlink(journal_path)) {
+            rs_error("can't remove journal %s: %s", journal_path,
+                     strerror(errno));
+            return RS_IO_ERROR;
+        }
+    }
+    return RS_DONE;
+}
+
+
+rs_result rs_patch_inplace(const char *path, FILE *delta_file,
+                           const char *journal_path, rs_stats_t *stats)
+{
+    rs_inplace_t        ip;
+    rs_job_t            *job;
+    rs_result           r;
+    FILE                *delta_copy;
+    rs_stats_t          my_stats;
+    rs_long_t           start = rs_clock_ns();
+    size_t              i;
+
+    rs_bzero(&ip, sizeof ip);
+    ip.jfd = -1;
+    ip.stats = stats ? stats : &my_stats;
+
+    if ((r = rs_dindex_seekable(delta_file, &delta_copy)) != RS_DONE)
+        goto out;
+    ip.delta = delta_copy ? delta_copy : delta_file;
+    ip.delta_base = ftell(ip.delta);
+
+    job = rs_dindex_begin(&ip.index);
+    r = rs_whole_run(job, ip.delta, NULL);
+    memcpy(ip.stats, &job->stats, sizeof *ip.stats);
+    rs_job_free(job);
+    if (r != RS_DONE)
+        goto out;
+
+    ip.stats->op = "patch";
+    ip.stats->in_bytes = ip.index.delta_len;
+    ip.stats->out_bytes = ip.index.out_len;
+
+    if ((ip.fd = open(path, O_RDWR)) < 0) {
+        rs_error("can't open %s: %s", path, strerror(errno));
+        r = RS_IO_ERROR;
+        goto out;
+    }
+
+    r = rs_inplace_run(&ip, journal_path);
+    if (close(ip.fd) && r == RS_DONE) {
+        rs_error("error closing %s: %s", path, strerror(errno));
+        r = RS_IO_ERROR;
+    }
+    ip.stats->end = time(NULL);
+    ip.stats->elapsed_ns = rs_clock_ns() - start;
+
+  out:
+    if (ip.nodes) {
+        for (i = 0; i < ip.nnodes; i++)
+            rs_free(ip.nodes[i].save_mem);
+        rs_free(ip.nodes);
+    }
+    rs_free(ip.succ_start);
+    rs_free(ip.succ);
+    rs_free(ip.pred_start);
+    rs_free(ip.pred);
+    rs_free(ip.steps);
+    rs_free(ip.buf);
+    if (ip.jfd >= 0)
+        close(ip.jfd);
+    if (ip.spill)
+        fclose(ip.spill);
+    if (delta_copy)
+        fclose(delta_copy);
+    rs_dindex_free(&ip.index);
+    return r;
+}
@@ -47,6 +47,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <time.h>
 
 #include "librsync.h"
@@ -55,25 +56,42 @@
 #include "sumset.h"
 #include "job.h"
 #include "trace.h"
+#include "context.h"
+#include "events.h"
 
 
 static const int rs_job_tag = 20010225;
 
 static rs_result rs_job_work(rs_job_t *job, rs_buffers_t *buffers);
+static rs_result rs_job_s_complete(rs_job_t *job);
 
 
 rs_job_t * rs_job_new(char const *job_name, rs_result (*statefn)(rs_job_t *))
+{
+    return rs_job_new_ctx(NULL, job_name, statefn);
+}
+
+
+rs_job_t * rs_job_new_ctx(rs_context_t const *ctx, char const *job_name,
+                          rs_result (*statefn)(rs_job_t *))
 {
     rs_job_t *job;
 
-    job = rs_alloc_struct(rs_job_t);
+    job = rs_ctx_alloc(ctx, sizeof *job, "rs_job_t");
+    rs_bzero(job, sizeof *job);
 
+    job->ctx = ctx;
+    job->events = rs_ctx_event_log(ctx);
+    if (job->events)
+        job->event_id = rs_event_job_id(job->events);
     job->job_name = job_name;
     job->dogtag = rs_job_tag;
     job->statefn = statefn;
+    job->start_fn = statefn;
 
     job->stats.op = job_name;
     job->stats.start = time(NULL);
+    job->start_ns = rs_clock_ns();
 
     rs_trace("start %s job", job_name);
 
@@ -89,11 +107,68 @@ void rs_job_check(rs_job_t *job)
 
 rs_result rs_job_free(rs_job_t *job)
 {
-    free(job->scoop_buf);
+    rs_context_t const *ctx = job->ctx;
+
+    if (job->statefn == rs_job_s_complete)
+        rs_ctx_report(ctx, job->final_result, &job->stats);
+    rs_scoop_free(job);
     if (job->job_owns_sig)
 	  rs_free_sumset(job->signature);
     rs_bzero(job, sizeof *job);
-    free(job);
+    rs_ctx_free(ctx, job);
+
+    return RS_DONE;
+}
+
+
+rs_result rs_job_reset(rs_job_t *job)
+{
+    rs_job_t    old;
+
+    rs_job_check(job);
+    if (!job->start_fn) {
+        rs_error("%s job can't be reset", job->job_name);
+        return RS_PARAM_ERROR;
+    }
+    if (job->statefn == rs_job_s_complete)
+        rs_ctx_report(job->ctx, job->final_result, &job->stats);
+    if (job->job_owns_sig)
+        rs_signature_done(job->signature);
+
+    /* Keep what the job was started with and its buffers, and clear
+     * everything to do with the last run. */
+    old = *job;
+    rs_bzero(job, sizeof *job);
+    job->dogtag = old.dogtag;
+    job->ctx = old.ctx;
+    job->events = old.events;
+    job->event_id = old.event_id;
+    job->job_name = old.job_name;
+    job->statefn = job->start_fn = old.start_fn;
+    job->sig_magic = old.sig_magic;
+    job->sig_block_len = old.sig_block_len;
+    job->sig_strong_len = old.sig_strong_len;
+    job->sig_levels = old.sig_levels;
+    job->sig_level_factor = old.sig_level_factor;
+    job->sig_fsize = old.sig_fsize;
+    job->signature = old.signature;
+    job->job_owns_sig = old.job_owns_sig;
+    job->scoop_buf = job->scoop_next = old.scoop_buf;
+    job->scoop_alloc = old.scoop_alloc;
+    job->scoop_mirror = old.scoop_mirror;
+    job->copy_cb = old.copy_cb;
+    job->copy_arg = old.copy_arg;
+    job->direct_copy_cb = old.direct_copy_cb;
+    job->direct_copy_arg = old.direct_copy_arg;
+    job->prefetch_cb = old.prefetch_cb;
+    job->prefetch_arg = old.prefetch_arg;
+    job->prefetch_depth = old.prefetch_depth;
+
+    job->stats.op = job->job_name;
+    job->stats.start = time(NULL);
+    job->start_ns = rs_clock_ns();
+
+    rs_trace("restart %s job", job->job_name);
 
     return RS_DONE;
 }
@@ -121,6 +196,7 @@ static rs_result rs_job_complete(rs_job_t *job, rs_result result)
     }
 
     job->stats.end = time(NULL);
+    job->stats.elapsed_ns = rs_clock_ns() - job->start_ns;
     if (result == RS_DONE && !rs_tube_is_idle(job))
         /* Processing is finished, but there is still some data
          * waiting to get into the output buffer. */
@@ -130,15 +206,40 @@ static rs_result rs_job_complete(rs_job_t *job, rs_result result)
 }
 
 
+/* Whether a blocked job is waiting for output space: its output buffer
+ * is full, or there's still something in the tube for it.  Copies stop
+ * when the output is full without leaving anything in the tube. */
+static int rs_job_blocked_on_output(rs_job_t const *job)
+{
+    return job->stream->avail_out == 0 || !rs_tube_is_idle(job);
+}
+
+
 rs_result rs_job_iter(rs_job_t *job, rs_buffers_t *buffers)
 {
     rs_result       result;
     rs_long_t       orig_in, orig_out;
+    rs_context_t const *old_ctx;
 
     orig_in  = buffers->avail_in;
     orig_out = buffers->avail_out;
+    rs_job_event(job, RS_EVENT_ITER_BEGIN, 0, orig_in, orig_out);
 
+    old_ctx = rs_trace_use(job->ctx);
     result = rs_job_work(job, buffers);
+    rs_trace_use(old_ctx);
+
+    rs_job_event(job, RS_EVENT_ITER_END, result,
+                 orig_in - (rs_long_t) buffers->avail_in,
+                 orig_out - (rs_long_t) buffers->avail_out);
+
+    job->stats.iter_count++;
+    if (result == RS_BLOCKED) {
+        if (rs_job_blocked_on_output(job))
+            job->stats.blocked_out_count++;
+        else if (!buffers->avail_in && !buffers->eof_in)
+            job->stats.blocked_in_count++;
+    }
 
     if (result == RS_BLOCKED  ||  result == RS_DONE)
         if ((orig_in == buffers->avail_in)  &&  (orig_out == buffers->avail_out)
@@ -154,6 +255,71 @@ rs_result rs_job_iter(rs_job_t *job, rs_buffers_t *buffers)
 }
 
 
+/* Drop any used-up segments from the front of an iovec array. */
+static void rs_iov_skip_empty(rs_iovec_t **iov, int *iovcnt)
+{
+    while (*iovcnt && !(*iov)->iov_len) {
+        (*iov)++;
+        (*iovcnt)--;
+    }
+}
+
+
+rs_result rs_job_iterv(rs_job_t *job, rs_buffersv_t *bufv)
+{
+    rs_buffers_t    buf;
+    rs_result       result;
+    size_t          used;
+
+    for (;;) {
+        rs_iov_skip_empty(&bufv->in_iov, &bufv->in_iovcnt);
+        rs_iov_skip_empty(&bufv->out_iov, &bufv->out_iovcnt);
+
+        rs_bzero(&buf, sizeof buf);
+        if (bufv->in_iovcnt) {
+            buf.next_in = bufv->in_iov->iov_base;
+            buf.avail_in = bufv->in_iov->iov_len;
+        }
+        buf.eof_in = bufv->eof_in && bufv->in_iovcnt <= 1;
+        if (bufv->out_iovcnt) {
+            buf.next_out = bufv->out_iov->iov_base;
+            buf.avail_out = bufv->out_iov->iov_len;
+        }
+
+        result = rs_job_iter(job, &buf);
+
+        if (bufv->in_iovcnt) {
+            used = bufv->in_iov->iov_len - buf.avail_in;
+            bufv->in_iov->iov_base = (char *) bufv->in_iov->iov_base + used;
+            bufv->in_iov->iov_len = buf.avail_in;
+        }
+        if (bufv->out_iovcnt) {
+            used = bufv->out_iov->iov_len - buf.avail_out;
+            bufv->out_iov->iov_base = (char *) bufv->out_iov->iov_base + used;
+            bufv->out_iov->iov_len = buf.avail_out;
+        }
+
+        if (result != RS_BLOCKED)
+            return result;
+
+        /* Carry on if the job stopped at the end of a segment and
+         * there's another one to give it. */
+        if (!(bufv->in_iovcnt > 1 && !buf.avail_in)
+            && !(bufv->out_iovcnt > 1 && !buf.avail_out))
+            return result;
+    }
+}
+
+
+/* Note that the job is waiting for more input or output space. */
+static rs_result rs_job_blocked(rs_job_t *job)
+{
+    rs_job_event(job, RS_EVENT_BLOCKED, rs_job_blocked_on_output(job),
+                 job->stream->avail_in, job->stream->avail_out);
+    return RS_BLOCKED;
+}
+
+
 static rs_result
 rs_job_work(rs_job_t *job, rs_buffers_t *buffers)
 {
@@ -170,21 +336,27 @@ rs_job_work(rs_job_t *job, rs_buffers_t *buffers)
     while (1) {
         result = rs_tube_catchup(job);
         if (result == RS_BLOCKED)
-            return result;
+            return rs_job_blocked(job);
         else if (result != RS_DONE)
             return rs_job_complete(job, result);
 
         if (job->statefn == rs_job_s_complete) {
-            if (rs_tube_is_idle(job))
+            if (rs_tube_is_idle(job)) {
+                job->stats.elapsed_ns = rs_clock_ns() - job->start_ns;
                 return RS_DONE;
-            else
-                return RS_BLOCKED;
+            } else
+                return rs_job_blocked(job);
         } else {
+            if (job->statefn != job->event_state) {
+                job->event_state = job->statefn;
+                rs_job_event(job, RS_EVENT_STATE, 0, (intptr_t) job->statefn,
+                             0);
+            }
             result = job->statefn(job);
             if (result == RS_RUNNING)
                 continue;
             else if (result == RS_BLOCKED)
-                return result;
+                return rs_job_blocked(job);
             else
                 return rs_job_complete(job, result);
         }
@@ -217,12 +389,18 @@ rs_job_drive(rs_job_t *job, rs_buffers_t *buf,
              rs_driven_cb out_cb, void *out_opaque)
 {
     rs_result       result, iores;
+    rs_long_t       start;
 
     rs_bzero(buf, sizeof *buf);
 
     do {
         if (!buf->eof_in && in_cb) {
+            rs_job_event(job, RS_EVENT_IO_BEGIN, 0, 0, 0);
+            start = rs_timing_now();
             iores = in_cb(job, buf, in_opaque);
+            job->stats.in_wait_ns += rs_timing_now() - start;
+            rs_job_event(job, RS_EVENT_IO_END, 0, buf->avail_in,
+                         buf->avail_out);
             if (iores != RS_DONE)
                 return iores;
         }
@@ -232,11 +410,18 @@ rs_job_drive(rs_job_t *job, rs_buffers_t *buf,
             return result;
 
         if (out_cb) {
+            rs_job_event(job, RS_EVENT_IO_BEGIN, 1, 0, 0);
+            start = rs_timing_now();
             iores = (out_cb)(job, buf, out_opaque);
+            job->stats.out_wait_ns += rs_timing_now() - start;
+            rs_job_event(job, RS_EVENT_IO_END, 1, buf->avail_in,
+                         buf->avail_out);
             if (iores != RS_DONE)
                 return iores;
         }
     } while (result != RS_DONE);
 
+    /* Count the last of the output being written. */
+    job->stats.elapsed_ns = rs_clock_ns() - job->start_ns;
     return result;
 }
@@ -21,6 +21,20 @@
 
 #include "mdfour.h"
 #include "rollsum.h"
+#include "sumset.h"
+
+/**
+ * Callback used by drivers that can execute a COPY command without
+ * passing the data through the stream's output buffer, for example by
+ * asking the kernel to copy between two files.
+ *
+ * On entry \p len is the length of the copy starting at \p pos in the
+ * basis. On return it is set to the number of bytes that were written
+ * directly to the output; the job copies whatever remains through
+ * ::rs_copy_cb as usual.
+ */
+typedef rs_result rs_direct_copy_cb(rs_job_t *job, void *opaque,
+                                    rs_long_t pos, rs_long_t *len);
 
 /**
  * \struct rs_job
@@ -32,11 +46,28 @@ struct rs_job {
     /** Human-readable job operation name. */
     const char          *job_name;
 
+    /** Settings the job was started with, or NULL for the process-wide
+     * ones. */
+    rs_context_t const  *ctx;
+
+    /** Log to record events in, or NULL. */
+    rs_event_log_t      *events;
+
+    /** This job's number in events, if it has a log. */
+    int                 event_id;
+
+    /** The state last recorded in events, so only changes are. */
+    rs_result           (*event_state)(rs_job_t *);
+
     rs_buffers_t *stream;
 
     /** Callback for each processing step. */
     rs_result           (*statefn)(rs_job_t *);
 
+    /** State rs_job_reset() goes back to, or NULL if the job can't be
+     * run again. */
+    rs_result           (*start_fn)(rs_job_t *);
+
     /** Final result of processing job.  Used by rs_job_s_failed(). */
     rs_result final_result;
 
@@ -45,6 +76,7 @@ struct rs_job {
     int                 sig_magic;
     int                 sig_block_len;
     int                 sig_strong_len;
+    int                 sig_levels, sig_level_factor;
 
     /** The size of the signature file if available. Used by loadsums.c
      * when initializing the signature to preallocate memory. */
@@ -56,12 +88,34 @@ struct rs_job {
     /** Flag indicating signature should be destroyed with the job. */
     int                 job_owns_sig;
 
+    /** Work done searching the signature, added to \p stats when the
+     * delta is finished. */
+    rs_match_stats_t sig_stats;
+
+    /** When the job was started or reset, by rs_clock_ns(). */
+    rs_long_t           start_ns;
+
+    /** Time a delta job has spent scanning, which is split between the
+     * phases in \p stats when it finishes, and a count for choosing
+     * which searches to time. */
+    rs_long_t           scan_ns;
+    unsigned            timing_tick;
+
     /** Command byte currently being processed, if any. */
     unsigned char       op;
 
     /** The weak signature digest used by readsums.c */
     rs_weak_sum_t       weak_sig;
 
+    /** The length of a content-defined chunk, used by readsums.c */
+    int                 chunk_len;
+
+    /** The level and offset of the next sum in a multi-level signature,
+     * used by mksum.c and readsums.c.  mksum.c's offsets are from the
+     * start of the coarsest block. */
+    int                 sig_level;
+    rs_long_t           sig_pos;
+
     /** The rollsum weak signature accumulator used by delta.c */
     Rollsum             weak_sum;
 
@@ -78,16 +132,22 @@ struct rs_job {
      * Buffer of data in the scoop.  Allocation is
      *  scoop_buf[0..scoop_alloc], and scoop_next[0..scoop_avail] contains
      *  data yet to be processed. scoop_next[scoop_pos..scoop_avail] is the
-     *  data yet to be scanned.  */
+     *  data yet to be scanned.
+     *
+     *  If scoop_mirror is set, scoop_buf[scoop_alloc..2*scoop_alloc] maps
+     *  the same memory again, so the data can wrap around the end of the
+     *  buffer and scoop_next may point into the second copy. */
     rs_byte_t   *scoop_buf;          /* the allocation pointer */
     rs_byte_t   *scoop_next;         /* the data pointer */
     size_t      scoop_alloc;           /* the allocation size */
     size_t      scoop_avail;           /* the data size */
     size_t      scoop_pos;             /* the scan position */
+    int         scoop_mirror;          /* scoop_buf is a mirrored ring */
 
     /** If USED is >0, then buf contains that much write data to
-     * be sent out. */
-    rs_byte_t   write_buf[36];
+     * be sent out.  The most written at once is a chunk's length, weak
+     * sum and strong sum in a signature. */
+    rs_byte_t   write_buf[40];
     int         write_len;
 
     /** If \p copy_len is >0, then that much data should be copied
@@ -101,11 +161,39 @@ struct rs_job {
     rs_copy_cb      *copy_cb;
     void            *copy_arg;
 
+    /** Optional callback used to execute COPY commands directly. */
+    rs_direct_copy_cb *direct_copy_cb;
+    void            *direct_copy_arg;
+
+    /** Callback told about COPY commands before they are reached. */
+    rs_prefetch_cb  *prefetch_cb;
+    void            *prefetch_arg;
+    int             prefetch_depth;
+
+    /** Number of commands, starting with the current one, already
+     * passed to the prefetcher; \p prefetch_next is the offset of the
+     * first unscanned command from the start of the current one. */
+    int             prefetch_cmds;
+    rs_long_t       prefetch_next;
+
+    /** Delta index being filled in by rs_dindex_begin(), or by a
+     * patch job recording the commands it runs. */
+    struct rs_dindex *dindex;
+
+    /** State of a delta composition job. */
+    struct rs_compose *compose;
+
+    /** State of a reverse delta job. */
+    struct rs_reverse *reverse;
+
 };
 
 
 rs_job_t * rs_job_new(const char *, rs_result (*statefn)(rs_job_t *));
 
+rs_job_t * rs_job_new_ctx(rs_context_t const *ctx, const char *,
+                          rs_result (*statefn)(rs_job_t *));
+
 void rs_job_check(rs_job_t *job);
 
 int rs_job_input_is_ending(rs_job_t *job);
@@ -104,7 +104,42 @@ typedef enum {
      *
      * \see rs_sig_begin()
      **/
-    RS_BLAKE2_SIG_MAGIC     = 0x72730137
+    RS_BLAKE2_SIG_MAGIC     = 0x72730137,
+
+    /**
+     * A signature file using the BLAKE2 hash, with the basis split into
+     * content-defined chunks averaging the block length rather than
+     * fixed blocks.  Deltas against it are much faster to make, because
+     * the new file is split the same way instead of searched at every
+     * byte, but find less of the basis.
+     *
+     * The four-byte literal \c "rs\x018".
+     *
+     * \see rs_sig_begin()
+     **/
+    RS_CDC_BLAKE2_SIG_MAGIC = 0x72730138,
+
+    /**
+     * A signature file using the BLAKE2 hash, with sums for blocks of
+     * the block length and also for up to ::RS_MAX_SIG_LEVELS coarser
+     * block lengths.  Deltas against it copy long unchanged stretches
+     * of the basis a coarse block at a time, and only search the rest
+     * block by block.
+     *
+     * The four-byte literal \c "rs\x019".
+     *
+     * \see rs_sig_set_levels()
+     **/
+    RS_MULTI_BLAKE2_SIG_MAGIC = 0x72730139,
+
+    /**
+     * A saved index of the commands in a delta.
+     *
+     * The four-byte literal \c "rs\x036".
+     *
+     * \see rs_delta_index_save()
+     **/
+    RS_DELTA_INDEX_MAGIC    = 0x72730336
 } rs_magic_number;
 
 
@@ -163,6 +198,34 @@ void            rs_trace_stderr(rs_loglevel level, char const *msg);
  */
 int             rs_supports_trace(void);
 
+/**
+ * \brief Functions the library uses to get and release memory.
+ *
+ * Each is passed \p opaque as its first argument.  \p alloc and
+ * \p realloc return NULL on failure, like malloc() and realloc().
+ *
+ * \see rs_set_allocator()
+ */
+typedef struct rs_allocator {
+    void        *(*alloc)(void *opaque, size_t size);
+    void        *(*realloc)(void *opaque, void *ptr, size_t size);
+    void        (*free)(void *opaque, void *ptr);
+    void        *opaque;
+} rs_allocator_t;
+
+/**
+ * \brief Set the allocator used for all memory the library allocates,
+ * or go back to malloc() and free() if \p allocator is NULL.
+ *
+ * This affects the whole process, and should only be changed while no
+ * jobs, signatures or other library objects are alive, since they
+ * will be released through whatever allocator is then in use.  An
+ * arena that is cleared between batches of work, together with
+ * rs_job_reset(), lets a stream of small jobs run without going to
+ * malloc() at all.
+ */
+void            rs_set_allocator(rs_allocator_t const *allocator);
+
 /**
  * Convert \p from_len bytes at \p from_buf into a hex representation in
  * \p to_buf, which must be twice as long plus one byte for the null
@@ -254,6 +317,65 @@ typedef struct rs_stats {
     rs_long_t       out_bytes;  /**< Total bytes written to output. */
 
     time_t          start, end;
+
+    rs_long_t       basis_wait_ns; /**< Time spent waiting for basis
+                                    * data while patching, in
+                                    * nanoseconds. */
+    rs_long_t       copy_direct_bytes; /**< COPY bytes the driver wrote
+                                        * itself rather than through
+                                        * the output buffer, such as
+                                        * those rs_patch_fd() copies in
+                                        * the kernel. */
+    rs_long_t       inplace_buffered; /**< Bytes of the basis set aside
+                                       * by rs_patch_inplace() to
+                                       * break copy cycles. */
+
+    /* Signature searches made by a delta job.  These are counted in
+     * the job rather than the signature, which isn't written to once
+     * its hash table is built. */
+    rs_long_t       find_count;     /**< Searches of the signature. */
+    rs_long_t       match_count;    /**< Searches that found a block. */
+    rs_long_t       hashcmp_count;  /**< Weak sum compares. */
+    rs_long_t       entrycmp_count; /**< Strong sum compares. */
+    rs_long_t       calc_strong_count; /**< Strong sums calculated. */
+
+    /** Time from starting the job to finishing it, in nanoseconds from
+     * a monotonic clock.  Unlike \p start and \p end this is useful
+     * for jobs shorter than a second. */
+    rs_long_t       elapsed_ns;
+
+    /* Time spent in each phase, in nanoseconds.  These are only
+     * collected if the library was built with timing, which it is by
+     * default.  Work done for every byte is timed on a sample of the
+     * bytes and scaled up, so those figures are estimates. */
+    rs_long_t       in_wait_ns;     /**< Filling input in rs_job_drive(). */
+    rs_long_t       out_wait_ns;    /**< Draining output in rs_job_drive(). */
+    rs_long_t       weak_sum_ns;    /**< Calculating and rolling weak
+                                     * sums. */
+    rs_long_t       probe_ns;       /**< Searching the signature's hash
+                                     * table, besides strong sums. */
+    rs_long_t       strong_sum_ns;  /**< Calculating strong sums. */
+    rs_long_t       emit_ns;        /**< Writing commands and data into
+                                     * the output. */
+
+    /* How the job was driven, for tuning buffer sizes. */
+    rs_long_t       iter_count;     /**< Calls to rs_job_iter(). */
+    rs_long_t       blocked_in_count; /**< RS_BLOCKED returns for want
+                                       * of input. */
+    rs_long_t       blocked_out_count; /**< RS_BLOCKED returns for want
+                                        * of output space. */
+    rs_long_t       scoop_allocs;   /**< Times the input scoop was
+                                     * (re)allocated to grow. */
+    rs_long_t       scoop_moved_bytes; /**< Bytes the scoop copied or
+                                        * moved within itself to make
+                                        * room for more input. */
+    rs_long_t       tube_catchups;  /**< Calls to flush pending output. */
+    rs_long_t       tube_buffered_bytes; /**< Output bytes held in the
+                                          * job's buffers until there
+                                          * was room for them. */
+    rs_long_t       tube_direct_bytes; /**< Output bytes written or
+                                        * copied from the input straight
+                                        * into the output buffer. */
 } rs_stats_t;
 
 
@@ -326,6 +448,65 @@ void rs_free_sumset(rs_signature_t *);
  */
 void rs_sumset_dump(rs_signature_t const *);
 
+/**
+ * \brief Number of buckets in the probe length histograms of
+ * ::rs_signature_stats_t.
+ *
+ * All three histograms count probes by the number of filled buckets
+ * skipped before the one they stop at, so bucket 0 is a probe that
+ * stops at its key's own bucket.  The last bucket counts all probes
+ * this long or longer.
+ */
+#define RS_PROBE_HIST_LEN 16
+
+/**
+ * \brief Diagnostics for a signature and its hashtable, for tuning block
+ * sizes.
+ *
+ * A probe length is the number of filled hashtable buckets looked at.
+ *
+ * \sa rs_signature_get_stats()
+ */
+typedef struct rs_signature_stats {
+    int magic;                  /**< The signature magic. */
+    int block_len;              /**< The block length. */
+    int strong_sum_len;         /**< The strong sum length. */
+    rs_long_t block_count;      /**< The number of blocks. */
+    rs_long_t distinct_weak_sums; /**< The number of different weak sums. */
+
+    /** Blocks with the same weak and strong sums as another block. */
+    rs_long_t duplicate_blocks;
+
+    /** Blocks with the same weak sum as another block but a different
+     * strong sum. */
+    rs_long_t weak_collisions;
+
+    /** Strong sum compares that failed when finding every block, which
+     * delta jobs also pay for when the block matches. */
+    rs_long_t false_weak_matches;
+
+    rs_long_t table_size;       /**< Hashtable buckets, or 0 if not built. */
+    double load;                /**< Filled fraction of the hashtable. */
+
+    /** Buckets skipped adding each block to the hashtable. */
+    rs_long_t build_probes[RS_PROBE_HIST_LEN];
+
+    /** Buckets skipped finding each block. */
+    rs_long_t hit_probes[RS_PROBE_HIST_LEN];
+
+    /** Buckets skipped by a missing find starting at each bucket. */
+    rs_long_t miss_probes[RS_PROBE_HIST_LEN];
+} rs_signature_stats_t;
+
+/**
+ * \brief Measure a signature and its hashtable.
+ *
+ * The hashtable fields are only filled if rs_build_hash_table() has been
+ * called.  This only reads the signature.
+ */
+rs_result rs_signature_get_stats(rs_signature_t const *sig,
+                                 rs_signature_stats_t *stats);
+
 
 /**
  * Description of input and output buffers.
@@ -402,9 +583,40 @@ struct rs_buffers_s {
  */
 typedef struct rs_buffers_s rs_buffers_t;
 
+/**
+ * A segment of memory, laid out like POSIX <tt>struct iovec</tt>.
+ */
+typedef struct rs_iovec {
+    void        *iov_base;
+    size_t      iov_len;
+} rs_iovec_t;
+
+/**
+ * Description of scattered input and output buffers, for
+ * rs_job_iterv().
+ *
+ * Like ::rs_buffers_s, but input and output are each an array of
+ * segments.  On return the arrays are advanced past the segments
+ * that were used up, and the first remaining segment of each is
+ * trimmed to what's left of it, so the same structure can be passed
+ * in again.
+ */
+typedef struct rs_buffersv {
+    rs_iovec_t  *in_iov;        /**< Segments of input. */
+    int         in_iovcnt;      /**< Number of input segments. */
+    int         eof_in;         /**< True if there is no more input
+                                 * after these segments. */
+    rs_iovec_t  *out_iov;       /**< Segments of output space. */
+    int         out_iovcnt;     /**< Number of output segments. */
+} rs_buffersv_t;
+
 /** Default block length, if not determined by any other factors. */
 #define RS_DEFAULT_BLOCK_LEN 2048
 
+/** Most coarser block lengths in a ::RS_MULTI_BLAKE2_SIG_MAGIC
+ * signature. */
+#define RS_MAX_SIG_LEVELS 4
+
 
 /**
  * \brief Job of work to be done.
@@ -440,6 +652,21 @@ typedef struct rs_job rs_job_t;
  */
 rs_result       rs_job_iter(rs_job_t *job, rs_buffers_t *buffers);
 
+/**
+ * \brief Run a job like rs_job_iter(), taking input from and writing
+ * output to several segments of memory.
+ *
+ * The job reads each input segment in place and only copies into its
+ * internal buffer when it needs a window that spans two segments.
+ * Output is written across segment boundaries, so data can go from
+ * one set of buffers to another, for instance from network packets to
+ * file writes, without being gathered into one buffer first.
+ *
+ * \return As for rs_job_iter().  ::RS_BLOCKED means that the job
+ * needs more input or output segments.
+ */
+rs_result       rs_job_iterv(rs_job_t *job, rs_buffersv_t *buffers);
+
 /**
  * Type of application-supplied function for rs_job_drive().
  *
@@ -465,6 +692,24 @@ const rs_stats_t * rs_job_statistics(rs_job_t *job);
  */
 rs_result       rs_job_free(rs_job_t *);
 
+/**
+ * \brief Get a finished or abandoned job ready to run again on new
+ * input, keeping its buffers.
+ *
+ * The job starts again with the arguments it was begun with: a
+ * signature job makes another signature with the same block and sum
+ * lengths, a delta job uses the same signature and a patch job the
+ * same copy callback and argument.  The statistics are cleared.
+ *
+ * Reusing one job for many small files avoids allocating and freeing
+ * its state and scoop buffer each time.
+ *
+ * \return ::RS_PARAM_ERROR for jobs that can't be rerun, such as those
+ * from rs_loadsig_begin(), which hand a new signature to the caller
+ * each time.
+ */
+rs_result       rs_job_reset(rs_job_t *);
+
 /**
  * \brief Start generating a signature.
  *
@@ -486,6 +731,18 @@ rs_job_t *rs_sig_begin(size_t new_block_len,
                        size_t strong_sum_len,
                        rs_magic_number sig_magic);
 
+/**
+ * Set the coarser block lengths of a ::RS_MULTI_BLAKE2_SIG_MAGIC
+ * signature job, before it's run.
+ *
+ * The signature gets \p levels more sets of sums, up to
+ * ::RS_MAX_SIG_LEVELS, each for blocks \p factor times the length of
+ * the last.  The default is one level with a factor of 32, so 64KiB
+ * blocks over the default 2KiB ones.  Other signature formats ignore
+ * this.
+ */
+void rs_sig_set_levels(rs_job_t *job, int levels, int factor);
+
 /**
  * Prepare to compute a streaming delta.
  *
@@ -511,6 +768,9 @@ rs_job_t *rs_loadsig_begin(rs_signature_t **);
 /**
  * Call this after loading a signature to index it.
  *
+ * After this the signature is only read, so it can be shared by delta
+ * jobs running in several threads at once.
+ *
  * Use rs_free_sumset() to release it after use.
  */
 rs_result rs_build_hash_table(rs_signature_t* sums);
@@ -534,6 +794,47 @@ typedef rs_result rs_copy_cb(void *opaque, rs_long_t pos,
 
 
 
+/**
+ * \brief An index of the commands in a delta, giving random access to
+ * the file it produces.
+ *
+ * \sa rs_patch_range()
+ */
+typedef struct rs_dindex rs_delta_index_t;
+
+
+/**
+ * \brief Rebuild a range of the new file from its basis and delta,
+ * without patching the rest.
+ *
+ * The commands covering the range are looked up in \p index, and only
+ * the parts of the basis and delta they refer to are read.
+ *
+ * \param pos Offset in the new file of the first byte wanted.
+ *
+ * \param len On input, the number of bytes wanted.  Updated to the
+ * number produced, which is less only if the range runs past the end
+ * of the new file.
+ *
+ * \param buf Buffer of at least \p *len bytes to receive the data.
+ *
+ * \param basis_cb Callback that reads from the basis.
+ *
+ * \param delta_cb Callback that reads from the delta, with positions
+ * counted from the start of the delta's magic number.
+ */
+rs_result rs_patch_range(rs_delta_index_t const *index, rs_long_t pos,
+                         size_t *len, void *buf,
+                         rs_copy_cb *basis_cb, void *basis_arg,
+                         rs_copy_cb *delta_cb, void *delta_arg);
+
+/** Return the length of the file a delta produces. */
+rs_long_t rs_delta_index_len(rs_delta_index_t const *index);
+
+/** Deallocate a delta index. */
+void rs_free_delta_index(rs_delta_index_t *index);
+
+
 /**
  * \brief Apply a \a delta to a \a basis file to recreate
  * the \a new file.
@@ -560,6 +861,143 @@ typedef rs_result rs_copy_cb(void *opaque, rs_long_t pos,
 rs_job_t *rs_patch_begin(rs_copy_cb *copy_cb, void *copy_arg);
 
 
+/**
+ * Callback used to hint that a range of the basis will soon be read
+ * by ::rs_copy_cb.
+ *
+ * The callback should start the read without waiting for it, for
+ * example with posix_fadvise(POSIX_FADV_WILLNEED).  An error result
+ * turns off prefetching for the rest of the job but doesn't fail it.
+ */
+typedef rs_result rs_prefetch_cb(void *opaque, rs_long_t pos, rs_long_t len);
+
+
+/**
+ * Ask a patch job to read ahead in the delta and announce upcoming
+ * COPY commands to \p prefetch_cb.
+ *
+ * The job parses up to \p depth commands beyond the one it's
+ * executing, but only as far as the delta data already passed in to
+ * it, so a larger input buffer lets it see further ahead.  A depth of
+ * 0 turns prefetching off.
+ *
+ * Time the job spends waiting in ::rs_copy_cb is reported in
+ * rs_stats_t::basis_wait_ns whether or not prefetching is on.
+ */
+void rs_patch_set_prefetch(rs_job_t *job, int depth,
+                           rs_prefetch_cb *prefetch_cb, void *opaque);
+
+
+/**
+ * \brief A recorder of job events: each call of rs_job_iter(), each
+ * change of state, each time it blocks, each buffer fill and drain by
+ * rs_job_drive() and the whole-file functions, and each command it
+ * emits or applies, with timestamps.
+ *
+ * Jobs record into the log of their ::rs_context, or
+ * ::rs_job_event_log if they have no context, when it isn't NULL.
+ * Recording costs a clock read and an atomic increment per event, and
+ * one log may be shared by jobs in many threads.  Once it is full
+ * further events are dropped.
+ *
+ * \sa rs_event_log_write_json()
+ */
+typedef struct rs_event_log rs_event_log_t;
+
+/**
+ * Make an event log with room for \p max_events events.
+ */
+rs_event_log_t *rs_event_log_new(size_t max_events);
+
+/**
+ * Free an event log, which no job may be recording into.
+ */
+void rs_event_log_free(rs_event_log_t *log);
+
+/**
+ * Number of events that have been recorded in \p log, and through
+ * \p dropped the number that didn't fit.
+ */
+size_t rs_event_log_count(rs_event_log_t const *log, size_t *dropped);
+
+/**
+ * Event log for jobs started without a context, NULL by default.
+ */
+extern rs_event_log_t *rs_job_event_log;
+
+
+/**
+ * Callback told about each run of a job that has finished, with its
+ * result and final statistics, just before the job is reset or freed.
+ *
+ * \sa rs_context
+ */
+typedef void rs_stats_cb(void *opaque, rs_result result,
+                         rs_stats_t const *stats);
+
+/**
+ * \brief Settings for the jobs started with it, in place of the
+ * process-wide ::rs_inbuflen, ::rs_outbuflen, trace and allocator
+ * settings.
+ *
+ * Fill one in with rs_context_init() and change what's wanted, then
+ * pass it to rs_sig_begin_ctx() and the other \c _ctx functions.  The
+ * jobs keep a pointer to it, so it must outlive them and shouldn't be
+ * changed while they are running, but one context can be shared by
+ * jobs in many threads.  Jobs started without a context use the
+ * process-wide settings.
+ *
+ * \sa \ref api_context
+ */
+typedef struct rs_context {
+    /** Sizes of the input and output buffers used by rs_whole_run_opts()
+     * for the job; delta jobs also write literal data in pieces of no
+     * more than \p outbuflen. */
+    int                 inbuflen, outbuflen;
+
+    /** Check every rolled weak sum in delta jobs against one calculated
+     * from scratch.  Only useful for testing. */
+    int                 roll_paranoia;
+
+    /** Trace messages logged while one of the context's jobs is being
+     * run go to \p trace_fn if they are at or above \p trace_level.  A
+     * NULL \p trace_fn discards them.  Messages from other threads and
+     * other jobs aren't affected. */
+    rs_loglevel         trace_level;
+    rs_trace_fn_t       *trace_fn;
+
+    /** Allocator for the jobs and their buffers, or NULL to use the
+     * process-wide one.  Signatures are still allocated with the
+     * process-wide allocator. */
+    rs_allocator_t const *allocator;
+
+    /** If set, called with \p stats_opaque when each run of a job
+     * finishes. */
+    rs_stats_cb         *stats_cb;
+    void                *stats_opaque;
+
+    /** Log to record the jobs' events in, or NULL not to. */
+    rs_event_log_t      *event_log;
+} rs_context_t;
+
+/**
+ * Fill in \p ctx with the current process-wide settings.
+ */
+void rs_context_init(rs_context_t *ctx);
+
+/**
+ * Like rs_sig_begin(), rs_delta_begin(), rs_loadsig_begin() and
+ * rs_patch_begin(), but the job uses the settings in \p ctx, which may
+ * be NULL for the process-wide ones.
+ */
+rs_job_t *rs_sig_begin_ctx(rs_context_t const *ctx, size_t new_block_len,
+                           size_t strong_sum_len, rs_magic_number sig_magic);
+rs_job_t *rs_delta_begin_ctx(rs_context_t const *ctx, rs_signature_t *);
+rs_job_t *rs_loadsig_begin_ctx(rs_context_t const *ctx, rs_signature_t **);
+rs_job_t *rs_patch_begin_ctx(rs_context_t const *ctx, rs_copy_cb *copy_cb,
+                             void *copy_arg);
+
+
 #ifndef RSYNC_NO_STDIO_INTERFACE
 #include <stdio.h>
 
@@ -571,6 +1009,87 @@ rs_job_t *rs_patch_begin(rs_copy_cb *copy_cb, void *copy_arg);
 extern int rs_inbuflen, rs_outbuflen;
 
 
+/**
+ * Write the events in \p log to \p file in the Chrome trace event JSON
+ * format, for loading into Perfetto or chrome://tracing.
+ *
+ * Each job is shown as a thread, with a span for each call of
+ * rs_job_iter() and instant events inside it.  No jobs should be
+ * recording into the log at the time.
+ */
+rs_result rs_event_log_write_json(rs_event_log_t const *log, FILE *file);
+
+
+/**
+ * Number of commands the whole-file patch functions read ahead in the
+ * delta to prefetch the basis.
+ *
+ * \sa rs_patch_set_prefetch()
+ */
+extern int rs_patch_lookahead;
+
+
+/**
+ * Coarser levels, and the factor between their block lengths, of the
+ * ::RS_MULTI_BLAKE2_SIG_MAGIC signatures made by rs_sig_file() and
+ * batches.
+ *
+ * \sa rs_sig_set_levels()
+ */
+extern int rs_sig_levels, rs_sig_level_factor;
+
+
+/**
+ * Whether the whole-file functions overlap IO with processing by
+ * reading and writing in background threads.  Off by default.
+ *
+ * \sa rs_whole_run_opts()
+ */
+extern int rs_whole_pipeline;
+
+
+/**
+ * Bytes of basis data rs_patch_inplace() sets aside in memory, without
+ * a journal, before the rest goes to a temporary file.  64MB by
+ * default.
+ */
+extern rs_long_t rs_inplace_mem_limit;
+
+
+/**
+ * Options for rs_whole_run_opts().  Zero fields take the defaults.
+ */
+typedef struct rs_whole_opts {
+    /** Read and write in background threads, so that the job runs
+     * while the next input is read and the last output written.
+     * Ignored if threads are not available. */
+    int         pipeline;
+
+    /** Number of buffers queued each way when pipelined. */
+    int         nbufs;
+
+    /** Sizes of each input and output buffer; by default those of the
+     * job's ::rs_context, or ::rs_inbuflen and ::rs_outbuflen. */
+    size_t      in_buf_len, out_buf_len;
+} rs_whole_opts_t;
+
+
+/**
+ * Run a job to completion, reading its input from \p in_file and
+ * writing its output to \p out_file, either of which may be NULL.
+ *
+ * This is what the whole-file functions use for signature, loadsig,
+ * delta and patch jobs, with ::rs_whole_pipeline giving
+ * rs_whole_opts::pipeline.  When pipelined, buffers are passed between
+ * the job and the IO threads without copying.  The input may be read
+ * ahead of the job by up to \p nbufs buffers.
+ *
+ * \sa \ref api_whole
+ */
+rs_result rs_whole_run_opts(rs_job_t *job, FILE *in_file, FILE *out_file,
+                            rs_whole_opts_t const *opts);
+
+
 /**
  * Generate the signature of a basis file, and write it out to
  * another.
@@ -619,9 +1138,237 @@ rs_result rs_delta_file(rs_signature_t *, FILE *new_file, FILE *delta_file, rs_s
 
 /**
  * Apply a patch, relative to a basis, into a new file.
+ *
+ * The basis is read by file descriptor in large aligned blocks that
+ * are kept to serve the following COPY commands, so \p basis_file must
+ * be seekable.  Its stdio position and anything buffered in the stream
+ * are ignored.  A stream with no descriptor, such as one from
+ * fmemopen(), is read through stdio with rs_file_copy_cb() instead.
+ *
  * \sa \ref api_whole
  */
 rs_result rs_patch_file(FILE *basis_file, FILE *delta_file, FILE *new_file, rs_stats_t *);
+
+
+/**
+ * Apply a patch, like rs_patch_file(), but reading and writing file
+ * descriptors.
+ *
+ * When the basis and new file are regular files, COPY commands are
+ * executed inside the kernel rather than through the output buffer:
+ * block-aligned ranges are reflinked with FICLONERANGE on filesystems
+ * that share extents (btrfs, XFS), and the rest goes through
+ * copy_file_range().  If neither is available the data is copied
+ * through the buffers as usual.
+ *
+ * \p basis_fd must be seekable; \p new_fd is written from its current
+ * offset.
+ *
+ * \sa \ref api_whole
+ */
+rs_result rs_patch_fd(int basis_fd, int delta_fd, int new_fd, rs_stats_t *);
+
+
+/**
+ * Apply a patch, like rs_patch_file(), with output done asynchronously
+ * through Linux io_uring.
+ *
+ * Each COPY command is queued as a read from the basis linked to a
+ * write at its offset in the new file, and literal data is written
+ * the same way, so many reads and writes are in flight at once.  This
+ * helps on devices that need a deep queue to reach full speed.
+ *
+ * \p new_file must be seekable.  If it isn't, or io_uring is not
+ * available, this falls back to rs_patch_file().
+ *
+ * \sa \ref api_whole
+ */
+rs_result rs_patch_file_async(FILE *basis_file, FILE *delta_file,
+                              FILE *new_file, rs_stats_t *);
+
+
+/**
+ * Apply a patch, like rs_patch_file(), using several threads.
+ *
+ * The delta is read once to index its commands, which gives the
+ * output offset of each.  The new file is then divided into pieces
+ * that \p nthreads worker threads fill concurrently with pread() and
+ * pwrite().  If \p nthreads is 0 or less, one thread per online CPU is
+ * used.
+ *
+ * All three files must be seekable.  If they aren't, or librsync was
+ * built without threads, this calls rs_patch_file() instead.
+ *
+ * \sa \ref api_whole
+ */
+rs_result rs_patch_file_mt(FILE *basis_file, FILE *delta_file,
+                           FILE *new_file, int nthreads, rs_stats_t *);
+
+
+/**
+ * Apply a patch, like rs_patch_file(), and also write a reverse delta
+ * that turns the new file back into the basis.
+ *
+ * The ranges of the basis copied by the patch are recorded as it runs.
+ * Once the new file is complete, the reverse delta is written from
+ * them: basis ranges that were copied become COPYs from the new file,
+ * and only the rest of the basis is read again, to be sent as literal
+ * data.  No signature of the new file is needed.
+ *
+ * \p basis_file must be seekable, and is left positioned at its end.
+ *
+ * \sa \ref api_whole
+ */
+rs_result rs_patch_file_reverse(FILE *basis_file, FILE *delta_file,
+                                FILE *new_file, FILE *reverse_file,
+                                rs_stats_t *stats);
+
+
+/**
+ * Combine a delta from A to B and a delta from B to C into a single
+ * delta from A to C, without reconstructing B.
+ *
+ * Each COPY in \p second_file is resolved through an index of the
+ * commands in \p first_file, becoming COPYs from A or literal data
+ * taken from the first delta.  Patching A with the result gives
+ * exactly the same output as applying the two deltas in turn.  A chain
+ * of deltas can be folded into one by composing repeatedly.
+ *
+ * If \p first_file is not seekable it's copied to a temporary file.
+ *
+ * \sa \ref api_whole
+ */
+rs_result rs_delta_compose(FILE *first_file, FILE *second_file,
+                           FILE *delta_file, rs_stats_t *stats);
+
+
+/**
+ * Read a delta and build an index of its commands for
+ * rs_patch_range().
+ *
+ * Literal data is skipped rather than stored, so the index is small
+ * compared to the delta, but the delta must be kept to read it back.
+ * Free the index with rs_free_delta_index().
+ *
+ * \sa \ref api_whole
+ */
+rs_result rs_delta_index_file(FILE *delta_file, rs_delta_index_t **index,
+                              rs_stats_t *stats);
+
+/**
+ * Write a delta index to a file, so that it need only be built once.
+ *
+ * \sa rs_delta_index_load()
+ */
+rs_result rs_delta_index_save(rs_delta_index_t const *index, FILE *f);
+
+/**
+ * Read a delta index written by rs_delta_index_save().
+ */
+rs_result rs_delta_index_load(FILE *f, rs_delta_index_t **index);
+
+
+/**
+ * Apply a patch by overwriting the basis file, so that no space is
+ * needed for a second copy.
+ *
+ * The whole delta is read first to plan the order of the COPY
+ * commands so that no data is overwritten before it has been copied.
+ * Where COPYs depend on each other in a cycle some basis data has to
+ * be set aside: up to ::rs_inplace_mem_limit bytes in memory, and the
+ * rest in a temporary file.  The number of bytes set aside is reported in
+ * rs_stats_t::inplace_buffered.
+ *
+ * If \p journal_path is not NULL, progress and set-aside data are kept
+ * in that file and synced as needed so that an interrupted patch can
+ * be completed by calling this again with the same delta and journal.
+ * The journal is removed when the patch is done.  It records a
+ * checksum of the delta and the basis's size and mtime, and
+ * ::RS_BAD_MAGIC is returned rather than resuming with a different
+ * delta, or if the basis has been replaced, shrunk or given an
+ * earlier mtime since the patch started.  Without a journal, an
+ * interrupted patch leaves the file in an unknown state.
+ *
+ * If \p delta_file is not seekable it's copied to a temporary file.
+ *
+ * \sa \ref api_whole
+ */
+rs_result rs_patch_inplace(const char *path, FILE *delta_file,
+                           const char *journal_path, rs_stats_t *stats);
+
+
+/**
+ * \brief Operations that can be queued on an ::rs_batch_t.
+ *
+ * The files for each are given to rs_batch_add() in the order rdiff
+ * takes them.
+ */
+typedef enum {
+    RS_BATCH_SIGNATURE,         /**< BASIS, SIGNATURE */
+    RS_BATCH_DELTA,             /**< SIGNATURE, NEWFILE, DELTA */
+    RS_BATCH_PATCH              /**< BASIS, DELTA, NEWFILE */
+} rs_batch_op;
+
+/**
+ * \brief A queue of whole-file operations run on a pool of threads.
+ *
+ * \see rs_batch_new()
+ */
+typedef struct rs_batch rs_batch_t;
+
+/**
+ * Make a batch that runs its tasks on \p nthreads threads, or one per
+ * online CPU if \p nthreads is 0 or less.  Signatures are made with
+ * \p block_len, \p strong_len and \p sig_magic, as for rs_sig_file().
+ *
+ * Each thread keeps its buffers and reuses its jobs from one task to
+ * the next, so many small files are handled much faster than by
+ * calling the whole-file functions for each.  Idle threads take work
+ * queued for busy ones.
+ *
+ * \sa \ref api_whole
+ */
+rs_batch_t *rs_batch_new(int nthreads, size_t block_len, size_t strong_len,
+                         rs_magic_number sig_magic);
+
+/**
+ * Queue a task, naming the files it reads and writes.  Only the
+ * first two names are used for ::RS_BATCH_SIGNATURE.  The names are
+ * copied.
+ *
+ * Tasks run in no particular order, so one that needs the output of
+ * another, such as a delta from a signature made in the same batch,
+ * must be added after that batch has been run.
+ *
+ * \return The number of the task, for rs_batch_result(), or -1 if
+ * the arguments are invalid.
+ */
+int rs_batch_add(rs_batch_t *batch, rs_batch_op op, char const *file1,
+                 char const *file2, char const *file3);
+
+/**
+ * Run all the tasks added since the batch was last run, and wait for
+ * them to finish.
+ *
+ * \param stats Optional pointer to receive the totals over all the
+ * jobs run.  rs_stats_t::elapsed_ns is the wall time of the whole run
+ * rather than a total, so that rates reflect the threads working
+ * together; the other times are summed over the jobs.
+ *
+ * \return ::RS_DONE if every task succeeded, or else the result of the
+ * first that failed, in the order they were added.
+ */
+rs_result rs_batch_run(rs_batch_t *batch, rs_stats_t *stats);
+
+/**
+ * Return the result of task number \p task, once it has been run.
+ */
+rs_result rs_batch_result(rs_batch_t const *batch, int task);
+
+/**
+ * Free a batch and everything it holds.
+ */
+void rs_batch_free(rs_batch_t *batch);
 #endif /* ! RSYNC_NO_STDIO_INTERFACE */
 
 #ifdef __cplusplus
@@ -41,6 +41,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
 #include <assert.h>
 
 #include "librsync.h"
@@ -55,6 +56,8 @@
 /* Possible state functions for signature generation. */
 static rs_result rs_sig_s_header(rs_job_t *);
 static rs_result rs_sig_s_generate(rs_job_t *);
+static rs_result rs_sig_s_chunk(rs_job_t *);
+static rs_result rs_sig_s_levels(rs_job_t *);
 
 
 
@@ -66,10 +69,29 @@ static rs_result rs_sig_s_header(rs_job_t *job)
 {
     rs_signature_t *sig = job->signature;
     rs_result result;
+    rs_long_t len;
+    int i;
 
     if ((result = rs_signature_init(sig, job->sig_magic, job->sig_block_len,
 				    job->sig_strong_len, 0)) != RS_DONE)
         return result;
+    if (rs_signature_is_multi(sig)) {
+        if (job->sig_levels < 1 || job->sig_level_factor < 2) {
+            rs_error("invalid signature levels %d or factor %d",
+                     job->sig_levels, job->sig_level_factor);
+            return RS_PARAM_ERROR;
+        }
+        len = sig->block_len;
+        for (i = 0; i < job->sig_levels; i++) {
+            len *= job->sig_level_factor;
+            if (len > INT_MAX) {
+                rs_error("level %d block length is too long", i + 1);
+                return RS_PARAM_ERROR;
+            }
+            if ((result = rs_signature_add_level(sig, len)) != RS_DONE)
+                return result;
+        }
+    }
     rs_squirt_n4(job, sig->magic);
     rs_squirt_n4(job, sig->block_len);
     rs_squirt_n4(job, sig->strong_sum_len);
@@ -77,7 +99,18 @@ static rs_result rs_sig_s_header(rs_job_t *job)
              sig->magic, (int) sig->block_len, (int) sig->strong_sum_len);
     job->stats.block_len = sig->block_len;
 
-    job->statefn = rs_sig_s_generate;
+    if (rs_signature_is_cdc(sig)) {
+        job->statefn = rs_sig_s_chunk;
+    } else if (rs_signature_is_multi(sig)) {
+        rs_squirt_n4(job, job->sig_levels);
+        for (i = 1; i <= job->sig_levels; i++)
+            rs_squirt_n4(job, rs_signature_level(sig, i)->block_len);
+        job->sig_level = job->sig_levels;
+        job->sig_pos = 0;
+        job->statefn = rs_sig_s_levels;
+    } else {
+        job->statefn = rs_sig_s_generate;
+    }
     return RS_RUNNING;
 }
 
@@ -93,11 +126,20 @@ rs_sig_do_block(rs_job_t *job, const void *block, size_t len)
     rs_signature_t      *sig = job->signature;
     rs_weak_sum_t       weak_sum;
     rs_strong_sum_t     strong_sum;
+    rs_long_t           t0, t1, t2;
 
+    t0 = rs_timing_now();
     weak_sum = rs_calc_weak_sum(block, len);
+    t1 = rs_timing_now();
     rs_signature_calc_strong_sum(sig, block, len, &strong_sum);
+    t2 = rs_timing_now();
+    if (rs_signature_is_cdc(sig))
+        rs_squirt_n4(job, len);
     rs_squirt_n4(job, weak_sum);
     rs_tube_write(job, strong_sum, sig->strong_sum_len);
+    job->stats.weak_sum_ns += t1 - t0;
+    job->stats.strong_sum_ns += t2 - t1;
+    job->stats.emit_ns += rs_timing_now() - t2;
     if (rs_trace_enabled()) {
         char                strong_sum_hex[RS_MAX_STRONG_SUM_LENGTH * 2 + 1];
         rs_hexify(strong_sum_hex, strong_sum, sig->strong_sum_len);
@@ -110,6 +152,10 @@ rs_sig_do_block(rs_job_t *job, const void *block, size_t len)
 
 /**
  * State of reading a block and trying to generate its sum.
+ *
+ * While the sums go straight into the output buffer this carries on
+ * to the next block, rather than going back through rs_job_work() for
+ * each one.
  * \private
  */
 static rs_result
@@ -119,37 +165,150 @@ rs_sig_s_generate(rs_job_t *job)
     size_t              len;
     void                *block;
 
-    /* must get a whole block, otherwise try again */
-    len = job->signature->block_len;
-    result = rs_scoop_read(job, len, &block);
-
-    /* unless we're near eof, in which case we'll accept
-     * whatever's in there */
-    if ((result == RS_BLOCKED && rs_job_input_is_ending(job))) {
-        result = rs_scoop_read_rest(job, &len, &block);
-    } else if (result == RS_INPUT_ENDED) {
-        return RS_DONE;
-    } else if (result != RS_DONE) {
-        rs_trace("generate stopped: %s", rs_strerror(result));
-        return result;
-    }
+    do {
+        /* must get a whole block, otherwise try again */
+        len = job->signature->block_len;
+        result = rs_scoop_read(job, len, &block);
+
+        /* unless we're near eof, in which case we'll accept
+         * whatever's in there */
+        if ((result == RS_BLOCKED && rs_job_input_is_ending(job))) {
+            result = rs_scoop_read_rest(job, &len, &block);
+        } else if (result == RS_INPUT_ENDED) {
+            return RS_DONE;
+        } else if (result != RS_DONE) {
+            rs_trace("generate stopped: %s", rs_strerror(result));
+            return result;
+        }
+
+        rs_trace("got %ld byte block", (long) len);
+
+        rs_sig_do_block(job, block, len);
+    } while (rs_tube_is_idle(job));
+
+    return RS_RUNNING;
+}
+
+
+/**
+ * State of splitting the input into content-defined chunks and
+ * generating their sums.
+ *
+ * A chunk can't be cut until the next boundary is seen, so this waits
+ * until it has the longest possible chunk or the rest of the input.
+ * \private
+ */
+static rs_result
+rs_sig_s_chunk(rs_job_t *job)
+{
+    rs_cdc_t const      *cdc = &job->signature->cdc;
+    rs_result           result;
+    size_t              len;
+    void                *buf;
+    rs_long_t           start;
+
+    do {
+        len = cdc->max;
+        result = rs_scoop_readahead(job, len, &buf);
+        if (result == RS_BLOCKED && rs_job_input_is_ending(job)) {
+            len = rs_scoop_total_avail(job);
+            result = rs_scoop_readahead(job, len, &buf);
+        }
+        if (result == RS_INPUT_ENDED) {
+            return RS_DONE;
+        } else if (result != RS_DONE) {
+            rs_trace("chunking stopped: %s", rs_strerror(result));
+            return result;
+        }
+
+        start = rs_timing_now();
+        len = rs_cdc_cut(cdc, buf, len, 1);
+        job->stats.weak_sum_ns += rs_timing_now() - start;
+        rs_trace("got %ld byte chunk", (long) len);
+
+        rs_scoop_advance(job, len);
+        rs_sig_do_block(job, buf, len);
+    } while (rs_tube_is_idle(job));
 
-    rs_trace("got %ld byte block", (long) len);
+    return RS_RUNNING;
+}
+
+
+/**
+ * State of generating the sums of a multi-level signature.
+ *
+ * The sums of a coarsest block and all the blocks in it are made from
+ * the scoop before it's moved on, so this waits for a whole one, or
+ * the rest of the input.
+ * \private
+ */
+static rs_result
+rs_sig_s_levels(rs_job_t *job)
+{
+    rs_signature_t      *sig = job->signature;
+    rs_result           result;
+    size_t              len, block_len;
+    rs_byte_t           *buf;
 
-    return rs_sig_do_block(job, block, len);
+    do {
+        len = rs_signature_level(sig, job->sig_levels)->block_len;
+        result = rs_scoop_readahead(job, len, (void **) &buf);
+        if (result == RS_BLOCKED && rs_job_input_is_ending(job)) {
+            len = rs_scoop_total_avail(job);
+            result = rs_scoop_readahead(job, len, (void **) &buf);
+        }
+        if (result == RS_INPUT_ENDED) {
+            return RS_DONE;
+        } else if (result != RS_DONE) {
+            rs_trace("generate stopped: %s", rs_strerror(result));
+            return result;
+        }
+
+        block_len = rs_signature_level(sig, job->sig_level)->block_len;
+        if (block_len > len - job->sig_pos)
+            block_len = len - job->sig_pos;
+        rs_trace("got %ld byte level %d block", (long) block_len,
+                 job->sig_level);
+        rs_sig_do_block(job, buf + job->sig_pos, block_len);
+
+        job->sig_level = rs_signature_next_sum(sig, job->sig_level,
+                                               &job->sig_pos);
+        if ((size_t) job->sig_pos >= len) {
+            rs_scoop_advance(job, len);
+            job->sig_level = job->sig_levels;
+            job->sig_pos = 0;
+        }
+    } while (rs_tube_is_idle(job));
+
+    return RS_RUNNING;
+}
+
+
+void rs_sig_set_levels(rs_job_t *job, int levels, int factor)
+{
+    job->sig_levels = levels;
+    job->sig_level_factor = factor;
 }
 
 
 rs_job_t * rs_sig_begin(size_t new_block_len, size_t strong_sum_len,
                         rs_magic_number sig_magic)
+{
+    return rs_sig_begin_ctx(NULL, new_block_len, strong_sum_len, sig_magic);
+}
+
+
+rs_job_t * rs_sig_begin_ctx(rs_context_t const *ctx, size_t new_block_len,
+                            size_t strong_sum_len, rs_magic_number sig_magic)
 {
     rs_job_t *job;
 
-    job = rs_job_new("signature", rs_sig_s_header);
+    job = rs_job_new_ctx(ctx, "signature", rs_sig_s_header);
     job->signature = rs_alloc_struct(rs_signature_t);
     job->job_owns_sig = 1;
     job->sig_magic = sig_magic;
     job->sig_block_len = new_block_len;
     job->sig_strong_len = strong_sum_len;
+    rs_sig_set_levels(job, 1, 32);
     return job;
 }
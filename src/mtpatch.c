@@ -0,0 +1,283 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*
+ * Parallel patching.
+ *
+ * Once the delta has been indexed, the output offset of every command
+ * is known, so the new file can be filled in any order.  It is cut
+ * into pieces of RS_MT_PIECE bytes, and worker threads take the next
+ * unclaimed piece, find the commands that cover it, and copy from the
+ * basis or the delta with pread() and pwrite().
+ */
+
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "librsync.h"
+#include "util.h"
+#include "trace.h"
+#include "command.h"
+#include "job.h"
+#include "whole.h"
+#include "dindex.h"
+
+/* use fseeko instead of fseek for long file support if we have it */
+#ifdef HAVE_FSEEKO
+#define fseek fseeko
+#define ftell ftello
+#elif defined HAVE_FSEEKO64
+#define fseek fseeko64
+#define ftell ftello64
+#endif
+
+/* Amount of output handed to a thread at a time. */
+#define RS_MT_PIECE     (4 << 20)
+
+/* Size of each thread's IO buffer. */
+#define RS_MT_BUF_LEN   (1 << 20)
+
+
+typedef struct rs_mt_patch {
+    rs_dindex_t         *index;
+    int                 basis_fd, delta_fd, new_fd;
+    rs_long_t           delta_base, new_base;
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t     lock;
+#endif
+    rs_long_t           next_piece;
+    rs_result           result;
+} rs_mt_patch_t;
+
+
+static rs_result rs_mt_copy(int from, rs_long_t from_pos, int to,
+                            rs_long_t to_pos, rs_long_t len, char *buf)
+{
+    ssize_t     n;
+    size_t      got, done;
+
+    while (len) {
+        n = pread(from, buf, len < RS_MT_BUF_LEN ? len : RS_MT_BUF_LEN,
+                  from_pos);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            rs_error("read failed: %s", strerror(errno));
+            return RS_IO_ERROR;
+        } else if (n == 0) {
+            rs_error("unexpected eof at " PRINTF_FORMAT_U64,
+                     PRINTF_CAST_U64(from_pos));
+            return RS_INPUT_ENDED;
+        }
+        got = n;
+        for (done = 0; done < got; done += n) {
+            n = pwrite(to, buf + done, got - done, to_pos + done);
+            if (n < 0 && errno == EINTR) {
+                n = 0;
+                continue;
+            }
+            if (n <= 0) {
+                rs_error("write failed: %s", strerror(errno));
+                return RS_IO_ERROR;
+            }
+        }
+        from_pos += got;
+        to_pos += got;
+        len -= got;
+    }
+    return RS_DONE;
+}
+
+
+/* Produce output bytes [START, END). */
+static rs_result rs_mt_piece(rs_mt_patch_t *mt, rs_long_t start,
+                             rs_long_t end, char *buf)
+{
+    rs_dindex_t const   *index = mt->index;
+    rs_dcmd_t const     *cmd;
+    size_t              i;
+    rs_long_t           from, to, skip;
+    rs_result           result;
+
+    for (i = rs_dindex_find(index, start); i < index->count; i++) {
+        cmd = &index->cmds[i];
+        if (cmd->out_pos >= end)
+            break;
+        from = cmd->out_pos > start ? cmd->out_pos : start;
+        to = cmd->out_pos + cmd->len < end ? cmd->out_pos + cmd->len : end;
+        skip = from - cmd->out_pos;
+        if (cmd->kind == RS_KIND_COPY)
+            result = rs_mt_copy(mt->basis_fd, cmd->src + skip, mt->new_fd,
+                                mt->new_base + from, to - from, buf);
+        else
+            result = rs_mt_copy(mt->delta_fd, mt->delta_base + cmd->src + skip,
+                                mt->new_fd, mt->new_base + from, to - from,
+                                buf);
+        if (result != RS_DONE)
+            return result;
+    }
+    return RS_DONE;
+}
+
+
+static void *rs_mt_worker(void *arg)
+{
+    rs_mt_patch_t       *mt = (rs_mt_patch_t *) arg;
+    char                *buf = rs_alloc(RS_MT_BUF_LEN, "patch buffer");
+    rs_long_t           start;
+    rs_result           result;
+
+    for (;;) {
+#ifdef HAVE_PTHREAD
+        pthread_mutex_lock(&mt->lock);
+#endif
+        start = mt->next_piece;
+        mt->next_piece += RS_MT_PIECE;
+        if (mt->result != RS_DONE)
+            start = mt->index->out_len;
+#ifdef HAVE_PTHREAD
+        pthread_mutex_unlock(&mt->lock);
+#endif
+        if (start >= mt->index->out_len)
+            break;
+
+        result = rs_mt_piece(mt, start, start + RS_MT_PIECE, buf);
+        if (result != RS_DONE) {
+#ifdef HAVE_PTHREAD
+            pthread_mutex_lock(&mt->lock);
+#endif
+            if (mt->result == RS_DONE)
+                mt->result = result;
+#ifdef HAVE_PTHREAD
+            pthread_mutex_unlock(&mt->lock);
+#endif
+            break;
+        }
+    }
+
+    rs_free(buf);
+    return NULL;
+}
+
+
+static rs_result rs_mt_run(rs_mt_patch_t *mt, int nthreads)
+{
+#ifdef HAVE_PTHREAD
+    pthread_t   *threads = NULL;
+    int         i, started = 0;
+
+    if (nthreads <= 0)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    /* The worker always locks, even when it's the only one. */
+    pthread_mutex_init(&mt->lock, NULL);
+    if (nthreads > 1) {
+        threads = rs_alloc(nthreads * sizeof *threads, "patch threads");
+        for (started = 0; started < nthreads; started++)
+            if (pthread_create(&threads[started], NULL, rs_mt_worker, mt))
+                break;
+        rs_trace("started %d patch threads", started);
+    }
+    /* With one thread, or if none could be started, do the work here. */
+    if (!started)
+        rs_mt_worker(mt);
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    rs_free(threads);
+    pthread_mutex_destroy(&mt->lock);
+#else
+    rs_mt_worker(mt);
+#endif
+    return mt->result;
+}
+
+
+rs_result rs_patch_file_mt(FILE *basis_file, FILE *delta_file,
+                           FILE *new_file, int nthreads, rs_stats_t *stats)
+{
+    rs_mt_patch_t       mt;
+    rs_dindex_t         index;
+    rs_job_t            *job;
+    rs_result           r;
+    rs_long_t           start = rs_clock_ns();
+
+#ifndef HAVE_PTHREAD
+    /* One thread of pread() and pwrite() gains nothing over the usual
+     * way. */
+    rs_trace("threads aren't available; patching sequentially");
+    return rs_patch_file(basis_file, delta_file, new_file, stats);
+#endif
+    rs_bzero(&mt, sizeof mt);
+    rs_bzero(&index, sizeof index);
+    mt.index = &index;
+    mt.result = RS_DONE;
+    mt.basis_fd = fileno(basis_file);
+    mt.delta_fd = fileno(delta_file);
+    mt.new_fd = fileno(new_file);
+
+    /* Everything is read and written at known offsets, so all the
+     * files must be seekable; if not, patch the usual way. */
+    if (fflush(new_file)
+        || (mt.delta_base = ftell(delta_file)) < 0
+        || (mt.new_base = lseek(mt.new_fd, 0, SEEK_CUR)) < 0
+        || lseek(mt.basis_fd, 0, SEEK_CUR) < 0) {
+        rs_trace("files aren't seekable; patching sequentially");
+        return rs_patch_file(basis_file, delta_file, new_file, stats);
+    }
+
+    job = rs_dindex_begin(&index);
+    r = rs_whole_run(job, delta_file, NULL);
+    if (stats) {
+        memcpy(stats, &job->stats, sizeof *stats);
+        stats->op = "patch";
+        stats->in_bytes = index.delta_len;
+        stats->out_bytes = index.out_len;
+    }
+    rs_job_free(job);
+
+    if (r == RS_DONE)
+        r = rs_mt_run(&mt, nthreads);
+
+    if (r == RS_DONE
+        && lseek(mt.new_fd, mt.new_base + index.out_len, SEEK_SET) < 0) {
+        rs_error("seek failed: %s", strerror(errno));
+        r = RS_IO_ERROR;
+    }
+    if (stats) {
+        stats->end = time(NULL);
+        stats->elapsed_ns = rs_clock_ns() - start;
+    }
+
+    rs_dindex_free(&index);
+    return r;
+}
@@ -41,6 +41,8 @@
 #include "prototab.h"
 #include "stream.h"
 #include "job.h"
+#include "dindex.h"
+#include "events.h"
 
 
 
@@ -50,6 +52,8 @@ static rs_result rs_patch_s_run(rs_job_t *);
 static rs_result rs_patch_s_literal(rs_job_t *);
 static rs_result rs_patch_s_copy(rs_job_t *);
 static rs_result rs_patch_s_copying(rs_job_t *);
+static rs_result rs_patch_s_copy_direct(rs_job_t *);
+static void rs_patch_prefetch(rs_job_t *);
 
 
 /**
@@ -61,6 +65,9 @@ static rs_result rs_patch_s_cmdbyte(rs_job_t *job)
 {
     rs_result result;
 
+    if (job->prefetch_cb)
+        rs_patch_prefetch(job);
+
     if ((result = rs_suck_byte(job, &job->op)) != RS_DONE)
         return result;
 
@@ -121,6 +128,15 @@ static rs_result rs_patch_s_run(rs_job_t *job)
 {
     rs_trace("running command 0x%x, kind %d", job->op, job->cmd->kind);
 
+    if (job->prefetch_cmds) {
+        /* This command has been scanned already; move the prefetcher's
+         * origin past it. */
+        job->prefetch_cmds--;
+        job->prefetch_next -= 1 + job->cmd->len_1 + job->cmd->len_2;
+        if (job->cmd->kind == RS_KIND_LITERAL)
+            job->prefetch_next -= job->param1;
+    }
+
     switch (job->cmd->kind) {
     case RS_KIND_LITERAL:
         job->statefn = rs_patch_s_literal;
@@ -158,6 +174,10 @@ static rs_result rs_patch_s_literal(rs_job_t *job)
     job->stats.lit_cmds++;
     job->stats.lit_bytes    += len;
     job->stats.lit_cmdbytes += 1 + job->cmd->len_1;
+    rs_job_event(job, RS_EVENT_LITERAL, 0, 0, len);
+
+    if (job->dindex)
+        rs_dindex_add(job->dindex, RS_KIND_LITERAL, -1, len);
 
     rs_tube_copy(job, len);
 
@@ -195,8 +215,48 @@ static rs_result rs_patch_s_copy(rs_job_t *job)
     stats->copy_cmds++;
     stats->copy_bytes += len;
     stats->copy_cmdbytes += 1 + job->cmd->len_1 + job->cmd->len_2;
+    rs_job_event(job, RS_EVENT_COPY, 0, where, len);
 
-    job->statefn = rs_patch_s_copying;
+    if (job->dindex && len)
+        rs_dindex_add(job->dindex, RS_KIND_COPY, where, len);
+
+    if (job->direct_copy_cb)
+        job->statefn = rs_patch_s_copy_direct;
+    else
+        job->statefn = rs_patch_s_copying;
+    return RS_RUNNING;
+}
+
+
+/**
+ * Called when executing a COPY command and the driver has offered to
+ * write the data to the output itself.  Whatever it doesn't manage to
+ * copy is done through the buffers by rs_patch_s_copying().
+ */
+static rs_result rs_patch_s_copy_direct(rs_job_t *job)
+{
+    rs_result       result;
+    rs_long_t       len = job->basis_len;
+    rs_long_t       start = rs_clock_ns();
+
+    result = (job->direct_copy_cb)(job, job->direct_copy_arg,
+                                   job->basis_pos, &len);
+    job->stats.basis_wait_ns += rs_clock_ns() - start;
+    if (result != RS_DONE)
+        return result;
+    job->stats.copy_direct_bytes += len;
+
+    rs_trace("copied " PRINTF_FORMAT_U64 " bytes directly from basis at offset "
+             PRINTF_FORMAT_U64 "", PRINTF_CAST_U64(len),
+             PRINTF_CAST_U64(job->basis_pos));
+
+    job->basis_pos += len;
+    job->basis_len -= len;
+
+    if (job->basis_len)
+        job->statefn = rs_patch_s_copying;
+    else
+        job->statefn = rs_patch_s_cmdbyte;
     return RS_RUNNING;
 }
 
@@ -211,6 +271,7 @@ static rs_result rs_patch_s_copying(rs_job_t *job)
     size_t          desired_len, len;
     void            *ptr;
     rs_buffers_t    *buffs = job->stream;
+    rs_long_t       start;
 
     /* copy only as much as will fit in the output buffer, so that we
      * don't have to block or store the input. */
@@ -224,7 +285,9 @@ static rs_result rs_patch_s_copying(rs_job_t *job)
 
     ptr = buffs->next_out;
 
+    start = rs_clock_ns();
     result = (job->copy_cb)(job->copy_arg, job->basis_pos, &len, &ptr);
+    job->stats.basis_wait_ns += rs_clock_ns() - start;
     if (result != RS_DONE)
         return result;
     else
@@ -256,6 +319,83 @@ static rs_result rs_patch_s_copying(rs_job_t *job)
 }
 
 
+/*
+ * Get the LEN-byte network integer at OFFSET from the current read
+ * position, without consuming anything.  Returns 0 if that much input
+ * hasn't arrived yet.
+ */
+static int rs_patch_peek(rs_job_t *job, rs_long_t offset, int len,
+                         rs_long_t *v)
+{
+    rs_buffers_t    *stream = job->stream;
+    rs_long_t       pos;
+    int             i;
+
+    if (offset + len > (rs_long_t) (job->scoop_avail + stream->avail_in))
+        return 0;
+
+    *v = 0;
+    for (i = 0; i < len; i++) {
+        pos = offset + i;
+        if (pos < (rs_long_t) job->scoop_avail)
+            *v = (*v << 8) | job->scoop_next[pos];
+        else
+            *v = (*v << 8) | ((rs_byte_t *) stream->next_in)[pos - job->scoop_avail];
+    }
+    return 1;
+}
+
+
+/*
+ * Parse ahead in whatever delta input is buffered, and tell the
+ * prefetch callback about COPY commands it hasn't seen yet.  Called at
+ * the start of each command, so offsets are relative to that.
+ */
+static void rs_patch_prefetch(rs_job_t *job)
+{
+    rs_long_t       off, param1, param2;
+    rs_long_t       op;
+    const struct rs_prototab_ent *cmd;
+    rs_result       result;
+
+    while (job->prefetch_cmds <= job->prefetch_depth) {
+        off = job->prefetch_next;
+        if (!rs_patch_peek(job, off, 1, &op))
+            return;
+        cmd = &rs_prototab[op];
+
+        param1 = cmd->immediate;
+        param2 = 0;
+        if (cmd->len_1 && !rs_patch_peek(job, off + 1, cmd->len_1, &param1))
+            return;
+        if (cmd->len_2 && !rs_patch_peek(job, off + 1 + cmd->len_1,
+                                         cmd->len_2, &param2))
+            return;
+        off += 1 + cmd->len_1 + cmd->len_2;
+
+        if (cmd->kind == RS_KIND_COPY) {
+            if (param1 >= 0 && param2 > 0) {
+                result = (job->prefetch_cb)(job->prefetch_arg, param1, param2);
+                if (result != RS_DONE) {
+                    rs_trace("prefetch callback returned %s, turning it off",
+                             rs_strerror(result));
+                    job->prefetch_cb = NULL;
+                    return;
+                }
+            }
+        } else if (cmd->kind == RS_KIND_LITERAL && param1 >= 0) {
+            off += param1;
+        } else {
+            /* END, or something the patch job will complain about. */
+            return;
+        }
+
+        job->prefetch_next = off;
+        job->prefetch_cmds++;
+    }
+}
+
+
 /**
  * Called while we're trying to read the header of the patch.
  */
@@ -276,6 +416,7 @@ static rs_result rs_patch_s_header(rs_job_t *job)
     } else
         rs_trace("got patch magic %#x", v);
 
+    rs_mdfour_begin(&job->output_md4);
 
     job->statefn = rs_patch_s_cmdbyte;
 
@@ -286,12 +427,27 @@ static rs_result rs_patch_s_header(rs_job_t *job)
 rs_job_t *
 rs_patch_begin(rs_copy_cb *copy_cb, void *copy_arg)
 {
-    rs_job_t *job = rs_job_new("patch", rs_patch_s_header);
+    return rs_patch_begin_ctx(NULL, copy_cb, copy_arg);
+}
+
+
+rs_job_t *
+rs_patch_begin_ctx(rs_context_t const *ctx, rs_copy_cb *copy_cb,
+                   void *copy_arg)
+{
+    rs_job_t *job = rs_job_new_ctx(ctx, "patch", rs_patch_s_header);
 
     job->copy_cb = copy_cb;
     job->copy_arg = copy_arg;
 
-    rs_mdfour_begin(&job->output_md4);
-
     return job;
 }
+
+
+void rs_patch_set_prefetch(rs_job_t *job, int depth,
+                           rs_prefetch_cb *prefetch_cb, void *opaque)
+{
+    job->prefetch_depth = depth;
+    job->prefetch_cb = depth > 0 ? prefetch_cb : NULL;
+    job->prefetch_arg = opaque;
+}
@@ -0,0 +1,372 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*
+ * Pipelined whole-file IO.
+ *
+ * Each direction is a ring of buffers with two counters: how many
+ * buffers have been produced into it and how many consumed from it.
+ * For input the reader thread produces and the job consumes; for
+ * output the job produces and the writer thread consumes.  The job
+ * keeps hold of one buffer at a time, which for input is released the
+ * next time it needs data, so nothing is copied between threads.
+ *
+ * One lock and condition variable cover both rings, since they're
+ * only touched once per buffer.
+ *
+ * When the job is finished the reader is told to stop.  If it is in
+ * the middle of reading a pipe that never ends, rs_pipeline_finish()
+ * waits for that read to return.
+ */
+
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "librsync.h"
+#include "util.h"
+#include "trace.h"
+#include "job.h"
+#include "pipeline.h"
+
+
+#ifdef HAVE_PTHREAD
+
+typedef struct rs_pipe_ring {
+    FILE                *f;
+    char                **bufs;
+    size_t              *lens;
+    size_t              buf_len;
+    unsigned            nbufs;
+    unsigned            produced, consumed;
+    int                 held;           /**< The job holds an input
+                                         * buffer. */
+    int                 stop;
+    rs_result           result;         /**< IO error seen by the thread. */
+    int                 started;
+    pthread_t           thread;
+} rs_pipe_ring_t;
+
+
+struct rs_pipeline {
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    rs_pipe_ring_t      in, out;
+};
+
+
+static void *rs_pipeline_reader(void *arg)
+{
+    rs_pipeline_t       *pl = (rs_pipeline_t *) arg;
+    rs_pipe_ring_t      *r = &pl->in;
+    unsigned            slot;
+    size_t              len;
+
+    pthread_mutex_lock(&pl->lock);
+    for (;;) {
+        while (!r->stop && r->produced - r->consumed == r->nbufs)
+            pthread_cond_wait(&pl->cond, &pl->lock);
+        if (r->stop)
+            break;
+        slot = r->produced % r->nbufs;
+        pthread_mutex_unlock(&pl->lock);
+
+        len = fread(r->bufs[slot], 1, r->buf_len, r->f);
+
+        pthread_mutex_lock(&pl->lock);
+        if (!len && ferror(r->f)) {
+            rs_error("error filling buf from file: %s", strerror(errno));
+            r->result = RS_IO_ERROR;
+        }
+        r->lens[slot] = len;
+        r->produced++;
+        pthread_cond_broadcast(&pl->cond);
+        if (!len)
+            break;
+    }
+    pthread_mutex_unlock(&pl->lock);
+    return NULL;
+}
+
+
+static void *rs_pipeline_writer(void *arg)
+{
+    rs_pipeline_t       *pl = (rs_pipeline_t *) arg;
+    rs_pipe_ring_t      *r = &pl->out;
+    unsigned            slot;
+    int                 ok;
+
+    pthread_mutex_lock(&pl->lock);
+    for (;;) {
+        while (!r->stop && r->consumed == r->produced)
+            pthread_cond_wait(&pl->cond, &pl->lock);
+        if (r->consumed == r->produced)
+            break;
+        slot = r->consumed % r->nbufs;
+        /* After an error, keep taking buffers so the job isn't left
+         * waiting for one, but don't write them. */
+        ok = r->result == RS_DONE;
+        pthread_mutex_unlock(&pl->lock);
+
+        if (ok && fwrite(r->bufs[slot], 1, r->lens[slot], r->f)
+            != r->lens[slot]) {
+            rs_error("error draining buf to file: %s", strerror(errno));
+            ok = 0;
+        }
+
+        pthread_mutex_lock(&pl->lock);
+        if (!ok)
+            r->result = RS_IO_ERROR;
+        r->consumed++;
+        pthread_cond_broadcast(&pl->cond);
+    }
+    pthread_mutex_unlock(&pl->lock);
+    return NULL;
+}
+
+
+static void rs_pipe_ring_init(rs_pipe_ring_t *r, FILE *f, size_t buf_len,
+                              unsigned nbufs)
+{
+    unsigned    i;
+
+    r->f = f;
+    r->result = RS_DONE;
+    if (!f)
+        return;
+    r->buf_len = buf_len;
+    r->nbufs = nbufs;
+    r->bufs = rs_alloc(nbufs * sizeof *r->bufs, "pipeline buffers");
+    r->lens = rs_alloc(nbufs * sizeof *r->lens, "pipeline buffers");
+    for (i = 0; i < nbufs; i++)
+        r->bufs[i] = rs_alloc(buf_len, "pipeline buffer");
+}
+
+
+static void rs_pipe_ring_free(rs_pipe_ring_t *r)
+{
+    unsigned    i;
+
+    for (i = 0; i < r->nbufs; i++)
+        rs_free(r->bufs[i]);
+    rs_free(r->bufs);
+    rs_free(r->lens);
+}
+
+
+/**
+ * Start threads to read \p in_file and write \p out_file, either of
+ * which may be NULL.  Returns NULL if the threads can't be started.
+ */
+rs_pipeline_t *rs_pipeline_new(FILE *in_file, size_t in_buf_len,
+                               FILE *out_file, size_t out_buf_len,
+                               int nbufs)
+{
+    rs_pipeline_t       *pl = rs_alloc_struct(rs_pipeline_t);
+
+    /* The job holds one buffer, so there must be another to fill. */
+    if (nbufs < 2)
+        nbufs = 2;
+    pthread_mutex_init(&pl->lock, NULL);
+    pthread_cond_init(&pl->cond, NULL);
+    rs_pipe_ring_init(&pl->in, in_file, in_buf_len, nbufs);
+    rs_pipe_ring_init(&pl->out, out_file, out_buf_len, nbufs);
+
+    if (in_file) {
+        if (pthread_create(&pl->in.thread, NULL, rs_pipeline_reader, pl))
+            goto fail;
+        pl->in.started = 1;
+    }
+    if (out_file) {
+        if (pthread_create(&pl->out.thread, NULL, rs_pipeline_writer, pl))
+            goto fail;
+        pl->out.started = 1;
+    }
+    return pl;
+
+  fail:
+    rs_trace("can't start IO thread: %s", strerror(errno));
+    rs_pipeline_finish(pl);
+    rs_pipeline_free(pl);
+    return NULL;
+}
+
+
+/**
+ * ::rs_driven_cb that gives the job the next buffer from the reader,
+ * once it has used up the last one.
+ */
+rs_result rs_pipeline_fill(rs_job_t *job, rs_buffers_t *buf, void *opaque)
+{
+    rs_pipeline_t       *pl = (rs_pipeline_t *) opaque;
+    rs_pipe_ring_t      *r = &pl->in;
+    unsigned            slot;
+    size_t              len;
+    rs_result           result;
+
+    if (buf->eof_in || buf->avail_in)
+        return RS_DONE;
+
+    pthread_mutex_lock(&pl->lock);
+    if (r->held) {
+        r->consumed++;
+        r->held = 0;
+        pthread_cond_broadcast(&pl->cond);
+    }
+    while (r->produced == r->consumed)
+        pthread_cond_wait(&pl->cond, &pl->lock);
+    slot = r->consumed % r->nbufs;
+    len = r->lens[slot];
+    result = r->result;
+    r->held = 1;
+    pthread_mutex_unlock(&pl->lock);
+
+    if (!len) {
+        if (result != RS_DONE)
+            return result;
+        rs_trace("seen end of file on input");
+        buf->eof_in = 1;
+        return RS_DONE;
+    }
+    buf->next_in = r->bufs[slot];
+    buf->avail_in = len;
+
+    job->stats.in_bytes += len;
+
+    return RS_DONE;
+}
+
+
+/**
+ * ::rs_driven_cb that passes any output to the writer and gives the
+ * job an empty buffer.
+ */
+rs_result rs_pipeline_drain(rs_job_t *job, rs_buffers_t *buf, void *opaque)
+{
+    rs_pipeline_t       *pl = (rs_pipeline_t *) opaque;
+    rs_pipe_ring_t      *r = &pl->out;
+    unsigned            slot = r->produced % r->nbufs;
+    size_t              present;
+    rs_result           result;
+
+    if (buf->next_out != NULL) {
+        assert(buf->next_out >= r->bufs[slot]);
+        assert(buf->next_out <= r->bufs[slot] + r->buf_len);
+
+        present = buf->next_out - r->bufs[slot];
+        if (!present)
+            return RS_DONE;
+        job->stats.out_bytes += present;
+
+        pthread_mutex_lock(&pl->lock);
+        r->lens[slot] = present;
+        r->produced++;
+        pthread_cond_broadcast(&pl->cond);
+        pthread_mutex_unlock(&pl->lock);
+    }
+
+    pthread_mutex_lock(&pl->lock);
+    while (r->produced - r->consumed == r->nbufs)
+        pthread_cond_wait(&pl->cond, &pl->lock);
+    slot = r->produced % r->nbufs;
+    result = r->result;
+    pthread_mutex_unlock(&pl->lock);
+
+    buf->next_out = r->bufs[slot];
+    buf->avail_out = r->buf_len;
+    return result;
+}
+
+
+/**
+ * Stop the reader, wait for the writer to write out everything it's
+ * been given, and return any error from writing.
+ */
+rs_result rs_pipeline_finish(rs_pipeline_t *pl)
+{
+    pthread_mutex_lock(&pl->lock);
+    pl->in.stop = pl->out.stop = 1;
+    pthread_cond_broadcast(&pl->cond);
+    pthread_mutex_unlock(&pl->lock);
+
+    if (pl->in.started)
+        pthread_join(pl->in.thread, NULL);
+    if (pl->out.started)
+        pthread_join(pl->out.thread, NULL);
+    pl->in.started = pl->out.started = 0;
+
+    return pl->out.result;
+}
+
+
+void rs_pipeline_free(rs_pipeline_t *pl)
+{
+    rs_pipe_ring_free(&pl->in);
+    rs_pipe_ring_free(&pl->out);
+    pthread_cond_destroy(&pl->cond);
+    pthread_mutex_destroy(&pl->lock);
+    rs_free(pl);
+}
+
+#else /* !HAVE_PTHREAD */
+
+rs_pipeline_t *rs_pipeline_new(FILE *UNUSED(in_file),
+                               size_t UNUSED(in_buf_len),
+                               FILE *UNUSED(out_file),
+                               size_t UNUSED(out_buf_len),
+                               int UNUSED(nbufs))
+{
+    return NULL;
+}
+
+
+rs_result rs_pipeline_fill(rs_job_t *UNUSED(job), rs_buffers_t *UNUSED(buf),
+                           void *UNUSED(opaque))
+{
+    return RS_UNIMPLEMENTED;
+}
+
+
+rs_result rs_pipeline_drain(rs_job_t *UNUSED(job), rs_buffers_t *UNUSED(buf),
+                            void *UNUSED(opaque))
+{
+    return RS_UNIMPLEMENTED;
+}
+
+
+rs_result rs_pipeline_finish(rs_pipeline_t *UNUSED(pl))
+{
+    return RS_UNIMPLEMENTED;
+}
+
+
+void rs_pipeline_free(rs_pipeline_t *UNUSED(pl))
+{
+}
+
+#endif /* !HAVE_PTHREAD */
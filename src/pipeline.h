@@ -0,0 +1,46 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/**
+ * \file pipeline.h
+ * Whole-file IO in background threads.
+ *
+ * A reader thread keeps a ring of input buffers filled from one FILE
+ * and a writer thread empties a ring of output buffers into another,
+ * while the job runs in the calling thread.  Buffers are handed over
+ * by pointer, never copied.
+ */
+
+/** Default number of buffers in each ring. */
+#define RS_PIPELINE_BUFS 4
+
+typedef struct rs_pipeline rs_pipeline_t;
+
+rs_pipeline_t *rs_pipeline_new(FILE *in_file, size_t in_buf_len,
+                               FILE *out_file, size_t out_buf_len,
+                               int nbufs);
+
+rs_result rs_pipeline_fill(rs_job_t *job, rs_buffers_t *buf, void *opaque);
+
+rs_result rs_pipeline_drain(rs_job_t *job, rs_buffers_t *buf, void *opaque);
+
+rs_result rs_pipeline_finish(rs_pipeline_t *pl);
+
+void rs_pipeline_free(rs_pipeline_t *pl);
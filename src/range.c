@@ -0,0 +1,276 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*
+ * Random access to the output of a delta.
+ *
+ * A delta index gives the output offset of every command, so any
+ * range of the new file can be rebuilt by finding the commands that
+ * cover it and reading just those parts of the basis and the delta.
+ *
+ * An index can be saved and loaded again so that a delta only has to
+ * be scanned once.  The saved form is the magic number
+ * RS_DELTA_INDEX_MAGIC, then the new file length, delta length and
+ * command count, then for each command a kind byte (0 for COPY, 1 for
+ * LITERAL) followed by its source offset and length.  All numbers are
+ * 8 bytes in network order.
+ */
+
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "librsync.h"
+#include "util.h"
+#include "trace.h"
+#include "command.h"
+#include "job.h"
+#include "whole.h"
+#include "dindex.h"
+
+/* Bytes in a saved command. */
+#define RS_DINDEX_CMD_LEN       17
+
+/* Bytes in the header. */
+#define RS_DINDEX_HEADER_LEN    28
+
+
+static void rs_put_n8(unsigned char *p, rs_long_t v)
+{
+    int i;
+
+    for (i = 7; i >= 0; i--) {
+        p[i] = (unsigned char) v;
+        v >>= 8;
+    }
+}
+
+
+static rs_long_t rs_get_n8(unsigned char const *p)
+{
+    rs_long_t   v = 0;
+    int         i;
+
+    for (i = 0; i < 8; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+
+/* Fill BUF with LEN bytes from CB at POS. */
+static rs_result rs_range_read(rs_copy_cb *cb, void *arg, rs_long_t pos,
+                               size_t len, char *buf)
+{
+    size_t      got;
+    void        *p;
+    rs_result   result;
+
+    while (len) {
+        got = len;
+        p = buf;
+        if ((result = cb(arg, pos, &got, &p)) != RS_DONE)
+            return result;
+        if (!got || got > len) {
+            rs_error("copy callback returned " PRINTF_FORMAT_U64
+                     " bytes at " PRINTF_FORMAT_U64,
+                     PRINTF_CAST_U64(got), PRINTF_CAST_U64(pos));
+            return RS_IO_ERROR;
+        }
+        if (p != buf)
+            memcpy(buf, p, got);
+        buf += got;
+        pos += got;
+        len -= got;
+    }
+    return RS_DONE;
+}
+
+
+rs_result rs_patch_range(rs_delta_index_t const *index, rs_long_t pos,
+                         size_t *len, void *buf,
+                         rs_copy_cb *basis_cb, void *basis_arg,
+                         rs_copy_cb *delta_cb, void *delta_arg)
+{
+    rs_dcmd_t const     *cmd;
+    rs_long_t           end, from, to;
+    size_t              i;
+    char                *out = buf;
+    rs_result           result;
+
+    if (pos < 0)
+        return RS_PARAM_ERROR;
+    if (pos >= index->out_len) {
+        *len = 0;
+        return RS_DONE;
+    }
+    if ((rs_long_t) *len > index->out_len - pos)
+        *len = index->out_len - pos;
+    end = pos + *len;
+
+    for (i = rs_dindex_find(index, pos); i < index->count; i++) {
+        cmd = &index->cmds[i];
+        if (cmd->out_pos >= end)
+            break;
+        from = cmd->out_pos > pos ? cmd->out_pos : pos;
+        to = cmd->out_pos + cmd->len < end ? cmd->out_pos + cmd->len : end;
+        if (cmd->kind == RS_KIND_COPY)
+            result = rs_range_read(basis_cb, basis_arg,
+                                   cmd->src + (from - cmd->out_pos),
+                                   to - from, out + (from - pos));
+        else
+            result = rs_range_read(delta_cb, delta_arg,
+                                   cmd->src + (from - cmd->out_pos),
+                                   to - from, out + (from - pos));
+        if (result != RS_DONE)
+            return result;
+    }
+    return RS_DONE;
+}
+
+
+rs_long_t rs_delta_index_len(rs_delta_index_t const *index)
+{
+    return index->out_len;
+}
+
+
+void rs_free_delta_index(rs_delta_index_t *index)
+{
+    if (index) {
+        rs_dindex_free(index);
+        rs_free(index);
+    }
+}
+
+
+rs_result rs_delta_index_file(FILE *delta_file, rs_delta_index_t **index,
+                              rs_stats_t *stats)
+{
+    rs_job_t    *job;
+    rs_result   r;
+
+    *index = rs_alloc_struct(rs_delta_index_t);
+    job = rs_dindex_begin(*index);
+    r = rs_whole_run(job, delta_file, NULL);
+    if (stats)
+        memcpy(stats, &job->stats, sizeof *stats);
+    rs_job_free(job);
+
+    if (r != RS_DONE) {
+        rs_free_delta_index(*index);
+        *index = NULL;
+    }
+    return r;
+}
+
+
+rs_result rs_delta_index_save(rs_delta_index_t const *index, FILE *f)
+{
+    unsigned char       buf[RS_DINDEX_HEADER_LEN];
+    rs_dcmd_t const     *cmd;
+    size_t              i;
+
+    buf[0] = (RS_DELTA_INDEX_MAGIC >> 24) & 0xff;
+    buf[1] = (RS_DELTA_INDEX_MAGIC >> 16) & 0xff;
+    buf[2] = (RS_DELTA_INDEX_MAGIC >> 8) & 0xff;
+    buf[3] = RS_DELTA_INDEX_MAGIC & 0xff;
+    rs_put_n8(buf + 4, index->out_len);
+    rs_put_n8(buf + 12, index->delta_len);
+    rs_put_n8(buf + 20, index->count);
+    if (fwrite(buf, 1, RS_DINDEX_HEADER_LEN, f) != RS_DINDEX_HEADER_LEN)
+        goto fail;
+
+    for (i = 0; i < index->count; i++) {
+        cmd = &index->cmds[i];
+        buf[0] = cmd->kind == RS_KIND_COPY ? 0 : 1;
+        rs_put_n8(buf + 1, cmd->src);
+        rs_put_n8(buf + 9, cmd->len);
+        if (fwrite(buf, 1, RS_DINDEX_CMD_LEN, f) != RS_DINDEX_CMD_LEN)
+            goto fail;
+    }
+    return RS_DONE;
+
+  fail:
+    rs_error("error writing delta index: %s", strerror(errno));
+    return RS_IO_ERROR;
+}
+
+
+rs_result rs_delta_index_load(FILE *f, rs_delta_index_t **index)
+{
+    unsigned char       buf[RS_DINDEX_HEADER_LEN];
+    rs_delta_index_t    *ix;
+    rs_long_t           out_len, count, src, len, i;
+    int                 magic;
+
+    *index = NULL;
+    if (fread(buf, 1, RS_DINDEX_HEADER_LEN, f) != RS_DINDEX_HEADER_LEN)
+        goto short_read;
+    magic = (int) ((buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3]);
+    if (magic != RS_DELTA_INDEX_MAGIC) {
+        rs_error("got magic number %#x rather than expected value %#x",
+                 magic, RS_DELTA_INDEX_MAGIC);
+        return RS_BAD_MAGIC;
+    }
+
+    ix = rs_alloc_struct(rs_delta_index_t);
+    out_len = rs_get_n8(buf + 4);
+    ix->delta_len = rs_get_n8(buf + 12);
+    count = rs_get_n8(buf + 20);
+    if (out_len < 0 || ix->delta_len < 0 || count < 0)
+        goto corrupt;
+
+    for (i = 0; i < count; i++) {
+        if (fread(buf, 1, RS_DINDEX_CMD_LEN, f) != RS_DINDEX_CMD_LEN) {
+            rs_free_delta_index(ix);
+            goto short_read;
+        }
+        src = rs_get_n8(buf + 1);
+        len = rs_get_n8(buf + 9);
+        if (buf[0] > 1 || src < 0 || len < 0
+            || len > out_len - ix->out_len
+            || (buf[0] == 1 && src + len > ix->delta_len))
+            goto corrupt;
+        rs_dindex_add(ix, buf[0] ? RS_KIND_LITERAL : RS_KIND_COPY, src, len);
+    }
+    if (ix->out_len != out_len)
+        goto corrupt;
+
+    *index = ix;
+    return RS_DONE;
+
+  corrupt:
+    rs_error("delta index is corrupt");
+    rs_free_delta_index(ix);
+    return RS_CORRUPT;
+
+  short_read:
+    if (ferror(f)) {
+        rs_error("error reading delta index: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    rs_error("unexpected end of delta index");
+    return RS_INPUT_ENDED;
+}
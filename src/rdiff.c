@@ -50,6 +50,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <popt.h>
 
@@ -79,6 +80,18 @@ static int show_stats = 0;
 static int bzip2_level = 0;
 static int gzip_level  = 0;
 static int file_force  = 0;
+static int async_io    = 0;
+static int stdio_io    = 0;
+static int patch_threads = 1;
+static int in_place    = 0;
+static int use_cdc     = 0;
+static int sig_levels  = 0;
+static char *journal_name = NULL;
+static char *reverse_name = NULL;
+static char *range_arg = NULL;
+static char *index_name = NULL;
+static char *batch_name = NULL;
+static char *events_name = NULL;
 
 enum {
     OPT_GZIP = 1069, OPT_BZIP2
@@ -92,7 +105,22 @@ const struct poptOption opts[] = {
     { "version",     'V', POPT_ARG_NONE, 0,             'V' },
     { "input-size",  'I', POPT_ARG_INT,  &rs_inbuflen },
     { "output-size", 'O', POPT_ARG_INT,  &rs_outbuflen },
+    { "lookahead",    0,  POPT_ARG_INT,  &rs_patch_lookahead },
+    { "async",        0,  POPT_ARG_NONE, &async_io },
+    { "stdio",        0,  POPT_ARG_NONE, &stdio_io },
+    { "threads",      0,  POPT_ARG_INT,  &patch_threads },
+    { "pipeline",     0,  POPT_ARG_NONE, &rs_whole_pipeline },
+    { "in-place",     0,  POPT_ARG_NONE, &in_place },
+    { "journal",      0,  POPT_ARG_STRING, &journal_name },
+    { "reverse",      0,  POPT_ARG_STRING, &reverse_name },
+    { "range",        0,  POPT_ARG_STRING, &range_arg },
+    { "index",        0,  POPT_ARG_STRING, &index_name },
+    { "batch",        0,  POPT_ARG_STRING, &batch_name },
+    { "events",       0,  POPT_ARG_STRING, &events_name },
     { "hash",        'H', POPT_ARG_STRING, &rs_hash_name },
+    { "cdc",          0,  POPT_ARG_NONE, &use_cdc },
+    { "levels",       0,  POPT_ARG_INT,  &sig_levels },
+    { "level-factor", 0,  POPT_ARG_INT,  &rs_sig_level_factor },
     { "help",        '?', POPT_ARG_NONE, 0,             'h' },
     {  0,            'h', POPT_ARG_NONE, 0,             'h' },
     { "block-size",  'b', POPT_ARG_INT,  &block_len },
@@ -136,6 +164,11 @@ static void help(void) {
     printf("Usage: rdiff [OPTIONS] signature [BASIS [SIGNATURE]]\n"
            "             [OPTIONS] delta SIGNATURE [NEWFILE [DELTA]]\n"
            "             [OPTIONS] patch BASIS [DELTA [NEWFILE]]\n"
+           "             [OPTIONS] --in-place patch BASIS [DELTA]\n"
+           "             [OPTIONS] compose DELTA1 DELTA2 [DELTA]\n"
+           "             [OPTIONS] index DELTA [INDEX]\n"
+           "             [OPTIONS] inspect SIGNATURE\n"
+           "             [OPTIONS] --batch=TASKS\n"
            "\n"
            "Options:\n"
            "  -v, --verbose             Trace internal processing\n"
@@ -143,8 +176,14 @@ static void help(void) {
            "  -?, --help                Show this help message\n"
            "  -s, --statistics          Show performance statistics\n"
            "  -f, --force               Force overwriting existing files\n"
+           "      --events=FILE         Write a Chrome trace of the jobs to FILE\n"
            "Signature generation options:\n"
            "  -H, --hash=ALG            Hash algorithm: blake2 (default), md4\n"
+           "      --cdc                 Split into content-defined chunks averaging\n"
+           "                            the block size\n"
+           "      --levels=N            Also store sums for N coarser block sizes\n"
+           "      --level-factor=F      Make each level's blocks F times longer\n"
+           "                            (default 32)\n"
            "Delta-encoding options:\n"
            "  -b, --block-size=BYTES    Signature block size\n"
            "  -S, --sum-size=BYTES      Set signature strength\n"
@@ -152,6 +191,22 @@ static void help(void) {
            "IO options:\n"
            "  -I, --input-size=BYTES    Input buffer size\n"
            "  -O, --output-size=BYTES   Output buffer size\n"
+           "      --lookahead=CMDS      Commands to read ahead when patching\n"
+           "      --async               Patch with asynchronous IO (io_uring)\n"
+           "      --stdio               Patch through stdio, without in-kernel\n"
+           "                            copies\n"
+           "      --threads=N           Patch or run --batch with N threads\n"
+           "                            (0 for one per CPU)\n"
+           "      --pipeline            Read and write in background threads\n"
+           "Patch options:\n"
+           "      --in-place            Overwrite BASIS rather than writing NEWFILE\n"
+           "      --journal=FILE        Make --in-place resumable using FILE\n"
+           "      --reverse=FILE        Also write a delta from NEWFILE to BASIS\n"
+           "      --range=OFFSET,LENGTH Write only part of NEWFILE\n"
+           "      --index=FILE          Use a delta index saved by `rdiff index'\n"
+           "Batch options:\n"
+           "      --batch=TASKS         Run the signature, delta and patch commands\n"
+           "                            listed one per line in TASKS\n"
            "  -z, --gzip[=LEVEL]        gzip-compress deltas\n"
            "  -i, --bzip2[=LEVEL]       bzip2-compress deltas\n"
            );
@@ -237,22 +292,23 @@ static void rdiff_options(poptContext opcon)
 
 
 /**
- * Generate signature from remaining command line arguments.
+ * Choose the signature format from the --hash option.
  */
-static rs_result rdiff_sig(poptContext opcon)
+static rs_result rdiff_sig_magic(rs_magic_number *sig_magic)
 {
-    FILE            *basis_file, *sig_file;
-    rs_stats_t      stats;
-    rs_result       result;
-    rs_long_t       sig_magic;
-
-    basis_file = rs_file_open(poptGetArg(opcon), "rb", file_force);
-    sig_file = rs_file_open(poptGetArg(opcon), "wb", file_force);
-
-    rdiff_no_more_args(opcon);
-
-    if (!rs_hash_name || !strcmp(rs_hash_name, "blake2")) {
-        sig_magic = RS_BLAKE2_SIG_MAGIC;
+    if (use_cdc && sig_levels) {
+        rs_error("content-defined chunks can't have levels");
+        return RS_PARAM_ERROR;
+    } else if (!rs_hash_name || !strcmp(rs_hash_name, "blake2")) {
+        *sig_magic = use_cdc ? RS_CDC_BLAKE2_SIG_MAGIC : RS_BLAKE2_SIG_MAGIC;
+        if (sig_levels) {
+            *sig_magic = RS_MULTI_BLAKE2_SIG_MAGIC;
+            rs_sig_levels = sig_levels;
+        }
+    } else if (use_cdc || sig_levels) {
+        rs_error("%s are only supported with blake2",
+                 use_cdc ? "content-defined chunks" : "signature levels");
+        return RS_PARAM_ERROR;
     } else if (!strcmp(rs_hash_name, "md4")) {
         /* By default, for compatibility with rdiff 0.9.8 and before, mdfour
          * sums are truncated to only 8 bytes, making them even weaker, but
@@ -260,11 +316,32 @@ static rs_result rdiff_sig(poptContext opcon)
          */
         if (!strong_len)
             strong_len = 8;
-        sig_magic = RS_MD4_SIG_MAGIC;
+        *sig_magic = RS_MD4_SIG_MAGIC;
     } else {
         rs_error("unknown hash algorithm %s", rs_hash_name);
         return RS_PARAM_ERROR;
     }
+    return RS_DONE;
+}
+
+
+/**
+ * Generate signature from remaining command line arguments.
+ */
+static rs_result rdiff_sig(poptContext opcon)
+{
+    FILE            *basis_file, *sig_file;
+    rs_stats_t      stats;
+    rs_result       result;
+    rs_magic_number sig_magic;
+
+    basis_file = rs_file_open(poptGetArg(opcon), "rb", file_force);
+    sig_file = rs_file_open(poptGetArg(opcon), "wb", file_force);
+
+    rdiff_no_more_args(opcon);
+
+    if ((result = rdiff_sig_magic(&sig_magic)) != RS_DONE)
+        return result;
 
     result = rs_sig_file(basis_file, sig_file, block_len, strong_len,
                          sig_magic, &stats);
@@ -317,10 +394,8 @@ static rs_result rdiff_delta(poptContext opcon)
     rs_file_close(new_file);
     rs_file_close(sig_file);
 
-    if (show_stats) {
-        rs_signature_log_stats(sumset);
+    if (show_stats)
         rs_log_stats(&stats);
-    }
 
     rs_free_sumset(sumset);
 
@@ -329,10 +404,114 @@ static rs_result rdiff_delta(poptContext opcon)
 
 
 
+static rs_result rdiff_patch_range(poptContext opcon, char const *basis_name)
+{
+    /*  --range=OFFSET,LENGTH patch BASIS DELTA [NEWFILE] */
+    FILE               *basis_file, *delta_file, *new_file, *index_file;
+    char const         *delta_name;
+    rs_delta_index_t   *index;
+    rs_long_t           pos, end;
+    char               *p, buf[65536];
+    size_t              len;
+    rs_stats_t          stats;
+    rs_result           result;
+
+    pos = strtoll(range_arg, &p, 0);
+    if (*p != ',' || pos < 0) {
+        rdiff_usage("rdiff: --range takes OFFSET,LENGTH");
+        return RS_SYNTAX_ERROR;
+    }
+    end = pos + strtoll(p + 1, &p, 0);
+    if (*p || end < pos) {
+        rdiff_usage("rdiff: --range takes OFFSET,LENGTH");
+        return RS_SYNTAX_ERROR;
+    }
+    if (!(delta_name = poptGetArg(opcon))) {
+        rdiff_usage("Usage for patch with --range: "
+                    "rdiff [OPTIONS] --range=OFFSET,LENGTH patch BASIS DELTA [NEW]");
+        return RS_SYNTAX_ERROR;
+    }
+
+    basis_file = rs_file_open(basis_name, "rb", file_force);
+    delta_file = rs_file_open(delta_name, "rb", file_force);
+    new_file =   rs_file_open(poptGetArg(opcon), "wb", file_force);
+
+    rdiff_no_more_args(opcon);
+
+    rs_bzero(&stats, sizeof stats);
+    if (index_name) {
+        index_file = rs_file_open(index_name, "rb", file_force);
+        result = rs_delta_index_load(index_file, &index);
+        rs_file_close(index_file);
+    } else
+        result = rs_delta_index_file(delta_file, &index, &stats);
+
+    while (result == RS_DONE && pos < end) {
+        len = end - pos < (rs_long_t) sizeof buf ? end - pos : sizeof buf;
+        result = rs_patch_range(index, pos, &len, buf,
+                                rs_file_copy_cb, basis_file,
+                                rs_file_copy_cb, delta_file);
+        if (result != RS_DONE || !len)
+            break;
+        if (fwrite(buf, 1, len, new_file) != len) {
+            rs_error("error writing output: %s", strerror(errno));
+            result = RS_IO_ERROR;
+        }
+        pos += len;
+    }
+    rs_free_delta_index(index);
+
+    rs_file_close(new_file);
+    rs_file_close(delta_file);
+    rs_file_close(basis_file);
+
+    if (show_stats)
+        rs_log_stats(&stats);
+
+    return result;
+}
+
+
+static rs_result rdiff_index(poptContext opcon)
+{
+    /*  index DELTA [INDEX] */
+    FILE            *delta_file, *index_file;
+    char const      *delta_name;
+    rs_delta_index_t *index;
+    rs_stats_t      stats;
+    rs_result       result;
+
+    if (!(delta_name = poptGetArg(opcon))) {
+        rdiff_usage("Usage for index: "
+                    "rdiff [OPTIONS] index DELTA [INDEX]");
+        return RS_SYNTAX_ERROR;
+    }
+
+    delta_file = rs_file_open(delta_name, "rb", file_force);
+    index_file = rs_file_open(poptGetArg(opcon), "wb", file_force);
+
+    rdiff_no_more_args(opcon);
+
+    result = rs_delta_index_file(delta_file, &index, &stats);
+    if (result == RS_DONE) {
+        result = rs_delta_index_save(index, index_file);
+        rs_free_delta_index(index);
+    }
+
+    rs_file_close(index_file);
+    rs_file_close(delta_file);
+
+    if (show_stats)
+        rs_log_stats(&stats);
+
+    return result;
+}
+
+
 static rs_result rdiff_patch(poptContext opcon)
 {
     /*  patch BASIS [DELTA [NEWFILE]] */
-    FILE               *basis_file, *delta_file, *new_file;
+    FILE               *basis_file, *delta_file, *new_file, *reverse_file;
     char const         *basis_name;
     rs_stats_t          stats;
     rs_result           result;
@@ -343,13 +522,54 @@ static rs_result rdiff_patch(poptContext opcon)
         return RS_SYNTAX_ERROR;
     }
 
+    if (patch_threads != 1
+        && (async_io || in_place || reverse_name || range_arg)) {
+        rs_error("--threads can't be combined with --%s",
+                 async_io ? "async" : in_place ? "in-place"
+                 : reverse_name ? "reverse" : "range");
+        return RS_PARAM_ERROR;
+    }
+
+    if (range_arg)
+        return rdiff_patch_range(opcon, basis_name);
+
+    if (in_place) {
+        delta_file = rs_file_open(poptGetArg(opcon), "rb", file_force);
+
+        rdiff_no_more_args(opcon);
+
+        result = rs_patch_inplace(basis_name, delta_file, journal_name,
+                                  &stats);
+
+        rs_file_close(delta_file);
+
+        if (show_stats)
+            rs_log_stats(&stats);
+
+        return result;
+    }
+
     basis_file = rs_file_open(basis_name, "rb", file_force);
     delta_file = rs_file_open(poptGetArg(opcon), "rb", file_force);
     new_file =   rs_file_open(poptGetArg(opcon), "wb", file_force);
 
     rdiff_no_more_args(opcon);
 
-    result = rs_patch_file(basis_file, delta_file, new_file, &stats);
+    if (reverse_name) {
+        reverse_file = rs_file_open(reverse_name, "wb", file_force);
+        result = rs_patch_file_reverse(basis_file, delta_file, new_file,
+                                       reverse_file, &stats);
+        rs_file_close(reverse_file);
+    } else if (patch_threads != 1)
+        result = rs_patch_file_mt(basis_file, delta_file, new_file,
+                                  patch_threads, &stats);
+    else if (async_io)
+        result = rs_patch_file_async(basis_file, delta_file, new_file, &stats);
+    else if (rs_whole_pipeline || stdio_io)
+        result = rs_patch_file(basis_file, delta_file, new_file, &stats);
+    else
+        result = rs_patch_fd(fileno(basis_file), fileno(delta_file),
+                             fileno(new_file), &stats);
 
     rs_file_close(new_file);
     rs_file_close(delta_file);
@@ -363,6 +583,196 @@ static rs_result rdiff_patch(poptContext opcon)
 
 
 
+static rs_result rdiff_compose(poptContext opcon)
+{
+    FILE            *first_file, *second_file, *delta_file;
+    char const      *first_name;
+    rs_result       result;
+    rs_stats_t      stats;
+
+    if (!(first_name = poptGetArg(opcon))) {
+        rdiff_usage("Usage for compose: "
+                    "rdiff [OPTIONS] compose DELTA1 DELTA2 [DELTA]");
+        return RS_SYNTAX_ERROR;
+    }
+
+    first_file = rs_file_open(first_name, "rb", file_force);
+    second_file = rs_file_open(poptGetArg(opcon), "rb", file_force);
+    delta_file = rs_file_open(poptGetArg(opcon), "wb", file_force);
+
+    rdiff_no_more_args(opcon);
+
+    result = rs_delta_compose(first_file, second_file, delta_file, &stats);
+
+    rs_file_close(delta_file);
+    rs_file_close(second_file);
+    rs_file_close(first_file);
+
+    if (show_stats)
+        rs_log_stats(&stats);
+
+    return result;
+}
+
+
+static void rdiff_print_hist(char const *name, rs_long_t const *hist,
+                             char const *sep)
+{
+    int i;
+
+    printf("  \"%s\": [", name);
+    for (i = 0; i < RS_PROBE_HIST_LEN; i++)
+        printf("%s" PRINTF_FORMAT_U64, i ? ", " : "", PRINTF_CAST_U64(hist[i]));
+    printf("]%s\n", sep);
+}
+
+
+/**
+ * Print the hashtable diagnostics for a signature as JSON.
+ */
+static rs_result rdiff_inspect(poptContext opcon)
+{
+    /*  inspect SIGNATURE */
+    FILE                 *sig_file;
+    char const           *sig_name;
+    rs_signature_t       *sumset;
+    rs_signature_stats_t  sig_stats;
+    rs_stats_t            stats;
+    rs_result             result;
+
+    if (!(sig_name = poptGetArg(opcon))) {
+        rdiff_usage("Usage for inspect: "
+                    "rdiff [OPTIONS] inspect SIGNATURE");
+        return RS_SYNTAX_ERROR;
+    }
+
+    sig_file = rs_file_open(sig_name, "rb", file_force);
+
+    rdiff_no_more_args(opcon);
+
+    result = rs_loadsig_file(sig_file, &sumset, &stats);
+    rs_file_close(sig_file);
+    if (result != RS_DONE)
+        return result;
+
+    if (show_stats)
+        rs_log_stats(&stats);
+
+    if ((result = rs_build_hash_table(sumset)) == RS_DONE
+        && (result = rs_signature_get_stats(sumset, &sig_stats)) == RS_DONE) {
+        printf("{\n"
+               "  \"magic\": %u,\n"
+               "  \"block_len\": %d,\n"
+               "  \"strong_sum_len\": %d,\n"
+               "  \"blocks\": " PRINTF_FORMAT_U64 ",\n"
+               "  \"distinct_weak_sums\": " PRINTF_FORMAT_U64 ",\n"
+               "  \"duplicate_blocks\": " PRINTF_FORMAT_U64 ",\n"
+               "  \"weak_collisions\": " PRINTF_FORMAT_U64 ",\n"
+               "  \"false_weak_matches\": " PRINTF_FORMAT_U64 ",\n"
+               "  \"table_size\": " PRINTF_FORMAT_U64 ",\n"
+               "  \"load\": %.4f,\n",
+               (unsigned) sig_stats.magic, sig_stats.block_len,
+               sig_stats.strong_sum_len,
+               PRINTF_CAST_U64(sig_stats.block_count),
+               PRINTF_CAST_U64(sig_stats.distinct_weak_sums),
+               PRINTF_CAST_U64(sig_stats.duplicate_blocks),
+               PRINTF_CAST_U64(sig_stats.weak_collisions),
+               PRINTF_CAST_U64(sig_stats.false_weak_matches),
+               PRINTF_CAST_U64(sig_stats.table_size), sig_stats.load);
+        rdiff_print_hist("build_probes", sig_stats.build_probes, ",");
+        rdiff_print_hist("hit_probes", sig_stats.hit_probes, ",");
+        rdiff_print_hist("miss_probes", sig_stats.miss_probes, "");
+        printf("}\n");
+    }
+
+    rs_free_sumset(sumset);
+
+    return result;
+}
+
+
+/**
+ * Run the commands listed in the --batch file, each line being an
+ * action and its files as they'd be given on the command line.
+ */
+static rs_result rdiff_batch(poptContext opcon)
+{
+    FILE            *tasks_file;
+    rs_batch_t      *batch;
+    rs_magic_number sig_magic;
+    rs_stats_t      stats;
+    rs_result       result;
+    char            line[4 * 4096];
+    char            *action, *names[4];
+    rs_batch_op     op;
+    int             *lines = NULL;
+    int             i, lineno = 0, task, ntasks = 0, nlines = 0;
+
+    rdiff_no_more_args(opcon);
+
+    if ((result = rdiff_sig_magic(&sig_magic)) != RS_DONE)
+        return result;
+
+    tasks_file = rs_file_open(batch_name, "rb", file_force);
+    batch = rs_batch_new(patch_threads, block_len, strong_len, sig_magic);
+
+    while (fgets(line, sizeof line, tasks_file)) {
+        lineno++;
+        if (!strchr(line, '\n') && !feof(tasks_file)) {
+            rs_error("%s:%d: line too long", batch_name, lineno);
+            result = RS_SYNTAX_ERROR;
+            break;
+        }
+        action = strtok(line, " \t\r\n");
+        if (!action || *action == '#')
+            continue;
+        for (i = 0; i < 4; i++)
+            names[i] = strtok(NULL, " \t\r\n");
+
+        if (isprefix(action, "signature"))
+            op = RS_BATCH_SIGNATURE;
+        else if (isprefix(action, "delta"))
+            op = RS_BATCH_DELTA;
+        else if (isprefix(action, "patch"))
+            op = RS_BATCH_PATCH;
+        else {
+            rs_error("%s:%d: unknown action `%s'", batch_name, lineno,
+                     action);
+            result = RS_SYNTAX_ERROR;
+            break;
+        }
+        if (names[3] || (op == RS_BATCH_SIGNATURE && names[2])
+            || (task = rs_batch_add(batch, op, names[0], names[1],
+                                    names[2])) < 0) {
+            rs_error("%s:%d: wrong number of files", batch_name, lineno);
+            result = RS_SYNTAX_ERROR;
+            break;
+        }
+        if (task >= nlines) {
+            nlines = nlines ? 2 * nlines : 256;
+            lines = rs_realloc(lines, nlines * sizeof *lines, "line numbers");
+        }
+        lines[task] = lineno;
+        ntasks = task + 1;
+    }
+    rs_file_close(tasks_file);
+
+    if (result == RS_DONE) {
+        result = rs_batch_run(batch, &stats);
+        for (i = 0; i < ntasks; i++)
+            if (rs_batch_result(batch, i) != RS_DONE)
+                rs_error("%s:%d: %s", batch_name, lines[i],
+                         rs_strerror(rs_batch_result(batch, i)));
+        if (show_stats)
+            rs_log_stats(&stats);
+    }
+
+    rs_free(lines);
+    rs_batch_free(batch);
+    return result;
+}
+
+
 static rs_result rdiff_action(poptContext opcon)
 {
     const char      *action;
@@ -376,8 +786,15 @@ static rs_result rdiff_action(poptContext opcon)
         return rdiff_delta(opcon);
     else if (isprefix(action, "patch"))
         return rdiff_patch(opcon);
-
-    rdiff_usage("rdiff: You must specify an action: `signature', `delta', or `patch'.");
+    else if (isprefix(action, "compose"))
+        return rdiff_compose(opcon);
+    else if (isprefix(action, "index"))
+        return rdiff_index(opcon);
+    else if (isprefix(action, "inspect"))
+        return rdiff_inspect(opcon);
+
+    rdiff_usage("rdiff: You must specify an action: `signature', `delta', "
+                "`patch', `compose', `index' or `inspect'.");
     return RS_SYNTAX_ERROR;
 }
 
@@ -386,10 +803,25 @@ int main(const int argc, const char *argv[])
 {
     poptContext     opcon;
     rs_result       result;
+    FILE            *events_file = NULL;
 
     opcon = poptGetContext(PROGRAM, argc, argv, opts, 0);
     rdiff_options(opcon);
-    result = rdiff_action(opcon);
+    if (events_name) {
+        events_file = rs_file_open(events_name, "wb", file_force);
+        rs_job_event_log = rs_event_log_new(1 << 20);
+    }
+    if (batch_name)
+        result = rdiff_batch(opcon);
+    else
+        result = rdiff_action(opcon);
+
+    if (events_file) {
+        if (rs_event_log_write_json(rs_job_event_log, events_file) != RS_DONE)
+            rs_error("couldn't write events to %s", events_name);
+        rs_file_close(events_file);
+        rs_event_log_free(rs_job_event_log);
+    }
 
     if (result != RS_DONE)
         rs_log(RS_LOG_ERR|RS_LOG_NONAME, "%s", rs_strerror(result));
@@ -44,6 +44,8 @@
 
 static rs_result rs_loadsig_s_weak(rs_job_t *job);
 static rs_result rs_loadsig_s_strong(rs_job_t *job);
+static rs_result rs_loadsig_s_chunklen(rs_job_t *job);
+static rs_result rs_loadsig_s_levels(rs_job_t *job);
 
 /**
  * Add a just-read-in checksum pair to the signature block.
@@ -57,7 +59,16 @@ static rs_result rs_loadsig_add_sum(rs_job_t *job, rs_strong_sum_t *strong)
         rs_hexify(hexbuf, strong, sig->strong_sum_len);
         rs_trace("got block: weak=%#x, strong=%s", job->weak_sig, hexbuf);
     }
-    rs_signature_add_block(job->signature, job->weak_sig, strong);
+    if (rs_signature_is_cdc(sig)) {
+        rs_signature_add_chunk(sig, job->chunk_len, job->weak_sig, strong);
+    } else if (rs_signature_is_multi(sig)) {
+        rs_signature_add_block(rs_signature_level(sig, job->sig_level),
+                               job->weak_sig, strong);
+        job->sig_level = rs_signature_next_sum(sig, job->sig_level,
+                                               &job->sig_pos);
+    } else {
+        rs_signature_add_block(sig, job->weak_sig, strong);
+    }
     job->stats.sig_blocks++;
     return RS_RUNNING;
 }
@@ -69,7 +80,8 @@ static rs_result rs_loadsig_s_weak(rs_job_t *job)
     rs_result           result;
 
     if ((result = rs_suck_n4(job, &l)) != RS_DONE) {
-        if (result == RS_INPUT_ENDED)   /* ending here is OK */
+        /* ending here is OK, unless it's after a chunk length */
+        if (result == RS_INPUT_ENDED && !rs_signature_is_cdc(job->signature))
             return RS_DONE;
         return result;
     }
@@ -86,11 +98,32 @@ static rs_result rs_loadsig_s_strong(rs_job_t *job)
 
     if ((result = rs_scoop_read(job, job->signature->strong_sum_len, (void **)&strongsum)) != RS_DONE)
         return result;
-    job->statefn = rs_loadsig_s_weak;
+    job->statefn = rs_signature_is_cdc(job->signature)
+        ? rs_loadsig_s_chunklen : rs_loadsig_s_weak;
     return rs_loadsig_add_sum(job, strongsum);
 }
 
 
+static rs_result rs_loadsig_s_chunklen(rs_job_t *job)
+{
+    int                 l;
+    rs_result           result;
+
+    if ((result = rs_suck_n4(job, &l)) != RS_DONE) {
+        if (result == RS_INPUT_ENDED)   /* ending here is OK */
+            return RS_DONE;
+        return result;
+    }
+    if (l < 1 || (size_t) l > job->signature->cdc.max) {
+        rs_error("chunk length %d is bogus", l);
+        return RS_CORRUPT;
+    }
+    job->chunk_len = l;
+    job->statefn = rs_loadsig_s_weak;
+    return RS_RUNNING;
+}
+
+
 
 static rs_result rs_loadsig_s_stronglen(rs_job_t *job)
 {
@@ -110,7 +143,48 @@ static rs_result rs_loadsig_s_stronglen(rs_job_t *job)
 				    job->sig_block_len, job->sig_strong_len,
 				    job->sig_fsize)) != RS_DONE)
         return result;
-    job->statefn = rs_loadsig_s_weak;
+    if (rs_signature_is_cdc(job->signature))
+        job->statefn = rs_loadsig_s_chunklen;
+    else if (rs_signature_is_multi(job->signature))
+        job->statefn = rs_loadsig_s_levels;
+    else
+        job->statefn = rs_loadsig_s_weak;
+    return RS_RUNNING;
+}
+
+
+static rs_result rs_loadsig_s_levellen(rs_job_t *job)
+{
+    int                 l;
+    rs_result           result;
+
+    if ((result = rs_suck_n4(job, &l)) != RS_DONE)
+        return result;
+    if (rs_signature_add_level(job->signature, l) != RS_DONE)
+        return RS_CORRUPT;
+    rs_trace("got level block length %d", l);
+    if (rs_signature_levels(job->signature) == job->sig_levels) {
+        job->sig_level = job->sig_levels;
+        job->sig_pos = 0;
+        job->statefn = rs_loadsig_s_weak;
+    }
+    return RS_RUNNING;
+}
+
+
+static rs_result rs_loadsig_s_levels(rs_job_t *job)
+{
+    int                 l;
+    rs_result           result;
+
+    if ((result = rs_suck_n4(job, &l)) != RS_DONE)
+        return result;
+    if (l < 1 || l > RS_MAX_SIG_LEVELS) {
+        rs_error("%d signature levels is bogus", l);
+        return RS_CORRUPT;
+    }
+    job->sig_levels = l;
+    job->statefn = rs_loadsig_s_levellen;
     return RS_RUNNING;
 }
 
@@ -149,10 +223,19 @@ static rs_result rs_loadsig_s_magic(rs_job_t *job)
 
 
 rs_job_t *rs_loadsig_begin(rs_signature_t **signature)
+{
+    return rs_loadsig_begin_ctx(NULL, signature);
+}
+
+
+rs_job_t *rs_loadsig_begin_ctx(rs_context_t const *ctx,
+                               rs_signature_t **signature)
 {
     rs_job_t *job;
 
-    job = rs_job_new("loadsig", rs_loadsig_s_magic);
+    job = rs_job_new_ctx(ctx, "loadsig", rs_loadsig_s_magic);
     *signature = job->signature = rs_alloc_struct(rs_signature_t);
+    /* Each run hands a new signature to the caller. */
+    job->start_fn = NULL;
     return job;
 }
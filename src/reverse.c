@@ -0,0 +1,258 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*
+ * Reverse deltas.
+ *
+ * While patching, every COPY says that a range of the basis now also
+ * exists at a known offset in the new file.  The patch job records
+ * these, and afterwards the reverse job walks through the basis in
+ * order: ranges that were copied become COPYs from the new file, and
+ * the rest, which the new file doesn't contain, is read from the basis
+ * and sent as literal data.  No signature or delta search is needed.
+ */
+
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "librsync.h"
+#include "util.h"
+#include "trace.h"
+#include "command.h"
+#include "emit.h"
+#include "stream.h"
+#include "job.h"
+#include "whole.h"
+#include "dindex.h"
+
+/* use fseeko instead of fseek for long file support if we have it */
+#ifdef HAVE_FSEEKO
+#define fseek fseeko
+#define ftell ftello
+#elif defined HAVE_FSEEKO64
+#define fseek fseeko64
+#define ftell ftello64
+#endif
+
+/* Longest LITERAL command emitted at once. */
+#define RS_REVERSE_MAX_LITERAL  (1 << 30)
+
+
+typedef struct rs_reverse {
+    /** COPY commands run by the patch, sorted by basis offset. */
+    rs_dcmd_t           *copies;
+    size_t              ncopies;
+
+    /** Next copy not yet considered, and the one reaching furthest
+     * into the basis of those already considered. */
+    size_t              next;
+    rs_dcmd_t const     *best;
+
+    rs_long_t           basis_len;
+    rs_long_t           pos;    /**< How much of the basis is done. */
+
+    /** COPY from the new file that has not been emitted yet. */
+    rs_long_t           copy_pos, copy_len;
+} rs_reverse_t;
+
+
+static rs_result rs_reverse_s_next(rs_job_t *);
+static rs_result rs_reverse_s_literal(rs_job_t *);
+
+
+static int rs_reverse_src_cmp(const void *a, const void *b)
+{
+    rs_dcmd_t const *x = a, *y = b;
+
+    if (x->src != y->src)
+        return x->src < y->src ? -1 : 1;
+    return 0;
+}
+
+
+static int rs_reverse_flush(rs_job_t *job)
+{
+    rs_reverse_t *rv = job->reverse;
+
+    if (!rv->copy_len)
+        return 0;
+    rs_emit_copy_cmd(job, rv->copy_pos, rv->copy_len);
+    rv->copy_len = 0;
+    return 1;
+}
+
+
+/*
+ * Work out what the next part of the basis looks like in terms of the
+ * new file.
+ */
+static rs_result rs_reverse_s_next(rs_job_t *job)
+{
+    rs_reverse_t        *rv = job->reverse;
+    rs_dcmd_t const     *c;
+    rs_long_t           end, where, len;
+
+    while (rv->pos < rv->basis_len) {
+        while (rv->next < rv->ncopies
+               && rv->copies[rv->next].src <= rv->pos) {
+            c = &rv->copies[rv->next++];
+            if (!rv->best || c->src + c->len > rv->best->src + rv->best->len)
+                rv->best = c;
+        }
+
+        if (rv->best && rv->best->src + rv->best->len > rv->pos) {
+            end = rv->best->src + rv->best->len;
+            if (end > rv->basis_len)
+                end = rv->basis_len;
+            where = rv->best->out_pos + rv->pos - rv->best->src;
+            len = end - rv->pos;
+            rv->pos = end;
+            if (rv->copy_len && rv->copy_pos + rv->copy_len == where) {
+                rv->copy_len += len;
+            } else {
+                int flushed = rs_reverse_flush(job);
+
+                rv->copy_pos = where;
+                rv->copy_len = len;
+                if (flushed)
+                    return RS_RUNNING;
+            }
+        } else {
+            if (rs_reverse_flush(job))
+                return RS_RUNNING;
+            end = rv->next < rv->ncopies ? rv->copies[rv->next].src
+                : rv->basis_len;
+            if (end > rv->basis_len)
+                end = rv->basis_len;
+            len = end - rv->pos;
+            if (len > RS_REVERSE_MAX_LITERAL)
+                len = RS_REVERSE_MAX_LITERAL;
+            rs_emit_literal_cmd(job, len);
+            job->basis_pos = rv->pos;
+            job->basis_len = len;
+            rv->pos += len;
+            job->statefn = rs_reverse_s_literal;
+            return RS_RUNNING;
+        }
+    }
+
+    if (rs_reverse_flush(job))
+        return RS_RUNNING;
+    rs_emit_end_cmd(job);
+    return RS_DONE;
+}
+
+
+/* Copy basis data that isn't in the new file into the output. */
+static rs_result rs_reverse_s_literal(rs_job_t *job)
+{
+    rs_buffers_t    *buffs = job->stream;
+    rs_result       result;
+    size_t          desired_len, len;
+    void            *ptr;
+
+    desired_len = len = (buffs->avail_out < job->basis_len) ?
+        buffs->avail_out : job->basis_len;
+    if (!len)
+        return RS_BLOCKED;
+
+    ptr = buffs->next_out;
+    result = (job->copy_cb)(job->copy_arg, job->basis_pos, &len, &ptr);
+    if (result != RS_DONE)
+        return result;
+    if (len > desired_len)
+        len = desired_len;
+    if (ptr != buffs->next_out)
+        memcpy(buffs->next_out, ptr, len);
+
+    buffs->next_out += len;
+    buffs->avail_out -= len;
+    job->basis_pos += len;
+    job->basis_len -= len;
+
+    if (!job->basis_len)
+        job->statefn = rs_reverse_s_next;
+    return RS_RUNNING;
+}
+
+
+static rs_result rs_reverse_s_header(rs_job_t *job)
+{
+    rs_emit_delta_header(job);
+    job->statefn = rs_reverse_s_next;
+    return RS_RUNNING;
+}
+
+
+rs_result rs_patch_file_reverse(FILE *basis_file, FILE *delta_file,
+                                FILE *new_file, FILE *reverse_file,
+                                rs_stats_t *stats)
+{
+    rs_job_t            *job;
+    rs_result           r;
+    rs_dindex_t         map;
+    rs_reverse_t        rv;
+    size_t              i;
+
+    rs_bzero(&map, sizeof map);
+    rs_bzero(&rv, sizeof rv);
+
+    job = rs_patch_begin(rs_file_copy_cb, basis_file);
+    job->dindex = &map;
+    r = rs_whole_run(job, delta_file, new_file);
+    if (stats)
+        memcpy(stats, &job->stats, sizeof *stats);
+    rs_job_free(job);
+    if (r != RS_DONE)
+        goto out;
+
+    if (fseek(basis_file, 0, SEEK_END)
+        || (rv.basis_len = ftell(basis_file)) < 0) {
+        rs_error("can't find length of basis: %s", strerror(errno));
+        r = RS_IO_ERROR;
+        goto out;
+    }
+
+    /* Only the COPYs matter now; keep them in basis order. */
+    rv.copies = map.cmds;
+    for (i = 0; i < map.count; i++)
+        if (map.cmds[i].kind == RS_KIND_COPY)
+            rv.copies[rv.ncopies++] = map.cmds[i];
+    qsort(rv.copies, rv.ncopies, sizeof *rv.copies, rs_reverse_src_cmp);
+
+    job = rs_job_new("reverse", rs_reverse_s_header);
+    job->copy_cb = rs_file_copy_cb;
+    job->copy_arg = basis_file;
+    job->reverse = &rv;
+    r = rs_whole_run(job, NULL, reverse_file);
+    rs_trace("reverse delta has " PRINTF_FORMAT_U64 " bytes of literal data",
+             PRINTF_CAST_U64(job->stats.lit_bytes));
+    rs_job_free(job);
+
+  out:
+    rs_dindex_free(&map);
+    return r;
+}
@@ -40,6 +40,15 @@
  *
  * As a future optimization, we might try to take data directly from the
  * input buffer if there's already enough there.
+ *
+ * Where the system allows, large scoops are kept in a mirrored ring
+ * buffer: the same memory is mapped twice, one copy after the other,
+ * so data that wraps around the end of the buffer can still be read as
+ * one contiguous block and never has to be moved down to the front.
+ * Setting one up costs a memfd and three mappings, and bypasses the
+ * context's allocator, so only scoops of at least RS_SCOOP_MIRROR_BUFS
+ * input buffers get one.  The rest are plain allocations, where moving
+ * the data is cheap next to reading it in.
  */
 
 /*
@@ -64,14 +73,75 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #include "librsync.h"
 #include "job.h"
 #include "stream.h"
 #include "trace.h"
+#include "context.h"
 #include "util.h"
 
 
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_SYS_MMAN_H)
+#define RS_SCOOP_MIRROR 1
+#endif
+
+/** Scoops of at least this many input buffers are mirrored. */
+#define RS_SCOOP_MIRROR_BUFS 4
+
+
+#ifdef RS_SCOOP_MIRROR
+/*
+ * Map SIZE bytes of memory twice in a row, or return NULL if that
+ * can't be done.  SIZE must be a multiple of the page size.
+ */
+static rs_byte_t *rs_scoop_mirror_new(size_t size)
+{
+    int         fd;
+    rs_byte_t   *base;
+
+    if ((fd = memfd_create("librsync-scoop", MFD_CLOEXEC)) < 0)
+        return NULL;
+    base = NULL;
+    if (ftruncate(fd, size) == 0) {
+        base = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+                    -1, 0);
+        if (base == MAP_FAILED)
+            base = NULL;
+        else if (mmap(base, size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+                 || mmap(base + size, size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            munmap(base, 2 * size);
+            base = NULL;
+        }
+    }
+    close(fd);
+    return base;
+}
+#endif
+
+
+void rs_scoop_free(rs_job_t *job)
+{
+#ifdef RS_SCOOP_MIRROR
+    if (job->scoop_mirror) {
+        munmap(job->scoop_buf, 2 * job->scoop_alloc);
+        job->scoop_buf = NULL;
+        return;
+    }
+#endif
+    rs_ctx_free(job->ctx, job->scoop_buf);
+    job->scoop_buf = NULL;
+}
+
+
 /**
  * Try to accept a from the input buffer to get LEN bytes in the scoop.
  */
@@ -79,26 +149,51 @@ void rs_scoop_input(rs_job_t *job, size_t len)
 {
     rs_buffers_t *stream = job->stream;
     size_t tocopy;
+    size_t newsize;
+    rs_byte_t *newbuf;
+    int mirror = 0;
 
     assert(len > job->scoop_avail);
 
     if (job->scoop_alloc < len) {
         /* need to allocate a new buffer, too */
-        rs_byte_t *newbuf;
-        int newsize = 2 * len;
-        newbuf = rs_alloc(newsize, "scoop buffer");
+        newsize = 2 * len;
+        newbuf = NULL;
+#ifdef RS_SCOOP_MIRROR
+        {
+            size_t page = sysconf(_SC_PAGESIZE);
+
+            if (newsize >= page && newsize >= RS_SCOOP_MIRROR_BUFS
+                * (size_t) rs_ctx_inbuflen(job->ctx)) {
+                newsize = (newsize + page - 1) / page * page;
+                newbuf = rs_scoop_mirror_new(newsize);
+                mirror = newbuf != NULL;
+            }
+        }
+#endif
+        if (newbuf == NULL)
+            newbuf = rs_ctx_alloc(job->ctx, newsize, "scoop buffer");
         if (job->scoop_avail)
             memcpy(newbuf, job->scoop_next, job->scoop_avail);
+        job->stats.scoop_allocs++;
+        job->stats.scoop_moved_bytes += job->scoop_avail;
         if (job->scoop_buf)
-            free(job->scoop_buf);
+            rs_scoop_free(job);
+        job->scoop_mirror = mirror;
         job->scoop_buf = job->scoop_next = newbuf;
         rs_trace("resized scoop buffer to " PRINTF_FORMAT_U64 " bytes from " PRINTF_FORMAT_U64 "",
                  PRINTF_CAST_U64(newsize), PRINTF_CAST_U64(job->scoop_alloc));
         job->scoop_alloc = newsize;
+    } else if (job->scoop_mirror) {
+        /* the data can stay where it is; just bring the pointer back
+         * into the first copy of the buffer. */
+        if (job->scoop_next >= job->scoop_buf + job->scoop_alloc)
+            job->scoop_next -= job->scoop_alloc;
     } else {
         /* this buffer size is fine, but move the existing
          * data down to the front. */
         memmove(job->scoop_buf, job->scoop_next, job->scoop_avail);
+        job->stats.scoop_moved_bytes += job->scoop_avail;
         job->scoop_next = job->scoop_buf;
     }
 
@@ -33,20 +33,11 @@
 #include "librsync.h"
 #include "trace.h"
 
-/*
- * TODO: Other things to show in statistics:
- *
- * Number of input and output bytes.
- *
- * Number of times we blocked waiting for input or output.
- *
- * Number of blocks.
- */
 
 int
 rs_log_stats(rs_stats_t const *stats)
 {
-    char buf[1000];
+    char buf[2000];
 
     rs_format_stats(stats, buf, sizeof buf - 1);
     rs_log(RS_LOG_INFO|RS_LOG_NONAME, "%s", buf);
@@ -61,7 +52,7 @@ rs_format_stats(rs_stats_t const * stats,
 {
     char const *op = stats->op;
     int len, sec;
-    double mbps_in, mbps_out;
+    double secs, mbps_in, mbps_out;
 
     if (!op)
         op = "noop";
@@ -100,14 +91,93 @@ rs_format_stats(rs_stats_t const * stats,
                          PRINTF_CAST_U64(stats->block_len));
     }
 
-    sec = (stats->end - stats->start);
-    if (sec == 0) sec = 1; // avoid division by zero
-    mbps_in = stats->in_bytes / 1e6 / sec;
-    mbps_out = stats->out_bytes / 1e6 / sec;
-    len += snprintf(buf+len, size-len,
-        " speed[%.1f MB (%.1f MB/s) in, %.1f MB (%.1f MB/s) out, %d sec]",
-        (stats->in_bytes/1e6), mbps_in,
-        (stats->out_bytes/1e6), mbps_out, sec);
+    if (stats->inplace_buffered) {
+        len += snprintf(buf+len, size-len,
+                        " in-place[" PRINTF_FORMAT_U64 " bytes buffered]",
+                        PRINTF_CAST_U64(stats->inplace_buffered));
+    }
+
+    if (stats->find_count) {
+        len += snprintf(buf+len, size-len,
+                        " match[" PRINTF_FORMAT_U64 " searches, " PRINTF_FORMAT_U64 " (%.3f%%) matches, "
+                        PRINTF_FORMAT_U64 " (%.3fx) weak sum compares, " PRINTF_FORMAT_U64 " (%.3f%%) strong sum compares, "
+                        PRINTF_FORMAT_U64 " (%.3f%%) strong sum calcs]",
+                        PRINTF_CAST_U64(stats->find_count),
+                        PRINTF_CAST_U64(stats->match_count),
+                        100.0 * (double) stats->match_count / stats->find_count,
+                        PRINTF_CAST_U64(stats->hashcmp_count),
+                        (double) stats->hashcmp_count / stats->find_count,
+                        PRINTF_CAST_U64(stats->entrycmp_count),
+                        100.0 * (double) stats->entrycmp_count / stats->find_count,
+                        PRINTF_CAST_U64(stats->calc_strong_count),
+                        100.0 * (double) stats->calc_strong_count / stats->find_count);
+    }
+
+    if (stats->copy_direct_bytes) {
+        len += snprintf(buf+len, size-len,
+                        " copy-direct[" PRINTF_FORMAT_U64 " bytes]",
+                        PRINTF_CAST_U64(stats->copy_direct_bytes));
+    }
+
+    if (stats->basis_wait_ns) {
+        len += snprintf(buf+len, size-len,
+                        " basis-wait[%.3f sec]",
+                        stats->basis_wait_ns / 1e9);
+    }
+
+    if (stats->in_wait_ns || stats->out_wait_ns || stats->weak_sum_ns
+        || stats->probe_ns || stats->strong_sum_ns || stats->emit_ns) {
+        len += snprintf(buf+len, size-len,
+                        " time[%.3f in-wait, %.3f out-wait, %.3f weak-sum, "
+                        "%.3f probe, %.3f strong-sum, %.3f emit ms]",
+                        stats->in_wait_ns / 1e6, stats->out_wait_ns / 1e6,
+                        stats->weak_sum_ns / 1e6, stats->probe_ns / 1e6,
+                        stats->strong_sum_ns / 1e6, stats->emit_ns / 1e6);
+    }
+
+    if (stats->iter_count) {
+        len += snprintf(buf+len, size-len,
+                        " iter[" PRINTF_FORMAT_U64 " calls, " PRINTF_FORMAT_U64 " blocked on input, "
+                        PRINTF_FORMAT_U64 " on output]",
+                        PRINTF_CAST_U64(stats->iter_count),
+                        PRINTF_CAST_U64(stats->blocked_in_count),
+                        PRINTF_CAST_U64(stats->blocked_out_count));
+    }
+
+    if (stats->tube_catchups) {
+        len += snprintf(buf+len, size-len,
+                        " tube[" PRINTF_FORMAT_U64 " catchups, " PRINTF_FORMAT_U64 " buffered, "
+                        PRINTF_FORMAT_U64 " direct bytes]",
+                        PRINTF_CAST_U64(stats->tube_catchups),
+                        PRINTF_CAST_U64(stats->tube_buffered_bytes),
+                        PRINTF_CAST_U64(stats->tube_direct_bytes));
+    }
+
+    if (stats->scoop_allocs || stats->scoop_moved_bytes) {
+        len += snprintf(buf+len, size-len,
+                        " scoop[" PRINTF_FORMAT_U64 " allocs, " PRINTF_FORMAT_U64 " bytes moved]",
+                        PRINTF_CAST_U64(stats->scoop_allocs),
+                        PRINTF_CAST_U64(stats->scoop_moved_bytes));
+    }
+
+    if (stats->elapsed_ns) {
+        secs = stats->elapsed_ns / 1e9;
+        mbps_in = stats->in_bytes / 1e6 / secs;
+        mbps_out = stats->out_bytes / 1e6 / secs;
+        len += snprintf(buf+len, size-len,
+            " speed[%.1f MB (%.1f MB/s) in, %.1f MB (%.1f MB/s) out, %.3f sec]",
+            (stats->in_bytes/1e6), mbps_in,
+            (stats->out_bytes/1e6), mbps_out, secs);
+    } else {
+        sec = (stats->end - stats->start);
+        if (sec == 0) sec = 1; // avoid division by zero
+        mbps_in = stats->in_bytes / 1e6 / sec;
+        mbps_out = stats->out_bytes / 1e6 / sec;
+        len += snprintf(buf+len, size-len,
+            " speed[%.1f MB (%.1f MB/s) in, %.1f MB (%.1f MB/s) out, %d sec]",
+            (stats->in_bytes/1e6), mbps_in,
+            (stats->out_bytes/1e6), mbps_out, sec);
+    }
 
     return buf;
 }
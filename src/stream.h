@@ -43,3 +43,4 @@ rs_result rs_scoop_read(rs_job_t *, size_t len, void **ptr);
 rs_result rs_scoop_read_rest(rs_job_t *, size_t *len, void **ptr);
 size_t rs_scoop_total_avail(rs_job_t *job);
 void rs_scoop_input(rs_job_t *job, size_t len);
+void rs_scoop_free(rs_job_t *job);
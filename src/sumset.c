@@ -49,16 +49,18 @@ unsigned rs_block_sig_hash(const rs_block_sig_t *sig)
 
 typedef struct rs_block_match {
     rs_block_sig_t block_sig;
-    rs_signature_t *signature;
+    const rs_signature_t *signature;
+    rs_match_stats_t *stats;
     const void *buf;
     size_t len;
 } rs_block_match_t;
 
-void rs_block_match_init(rs_block_match_t *match, rs_signature_t *sig, rs_weak_sum_t weak_sum, const void *buf,
-                         size_t len)
+void rs_block_match_init(rs_block_match_t *match, const rs_signature_t *sig, rs_match_stats_t *stats,
+                         rs_weak_sum_t weak_sum, const void *buf, size_t len)
 {
     match->block_sig.weak_sum = weak_sum;
     match->signature = sig;
+    match->stats = stats;
     match->buf = buf;
     match->len = len;
 }
@@ -67,11 +69,16 @@ int rs_block_match_cmp(rs_block_match_t *match, const rs_block_sig_t *block_sig)
 {
     /* If buf is not NULL, the strong sum is yet to be calculated. */
     if (match->buf) {
-#ifndef HASHTABLE_NSTATS
-        match->signature->calc_strong_count++;
-#endif
+        rs_long_t start = rs_timing_now();
+
         rs_signature_calc_strong_sum(match->signature, match->buf, match->len, &(match->block_sig.strong_sum));
         match->buf = NULL;
+        if (match->stats) {
+#ifndef HASHTABLE_NSTATS
+            match->stats->calc_strong_count++;
+#endif
+            match->stats->strong_sum_ns += rs_timing_now() - start;
+        }
     }
     return memcmp(&match->block_sig.strong_sum, &block_sig->strong_sum, match->signature->strong_sum_len);
 }
@@ -97,16 +104,25 @@ static inline int rs_block_sig_idx(const rs_signature_t *sig, rs_block_sig_t *bl
 rs_result rs_signature_init(rs_signature_t *sig, int magic, int block_len, int strong_len, rs_long_t sig_fsize)
 {
     int max_strong_len;
+    rs_long_t block_size;
 
     /* Check and set default arguments. */
     magic = magic ? magic : RS_BLAKE2_SIG_MAGIC;
     switch (magic) {
     case RS_BLAKE2_SIG_MAGIC:
+    case RS_MULTI_BLAKE2_SIG_MAGIC:
         max_strong_len = RS_BLAKE2_SUM_LENGTH;
         break;
     case RS_MD4_SIG_MAGIC:
         max_strong_len = RS_MD4_SUM_LENGTH;
         break;
+    case RS_CDC_BLAKE2_SIG_MAGIC:
+        max_strong_len = RS_BLAKE2_SUM_LENGTH;
+        if (block_len < RS_CDC_MIN_AVG || RS_CDC_MAX_AVG < block_len) {
+            rs_error("invalid block_len %d for content-defined chunks", block_len);
+            return RS_PARAM_ERROR;
+        }
+        break;
     default:
         rs_error("invalid magic %#x", magic);
         return RS_BAD_MAGIC;
@@ -122,16 +138,22 @@ rs_result rs_signature_init(rs_signature_t *sig, int magic, int block_len, int s
     sig->strong_sum_len = strong_len;
     sig->count = 0;
     /* Calculate the number of blocks if we have the signature file size. */
-    /* Magic+header is 12 bytes, each block thereafter is 4 bytes weak_sum+strong_sum_len bytes */
-    sig->size = (int)(sig_fsize ? (sig_fsize - 12) / (4 + strong_len) : 0);
+    /* Magic+header is 12 bytes, each block thereafter is 4 bytes weak_sum+strong_sum_len bytes,
+     * after 4 bytes of length for content-defined chunks. */
+    block_size = 4 + strong_len + (magic == RS_CDC_BLAKE2_SIG_MAGIC ? 4 : 0);
+    sig->size = (int)(sig_fsize ? (sig_fsize - 12) / block_size : 0);
     if (sig->size)
         sig->block_sigs = rs_alloc(sig->size * rs_block_sig_size(sig), "signature->block_sigs");
     else
         sig->block_sigs = NULL;
     sig->hashtable = NULL;
-#ifndef HASHTABLE_NSTATS
-    sig->calc_strong_count = 0;
-#endif
+    sig->block_offs = NULL;
+    sig->coarse = NULL;
+    if (rs_signature_is_cdc(sig)) {
+        sig->block_offs = rs_alloc((sig->size + 1) * sizeof(rs_long_t), "signature->block_offs");
+        sig->block_offs[0] = 0;
+        rs_cdc_init(&sig->cdc, block_len);
+    }
     rs_signature_check(sig);
     return RS_DONE;
 }
@@ -139,6 +161,10 @@ rs_result rs_signature_init(rs_signature_t *sig, int magic, int block_len, int s
 void rs_signature_done(rs_signature_t *sig)
 {
     hashtable_free(sig->hashtable);
+    rs_free(sig->block_sigs);
+    rs_free(sig->block_offs);
+    if (sig->coarse)
+        rs_free_sumset(sig->coarse);
     rs_bzero(sig, sizeof(*sig));
 }
 
@@ -155,34 +181,174 @@ rs_block_sig_t *rs_signature_add_block(rs_signature_t *sig, rs_weak_sum_t weak_s
     return b;
 }
 
-rs_long_t rs_signature_find_match(rs_signature_t *sig, rs_weak_sum_t weak_sum, void const *buf, size_t len)
+rs_block_sig_t *rs_signature_add_chunk(rs_signature_t *sig, size_t len, rs_weak_sum_t weak_sum,
+                                       rs_strong_sum_t *strong_sum)
+{
+    int size = sig->size;
+    rs_block_sig_t *b;
+
+    assert(rs_signature_is_cdc(sig));
+    b = rs_signature_add_block(sig, weak_sum, strong_sum);
+    /* Grow the offsets along with block_sigs. */
+    if (sig->size != size)
+        sig->block_offs = rs_realloc(sig->block_offs, (sig->size + 1) * sizeof(rs_long_t), "signature->block_offs");
+    sig->block_offs[sig->count] = sig->block_offs[sig->count - 1] + len;
+    return b;
+}
+
+rs_result rs_signature_add_level(rs_signature_t *sig, int block_len)
+{
+    rs_signature_t *last = sig;
+
+    rs_signature_check(sig);
+    assert(rs_signature_is_multi(sig));
+    while (last->coarse)
+        last = last->coarse;
+    if (rs_signature_levels(sig) >= RS_MAX_SIG_LEVELS) {
+        rs_error("more than %d coarser block lengths", RS_MAX_SIG_LEVELS);
+        return RS_PARAM_ERROR;
+    }
+    if (block_len <= last->block_len || block_len % last->block_len) {
+        rs_error("block_len %d isn't a multiple of %d", block_len, last->block_len);
+        return RS_PARAM_ERROR;
+    }
+    last->coarse = rs_alloc_struct(rs_signature_t);
+    return rs_signature_init(last->coarse, sig->magic, block_len, sig->strong_sum_len, 0);
+}
+
+int rs_signature_levels(rs_signature_t const *sig)
+{
+    int n = 0;
+
+    while ((sig = sig->coarse))
+        n++;
+    return n;
+}
+
+rs_signature_t *rs_signature_level(rs_signature_t *sig, int n)
+{
+    while (n--)
+        sig = sig->coarse;
+    return sig;
+}
+
+int rs_signature_next_sum(rs_signature_t const *sig, int level, rs_long_t *pos)
+{
+    rs_signature_t const *s;
+    int l, next = 0;
+
+    if (level > 0)
+        return level - 1;
+    *pos += sig->block_len;
+    /* Each level's block length divides the next's. */
+    for (s = sig->coarse, l = 1; s; s = s->coarse, l++)
+        if (*pos % s->block_len == 0)
+            next = l;
+    return next;
+}
+
+rs_long_t rs_signature_find_match(rs_signature_t const *sig, rs_match_stats_t *stats, rs_weak_sum_t weak_sum,
+                                  void const *buf, size_t len)
 {
     rs_block_match_t m;
     rs_block_sig_t *b;
 
     rs_signature_check(sig);
-    rs_block_match_init(&m, sig, weak_sum, buf, len);
-    if ((b = hashtable_find(sig->hashtable, &m))) {
-        return (rs_long_t)rs_block_sig_idx(sig, b) * sig->block_len;
+    rs_block_match_init(&m, sig, stats, weak_sum, buf, len);
+    if ((b = hashtable_find(sig->hashtable, &m, stats ? &stats->find : NULL))) {
+        int i = rs_block_sig_idx(sig, b);
+
+        if (!sig->block_offs)
+            return (rs_long_t)i * sig->block_len;
+        /* A chunk with the same sums is surely the same length, but a
+         * wrong copy would be worse than a miss. */
+        if (sig->block_offs[i + 1] - sig->block_offs[i] == (rs_long_t)len)
+            return sig->block_offs[i];
     }
     return -1;
 }
 
-void rs_signature_log_stats(rs_signature_t const *sig)
+void rs_signature_add_stats(rs_stats_t *to, rs_match_stats_t const *stats)
 {
-#ifndef HASHTABLE_NSTATS
-    hashtable_t *t = sig->hashtable;
-
-    rs_log(RS_LOG_INFO|RS_LOG_NONAME,
-           "match statistics: signature[%ld searches, %ld (%.3f%%) matches, "
-           "%ld (%.3fx) weak sum compares, %ld (%.3f%%) strong sum compares, "
-           "%ld (%.3f%%) strong sum calcs]",
-           t->find_count,
-           t->match_count, 100.0 * (double)t->match_count / t->find_count,
-           t->hashcmp_count, (double)t->hashcmp_count / t->find_count,
-           t->entrycmp_count, 100.0 * (double)t->entrycmp_count / t->find_count,
-           sig->calc_strong_count, 100.0 * (double)sig->calc_strong_count / t->find_count);
-#endif
+    to->find_count += stats->find.find_count;
+    to->match_count += stats->find.match_count;
+    to->hashcmp_count += stats->find.hashcmp_count;
+    to->entrycmp_count += stats->find.entrycmp_count;
+    to->calc_strong_count += stats->calc_strong_count;
+    to->strong_sum_ns += stats->strong_sum_ns;
+}
+
+/* Order block sigs by weak sum then strong sum, for counting repeats. */
+static int rs_block_sig_cmp(const void *a, const void *b)
+{
+    const rs_block_sig_t *x = a, *y = b;
+
+    if (x->weak_sum != y->weak_sum)
+        return x->weak_sum < y->weak_sum ? -1 : 1;
+    return memcmp(x->strong_sum, y->strong_sum, sizeof x->strong_sum);
+}
+
+rs_result rs_signature_get_stats(rs_signature_t const *sig, rs_signature_stats_t *stats)
+{
+    rs_block_sig_t *sorted, *b;
+    rs_block_match_t m;
+    hashtable_stats_t find;
+    long add_hist[HASHTABLE_HIST_LEN], hit_hist[HASHTABLE_HIST_LEN], miss_hist[HASHTABLE_HIST_LEN];
+    int i;
+
+    rs_signature_check(sig);
+    rs_bzero(stats, sizeof *stats);
+    stats->magic = sig->magic;
+    stats->block_len = sig->block_len;
+    stats->strong_sum_len = sig->strong_sum_len;
+    stats->block_count = sig->count;
+
+    /* Unpack and sort the block sigs, zero padding the strong sums. */
+    if (sig->count) {
+        sorted = rs_alloc(sig->count * sizeof *sorted, "sorted block sigs");
+        rs_bzero(sorted, sig->count * sizeof *sorted);
+        for (i = 0; i < sig->count; i++) {
+            b = rs_block_sig_ptr(sig, i);
+            rs_block_sig_init(&sorted[i], b->weak_sum, &b->strong_sum, sig->strong_sum_len);
+        }
+        qsort(sorted, sig->count, sizeof *sorted, rs_block_sig_cmp);
+        stats->distinct_weak_sums = 1;
+        for (i = 1; i < sig->count; i++) {
+            if (sorted[i].weak_sum != sorted[i - 1].weak_sum)
+                stats->distinct_weak_sums++;
+            else if (rs_block_sig_cmp(&sorted[i], &sorted[i - 1]))
+                stats->weak_collisions++;
+            else
+                stats->duplicate_blocks++;
+        }
+        rs_free(sorted);
+    }
+
+    if (!sig->hashtable)
+        return RS_DONE;
+    stats->table_size = sig->hashtable->size;
+    stats->load = (double)sig->hashtable->count / sig->hashtable->size;
+    rs_bzero(add_hist, sizeof add_hist);
+    rs_bzero(miss_hist, sizeof miss_hist);
+    hashtable_probe_hist(sig->hashtable, add_hist, miss_hist);
+    /* Find every block by its own sums, without a buffer to sum.  Only
+     * these finds fill in a probe histogram, not a delta's. */
+    rs_bzero(&find, sizeof find);
+    rs_bzero(hit_hist, sizeof hit_hist);
+    find.probe_hist = hit_hist;
+    for (i = 0; i < sig->count; i++) {
+        b = rs_block_sig_ptr(sig, i);
+        rs_block_match_init(&m, sig, NULL, b->weak_sum, NULL, 0);
+        memcpy(m.block_sig.strong_sum, b->strong_sum, sig->strong_sum_len);
+        hashtable_find(sig->hashtable, &m, &find);
+    }
+    stats->false_weak_matches = find.entrycmp_count - find.match_count;
+    for (i = 0; i < RS_PROBE_HIST_LEN && i < HASHTABLE_HIST_LEN; i++) {
+        stats->build_probes[i] = add_hist[i];
+        stats->hit_probes[i] = hit_hist[i];
+        stats->miss_probes[i] = miss_hist[i];
+    }
+    return RS_DONE;
 }
 
 rs_result rs_build_hash_table(rs_signature_t *sig)
@@ -195,13 +361,14 @@ rs_result rs_build_hash_table(rs_signature_t *sig)
         return RS_MEM_ERROR;
     for (i = 0; i < sig->count; i++)
         hashtable_add(sig->hashtable, rs_block_sig_ptr(sig, i));
-    return RS_DONE;
+    /* Each level of a multi-level signature gets its own table. */
+    return sig->coarse ? rs_build_hash_table(sig->coarse) : RS_DONE;
 }
 
 void rs_free_sumset(rs_signature_t *psums)
 {
     rs_signature_done(psums);
-    free(psums);
+    rs_free(psums);
 }
 
 void rs_sumset_dump(rs_signature_t const *sums)
@@ -20,9 +20,13 @@
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#ifndef _SUMSET_H_
+#define _SUMSET_H_
+
 #include <assert.h>
 #include "hashtable.h"
 #include "checksum.h"
+#include "cdc.h"
 
 /** Signature of a single block. */
 typedef struct rs_block_sig {
@@ -35,21 +39,42 @@ void rs_block_sig_init(rs_block_sig_t *sig, rs_weak_sum_t weak_sum, rs_strong_su
 /** Signature of a whole file.
  *
  * This includes the all the block sums generated for a file and
- * datastructures for fast matching against them. */
+ * datastructures for fast matching against them.
+ *
+ * Once rs_build_hash_table() has been called the signature is only
+ * read, so any number of delta jobs can use it at once. */
 struct rs_signature {
     int magic;                  /**< The signature magic value. */
-    int block_len;              /**< The block length. */
+    int block_len;              /**< The block length, or the average
+                                 * chunk length for content-defined
+                                 * chunks. */
     int strong_sum_len;         /**< The block strong sum length. */
     int count;                  /**< Total number of blocks. */
     int size;                   /**< Total number of blocks allocated. */
     void *block_sigs;           /**< The packed block_sigs for all blocks. */
     hashtable_t *hashtable;     /**< The hashtable for finding matches. */
-    /* The is extra stats not included in the hashtable stats. */
-#ifndef HASHTABLE_NSTATS
-    long calc_strong_count;     /**< The count of strongsum calcs done. */
-#endif
+    rs_long_t *block_offs;      /**< For content-defined chunks, the offset
+                                 * of each block and then the end of the
+                                 * last, else NULL. */
+    rs_cdc_t cdc;               /**< Chunk boundary settings. */
+    struct rs_signature *coarse; /**< For multi-level signatures, the
+                                 * next coarser level, else NULL. */
 };
 
+/** Whether a signature's blocks are content-defined chunks. */
+#define rs_signature_is_cdc(sig) ((sig)->magic == RS_CDC_BLAKE2_SIG_MAGIC)
+
+/** Whether a signature has sums for several block lengths. */
+#define rs_signature_is_multi(sig) ((sig)->magic == RS_MULTI_BLAKE2_SIG_MAGIC)
+
+/** Stats for rs_signature_find_match(), kept by each user of a
+ * signature. */
+typedef struct rs_match_stats {
+    hashtable_stats_t find;     /**< The hashtable_find() stats. */
+    long calc_strong_count;     /**< The count of strongsum calcs done. */
+    rs_long_t strong_sum_ns;    /**< Time spent calculating them. */
+} rs_match_stats_t;
+
 /** Initialize an rs_signature instance.
  *
  * \param *sig the signature to initialize.
@@ -72,32 +97,63 @@ void rs_signature_done(rs_signature_t *sig);
 /** Add a block to an rs_signature instance. */
 rs_block_sig_t *rs_signature_add_block(rs_signature_t *sig, rs_weak_sum_t weak_sum, rs_strong_sum_t *strong_sum);
 
-/** Find a matching block offset in a signature. */
-rs_long_t rs_signature_find_match(rs_signature_t *sig, rs_weak_sum_t weak_sum, void const *buf, size_t len);
+/** Add a content-defined chunk of \p len bytes to an rs_signature
+ * instance. */
+rs_block_sig_t *rs_signature_add_chunk(rs_signature_t *sig, size_t len, rs_weak_sum_t weak_sum,
+                                       rs_strong_sum_t *strong_sum);
+
+/** Add a level of blocks of \p block_len, a multiple of the last
+ * level's, to a multi-level signature. */
+rs_result rs_signature_add_level(rs_signature_t *sig, int block_len);
+
+/** Get the number of levels coarser than \p sig itself. */
+int rs_signature_levels(rs_signature_t const *sig);
 
-/** Log the rs_signature_find_match() stats. */
-void rs_signature_log_stats(rs_signature_t const *sig);
+/** Get level \p n of a signature, where 0 is \p sig itself. */
+rs_signature_t *rs_signature_level(rs_signature_t *sig, int n);
+
+/** Step from the sum for a level \p level block at \p *pos to the
+ * next in a multi-level signature, returning its level and setting \p
+ * *pos to its offset.
+ *
+ * Each coarse block's sum is followed by those of the blocks it's
+ * made of, so this goes down a level, or on to the next fine block
+ * and up to the coarsest level that starts there. */
+int rs_signature_next_sum(rs_signature_t const *sig, int level, rs_long_t *pos);
+
+/** Find a matching block offset in a signature, counting the work
+ * done in stats if it's not NULL. */
+rs_long_t rs_signature_find_match(rs_signature_t const *sig, rs_match_stats_t *stats, rs_weak_sum_t weak_sum,
+                                  void const *buf, size_t len);
+
+/** Add rs_signature_find_match() stats to a job's ::rs_stats_t. */
+void rs_signature_add_stats(rs_stats_t *to, rs_match_stats_t const *stats);
 
 /** Assert that a signature is valid.
  *
  * We don't use a static inline function here so that assert failure output
  * points at where rs_signature_check() was called from. */
 #define rs_signature_check(sig) do {\
-    assert(((sig)->magic == RS_BLAKE2_SIG_MAGIC && (sig)->strong_sum_len <= RS_BLAKE2_SUM_LENGTH)\
+    assert((((sig)->magic == RS_BLAKE2_SIG_MAGIC || rs_signature_is_cdc(sig) || rs_signature_is_multi(sig))\
+            && (sig)->strong_sum_len <= RS_BLAKE2_SUM_LENGTH)\
            || ((sig)->magic == RS_MD4_SIG_MAGIC && (sig)->strong_sum_len <= RS_MD4_SUM_LENGTH));\
     assert(0 < (sig)->block_len);\
     assert(0 < (sig)->strong_sum_len && (sig)->strong_sum_len <= RS_MAX_STRONG_SUM_LENGTH);\
     assert(0 <= (sig)->count && (sig)->count <= (sig)->size);\
     assert(!(sig)->hashtable || (sig)->hashtable->count == (sig)->count);\
+    assert(!rs_signature_is_cdc(sig) == !(sig)->block_offs);\
+    assert(!(sig)->coarse || (rs_signature_is_multi(sig) && (sig)->coarse->block_len % (sig)->block_len == 0));\
 } while (0)
 
 /** Calculate the strong sum of a buffer. */
 static inline void rs_signature_calc_strong_sum(rs_signature_t const *sig, void const *buf, size_t len,
                                                 rs_strong_sum_t *sum)
 {
-    if (sig->magic == RS_BLAKE2_SIG_MAGIC) {
-        rs_calc_blake2_sum(buf, len, sum);
-    } else {
+    if (sig->magic == RS_MD4_SIG_MAGIC) {
         rs_calc_md4_sum(buf, len, sum);
+    } else {
+        rs_calc_blake2_sum(buf, len, sum);
     }
 }
+
+#endif                          /* _SUMSET_H_ */
@@ -52,11 +52,17 @@
 #include "librsync.h"
 #include "util.h"
 #include "trace.h"
+#include "context.h"
 
 rs_trace_fn_t  *rs_trace_impl = rs_trace_stderr;
 
 int rs_trace_level = RS_LOG_INFO;
 
+#ifdef HAVE___THREAD
+/* Context of the job this thread is running, if any. */
+static __thread rs_context_t const *rs_trace_ctx;
+#endif
+
 #ifdef HAVE_PROGRAM_INVOCATION_NAME
 #  define MY_NAME program_invocation_short_name
 #else
@@ -101,14 +107,49 @@ rs_trace_set_level(rs_loglevel level)
 }
 
 
+/**
+ * Send trace from this thread to \p ctx until told otherwise, returning
+ * the context it was going to before.  A NULL \p ctx uses the
+ * process-wide settings.
+ */
+rs_context_t const *
+rs_trace_use(rs_context_t const *ctx)
+{
+#ifdef HAVE___THREAD
+    rs_context_t const *old = rs_trace_ctx;
+
+    rs_trace_ctx = ctx;
+    return old;
+#else
+    return NULL;
+#endif
+}
+
+
+int
+rs_trace_cur_level(void)
+{
+#ifdef HAVE___THREAD
+    if (rs_trace_ctx)
+        return rs_trace_ctx->trace_level;
+#endif
+    return rs_trace_level;
+}
+
+
 static void
 rs_log_va(int flags, char const *fn, char const *fmt, va_list va)
 {
     int level = flags & RS_LOG_PRIMASK;
+    rs_trace_fn_t *impl = rs_trace_impl;
 
-    if (rs_trace_impl && level <= rs_trace_level) {
-        char            buf[1000];
-        char            full_buf[1000];
+#ifdef HAVE___THREAD
+    if (rs_trace_ctx)
+        impl = rs_trace_ctx->trace_fn;
+#endif
+    if (impl && level <= rs_trace_cur_level()) {
+        char            buf[2000];
+        char            full_buf[2000];
 
         vsnprintf(buf, sizeof buf - 1, fmt, va);
 
@@ -122,7 +163,7 @@ rs_log_va(int flags, char const *fn, char const *fmt, va_list va)
                      MY_NAME, rs_severities[level], fn, buf);
         }
 
-        rs_trace_impl(level, full_buf);
+        impl(level, full_buf);
     }
 }
 
@@ -129,9 +129,12 @@ enum {
  */
 
 extern int rs_trace_level;
+extern rs_trace_fn_t *rs_trace_impl;
+
+int rs_trace_cur_level(void);
 
 #ifdef DO_RS_TRACE
-#  define rs_trace_enabled() ((rs_trace_level & RS_LOG_PRIMASK) >= RS_LOG_DEBUG)
+#  define rs_trace_enabled() ((rs_trace_cur_level() & RS_LOG_PRIMASK) >= RS_LOG_DEBUG)
 #else
 #  define rs_trace_enabled() 0
 #endif
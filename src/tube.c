@@ -46,9 +46,6 @@
 
 
 /*
- * TODO: As an optimization, write it directly to the stream if
- * possible.  But for simplicity don't do that yet.
- *
  * TODO: I think our current copy code will lock up if the application
  * only ever calls us with either input or output buffers, and not
  * both.  So I guess in that case we might need to copy into some
@@ -127,6 +124,7 @@ rs_tube_copy_from_scoop(rs_job_t *job)
     }
 
     memcpy(stream->next_out, job->scoop_next, this_len);
+    job->stats.tube_buffered_bytes += this_len;
 
     stream->next_out += this_len;
     stream->avail_out -= this_len;
@@ -168,6 +166,7 @@ static void rs_tube_catchup_copy(rs_job_t *job)
         this_copy = rs_buffers_copy(stream, job->copy_len);
 
         job->copy_len -= this_copy;
+        job->stats.tube_direct_bytes += this_copy;
 
         rs_trace("copied " PRINTF_FORMAT_U64 " bytes from input buffer, " PRINTF_FORMAT_U64 " remain to be copied",
                  PRINTF_CAST_U64(this_copy), PRINTF_CAST_U64(job->copy_len));
@@ -182,6 +181,7 @@ static void rs_tube_catchup_copy(rs_job_t *job)
  */
 int rs_tube_catchup(rs_job_t *job)
 {
+    job->stats.tube_catchups++;
     if (job->write_len)
         rs_tube_catchup_write(job);
 
@@ -245,14 +245,32 @@ void rs_tube_copy(rs_job_t *job, int len)
  * supposed to get very big, so this will just pop loudly if you do
  * that.
  *
+ * If nothing is already waiting in the tube, as much as fits goes
+ * straight into the stream's output, and only the rest is kept.
+ *
  * We can't accept write data if there's already a copy command in the
  * tube, because the write data comes out first.
  */
 void
 rs_tube_write(rs_job_t *job, const void *buf, size_t len)
 {
+    rs_buffers_t *stream = job->stream;
+    size_t direct;
+
     assert(job->copy_len == 0);
 
+    if (!job->write_len && stream && stream->avail_out) {
+        direct = len < stream->avail_out ? len : stream->avail_out;
+        memcpy(stream->next_out, buf, direct);
+        stream->next_out += direct;
+        stream->avail_out -= direct;
+        job->stats.tube_direct_bytes += direct;
+        buf = (const char *) buf + direct;
+        len -= direct;
+        if (!len)
+            return;
+    }
+
     if (len > sizeof(job->write_buf) - job->write_len) {
         rs_fatal("tube popped when trying to write %ld bytes!",
                  (long) len);
@@ -260,4 +278,5 @@ rs_tube_write(rs_job_t *job, const void *buf, size_t len)
 
     memcpy(job->write_buf + job->write_len, buf, len);
     job->write_len += len;
+    job->stats.tube_buffered_bytes += len;
 }
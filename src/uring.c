@@ -0,0 +1,521 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/*
+ * This talks to the kernel directly with io_uring_setup() and
+ * io_uring_enter() rather than through liburing, so that there's no
+ * new dependency.  Only the little we need is here: one submission
+ * and completion queue, READ and WRITE at explicit offsets, and
+ * linking a read to the write of the same buffer.
+ */
+
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <sys/types.h>
+
+#include "librsync.h"
+#include "job.h"
+#include "uring.h"
+#include "trace.h"
+#include "util.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(HAVE_SYS_SYSCALL_H) \
+    && defined(__GNUC__)
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <linux/io_uring.h>
+#  if defined(__NR_io_uring_setup) && defined(IORING_FEAT_RW_CUR_POS)
+#    define RS_HAVE_URING 1
+#  endif
+#endif
+
+
+/* Size of each IO buffer, unless rs_outbuflen is bigger. */
+#define RS_ASYNC_BUF_LEN (128 << 10)
+
+#ifdef RS_HAVE_URING
+
+typedef struct rs_async_slot {
+    char                *buf;
+    size_t              len;    /* bytes being transferred */
+    rs_long_t           off;    /* offset in the new file */
+    int                 pending; /* outstanding completions */
+} rs_async_slot_t;
+
+
+struct rs_async_patch {
+    int                 ring_fd;
+    unsigned            *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned            *cq_head, *cq_tail, *cq_mask;
+    unsigned            sq_entries;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void                *sq_ring, *cq_ring;
+    size_t              sq_ring_len, cq_ring_len, sqes_len;
+    unsigned            to_submit;
+
+    int                 basis_fd, new_fd;
+    rs_long_t           out_pos;        /* offset of next output */
+
+    rs_async_slot_t     *slots;
+    unsigned            nslots;
+    size_t              buf_len;
+    rs_async_slot_t     *out_slot;      /* the job's output buffer */
+
+    rs_result           error;
+};
+
+
+static int rs_uring_setup(rs_async_patch_t *ap, unsigned entries)
+{
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    rs_bzero(&p, sizeof p);
+    ap->ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ap->ring_fd < 0) {
+        rs_trace("io_uring_setup failed: %s", strerror(errno));
+        return 0;
+    }
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+        /* Too old to have IORING_OP_READ and IORING_OP_WRITE. */
+        rs_trace("kernel io_uring lacks READ and WRITE");
+        return 0;
+    }
+
+    ap->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ap->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ap->cq_ring_len > ap->sq_ring_len)
+            ap->sq_ring_len = ap->cq_ring_len;
+        ap->cq_ring_len = ap->sq_ring_len;
+    }
+
+    ap->sq_ring = mmap(NULL, ap->sq_ring_len, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ap->ring_fd,
+                       IORING_OFF_SQ_RING);
+    if (ap->sq_ring == MAP_FAILED) {
+        ap->sq_ring = NULL;
+        return 0;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ap->cq_ring = ap->sq_ring;
+    } else {
+        ap->cq_ring = mmap(NULL, ap->cq_ring_len, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ap->ring_fd,
+                           IORING_OFF_CQ_RING);
+        if (ap->cq_ring == MAP_FAILED) {
+            ap->cq_ring = NULL;
+            return 0;
+        }
+    }
+    ap->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ap->sqes = mmap(NULL, ap->sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ap->ring_fd,
+                    IORING_OFF_SQES);
+    if (ap->sqes == MAP_FAILED) {
+        ap->sqes = NULL;
+        return 0;
+    }
+
+    sq = ap->sq_ring;
+    cq = ap->cq_ring;
+    ap->sq_head = (unsigned *) (sq + p.sq_off.head);
+    ap->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    ap->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    ap->sq_array = (unsigned *) (sq + p.sq_off.array);
+    ap->sq_entries = p.sq_entries;
+    ap->cq_head = (unsigned *) (cq + p.cq_off.head);
+    ap->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    ap->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    ap->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    return 1;
+}
+
+
+/*
+ * Pass queued entries to the kernel, and optionally wait until at
+ * least MIN_COMPLETE have finished.
+ */
+static rs_result rs_uring_enter(rs_async_patch_t *ap, unsigned min_complete)
+{
+    int ret;
+
+    do {
+        ret = syscall(__NR_io_uring_enter, ap->ring_fd, ap->to_submit,
+                      min_complete,
+                      min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        rs_error("io_uring_enter failed: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    ap->to_submit -= ret;
+    return RS_DONE;
+}
+
+
+/* Take note of all finished operations. */
+static void rs_uring_reap(rs_async_patch_t *ap)
+{
+    unsigned            head, tail;
+    struct io_uring_cqe *cqe;
+    rs_async_slot_t     *slot;
+    int                 is_write;
+    ssize_t             done;
+
+    head = *ap->cq_head;
+    tail = __atomic_load_n(ap->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        cqe = &ap->cqes[head & *ap->cq_mask];
+        slot = &ap->slots[cqe->user_data >> 1];
+        is_write = cqe->user_data & 1;
+
+        if (cqe->res == -ECANCELED && ap->error != RS_DONE) {
+            /* write after a failed read */
+        } else if (cqe->res < 0) {
+            rs_error("async %s failed: %s", is_write ? "write" : "read",
+                     strerror(-cqe->res));
+            ap->error = RS_IO_ERROR;
+        } else if ((size_t) cqe->res < slot->len && !is_write) {
+            rs_error("unexpected eof in basis");
+            ap->error = RS_INPUT_ENDED;
+        } else if ((size_t) cqe->res < slot->len) {
+            /* Short writes are unusual enough to finish by hand. */
+            done = cqe->res;
+            while ((size_t) done < slot->len) {
+                ssize_t n = pwrite(ap->new_fd, slot->buf + done,
+                                   slot->len - done, slot->off + done);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0) {
+                    rs_error("write failed: %s", strerror(errno));
+                    ap->error = RS_IO_ERROR;
+                    break;
+                }
+                done += n;
+            }
+        }
+        slot->pending--;
+        head++;
+    }
+    __atomic_store_n(ap->cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+static struct io_uring_sqe *rs_uring_get_sqe(rs_async_patch_t *ap)
+{
+    unsigned tail = *ap->sq_tail, idx;
+    struct io_uring_sqe *sqe;
+
+    if (tail - __atomic_load_n(ap->sq_head, __ATOMIC_ACQUIRE)
+        >= ap->sq_entries)
+        return NULL;
+
+    idx = tail & *ap->sq_mask;
+    sqe = &ap->sqes[idx];
+    rs_bzero(sqe, sizeof *sqe);
+    ap->sq_array[idx] = idx;
+    return sqe;
+}
+
+
+static void rs_uring_queue(rs_async_patch_t *ap)
+{
+    __atomic_store_n(ap->sq_tail, *ap->sq_tail + 1, __ATOMIC_RELEASE);
+    ap->to_submit++;
+}
+
+
+/*
+ * Find a buffer that's not in use, waiting for some IO to finish if
+ * necessary.
+ */
+static rs_result rs_async_get_slot(rs_async_patch_t *ap,
+                                   rs_async_slot_t **slot)
+{
+    unsigned    i;
+    rs_result   result;
+
+    for (;;) {
+        rs_uring_reap(ap);
+        if (ap->error != RS_DONE)
+            return ap->error;
+        for (i = 0; i < ap->nslots; i++) {
+            if (!ap->slots[i].pending && &ap->slots[i] != ap->out_slot) {
+                *slot = &ap->slots[i];
+                return RS_DONE;
+            }
+        }
+        if ((result = rs_uring_enter(ap, 1)) != RS_DONE)
+            return result;
+    }
+}
+
+
+/*
+ * Queue a write of the first LEN bytes of SLOT to the end of the new
+ * file, after a read from the basis at BASIS_POS if that's not -1.
+ */
+static rs_result rs_async_submit(rs_async_patch_t *ap, rs_async_slot_t *slot,
+                                 size_t len, rs_long_t basis_pos)
+{
+    struct io_uring_sqe *sqe;
+    unsigned            need = basis_pos >= 0 ? 2 : 1;
+    rs_result           result;
+    unsigned long long  id = (unsigned long long) (slot - ap->slots) << 1;
+
+    while (ap->sq_entries - (*ap->sq_tail - *ap->sq_head) < need) {
+        if ((result = rs_uring_enter(ap, 0)) != RS_DONE)
+            return result;
+    }
+
+    slot->len = len;
+    slot->off = ap->out_pos;
+    slot->pending = need;
+
+    if (basis_pos >= 0) {
+        sqe = rs_uring_get_sqe(ap);
+        sqe->opcode = IORING_OP_READ;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->fd = ap->basis_fd;
+        sqe->addr = (unsigned long) slot->buf;
+        sqe->len = len;
+        sqe->off = basis_pos;
+        sqe->user_data = id;
+        rs_uring_queue(ap);
+    }
+
+    sqe = rs_uring_get_sqe(ap);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = ap->new_fd;
+    sqe->addr = (unsigned long) slot->buf;
+    sqe->len = len;
+    sqe->off = ap->out_pos;
+    sqe->user_data = id | 1;
+    rs_uring_queue(ap);
+
+    ap->out_pos += len;
+
+    /* Don't let the kernel sit idle while we fill the rest of the
+     * queue. */
+    return rs_uring_enter(ap, 0);
+}
+
+
+rs_async_patch_t *rs_async_patch_new(int basis_fd, int new_fd,
+                                     unsigned depth)
+{
+    rs_async_patch_t    *ap;
+    off_t               pos;
+    unsigned            i;
+
+    /* Output has to be at known offsets. */
+    if ((pos = lseek(new_fd, 0, SEEK_CUR)) < 0)
+        return NULL;
+
+    ap = rs_alloc_struct(rs_async_patch_t);
+    ap->error = RS_DONE;
+    ap->basis_fd = basis_fd;
+    ap->new_fd = new_fd;
+    ap->out_pos = pos;
+
+    /* Each buffer can have a read and a write queued. */
+    if (depth < 2)
+        depth = 2;
+    if (!rs_uring_setup(ap, 2 * depth)) {
+        rs_async_patch_free(ap);
+        return NULL;
+    }
+
+    ap->buf_len = RS_ASYNC_BUF_LEN;
+    if ((size_t) rs_outbuflen > ap->buf_len)
+        ap->buf_len = rs_outbuflen;
+    ap->nslots = depth;
+    ap->slots = rs_alloc(depth * sizeof *ap->slots, "async buffers");
+    rs_bzero(ap->slots, depth * sizeof *ap->slots);
+    for (i = 0; i < depth; i++)
+        ap->slots[i].buf = rs_alloc(ap->buf_len, "async buffer");
+
+    return ap;
+}
+
+
+rs_result rs_async_patch_drain(rs_job_t *job, rs_buffers_t *buf,
+                               void *opaque)
+{
+    rs_async_patch_t    *ap = (rs_async_patch_t *) opaque;
+    size_t              present;
+    rs_result           result;
+
+    if (ap->error != RS_DONE)
+        return ap->error;
+
+    if (buf->next_out != NULL) {
+        assert(ap->out_slot);
+        assert(buf->next_out >= ap->out_slot->buf);
+        assert(buf->next_out <= ap->out_slot->buf + ap->buf_len);
+
+        present = buf->next_out - ap->out_slot->buf;
+        if (!present)
+            return RS_DONE;
+        result = rs_async_submit(ap, ap->out_slot, present, -1);
+        if (result != RS_DONE)
+            return result;
+        job->stats.out_bytes += present;
+    }
+
+    ap->out_slot = NULL;
+    if ((result = rs_async_get_slot(ap, &ap->out_slot)) != RS_DONE)
+        return result;
+    buf->next_out = ap->out_slot->buf;
+    buf->avail_out = ap->buf_len;
+
+    return RS_DONE;
+}
+
+
+rs_result rs_async_patch_copy_cb(rs_job_t *job, void *opaque,
+                                 rs_long_t pos, rs_long_t *len)
+{
+    rs_async_patch_t    *ap = (rs_async_patch_t *) opaque;
+    rs_long_t           want = *len;
+    rs_async_slot_t     *slot;
+    size_t              this_len;
+    rs_result           result;
+
+    *len = 0;
+
+    /* Literal data before this COPY has to be placed first. */
+    if ((result = rs_async_patch_drain(job, job->stream, ap)) != RS_DONE)
+        return result;
+
+    while (*len < want) {
+        if ((result = rs_async_get_slot(ap, &slot)) != RS_DONE)
+            return result;
+        this_len = ap->buf_len;
+        if ((rs_long_t) this_len > want - *len)
+            this_len = want - *len;
+        result = rs_async_submit(ap, slot, this_len, pos + *len);
+        if (result != RS_DONE)
+            return result;
+        *len += this_len;
+    }
+
+    job->stats.out_bytes += *len;
+    return RS_DONE;
+}
+
+
+rs_result rs_async_patch_finish(rs_async_patch_t *ap)
+{
+    unsigned    i;
+    rs_result   result;
+
+    for (;;) {
+        rs_uring_reap(ap);
+        for (i = 0; i < ap->nslots; i++)
+            if (ap->slots[i].pending)
+                break;
+        if (i == ap->nslots)
+            break;
+        if ((result = rs_uring_enter(ap, 1)) != RS_DONE)
+            return result;
+    }
+    if (ap->error != RS_DONE)
+        return ap->error;
+
+    /* Leave the file offset where a synchronous write would have. */
+    if (lseek(ap->new_fd, ap->out_pos, SEEK_SET) < 0) {
+        rs_error("seek failed: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    return RS_DONE;
+}
+
+
+void rs_async_patch_free(rs_async_patch_t *ap)
+{
+    unsigned i;
+
+    if (ap->slots) {
+        for (i = 0; i < ap->nslots; i++)
+            rs_free(ap->slots[i].buf);
+        rs_free(ap->slots);
+    }
+    if (ap->sqes)
+        munmap(ap->sqes, ap->sqes_len);
+    if (ap->cq_ring && ap->cq_ring != ap->sq_ring)
+        munmap(ap->cq_ring, ap->cq_ring_len);
+    if (ap->sq_ring)
+        munmap(ap->sq_ring, ap->sq_ring_len);
+    if (ap->ring_fd >= 0)
+        close(ap->ring_fd);
+    rs_free(ap);
+}
+
+#else /* ! RS_HAVE_URING */
+
+rs_async_patch_t *rs_async_patch_new(int UNUSED(basis_fd),
+                                     int UNUSED(new_fd),
+                                     unsigned UNUSED(depth))
+{
+    return NULL;
+}
+
+
+rs_result rs_async_patch_drain(rs_job_t *UNUSED(job),
+                               rs_buffers_t *UNUSED(buf),
+                               void *UNUSED(opaque))
+{
+    return RS_UNIMPLEMENTED;
+}
+
+
+rs_result rs_async_patch_copy_cb(rs_job_t *UNUSED(job),
+                                 void *UNUSED(opaque),
+                                 rs_long_t UNUSED(pos),
+                                 rs_long_t *UNUSED(len))
+{
+    return RS_UNIMPLEMENTED;
+}
+
+
+rs_result rs_async_patch_finish(rs_async_patch_t *UNUSED(ap))
+{
+    return RS_UNIMPLEMENTED;
+}
+
+
+void rs_async_patch_free(rs_async_patch_t *UNUSED(ap))
+{
+}
+
+#endif /* ! RS_HAVE_URING */
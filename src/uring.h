@@ -0,0 +1,48 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- the library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+
+/**
+ * \file uring.h
+ * Asynchronous patch output through io_uring.
+ *
+ * The async driver is a pair of callbacks for a patch job: an output
+ * drain that queues each buffer of literal data as a write at its
+ * offset in the new file, and a direct-copy callback that queues each
+ * COPY as a basis read linked to a write of the same buffer.  Up to
+ * \p depth buffers are in flight at once.
+ */
+
+/** Number of buffers in flight. */
+#define RS_ASYNC_DEPTH 32
+
+typedef struct rs_async_patch rs_async_patch_t;
+
+rs_async_patch_t *rs_async_patch_new(int basis_fd, int new_fd,
+                                     unsigned depth);
+
+rs_result rs_async_patch_drain(rs_job_t *job, rs_buffers_t *buf,
+                               void *opaque);
+
+rs_result rs_async_patch_copy_cb(rs_job_t *job, void *opaque,
+                                 rs_long_t pos, rs_long_t *len);
+
+rs_result rs_async_patch_finish(rs_async_patch_t *ap);
+
+void rs_async_patch_free(rs_async_patch_t *ap);
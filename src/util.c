@@ -32,6 +32,8 @@
 #include <string.h>
 #include <stdio.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
 
 #include "librsync.h"
 #include "util.h"
@@ -44,14 +46,50 @@ rs_bzero(void *buf, size_t size)
 }
 
 
+/*
+ * The allocator used for all of the library's memory.  The defaults
+ * just call the C library.
+ */
+static void *rs_std_alloc(void *UNUSED(opaque), size_t size)
+{
+    return malloc(size);
+}
+
+
+static void *rs_std_realloc(void *UNUSED(opaque), void *ptr, size_t size)
+{
+    return realloc(ptr, size);
+}
+
+
+static void rs_std_free(void *UNUSED(opaque), void *ptr)
+{
+    free(ptr);
+}
+
+
+static rs_allocator_t rs_allocator = {
+    rs_std_alloc, rs_std_realloc, rs_std_free, NULL
+};
+
+
+void
+rs_set_allocator(rs_allocator_t const *allocator)
+{
+    static const rs_allocator_t std = {
+        rs_std_alloc, rs_std_realloc, rs_std_free, NULL
+    };
+
+    rs_allocator = allocator ? *allocator : std;
+}
+
+
 void *
 rs_alloc_struct0(size_t size, char const *name)
 {
     void           *p;
 
-    if (!(p = malloc(size))) {
-        rs_fatal("couldn't allocate instance of %s", name);
-    }
+    p = rs_alloc(size, name);
     rs_bzero(p, size);
     return p;
 }
@@ -63,7 +101,7 @@ rs_alloc(size_t size, char const *name)
 {
     void           *p;
 
-    if (!(p = malloc(size))) {
+    if (!(p = rs_allocator.alloc(rs_allocator.opaque, size))) {
         rs_fatal("couldn't allocate instance of %s", name);
     }
 
@@ -76,13 +114,46 @@ rs_realloc(void *ptr, size_t size, char const *name)
 {
     void *p;
 
-    if (!(p = realloc(ptr, size))) {
+    if (!ptr)
+        return rs_alloc(size, name);
+    if (!(p = rs_allocator.realloc(rs_allocator.opaque, ptr, size))) {
 	rs_fatal("couldn't reallocate instance of %s", name);
      }
      return p;
 }
 
 
+void
+rs_free(void *ptr)
+{
+    if (ptr)
+        rs_allocator.free(rs_allocator.opaque, ptr);
+}
+
+
+/*
+ * Return a monotonic timestamp in nanoseconds, for measuring
+ * intervals.  Falls back to the wall clock where there is no
+ * clock_gettime().
+ */
+rs_long_t
+rs_clock_ns(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return (rs_long_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+    {
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
+        return (rs_long_t) tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+    }
+}
+
+
 #ifdef HAVE_FSTATI64
 #  ifdef stat
 #   undef stat
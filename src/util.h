@@ -24,11 +24,26 @@
 void * rs_alloc(size_t size, char const *name);
 void * rs_realloc(void *ptr, size_t size, char const *name);
 void *rs_alloc_struct0(size_t size, char const *name);
+void rs_free(void *ptr);
 
 void rs_bzero(void *buf, size_t size);
 
 void rs_get_filesize(FILE *f, rs_long_t *size);
 
+rs_long_t rs_clock_ns(void);
+
+/*
+ * Timestamps for the phase timings in rs_stats_t, which are compiled
+ * out without DO_RS_TIMING.  Work done for each byte is only timed on
+ * one in RS_TIMING_SAMPLE bytes, and scaled up.
+ */
+#ifdef DO_RS_TIMING
+#  define rs_timing_now() rs_clock_ns()
+#else
+#  define rs_timing_now() ((rs_long_t) 0)
+#endif
+#define RS_TIMING_SAMPLE 256
+
 
 /*
  * Allocate and zero-fill an instance of TYPE.
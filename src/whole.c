@@ -46,17 +46,30 @@
 #include "fileutil.h"
 #include "sumset.h"
 #include "job.h"
+#include "context.h"
 #include "buf.h"
 #include "whole.h"
+#include "uring.h"
+#include "pipeline.h"
 #include "util.h"
 
+/* Size of the basis cache used by rs_patch_file(). */
+#define RS_BASISBUF_LEN         (1 << 20)
+
+/**
+ * Whether the whole-file functions read and write in background
+ * threads.
+ */
+int rs_whole_pipeline = 0;
+
+
 /**
  * Run a job continuously, with input to/from the two specified files.
  * The job should already be set up, and must be free by the caller
  * after return.
  *
- * Buffers of ::rs_inbuflen and ::rs_outbuflen are allocated for
- * temporary storage.
+ * Buffers of the sizes set in the job's context, by default
+ * ::rs_inbuflen and ::rs_outbuflen, are allocated for temporary storage.
  *
  * \param in_file Source of input bytes, or NULL if the input buffer
  * should not be filled.
@@ -65,16 +78,50 @@
  */
 rs_result
 rs_whole_run(rs_job_t *job, FILE *in_file, FILE *out_file)
+{
+    rs_whole_opts_t opts;
+
+    rs_bzero(&opts, sizeof opts);
+    opts.pipeline = rs_whole_pipeline;
+
+    return rs_whole_run_opts(job, in_file, out_file, &opts);
+}
+
+
+rs_result
+rs_whole_run_opts(rs_job_t *job, FILE *in_file, FILE *out_file,
+                  rs_whole_opts_t const *opts)
 {
     rs_buffers_t    buf;
-    rs_result       result;
+    rs_result       result, r2;
     rs_filebuf_t    *in_fb = NULL, *out_fb = NULL;
+    rs_pipeline_t   *pl = NULL;
+    size_t          in_len, out_len;
+
+    in_len = opts->in_buf_len ? opts->in_buf_len
+        : (size_t) rs_ctx_inbuflen(job->ctx);
+    out_len = opts->out_buf_len ? opts->out_buf_len
+        : (size_t) rs_ctx_outbuflen(job->ctx);
+
+    if (opts->pipeline && (in_file || out_file))
+        pl = rs_pipeline_new(in_file, in_len, out_file, out_len,
+                             opts->nbufs ? opts->nbufs : RS_PIPELINE_BUFS);
+    if (pl) {
+        result = rs_job_drive(job, &buf,
+                              in_file ? rs_pipeline_fill : NULL, pl,
+                              out_file ? rs_pipeline_drain : NULL, pl);
+        r2 = rs_pipeline_finish(pl);
+        if (result == RS_DONE)
+            result = r2;
+        rs_pipeline_free(pl);
+        return result;
+    }
 
     if (in_file)
-        in_fb = rs_filebuf_new(in_file, rs_inbuflen);
+        in_fb = rs_filebuf_new(in_file, in_len);
 
     if (out_file)
-        out_fb = rs_filebuf_new(out_file, rs_outbuflen);
+        out_fb = rs_filebuf_new(out_file, out_len);
 
     result = rs_job_drive(job, &buf,
                           in_fb ? rs_infilebuf_fill : NULL, in_fb,
@@ -101,6 +148,7 @@ rs_sig_file(FILE *old_file, FILE *sig_file, size_t new_block_len,
     rs_result       r;
 
     job = rs_sig_begin(new_block_len, strong_len, sig_magic);
+    rs_sig_set_levels(job, rs_sig_levels, rs_sig_level_factor);
     r = rs_whole_run(job, old_file, sig_file);
     if (stats)
         memcpy(stats, &job->stats, sizeof *stats);
@@ -157,11 +205,109 @@ rs_result rs_patch_file(FILE *basis_file, FILE *delta_file, FILE *new_file,
 {
     rs_job_t            *job;
     rs_result           r;
-
-    job = rs_patch_begin(rs_file_copy_cb, basis_file);
+    int                 basis_fd = fileno(basis_file);
+    rs_basisbuf_t       *bb = NULL;
+
+    if (basis_fd < 0) {
+        /* Streams with no descriptor behind them, such as those from
+         * fmemopen(), can only be read through stdio. */
+        rs_trace("basis has no file descriptor; reading it through stdio");
+        job = rs_patch_begin(rs_file_copy_cb, basis_file);
+    } else {
+        bb = rs_basisbuf_new(basis_fd, RS_BASISBUF_LEN);
+        job = rs_patch_begin(rs_basisbuf_copy_cb, bb);
+        rs_patch_set_prefetch(job, rs_patch_lookahead, rs_fd_prefetch_cb,
+                              &basis_fd);
+    }
 
     r = rs_whole_run(job, delta_file, new_file);
     
+    if (stats)
+        memcpy(stats, &job->stats, sizeof *stats);
+
+    rs_job_free(job);
+    if (bb)
+        rs_basisbuf_free(bb);
+
+    return r;
+}
+
+
+rs_result rs_patch_fd(int basis_fd, int delta_fd, int new_fd,
+                      rs_stats_t *stats)
+{
+    rs_job_t            *job;
+    rs_result           r;
+    rs_buffers_t        buf;
+    rs_filebuf_t        *in_fb, *out_fb;
+    rs_fd_direct_copy_t dc;
+
+    job = rs_patch_begin(rs_fd_copy_cb, &basis_fd);
+    rs_patch_set_prefetch(job, rs_patch_lookahead, rs_fd_prefetch_cb,
+                          &basis_fd);
+
+    in_fb = rs_fdbuf_new(delta_fd, rs_ctx_inbuflen(job->ctx));
+    out_fb = rs_fdbuf_new(new_fd, rs_ctx_outbuflen(job->ctx));
+
+    rs_fd_direct_copy_init(&dc, basis_fd, out_fb);
+    job->direct_copy_cb = rs_fd_direct_copy_cb;
+    job->direct_copy_arg = &dc;
+
+    r = rs_job_drive(job, &buf, rs_infdbuf_fill, in_fb,
+                     rs_outfdbuf_drain, out_fb);
+
+    rs_filebuf_free(in_fb);
+    rs_filebuf_free(out_fb);
+
+    if (stats)
+        memcpy(stats, &job->stats, sizeof *stats);
+
+    rs_job_free(job);
+
+    return r;
+}
+
+
+rs_result rs_patch_file_async(FILE *basis_file, FILE *delta_file,
+                              FILE *new_file, rs_stats_t *stats)
+{
+    rs_job_t            *job;
+    rs_result           r, r2;
+    rs_buffers_t        buf;
+    rs_filebuf_t        *in_fb;
+    rs_async_patch_t    *ap;
+    int                 basis_fd = fileno(basis_file);
+
+    /* The async writes go around the stdio buffer. */
+    if (fflush(new_file)) {
+        rs_error("error flushing output: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+
+    if (!(ap = rs_async_patch_new(basis_fd, fileno(new_file),
+                                  RS_ASYNC_DEPTH))) {
+        rs_trace("async IO not available; patching synchronously");
+        return rs_patch_file(basis_file, delta_file, new_file, stats);
+    }
+
+    job = rs_patch_begin(rs_fd_copy_cb, &basis_fd);
+    job->direct_copy_cb = rs_async_patch_copy_cb;
+    job->direct_copy_arg = ap;
+
+    in_fb = rs_filebuf_new(delta_file, rs_ctx_inbuflen(job->ctx));
+
+    r = rs_job_drive(job, &buf, rs_infilebuf_fill, in_fb,
+                     rs_async_patch_drain, ap);
+
+    /* Whatever happened, wait until the kernel is done with the
+     * buffers. */
+    r2 = rs_async_patch_finish(ap);
+    if (r == RS_DONE)
+        r = r2;
+
+    rs_async_patch_free(ap);
+    rs_filebuf_free(in_fb);
+
     if (stats)
         memcpy(stats, &job->stats, sizeof *stats);
 
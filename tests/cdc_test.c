@@ -0,0 +1,99 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * cdc_test -- tests for content-defined chunking.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "cdc.h"
+
+#define AVG     1024
+#define LEN     (1 << 20)
+#define SHIFT   100
+
+/* Cut all of BUF into chunks, recording where each one ends in ENDS. */
+static int cut_all(rs_cdc_t const *cdc, unsigned char const *buf, size_t len,
+                   size_t *ends)
+{
+    size_t pos = 0, n;
+    int count = 0;
+
+    while (pos < len) {
+        n = rs_cdc_cut(cdc, buf + pos, len - pos, 1);
+        assert(n > 0 && n <= cdc->max);
+        assert(n >= cdc->min || pos + n == len);
+        pos += n;
+        ends[count++] = pos;
+    }
+    return count;
+}
+
+/*
+ * Test driver for cdc.
+ */
+int main(int argc, char **argv)
+{
+    static unsigned char buf[LEN + SHIFT], zeros[16 * AVG];
+    static size_t ends[LEN], shifted[LEN];
+    rs_cdc_t cdc;
+    int count, shifted_count, i, j, same;
+    size_t n;
+
+    rs_cdc_init(&cdc, AVG);
+    assert(cdc.min == AVG / 4 && cdc.avg == AVG && cdc.max == 8 * AVG);
+
+    srand(1);
+    for (i = 0; i < LEN + SHIFT; i++)
+        buf[i] = rand();
+
+    /* Chunks average near the block length. */
+    count = cut_all(&cdc, buf, LEN, ends);
+    assert(count > LEN / AVG / 2 && count < LEN / AVG * 2);
+
+    /* Without the end of the data, a boundary is only reported if it
+     * is where it would be with all of it. */
+    n = rs_cdc_cut(&cdc, buf, LEN, 0);
+    assert(n == ends[0]);
+    assert(rs_cdc_cut(&cdc, buf, n - 1, 0) == 0);
+    assert(rs_cdc_cut(&cdc, buf, n - 1, 1) == n - 1);
+    assert(rs_cdc_cut(&cdc, buf, n, 0) == n);
+    assert(rs_cdc_cut(&cdc, buf, cdc.min, 0) == 0);
+
+    /* Data with no boundaries is cut at the maximum. */
+    assert(rs_cdc_cut(&cdc, zeros, sizeof zeros, 0) == cdc.max);
+
+    /* Inserting bytes at the front only moves the boundaries after
+     * the first few. */
+    shifted_count = cut_all(&cdc, buf + SHIFT, LEN - SHIFT, shifted);
+    for (i = same = 0, j = 0; i < count && j < shifted_count; ) {
+        if (ends[i] == shifted[j] + SHIFT) {
+            same++;
+            i++;
+            j++;
+        } else if (ends[i] < shifted[j] + SHIFT) {
+            i++;
+        } else {
+            j++;
+        }
+    }
+    assert(same >= count - 3);
+
+    return 0;
+}
@@ -0,0 +1,221 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * context_test -- tests for running jobs with their own settings.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "librsync.h"
+#include "gen.h"
+#include "memjob.h"
+
+#define DATA_LEN        20000
+#define OUT_LEN         40000
+
+
+static long allocs[2], live[2];
+static int global_msgs, ctx_msgs, runs;
+static rs_result last_result;
+
+
+static void *count_alloc(void *opaque, size_t size)
+{
+    allocs[*(int *) opaque]++;
+    live[*(int *) opaque]++;
+    return malloc(size);
+}
+
+
+static void *count_realloc(void *opaque, void *ptr, size_t size)
+{
+    allocs[*(int *) opaque]++;
+    return realloc(ptr, size);
+}
+
+
+static void count_free(void *opaque, void *ptr)
+{
+    live[*(int *) opaque]--;
+    free(ptr);
+}
+
+
+static void global_trace(rs_loglevel level, char const *msg)
+{
+    global_msgs++;
+}
+
+
+static void ctx_trace(rs_loglevel level, char const *msg)
+{
+    ctx_msgs++;
+}
+
+
+static void count_run(void *opaque, rs_result result, rs_stats_t const *stats)
+{
+    assert(!strcmp(stats->op, (char const *) opaque));
+    assert(stats->elapsed_ns > 0);
+    last_result = result;
+    runs++;
+}
+
+
+/* Check that loading JUNK as a signature fails, and free the job. */
+static void load_junk(rs_job_t *job, rs_signature_t *sumset)
+{
+    static char junk[64], out[64];
+    rs_buffers_t buf;
+
+    buf.next_in = junk;
+    buf.avail_in = sizeof junk;
+    buf.eof_in = 1;
+    buf.next_out = out;
+    buf.avail_out = sizeof out;
+    assert(rs_job_iter(job, &buf) == RS_CORRUPT);
+    rs_job_free(job);
+    rs_free_sumset(sumset);
+}
+
+
+/* Patch OLD with DELTA and check that it gives NEW. */
+static void check_patch(void *old, char *delta, size_t delta_len,
+                        void const *new)
+{
+    static char out[OUT_LEN];
+    rs_job_t    *job = rs_patch_begin(memjob_copy_cb, old);
+
+    assert(memjob_iter(job, delta, delta_len, out, OUT_LEN) == DATA_LEN);
+    assert(!memcmp(out, new, DATA_LEN));
+    rs_job_free(job);
+}
+
+
+int main(int argc, char **argv)
+{
+    static char     sig[OUT_LEN], delta[OUT_LEN], delta2[OUT_LEN];
+    static int      ids[2] = { 0, 1 };
+    rs_allocator_t  alloc_a = { count_alloc, count_realloc, count_free,
+                                &ids[0] };
+    rs_allocator_t  alloc_b = { count_alloc, count_realloc, count_free,
+                                &ids[1] };
+    rs_context_t    a, b;
+    rs_signature_t  *sumset;
+    rs_job_t        *job;
+    gen_data_t      data;
+    unsigned char   *old, *new;
+    size_t          sig_len, len, len2;
+
+    /* The new file is the first half of the old one followed by new
+     * data. */
+    assert(!gen_make(&data, "random,truncate=10000,append=10000", DATA_LEN,
+                     256, 1));
+    old = data.old;
+    new = data.new;
+
+    rs_trace_to(global_trace);
+    rs_trace_set_level(RS_LOG_ERR);
+
+    /* Contexts start with the process-wide settings. */
+    rs_inbuflen = 1234;
+    rs_context_init(&a);
+    assert(a.inbuflen == 1234);
+    assert(a.outbuflen == rs_outbuflen);
+    assert(a.trace_fn == global_trace);
+    assert(a.trace_level == RS_LOG_ERR);
+    assert(a.allocator == NULL);
+    rs_inbuflen = 16000;
+
+    a.allocator = &alloc_a;
+    a.trace_fn = ctx_trace;
+    a.stats_cb = count_run;
+    a.stats_opaque = "signature";
+    rs_context_init(&b);
+    b.allocator = &alloc_b;
+    b.trace_fn = NULL;
+
+    /* Jobs use their context's allocator, and tell its stats hook
+     * about each run. */
+    job = rs_sig_begin_ctx(&a, 256, 8, RS_BLAKE2_SIG_MAGIC);
+    sig_len = memjob_iter(job, old, DATA_LEN, sig, OUT_LEN);
+    assert(sig_len > 0);
+    assert(allocs[0] > 0 && allocs[1] == 0);
+    assert(runs == 0);
+    assert(rs_job_reset(job) == RS_DONE);
+    assert(runs == 1 && last_result == RS_DONE);
+    assert(rs_job_reset(job) == RS_DONE);
+    assert(runs == 1);
+    assert(memjob_iter(job, old, DATA_LEN, sig, OUT_LEN) == sig_len);
+    rs_job_free(job);
+    assert(runs == 2);
+    assert(live[0] == 0);
+
+    /* Errors go to the context's trace function, or nowhere. */
+    a.stats_opaque = "loadsig";
+    job = rs_loadsig_begin_ctx(&a, &sumset);
+    load_junk(job, sumset);
+    assert(runs == 3 && last_result == RS_CORRUPT);
+#ifdef HAVE___THREAD
+    assert(ctx_msgs > 0 && global_msgs == 0);
+#endif
+
+    ctx_msgs = global_msgs = 0;
+    job = rs_loadsig_begin_ctx(&b, &sumset);
+    load_junk(job, sumset);
+    assert(allocs[1] > 0 && live[1] == 0);
+#ifdef HAVE___THREAD
+    assert(ctx_msgs == 0 && global_msgs == 0);
+#endif
+
+    job = rs_loadsig_begin(&sumset);
+    load_junk(job, sumset);
+    assert(global_msgs > 0);
+
+    /* Delta jobs break literal data into pieces of the context's
+     * output buffer length. */
+    job = rs_loadsig_begin(&sumset);
+    memjob_iter(job, sig, sig_len, delta, OUT_LEN);
+    rs_job_free(job);
+    assert(rs_build_hash_table(sumset) == RS_DONE);
+
+    job = rs_delta_begin_ctx(NULL, sumset);
+    len = memjob_iter(job, new, DATA_LEN, delta, OUT_LEN);
+    rs_job_free(job);
+    b.outbuflen = 100;
+    job = rs_delta_begin_ctx(&b, sumset);
+    len2 = memjob_iter(job, new, DATA_LEN, delta2, OUT_LEN);
+    rs_job_free(job);
+    assert(len > 0 && len2 > len);
+    check_patch(old, delta, len, new);
+    check_patch(old, delta2, len2, new);
+    rs_free_sumset(sumset);
+
+    job = rs_patch_begin_ctx(&b, memjob_copy_cb, old);
+    assert(memjob_iter(job, delta2, len2, sig, OUT_LEN) == DATA_LEN);
+    assert(!memcmp(sig, new, DATA_LEN));
+    rs_job_free(job);
+    assert(live[1] == 0);
+
+    rs_trace_to(rs_trace_stderr);
+    gen_free(&data);
+    return 0;
+}
@@ -0,0 +1,173 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * events_test -- check job event logs and their Chrome trace output.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "librsync.h"
+#include "gen.h"
+#include "memjob.h"
+
+#define DATA_LEN        (64 << 10)
+#define OUT_LEN         (2 * DATA_LEN + 1024)
+#define CHUNK           1000
+
+
+/* Run JOB over IN, passing it at most CHUNK bytes of input and output
+ * space at a time so that it blocks, returning the output length. */
+static size_t run(rs_job_t *job, void const *in, size_t in_len, void *out)
+{
+    return memjob_run(job, in, in_len, CHUNK, out, CHUNK, NULL);
+}
+
+
+/* Read all of F into a string. */
+static char *slurp(FILE *f)
+{
+    long        len;
+    char        *s;
+
+    len = ftell(f);
+    rewind(f);
+    s = malloc(len + 1);
+    assert(fread(s, 1, len, f) == (size_t) len);
+    s[len] = '\0';
+    return s;
+}
+
+
+static int count(char const *s, char const *what)
+{
+    int         n = 0;
+
+    while ((s = strstr(s, what))) {
+        n++;
+        s++;
+    }
+    return n;
+}
+
+
+int main(int argc, char **argv)
+{
+    static char     sig[OUT_LEN], delta[OUT_LEN], out[OUT_LEN];
+    gen_data_t      data;
+    unsigned char   *old, *new;
+    rs_event_log_t  *log, *small;
+    rs_context_t    ctx;
+    rs_signature_t  *sumset;
+    size_t          sig_len, delta_len, n, dropped;
+    FILE            *f, *g;
+    char            *json;
+
+    assert(!gen_make(&data, "random,delete=32K@0,append=32K", DATA_LEN,
+                     1024, 1));
+    old = data.old;
+    new = data.new;
+
+    /* Jobs without a log record nothing. */
+    log = rs_event_log_new(100000);
+    rs_context_init(&ctx);
+    assert(ctx.event_log == NULL);
+    sig_len = run(rs_sig_begin_ctx(&ctx, 1024, 8, RS_BLAKE2_SIG_MAGIC),
+                  old, DATA_LEN, sig);
+    assert(rs_event_log_count(log, NULL) == 0);
+
+    /* Jobs with a log in their context use it. */
+    ctx.event_log = log;
+    assert(run(rs_sig_begin_ctx(&ctx, 1024, 8, RS_BLAKE2_SIG_MAGIC),
+               old, DATA_LEN, sig) == sig_len);
+    assert(rs_event_log_count(log, &dropped) > 0 && dropped == 0);
+    run(rs_loadsig_begin_ctx(&ctx, &sumset), sig, sig_len, out);
+    assert(rs_build_hash_table(sumset) == RS_DONE);
+    delta_len = run(rs_delta_begin_ctx(&ctx, sumset), new, DATA_LEN, delta);
+    rs_free_sumset(sumset);
+
+    /* And so do jobs without a context once there is a global log. */
+    rs_job_event_log = log;
+    n = rs_event_log_count(log, NULL);
+    assert(run(rs_patch_begin(memjob_copy_cb, old), delta, delta_len, out)
+           == DATA_LEN);
+    assert(!memcmp(out, new, DATA_LEN));
+    assert(rs_event_log_count(log, NULL) > n);
+
+    /* Whole-file jobs also record filling and draining their buffers. */
+    f = tmpfile();
+    g = tmpfile();
+    assert(fwrite(old, 1, DATA_LEN, f) == DATA_LEN);
+    rewind(f);
+    assert(rs_sig_file(f, g, 1024, 8, RS_BLAKE2_SIG_MAGIC, NULL) == RS_DONE);
+    fclose(f);
+    fclose(g);
+    rs_job_event_log = NULL;
+
+    f = tmpfile();
+    assert(rs_event_log_write_json(log, f) == RS_DONE);
+    json = slurp(f);
+    fclose(f);
+    assert(!strncmp(json, "{\"displayTimeUnit\"", 18));
+    assert(!strcmp(json + strlen(json) - 3, "]}\n"));
+    assert(count(json, "{") == count(json, "}"));
+    assert(count(json, "\"ph\": \"B\"") == count(json, "\"ph\": \"E\""));
+    /* Five jobs, each blocking for input and output with these small
+     * buffers, and the delta has copies and literals for the patch to
+     * apply too. */
+    assert(count(json, "\"thread_name\"") == 5);
+    assert(count(json, "\"signature job 1\""));
+    assert(count(json, "\"patch job 4\""));
+    assert(count(json, "\"signature job 5\""));
+    assert(count(json, "\"fill input\"") > 0);
+    assert(count(json, "\"drain output\"") > 0);
+    assert(count(json, "blocked on input") > 0);
+    assert(count(json, "blocked on output") > 0);
+    assert(count(json, "\"name\": \"copy\"") >= 2);
+    assert(count(json, "\"name\": \"literal\"") >= 2);
+    assert(count(json, "\"name\": \"state\"") > 0);
+    free(json);
+    rs_event_log_free(log);
+
+    /* States are only recorded when they change, not on every call: a
+     * signature job sends its header and then generates sums. */
+    log = rs_event_log_new(100000);
+    ctx.event_log = log;
+    run(rs_sig_begin_ctx(&ctx, 1024, 8, RS_BLAKE2_SIG_MAGIC), old, DATA_LEN,
+        sig);
+    f = tmpfile();
+    assert(rs_event_log_write_json(log, f) == RS_DONE);
+    json = slurp(f);
+    fclose(f);
+    assert(count(json, "\"name\": \"state\"") == 2);
+    assert(count(json, "\"ph\": \"B\"") > DATA_LEN / CHUNK);
+    free(json);
+    rs_event_log_free(log);
+
+    /* A full log drops the rest. */
+    small = rs_event_log_new(10);
+    ctx.event_log = small;
+    run(rs_sig_begin_ctx(&ctx, 1024, 8, RS_BLAKE2_SIG_MAGIC), old,
+        DATA_LEN, sig);
+    assert(rs_event_log_count(small, &dropped) == 10 && dropped > 0);
+    rs_event_log_free(small);
+    gen_free(&data);
+    return 0;
+}
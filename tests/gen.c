@@ -0,0 +1,345 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * gen.c -- repeatable synthetic basis and new files for benchmarks and
+ * tests.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "gen.h"
+
+
+const gen_profile_t gen_profiles[] = {
+    { "random", "random,edit=64K",
+      "random basis, new file with a few scattered edits" },
+    { "shifted", "random,insert=7@0",
+      "new file is the basis with a few bytes inserted in front" },
+    { "sparse", "sparse,edit=64K",
+      "mostly zeros with short random runs, like a sparse image" },
+    { "lowentropy", "lowentropy,edit=64K",
+      "bytes from a four-letter alphabet" },
+    { "duplicates", "duplicates,edit=64K",
+      "a few distinct blocks repeated over and over" },
+    { "inserts", "random,insert=100x32,delete=100x32",
+      "short inserts and deletes that shift the data after them" },
+    { "moves", "random,move=64Kx8",
+      "chunks of the basis moved around" },
+    { "rewrite", "random,rewrite=32",
+      "whole blocks rewritten in place, like a database file" },
+    { "append", "random,append=256K",
+      "new data added to the end" },
+    { "log", "log,log=256K",
+      "a log file with lines added to the end" },
+    { NULL, NULL, NULL }
+};
+
+
+/* State while making one pair of files. */
+typedef struct gen_state {
+    gen_rng_t       rng;
+    gen_data_t      *d;
+    size_t          cap;        /* allocated size of d->new */
+    size_t          block_len;
+    unsigned long   seq;        /* last log line number */
+} gen_state_t;
+
+
+void gen_seed(gen_rng_t *rng, uint64_t seed)
+{
+    rng->state = seed ? seed : 1;
+}
+
+
+uint32_t gen_rand(gen_rng_t *rng)
+{
+    rng->state ^= rng->state >> 12;
+    rng->state ^= rng->state << 25;
+    rng->state ^= rng->state >> 27;
+    return (uint32_t) ((rng->state * 2685821657736338717ULL) >> 32);
+}
+
+
+void gen_fill(gen_rng_t *rng, unsigned char *p, size_t len)
+{
+    size_t      i;
+
+    for (i = 0; i < len; i++)
+        p[i] = gen_rand(rng);
+}
+
+
+/* A random number below N, or 0 if N is 0. */
+static size_t gen_below(gen_rng_t *rng, size_t n)
+{
+    uint64_t    r;
+
+    /* Two statements, so the high half is always drawn first. */
+    r = (uint64_t) gen_rand(rng) << 32;
+    r |= gen_rand(rng);
+    return n ? r % n : 0;
+}
+
+
+/* Parse a size at S, leaving END at S if there are no digits. */
+static size_t parse_size(char const *s, char **end)
+{
+    unsigned long long n;
+
+    if (*s < '0' || *s > '9') {
+        *end = (char *) s;
+        return 0;
+    }
+    n = strtoull(s, end, 10);
+    switch (**end) {
+    case 'G':
+        n <<= 10;
+        /* fall through */
+    case 'M':
+        n <<= 10;
+        /* fall through */
+    case 'K':
+        n <<= 10;
+        (*end)++;
+    }
+    return n;
+}
+
+
+size_t gen_parse_size(char const *s)
+{
+    char        *end;
+    size_t      n = parse_size(s, &end);
+
+    return n && !*end ? n : 0;
+}
+
+
+/* Write LEN bytes of log lines to P, cutting the last one short. */
+static void gen_log(gen_state_t *g, unsigned char *p, size_t len)
+{
+    static char const *const verbs[] = { "GET", "PUT", "POST", "DELETE" };
+    static char const *const paths[] = {
+        "/", "/index.html", "/api/v1/items", "/api/v1/users", "/login",
+        "/static/app.js", "/static/style.css", "/health"
+    };
+    char        line[128];
+    size_t      n;
+    unsigned    host, pid, verb, path, ms;
+
+    while (len) {
+        /* Draw the numbers in order, not as arguments, whose order of
+         * evaluation is up to the compiler. */
+        host = gen_rand(&g->rng) % 8;
+        pid = 1000 + gen_rand(&g->rng) % 9000;
+        verb = gen_rand(&g->rng) % 4;
+        path = gen_rand(&g->rng) % 8;
+        ms = gen_rand(&g->rng) % 1000;
+        n = snprintf(line, sizeof line, "%010lu host%u app[%u]: %s %s "
+                     "took %u ms\n", ++g->seq, host, pid, verbs[verb],
+                     paths[path], ms);
+        if (n > len)
+            n = len;
+        memcpy(p, line, n);
+        p += n;
+        len -= n;
+    }
+}
+
+
+static void gen_basis(gen_state_t *g, char const *kind)
+{
+    gen_data_t  *d = g->d;
+    size_t      i, n, run, distinct = 4;
+
+    if (!strcmp(kind, "random")) {
+        gen_fill(&g->rng, d->old, d->old_len);
+    } else if (!strcmp(kind, "sparse")) {
+        memset(d->old, 0, d->old_len);
+        for (i = gen_below(&g->rng, 4096); i < d->old_len;
+             i += 1024 + gen_below(&g->rng, 8192)) {
+            run = 1 + gen_below(&g->rng, 64);
+            if (run > d->old_len - i)
+                run = d->old_len - i;
+            gen_fill(&g->rng, d->old + i, run);
+        }
+    } else if (!strcmp(kind, "lowentropy")) {
+        for (i = 0; i < d->old_len; i++)
+            d->old[i] = "ACGT"[gen_rand(&g->rng) % 4];
+    } else if (!strcmp(kind, "duplicates")) {
+        n = distinct * g->block_len;
+        if (n > d->old_len)
+            n = d->old_len;
+        gen_fill(&g->rng, d->old, n);
+        for (i = n; i < d->old_len; i += n) {
+            n = g->block_len < d->old_len - i ? g->block_len : d->old_len - i;
+            memcpy(d->old + i,
+                   d->old + gen_below(&g->rng, distinct) * g->block_len, n);
+        }
+    } else {
+        gen_log(g, d->old, d->old_len);
+    }
+}
+
+
+/* Replace DEL bytes at POS in the new file with INS bytes of space,
+ * returning where they are. */
+static unsigned char *gen_splice(gen_state_t *g, size_t pos, size_t del,
+                                 size_t ins)
+{
+    gen_data_t  *d = g->d;
+    size_t      len = d->new_len - del + ins;
+
+    if (len > g->cap) {
+        g->cap = len + len / 2;
+        d->new = realloc(d->new, g->cap);
+    }
+    memmove(d->new + pos + ins, d->new + pos + del, d->new_len - pos - del);
+    d->new_len = len;
+    return d->new + pos;
+}
+
+
+static int gen_mutate(gen_state_t *g, char const *op, char const *arg)
+{
+    gen_data_t  *d = g->d;
+    unsigned char *tmp;
+    char        *end;
+    size_t      len, pos = 0, count = 1, i, nblocks;
+    int         at = 0;
+
+    len = parse_size(arg, &end);
+    if (*end == '@') {
+        at = 1;
+        arg = end + 1;
+        pos = parse_size(arg, &end);
+    } else if (*end == 'x') {
+        arg = end + 1;
+        count = parse_size(arg, &end);
+    }
+    if (*end || end == arg || !len || !count)
+        return -1;
+
+    if (!strcmp(op, "edit") && !at && count == 1) {
+        for (i = gen_below(&g->rng, len); i < d->new_len;
+             i += 1 + len / 2 + gen_below(&g->rng, len))
+            d->new[i] ^= 1 + gen_rand(&g->rng) % 255;
+    } else if (!strcmp(op, "insert")) {
+        while (count--) {
+            if (!at)
+                pos = gen_below(&g->rng, d->new_len + 1);
+            if (pos > d->new_len)
+                pos = d->new_len;
+            gen_fill(&g->rng, gen_splice(g, pos, 0, len), len);
+        }
+    } else if (!strcmp(op, "delete")) {
+        while (count--) {
+            if (len > d->new_len)
+                len = d->new_len;
+            if (!at)
+                pos = gen_below(&g->rng, d->new_len - len + 1);
+            else if (pos > d->new_len - len)
+                pos = d->new_len - len;
+            gen_splice(g, pos, len, 0);
+        }
+    } else if (!strcmp(op, "move") && !at) {
+        if (len > d->new_len)
+            len = d->new_len;
+        tmp = malloc(len);
+        while (count--) {
+            pos = gen_below(&g->rng, d->new_len - len + 1);
+            memcpy(tmp, d->new + pos, len);
+            gen_splice(g, pos, len, 0);
+            pos = gen_below(&g->rng, d->new_len + 1);
+            memcpy(gen_splice(g, pos, 0, len), tmp, len);
+        }
+        free(tmp);
+    } else if (!strcmp(op, "rewrite") && !at && count == 1) {
+        nblocks = d->new_len / g->block_len;
+        for (i = 0; i < len && nblocks; i++)
+            gen_fill(&g->rng, d->new + gen_below(&g->rng, nblocks)
+                     * g->block_len, g->block_len);
+    } else if (!strcmp(op, "append") && !at && count == 1) {
+        gen_fill(&g->rng, gen_splice(g, d->new_len, 0, len), len);
+    } else if (!strcmp(op, "log") && !at && count == 1) {
+        gen_log(g, gen_splice(g, d->new_len, 0, len), len);
+    } else if (!strcmp(op, "truncate") && !at && count == 1) {
+        d->new_len -= len < d->new_len ? len : d->new_len;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+
+int gen_make(gen_data_t *d, char const *profile, size_t size,
+             size_t block_len, uint64_t seed)
+{
+    gen_state_t g;
+    char        *spec, *kind, *op, *arg;
+    int         i;
+
+    for (i = 0; gen_profiles[i].name; i++)
+        if (!strcmp(profile, gen_profiles[i].name)) {
+            profile = gen_profiles[i].spec;
+            break;
+        }
+    spec = strdup(profile);
+    kind = strtok(spec, ",");
+    if (!kind || (strcmp(kind, "random") && strcmp(kind, "sparse")
+                  && strcmp(kind, "lowentropy") && strcmp(kind, "duplicates")
+                  && strcmp(kind, "log"))) {
+        fprintf(stderr, "gen: unknown basis `%s' in profile `%s'\n",
+                kind ? kind : "", profile);
+        free(spec);
+        return -1;
+    }
+
+    memset(d, 0, sizeof *d);
+    memset(&g, 0, sizeof g);
+    gen_seed(&g.rng, seed);
+    g.d = d;
+    g.block_len = block_len ? block_len : 2048;
+    g.cap = size ? size : 1;
+    d->old_len = d->new_len = size;
+    d->old = malloc(g.cap);
+    d->new = malloc(g.cap);
+    gen_basis(&g, kind);
+    memcpy(d->new, d->old, size);
+
+    while ((op = strtok(NULL, ","))) {
+        if ((arg = strchr(op, '=')))
+            *arg++ = '\0';
+        if (!arg || gen_mutate(&g, op, arg)) {
+            fprintf(stderr, "gen: bad mutation `%s' in profile `%s'\n", op,
+                    profile);
+            gen_free(d);
+            free(spec);
+            return -1;
+        }
+    }
+    free(spec);
+    return 0;
+}
+
+
+void gen_free(gen_data_t *d)
+{
+    free(d->old);
+    free(d->new);
+    memset(d, 0, sizeof *d);
+}
@@ -0,0 +1,84 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * gen.h -- repeatable synthetic basis and new files for benchmarks and
+ * tests.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * A profile describes how to make a basis and how to change it into the
+ * new file, as a basis kind followed by mutations applied in order:
+ *
+ *   PROFILE  := BASIS [ "," MUTATION ]...
+ *   BASIS    := random | sparse | lowentropy | duplicates | log
+ *   MUTATION := edit=GAP            change a byte about every GAP bytes
+ *             | insert=LEN[@POS|xN] insert LEN random bytes
+ *             | delete=LEN[@POS|xN] delete LEN bytes
+ *             | move=LEN[xN]        move LEN bytes somewhere else
+ *             | rewrite=N           overwrite N whole blocks
+ *             | append=LEN          add LEN random bytes at the end
+ *             | log=LEN             add LEN bytes of log lines at the end
+ *             | truncate=LEN        drop LEN bytes from the end
+ *
+ * Without @POS or xN a mutation happens once at a random place.  Sizes
+ * may end in K, M or G.  The data depends only on the profile, size,
+ * block length and seed, never on the machine or C library.
+ */
+
+#ifndef _GEN_H_
+#define _GEN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** xorshift64* random numbers. */
+typedef struct gen_rng {
+    uint64_t state;
+} gen_rng_t;
+
+void gen_seed(gen_rng_t *rng, uint64_t seed);
+uint32_t gen_rand(gen_rng_t *rng);
+void gen_fill(gen_rng_t *rng, unsigned char *p, size_t len);
+
+/** A named profile. */
+typedef struct gen_profile {
+    char const *name;
+    char const *spec;
+    char const *help;
+} gen_profile_t;
+
+/** The named profiles, ending with a NULL name. */
+extern const gen_profile_t gen_profiles[];
+
+/** A generated pair of files. */
+typedef struct gen_data {
+    unsigned char *old, *new;
+    size_t old_len, new_len;
+} gen_data_t;
+
+/** Parse a size with an optional K, M or G suffix, returning 0 if it's
+ * not valid. */
+size_t gen_parse_size(char const *s);
+
+/** Make a basis of SIZE bytes and a new file from PROFILE, which is
+ * either a name from gen_profiles or a spec.  Returns 0, or -1 after
+ * printing an error if PROFILE is bad. */
+int gen_make(gen_data_t *d, char const *profile, size_t size,
+             size_t block_len, uint64_t seed);
+
+void gen_free(gen_data_t *d);
+
+#endif                          /* _GEN_H_ */
@@ -0,0 +1,84 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * gen_test -- check the synthetic workload generator.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "gen.h"
+
+#define SIZE    (256 << 10)
+#define BLOCK   2048
+
+
+int main(int argc, char **argv)
+{
+    gen_data_t  a, b;
+    gen_rng_t   rng;
+    int         i;
+
+    /* The numbers never change, so data is the same everywhere. */
+    gen_seed(&rng, 1);
+    assert(gen_rand(&rng) == 0x47e4ce4b);
+
+    assert(gen_parse_size("123") == 123);
+    assert(gen_parse_size("4K") == 4096);
+    assert(gen_parse_size("2M") == 2 << 20);
+    assert(gen_parse_size("1G") == 1 << 30);
+    assert(gen_parse_size("0") == 0);
+    assert(gen_parse_size("4k") == 0);
+    assert(gen_parse_size("") == 0);
+
+    /* Every profile is repeatable, and different seeds differ. */
+    for (i = 0; gen_profiles[i].name; i++) {
+        assert(!gen_make(&a, gen_profiles[i].name, SIZE, BLOCK, 7));
+        assert(!gen_make(&b, gen_profiles[i].spec, SIZE, BLOCK, 7));
+        assert(a.old_len == SIZE);
+        assert(a.new_len == b.new_len);
+        assert(!memcmp(a.old, b.old, SIZE));
+        assert(!memcmp(a.new, b.new, a.new_len));
+        assert(a.new_len != SIZE || memcmp(a.old, a.new, SIZE));
+        gen_free(&b);
+        assert(!gen_make(&b, gen_profiles[i].name, SIZE, BLOCK, 8));
+        assert(memcmp(a.old, b.old, SIZE) || memcmp(a.new, b.new, b.new_len));
+        gen_free(&a);
+        gen_free(&b);
+    }
+
+    /* Mutations change the length as they should. */
+    assert(!gen_make(&a, "random,insert=10@0,delete=3x5,append=1K,"
+                     "truncate=100,move=1Kx2,rewrite=4", SIZE, BLOCK, 1));
+    assert(a.new_len == SIZE + 10 - 15 + 1024 - 100);
+    assert(!memcmp(a.old, a.new + 10, 100));
+    gen_free(&a);
+    assert(!gen_make(&a, "random,delete=100@0", SIZE, BLOCK, 1));
+    assert(!memcmp(a.old + 100, a.new, SIZE - 100));
+    gen_free(&a);
+
+    /* Bad profiles are refused. */
+    assert(gen_make(&a, "nothing", SIZE, BLOCK, 1));
+    assert(gen_make(&a, "random,insert", SIZE, BLOCK, 1));
+    assert(gen_make(&a, "random,insert=", SIZE, BLOCK, 1));
+    assert(gen_make(&a, "random,insert=10x", SIZE, BLOCK, 1));
+    assert(gen_make(&a, "random,grow=10", SIZE, BLOCK, 1));
+    assert(gen_make(&a, "random,append=10@5", SIZE, BLOCK, 1));
+    return 0;
+}
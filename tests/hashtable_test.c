@@ -88,10 +88,14 @@ int match_cmp(match_t *m, const entry_t *e)
 /* Test driver for hashtable. */
 int main(int argc, char **argv)
 {
-    hashtable_t *t;
+    hashtable_t *t, *u;
     entry_t entry[256];
     entry_t e;
     match_t m;
+    long probe_hist[HASHTABLE_HIST_LEN] = { 0 };
+    hashtable_stats_t stats = { 0, 0, 0, 0, probe_hist };
+    long add_hist[HASHTABLE_HIST_LEN] = { 0 }, miss_hist[HASHTABLE_HIST_LEN] = { 0 };
+    long n;
     int i;
 
     entry_init(&e, 0);
@@ -116,23 +120,58 @@ int main(int argc, char **argv)
 
     /* Test hashtable_find() */
     match_init(&m, 0);
-    assert(hashtable_find(t, &m) == &e);        /* Finds first duplicate added. */
+    assert(hashtable_find(t, &m, &stats) == &e);        /* Finds first duplicate added. */
     assert(m.value == m.source);        /* match_cmp() updated m.value. */
     for (i = 1; i < 256; i++) {
         match_init(&m, i);
-        assert(hashtable_find(t, &m) == &entry[i]);
+        assert(hashtable_find(t, &m, &stats) == &entry[i]);
         assert(m.value == m.source);    /* match_cmp() updated m.value. */
     }
     match_init(&m, 256);
-    assert(hashtable_find(t, &m) == NULL);      /* Find missing entry. */
+    assert(hashtable_find(t, &m, &stats) == NULL);      /* Find missing entry. */
     assert(m.value == 0);       /* match_cmp() didn't update m.value. */
 #ifndef HASHTABLE_NSTATS
-    assert(t->find_count == 257);
-    assert(t->match_count == 256);
-    assert(t->hashcmp_count >= 256);
-    assert(t->entrycmp_count >= 256);
+    assert(stats.find_count == 257);
+    assert(stats.match_count == 256);
+    assert(stats.hashcmp_count >= 256);
+    assert(stats.entrycmp_count >= 256);
+    /* Every find is counted once, and the probes add up. */
+    for (i = n = 0; i < HASHTABLE_HIST_LEN; i++)
+        n += probe_hist[i];
+    assert(n == 257);
+    assert(probe_hist[0] > 0);
 #endif
 
+    /* Test hashtable_probe_hist() */
+    hashtable_probe_hist(t, add_hist, miss_hist);
+    for (i = n = 0; i < HASHTABLE_HIST_LEN; i++)
+        n += add_hist[i];
+    assert(n == 258);
+    assert(add_hist[0] > 0);
+    assert(add_hist[1] > 0);    /* Duplicate keys must collide. */
+    for (i = n = 0; i < HASHTABLE_HIST_LEN; i++)
+        n += miss_hist[i];
+    assert(n == 512);
+    assert(miss_hist[0] == 512 - 258);  /* Empty buckets. */
+
+    /* Without collisions every entry is added and found in its own
+     * bucket, which both histograms count as bucket 0. */
+    u = hashtable_new(256, (hash_f)&key_hash, (cmp_f)&match_cmp);
+    for (i = 0; i < 16; i += 2)     /* Only distinct keys. */
+        assert(hashtable_add(u, &entry[i]) == &entry[i]);
+    for (i = 0; i < HASHTABLE_HIST_LEN; i++)
+        add_hist[i] = miss_hist[i] = probe_hist[i] = 0;
+    hashtable_probe_hist(u, add_hist, miss_hist);
+    assert(add_hist[0] == 8);
+    for (i = 0; i < 16; i += 2) {
+        match_init(&m, i);
+        assert(hashtable_find(u, &m, &stats) == &entry[i]);
+    }
+#ifndef HASHTABLE_NSTATS
+    assert(probe_hist[0] == 8);
+#endif
+    hashtable_free(u);
+
     /* Test hashtable iterators */
     entry_t *p;
     hashtable_iter_t iter;
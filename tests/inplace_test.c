@@ -0,0 +1,156 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * inplace_test -- check rs_patch_inplace() spilling to a file, and
+ * resuming from its journal after being killed.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <utime.h>
+#ifdef HAVE_SETRLIMIT
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+#include "librsync.h"
+#include "gen.h"
+#include "memjob.h"
+
+#define DATA_LEN        (4 << 20)
+#define OUT_LEN         (2 * DATA_LEN)
+#define BASIS           "inplace_test.basis"
+#define JOURNAL         "inplace_test.journal"
+
+static char     sig[OUT_LEN], delta[OUT_LEN], out[OUT_LEN];
+
+
+static void write_basis(gen_data_t const *data)
+{
+    FILE *f = fopen(BASIS, "wb");
+
+    assert(f);
+    assert(fwrite(data->old, 1, DATA_LEN, f) == DATA_LEN);
+    assert(!fclose(f));
+}
+
+
+static void check_new(gen_data_t const *data)
+{
+    FILE *f = fopen(BASIS, "rb");
+
+    assert(f);
+    assert(fread(out, 1, OUT_LEN, f) == data->new_len);
+    assert(!memcmp(out, data->new, data->new_len));
+    fclose(f);
+}
+
+
+/* Patch the basis in place with the delta in F. */
+static rs_result patch(FILE *f, const char *journal, rs_stats_t *stats)
+{
+    rewind(f);
+    return rs_patch_inplace(BASIS, f, journal, stats);
+}
+
+
+int main(int argc, char **argv)
+{
+    gen_data_t      data;
+    rs_signature_t  *sumset;
+    rs_stats_t      stats;
+    size_t          sig_len, delta_len;
+    FILE            *delta_file, *bad_delta;
+#ifdef HAVE_SETRLIMIT
+    struct utimbuf  old_time;
+    struct rlimit   lim;
+    pid_t           pid;
+    int             status;
+#endif
+
+    /* Moved blocks give copy cycles, and the appended data is written
+     * past the end of the basis. */
+    assert(!gen_make(&data, "random,move=256Kx8,insert=100,append=1M",
+                     DATA_LEN, 2048, 1));
+    sig_len = memjob_once(rs_sig_begin(2048, 8, RS_BLAKE2_SIG_MAGIC),
+                          data.old, DATA_LEN, sig, OUT_LEN);
+    memjob_once(rs_loadsig_begin(&sumset), sig, sig_len, out, OUT_LEN);
+    assert(rs_build_hash_table(sumset) == RS_DONE);
+    delta_len = memjob_once(rs_delta_begin(sumset), data.new, data.new_len,
+                            delta, OUT_LEN);
+    rs_free_sumset(sumset);
+
+    delta_file = tmpfile();
+    assert(delta_file);
+    assert(fwrite(delta, 1, delta_len, delta_file) == delta_len);
+
+    /* The same commands with a changed byte of the appended literal,
+     * just before the END command. */
+    delta[delta_len - 2] ^= 1;
+    bad_delta = tmpfile();
+    assert(bad_delta);
+    assert(fwrite(delta, 1, delta_len, bad_delta) == delta_len);
+
+    /* With no memory budget everything set aside is spilled. */
+    write_basis(&data);
+    rs_inplace_mem_limit = 0;
+    assert(patch(delta_file, NULL, &stats) == RS_DONE);
+    rs_inplace_mem_limit = 64 << 20;
+    assert(stats.inplace_buffered > 0);
+    check_new(&data);
+
+#ifdef HAVE_SETRLIMIT
+    /* Kill a patch with SIGXFSZ when it first writes past the end of
+     * the basis, leaving the journal behind. */
+    write_basis(&data);
+    unlink(JOURNAL);
+    pid = fork();
+    assert(pid >= 0);
+    if (!pid) {
+        lim.rlim_cur = lim.rlim_max = 0;
+        setrlimit(RLIMIT_CORE, &lim);
+        lim.rlim_cur = lim.rlim_max = DATA_LEN;
+        setrlimit(RLIMIT_FSIZE, &lim);
+        _exit(patch(delta_file, JOURNAL, NULL) == RS_DONE ? 0 : 1);
+    }
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGXFSZ);
+    assert(!access(JOURNAL, F_OK));
+
+    /* It won't resume with another delta, or over an older basis. */
+    assert(patch(bad_delta, JOURNAL, NULL) == RS_BAD_MAGIC);
+    old_time.actime = old_time.modtime = 1;
+    assert(!utime(BASIS, &old_time));
+    assert(patch(delta_file, JOURNAL, NULL) == RS_BAD_MAGIC);
+    assert(!utime(BASIS, NULL));
+
+    assert(patch(delta_file, JOURNAL, NULL) == RS_DONE);
+    assert(access(JOURNAL, F_OK));
+    check_new(&data);
+#endif
+
+    unlink(BASIS);
+    fclose(bad_delta);
+    fclose(delta_file);
+    gen_free(&data);
+    return 0;
+}
@@ -0,0 +1,130 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * iterv_test -- tests for running jobs over scattered buffers.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "librsync.h"
+#include "gen.h"
+#include "memjob.h"
+
+#define DATA_LEN        100000
+#define OUT_LEN         200000
+#define MAX_SEGS        64
+
+
+/* Run JOB over IN cut into segments of 1 to SEG bytes, with output
+ * segments of 1 to SEG + 3 bytes, returning the output length. */
+static size_t run_scattered(rs_job_t *job, char *in, size_t in_len,
+                            char *out, int seg)
+{
+    rs_iovec_t      in_iov[MAX_SEGS], out_iov[MAX_SEGS];
+    rs_buffersv_t   bufv;
+    size_t          in_pos = 0, out_pos = 0, len;
+    int             i, n = 0;
+    rs_result       result;
+
+    do {
+        /* Offer up to MAX_SEGS fresh segments each way. */
+        for (i = 0; i < MAX_SEGS && in_pos < in_len; i++) {
+            len = 1 + n++ % seg;
+            if (len > in_len - in_pos)
+                len = in_len - in_pos;
+            in_iov[i].iov_base = in + in_pos;
+            in_iov[i].iov_len = len;
+            in_pos += len;
+        }
+        bufv.in_iov = in_iov;
+        bufv.in_iovcnt = i;
+        bufv.eof_in = in_pos == in_len;
+        for (i = 0; i < MAX_SEGS; i++) {
+            len = 1 + n++ % (seg + 3);
+            assert(out_pos + len <= OUT_LEN);
+            out_iov[i].iov_base = out + out_pos;
+            out_iov[i].iov_len = len;
+            out_pos += len;
+        }
+        bufv.out_iov = out_iov;
+        bufv.out_iovcnt = i;
+
+        result = rs_job_iterv(job, &bufv);
+        assert(result == RS_DONE || result == RS_BLOCKED);
+
+        /* Both are used in order, so what's left over is the tail:
+         * input not taken is offered again and unused output space is
+         * taken back. */
+        for (i = 0; i < bufv.in_iovcnt; i++)
+            in_pos -= bufv.in_iov[i].iov_len;
+        for (i = 0; i < bufv.out_iovcnt; i++)
+            out_pos -= bufv.out_iov[i].iov_len;
+    } while (result == RS_BLOCKED);
+
+    rs_job_free(job);
+    return out_pos;
+}
+
+
+int main(int argc, char **argv)
+{
+    static char     sig[OUT_LEN], sig2[OUT_LEN];
+    static char     delta[OUT_LEN], delta2[OUT_LEN], out[OUT_LEN];
+    gen_data_t      data;
+    char            *old, *new;
+    size_t          sig_len, delta_len, len;
+    rs_signature_t  *sumset;
+    int             seg;
+
+    assert(!gen_make(&data, "lowentropy,move=500,edit=50K", DATA_LEN, 256,
+                     1));
+    assert(data.new_len == DATA_LEN);
+    old = (char *) data.old;
+    new = (char *) data.new;
+
+    sig_len = memjob_once(rs_sig_begin(256, 8, RS_BLAKE2_SIG_MAGIC),
+                          old, DATA_LEN, sig, OUT_LEN);
+    memjob_once(rs_loadsig_begin(&sumset), sig, sig_len, out, OUT_LEN);
+    assert(rs_build_hash_table(sumset) == RS_DONE);
+    delta_len = memjob_once(rs_delta_begin(sumset), new, DATA_LEN, delta,
+                            OUT_LEN);
+
+    for (seg = 1; seg < 3000; seg = seg * 3 + 1) {
+        len = run_scattered(rs_sig_begin(256, 8, RS_BLAKE2_SIG_MAGIC),
+                            old, DATA_LEN, sig2, seg);
+        assert(len == sig_len);
+        assert(!memcmp(sig, sig2, len));
+
+        len = run_scattered(rs_delta_begin(sumset), new, DATA_LEN, delta2,
+                            seg);
+        assert(len == delta_len);
+        assert(!memcmp(delta, delta2, len));
+
+        len = run_scattered(rs_patch_begin(memjob_copy_cb, old), delta,
+                            delta_len, out, seg);
+        assert(len == DATA_LEN);
+        assert(!memcmp(new, out, len));
+    }
+
+    rs_free_sumset(sumset);
+    gen_free(&data);
+    return 0;
+}
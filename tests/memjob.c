@@ -0,0 +1,90 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * memjob.c -- drive jobs over buffers in memory for benchmarks and
+ * tests.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Force DEBUG on so that the checks here are always made. */
+#undef NDEBUG
+#include "config.h"
+#include <string.h>
+#include <assert.h>
+#include "memjob.h"
+
+
+size_t memjob_iter(rs_job_t *job, void const *in, size_t in_len, void *out,
+                   size_t out_len)
+{
+    rs_buffers_t buf;
+
+    buf.next_in = (char *) in;
+    buf.avail_in = in_len;
+    buf.eof_in = 1;
+    buf.next_out = out;
+    buf.avail_out = out_len;
+    assert(rs_job_iter(job, &buf) == RS_DONE);
+    return out_len - buf.avail_out;
+}
+
+
+size_t memjob_once(rs_job_t *job, void const *in, size_t in_len, void *out,
+                   size_t out_len)
+{
+    size_t      len = memjob_iter(job, in, in_len, out, out_len);
+
+    rs_job_free(job);
+    return len;
+}
+
+
+size_t memjob_run(rs_job_t *job, void const *in, size_t in_len,
+                  size_t in_chunk, void *out, size_t out_chunk,
+                  rs_stats_t *stats)
+{
+    char const  *from = in;
+    rs_buffers_t buf;
+    rs_result   result;
+    size_t      done = 0, room;
+
+    buf.next_in = (char *) from;
+    buf.avail_in = 0;
+    buf.eof_in = 0;
+    do {
+        if (!buf.avail_in && !buf.eof_in) {
+            buf.avail_in = in_len - (buf.next_in - from);
+            if (buf.avail_in > in_chunk)
+                buf.avail_in = in_chunk;
+            buf.eof_in = buf.next_in + buf.avail_in == from + in_len;
+        }
+        buf.next_out = (char *) out + done;
+        buf.avail_out = room = out_chunk;
+        result = rs_job_iter(job, &buf);
+        done += room - buf.avail_out;
+    } while (result == RS_BLOCKED);
+    assert(result == RS_DONE);
+    if (stats)
+        *stats = *rs_job_statistics(job);
+    rs_job_free(job);
+    return done;
+}
+
+
+rs_result memjob_copy_cb(void *arg, rs_long_t pos, size_t *len, void **buf)
+{
+    memcpy(*buf, (char const *) arg + pos, *len);
+    return RS_DONE;
+}
@@ -0,0 +1,49 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * memjob.h -- drive jobs over buffers in memory for benchmarks and
+ * tests.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#ifndef _MEMJOB_H_
+#define _MEMJOB_H_
+
+#include <stddef.h>
+#include "librsync.h"
+
+/** Run JOB over all the IN_LEN bytes at IN in one call, which must
+ * finish it, and return the number of bytes written to OUT.  The job is
+ * left for the caller to reset or free. */
+size_t memjob_iter(rs_job_t *job, void const *in, size_t in_len, void *out,
+                   size_t out_len);
+
+/** Like memjob_iter(), but frees the job. */
+size_t memjob_once(rs_job_t *job, void const *in, size_t in_len, void *out,
+                   size_t out_len);
+
+/** Run JOB until it's done, giving it at most IN_CHUNK bytes of input
+ * and OUT_CHUNK bytes of output space at a time so that it may block,
+ * copy its stats into STATS if that's not NULL, free it, and return the
+ * output length. */
+size_t memjob_run(rs_job_t *job, void const *in, size_t in_len,
+                  size_t in_chunk, void *out, size_t out_chunk,
+                  rs_stats_t *stats);
+
+/** A copy callback for rs_patch_begin() reading the basis from memory
+ * at ARG. */
+rs_result memjob_copy_cb(void *arg, rs_long_t pos, size_t *len, void **buf);
+
+#endif                          /* _MEMJOB_H_ */
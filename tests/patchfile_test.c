@@ -0,0 +1,73 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * patchfile_test -- check rs_patch_file() with streams that have no file
+ * descriptor.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "librsync.h"
+#include "gen.h"
+#include "memjob.h"
+
+#define DATA_LEN        (256 << 10)
+#define OUT_LEN         (2 * DATA_LEN + 1024)
+
+
+int main(int argc, char **argv)
+{
+#ifdef HAVE_FMEMOPEN
+    static char     sig[OUT_LEN], delta[OUT_LEN], out[OUT_LEN];
+    gen_data_t      data;
+    rs_signature_t  *sumset;
+    size_t          sig_len, delta_len;
+    FILE            *basis, *delta_file, *new_file;
+
+    assert(!gen_make(&data, "moves", DATA_LEN, 2048, 1));
+    sig_len = memjob_once(rs_sig_begin(2048, 8, RS_BLAKE2_SIG_MAGIC),
+                          data.old, DATA_LEN, sig, OUT_LEN);
+    memjob_once(rs_loadsig_begin(&sumset), sig, sig_len, out, OUT_LEN);
+    assert(rs_build_hash_table(sumset) == RS_DONE);
+    delta_len = memjob_once(rs_delta_begin(sumset), data.new, data.new_len,
+                            delta, OUT_LEN);
+    rs_free_sumset(sumset);
+
+    /* The basis and delta are in memory, with no descriptor behind
+     * them, so the basis has to be read through stdio. */
+    basis = fmemopen(data.old, DATA_LEN, "rb");
+    delta_file = fmemopen(delta, delta_len, "rb");
+    new_file = tmpfile();
+    assert(basis && delta_file && new_file);
+    assert(fileno(basis) < 0);
+    assert(rs_patch_file(basis, delta_file, new_file, NULL) == RS_DONE);
+    assert(ftell(new_file) == (long) data.new_len);
+    rewind(new_file);
+    assert(fread(out, 1, OUT_LEN, new_file) == data.new_len);
+    assert(!memcmp(out, data.new, data.new_len));
+
+    fclose(basis);
+    fclose(delta_file);
+    fclose(new_file);
+    gen_free(&data);
+#endif
+    return 0;
+}
@@ -0,0 +1,454 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * rs_bench -- timings of the librsync kernels and whole operations.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Usage: rs_bench [-s SIZE] [-b BLOCK_LEN] [-r RUNS] [-w WARMUPS]
+ *                 [-o JSON_FILE] [FILTER...]
+ *
+ * For each synthetic workload a basis of SIZE bytes and a new file are
+ * made by the gen.h profile of the same name from a fixed seed, so
+ * every run sees the same data.  Each
+ * benchmark is run WARMUPS times untimed and then RUNS times timed,
+ * and the min, median, 90th and 99th percentile, max and mean times are
+ * reported with the throughput at the median.
+ *
+ * Kernels:
+ *   rollsum    rolling the weak sum over every byte of the new file
+ *   md4        MD4 strong sums of every block of the basis
+ *   blake2     BLAKE2 strong sums of every block of the basis
+ *   hashtable  signature lookups at each offset in the new file, skipping
+ *              over blocks that match
+ *
+ * Whole operations, through the streaming API in memory:
+ *   signature, loadsig (including rs_build_hash_table()), delta, patch
+ *   cdc-sig, cdc-delta: signature and delta with content-defined chunks
+ *   multi-sig, multi-delta: signature and delta with a level of blocks 32
+ *              times longer
+ *
+ * The workloads are the profiles listed by `rs_gen -l'.
+ *
+ * Only the benchmarks whose "workload/name" contains one of the
+ * FILTERs are run, if any are given.  With -o the results are also
+ * written as JSON, one result per line in a fixed order so that files
+ * from two builds can be compared with diff.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "librsync.h"
+#include "util.h"
+#include "rollsum.h"
+#include "sumset.h"
+#include "gen.h"
+#include "memjob.h"
+
+
+typedef struct bench_result {
+    double      min, p50, p90, p99, max, mean;  /* in nanoseconds */
+} bench_result_t;
+
+
+/* Data for the current workload. */
+static gen_data_t       data;
+static unsigned char    *old, *new;
+static size_t           data_len, new_len, block_len, out_len;
+static char             *sig, *delta, *out, *cdc_sig, *cdc_delta;
+static char             *multi_sig, *multi_delta;
+static size_t           sig_len, delta_len, cdc_sig_len, cdc_delta_len;
+static size_t           multi_sig_len, multi_delta_len;
+static rs_signature_t   *sumset, *cdc_sumset, *multi_sumset;
+static rs_weak_sum_t    *weak_sums;     /* at every offset in new */
+static size_t           nweak;
+
+static int              runs = 10, warmups = 2;
+static char             **filters;
+static int              nfilters;
+static FILE             *json;
+static int              nresults;
+
+
+/* Keep results where the compiler can't throw the work away. */
+static volatile uint32_t sink;
+
+
+static void bench_rollsum(void)
+{
+    Rollsum     sum;
+    size_t      i;
+
+    RollsumInit(&sum);
+    RollsumUpdate(&sum, new, block_len);
+    for (i = block_len; i < new_len; i++)
+        RollsumRotate(&sum, new[i - block_len], new[i]);
+    sink = RollsumDigest(&sum);
+}
+
+
+static void bench_md4(void)
+{
+    rs_strong_sum_t strong;
+    size_t      i;
+
+    for (i = 0; i + block_len <= data_len; i += block_len)
+        rs_calc_md4_sum(old + i, block_len, &strong);
+    sink = strong[0];
+}
+
+
+static void bench_blake2(void)
+{
+    rs_strong_sum_t strong;
+    size_t      i;
+
+    for (i = 0; i + block_len <= data_len; i += block_len)
+        rs_calc_blake2_sum(old + i, block_len, &strong);
+    sink = strong[0];
+}
+
+
+static void bench_hashtable(void)
+{
+    rs_long_t   found = 0;
+    size_t      i;
+
+    /* Like a delta, carry on from the end of each matching block, so
+     * runs of identical blocks don't make this all strong sums. */
+    for (i = 0; i < nweak; i++)
+        if (rs_signature_find_match(sumset, NULL, weak_sums[i], new + i,
+                                    block_len) >= 0) {
+            found++;
+            i += block_len - 1;
+        }
+    sink = found;
+}
+
+
+static void bench_signature(void)
+{
+    sig_len = memjob_once(rs_sig_begin(block_len, 0, RS_BLAKE2_SIG_MAGIC),
+                          old, data_len, sig, out_len);
+}
+
+
+static void bench_loadsig(void)
+{
+    rs_signature_t *s;
+
+    memjob_once(rs_loadsig_begin(&s), sig, sig_len, out, out_len);
+    assert(rs_build_hash_table(s) == RS_DONE);
+    rs_free_sumset(s);
+}
+
+
+static void bench_delta(void)
+{
+    delta_len = memjob_once(rs_delta_begin(sumset), new, new_len, delta,
+                            out_len);
+}
+
+
+static void bench_cdc_sig(void)
+{
+    cdc_sig_len = memjob_once(rs_sig_begin(block_len, 0,
+                                           RS_CDC_BLAKE2_SIG_MAGIC),
+                              old, data_len, cdc_sig, out_len);
+}
+
+
+static void bench_cdc_delta(void)
+{
+    cdc_delta_len = memjob_once(rs_delta_begin(cdc_sumset), new, new_len,
+                                cdc_delta, out_len);
+}
+
+
+static void bench_multi_sig(void)
+{
+    multi_sig_len = memjob_once(rs_sig_begin(block_len, 0,
+                                             RS_MULTI_BLAKE2_SIG_MAGIC),
+                                old, data_len, multi_sig, out_len);
+}
+
+
+static void bench_multi_delta(void)
+{
+    multi_delta_len = memjob_once(rs_delta_begin(multi_sumset), new,
+                                  new_len, multi_delta, out_len);
+}
+
+
+static void bench_patch(void)
+{
+    assert(memjob_once(rs_patch_begin(memjob_copy_cb, old), delta,
+                       delta_len, out, out_len) == new_len);
+}
+
+
+static const struct bench {
+    char const  *name;
+    void        (*fn)(void);
+} benches[] = {
+    { "rollsum", bench_rollsum },
+    { "md4", bench_md4 },
+    { "blake2", bench_blake2 },
+    { "hashtable", bench_hashtable },
+    { "signature", bench_signature },
+    { "loadsig", bench_loadsig },
+    { "delta", bench_delta },
+    { "patch", bench_patch },
+    { "cdc-sig", bench_cdc_sig },
+    { "cdc-delta", bench_cdc_delta },
+    { "multi-sig", bench_multi_sig },
+    { "multi-delta", bench_multi_delta },
+};
+
+#define NELEM(a) (sizeof (a) / sizeof *(a))
+
+
+static int selected(char const *workload, char const *name)
+{
+    char        full[64];
+    int         i;
+
+    if (!nfilters)
+        return 1;
+    snprintf(full, sizeof full, "%s/%s", workload, name);
+    for (i = 0; i < nfilters; i++)
+        if (strstr(full, filters[i]))
+            return 1;
+    return 0;
+}
+
+
+static int cmp_double(void const *a, void const *b)
+{
+    double      x = *(double const *) a, y = *(double const *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+/* Nearest-rank percentile of N sorted values. */
+static double percentile(double const *v, int n, int pct)
+{
+    int         rank = (pct * n + 99) / 100;
+
+    return v[rank > 0 ? rank - 1 : 0];
+}
+
+
+static void time_bench(struct bench const *b, bench_result_t *r)
+{
+    double      *ns = malloc(runs * sizeof *ns), total = 0;
+    rs_long_t   start;
+    int         i;
+
+    for (i = 0; i < warmups; i++)
+        b->fn();
+    for (i = 0; i < runs; i++) {
+        start = rs_clock_ns();
+        b->fn();
+        ns[i] = rs_clock_ns() - start;
+        total += ns[i];
+    }
+    qsort(ns, runs, sizeof *ns, cmp_double);
+    r->min = ns[0];
+    r->p50 = percentile(ns, runs, 50);
+    r->p90 = percentile(ns, runs, 90);
+    r->p99 = percentile(ns, runs, 99);
+    r->max = ns[runs - 1];
+    r->mean = total / runs;
+    free(ns);
+}
+
+
+static void report(char const *workload, char const *name,
+                   bench_result_t const *r)
+{
+    double      mbps = r->p50 > 0 ? data_len / r->p50 * 1e3 : 0;
+
+    printf("%-10s %-10s %9.1f MB/s  p50 %9.3f ms  p90 %9.3f ms  "
+           "p99 %9.3f ms\n", workload, name, mbps, r->p50 / 1e6,
+           r->p90 / 1e6, r->p99 / 1e6);
+    if (json)
+        fprintf(json, "%s    {\"workload\": \"%s\", \"name\": \"%s\", "
+                "\"bytes\": %lu, \"runs\": %d, \"min_ns\": %.0f, "
+                "\"p50_ns\": %.0f, \"p90_ns\": %.0f, \"p99_ns\": %.0f, "
+                "\"max_ns\": %.0f, \"mean_ns\": %.0f, \"mb_per_s\": %.1f}",
+                nresults ? ",\n" : "", workload, name,
+                (unsigned long) data_len, runs, r->min, r->p50, r->p90,
+                r->p99, r->max, r->mean, mbps);
+    nresults++;
+}
+
+
+/* Make the data for workload W, with its signature and delta. */
+static void setup(int w)
+{
+    rs_job_t    *job;
+    Rollsum     sum;
+    size_t      i;
+
+    assert(!gen_make(&data, gen_profiles[w].name, data_len, block_len,
+                     0x5eed + w));
+    old = data.old;
+    new = data.new;
+    new_len = data.new_len;
+    out_len = 2 * (new_len > data_len ? new_len : data_len) + 1024;
+    sig = realloc(sig, out_len);
+    delta = realloc(delta, out_len);
+    out = realloc(out, out_len);
+    cdc_sig = realloc(cdc_sig, out_len);
+    cdc_delta = realloc(cdc_delta, out_len);
+    multi_sig = realloc(multi_sig, out_len);
+    multi_delta = realloc(multi_delta, out_len);
+    weak_sums = realloc(weak_sums, new_len * sizeof *weak_sums);
+
+    sig_len = memjob_once(rs_sig_begin(block_len, 0, RS_BLAKE2_SIG_MAGIC),
+                          old, data_len, sig, out_len);
+    job = rs_loadsig_begin(&sumset);
+    memjob_once(job, sig, sig_len, out, out_len);
+    assert(rs_build_hash_table(sumset) == RS_DONE);
+    delta_len = memjob_once(rs_delta_begin(sumset), new, new_len, delta,
+                            out_len);
+    bench_cdc_sig();
+    memjob_once(rs_loadsig_begin(&cdc_sumset), cdc_sig, cdc_sig_len, out,
+                out_len);
+    assert(rs_build_hash_table(cdc_sumset) == RS_DONE);
+    bench_cdc_delta();
+    bench_multi_sig();
+    memjob_once(rs_loadsig_begin(&multi_sumset), multi_sig, multi_sig_len,
+                out, out_len);
+    assert(rs_build_hash_table(multi_sumset) == RS_DONE);
+    bench_multi_delta();
+
+    nweak = new_len >= block_len ? new_len - block_len + 1 : 0;
+    RollsumInit(&sum);
+    RollsumUpdate(&sum, new, block_len);
+    for (i = 0; i < nweak; i++) {
+        if (i)
+            RollsumRotate(&sum, new[i - 1], new[i + block_len - 1]);
+        weak_sums[i] = RollsumDigest(&sum);
+    }
+}
+
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: rs_bench [-s SIZE] [-b BLOCK_LEN] [-r RUNS] "
+            "[-w WARMUPS] [-o JSON_FILE] [FILTER...]\n");
+    exit(2);
+}
+
+
+int main(int argc, char **argv)
+{
+    char const  *json_name = NULL;
+    bench_result_t r;
+    size_t      b;
+    int         i, w;
+
+    data_len = 8 << 20;
+    block_len = 2048;
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!argv[i][1] || argv[i][2] || i + 1 == argc)
+            usage();
+        switch (argv[i++][1]) {
+        case 's':
+            data_len = strtoul(argv[i], NULL, 0);
+            break;
+        case 'b':
+            block_len = strtoul(argv[i], NULL, 0);
+            break;
+        case 'r':
+            runs = atoi(argv[i]);
+            break;
+        case 'w':
+            warmups = atoi(argv[i]);
+            break;
+        case 'o':
+            json_name = argv[i];
+            break;
+        default:
+            usage();
+        }
+    }
+    filters = argv + i;
+    nfilters = argc - i;
+    if (runs < 1 || warmups < 0 || block_len < 64 || data_len < 4 * block_len)
+        usage();
+
+    if (json_name && !(json = fopen(json_name, "w"))) {
+        perror(json_name);
+        return 1;
+    }
+    if (json)
+        fprintf(json, "{\n  \"version\": \"%s\",\n  \"size\": %lu,\n"
+                "  \"block_len\": %lu,\n  \"runs\": %d,\n  \"warmups\": %d,\n"
+                "  \"results\": [\n", rs_librsync_version,
+                (unsigned long) data_len, (unsigned long) block_len, runs,
+                warmups);
+
+    for (w = 0; gen_profiles[w].name; w++) {
+        for (b = 0; b < NELEM(benches); b++)
+            if (selected(gen_profiles[w].name, benches[b].name))
+                break;
+        if (b == NELEM(benches))
+            continue;
+        setup(w);
+        for (b = 0; b < NELEM(benches); b++) {
+            if (!selected(gen_profiles[w].name, benches[b].name))
+                continue;
+            time_bench(&benches[b], &r);
+            report(gen_profiles[w].name, benches[b].name, &r);
+        }
+        /* Patching must still give the new file back. */
+        bench_patch();
+        assert(!memcmp(out, new, new_len));
+        assert(memjob_once(rs_patch_begin(memjob_copy_cb, old), cdc_delta,
+                           cdc_delta_len, out, out_len) == new_len);
+        assert(!memcmp(out, new, new_len));
+        assert(memjob_once(rs_patch_begin(memjob_copy_cb, old), multi_delta,
+                           multi_delta_len, out, out_len) == new_len);
+        assert(!memcmp(out, new, new_len));
+        rs_free_sumset(sumset);
+        rs_free_sumset(cdc_sumset);
+        rs_free_sumset(multi_sumset);
+        gen_free(&data);
+    }
+
+    if (json) {
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+    }
+    free(sig);
+    free(delta);
+    free(out);
+    free(cdc_sig);
+    free(cdc_delta);
+    free(multi_sig);
+    free(multi_delta);
+    free(weak_sums);
+    return 0;
+}
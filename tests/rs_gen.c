@@ -0,0 +1,97 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * rs_gen -- write a repeatable synthetic basis and new file.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Usage: rs_gen [-s SIZE] [-b BLOCK_LEN] [-S SEED] PROFILE BASIS NEW
+ *        rs_gen -l
+ *
+ * PROFILE is one of the names listed by -l or a spec as described in
+ * gen.h.  The same arguments always give the same files.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "gen.h"
+
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: rs_gen [-s SIZE] [-b BLOCK_LEN] [-S SEED] "
+            "PROFILE BASIS NEW\n"
+            "       rs_gen -l\n");
+    exit(2);
+}
+
+
+static void write_file(char const *name, unsigned char const *p,
+                       size_t len)
+{
+    FILE        *f;
+
+    if (!(f = fopen(name, "wb")) || fwrite(p, 1, len, f) != len
+        || fclose(f)) {
+        perror(name);
+        exit(1);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    gen_data_t  d;
+    size_t      size = 8 << 20, block_len = 2048;
+    uint64_t    seed = 1;
+    int         i;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-l")) {
+            for (i = 0; gen_profiles[i].name; i++)
+                printf("%-12s %-36s %s\n", gen_profiles[i].name,
+                       gen_profiles[i].spec, gen_profiles[i].help);
+            return 0;
+        }
+        if (!argv[i][1] || argv[i][2] || i + 1 == argc)
+            usage();
+        switch (argv[i++][1]) {
+        case 's':
+            if (!(size = gen_parse_size(argv[i])))
+                usage();
+            break;
+        case 'b':
+            if (!(block_len = gen_parse_size(argv[i])))
+                usage();
+            break;
+        case 'S':
+            seed = strtoull(argv[i], NULL, 0);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (argc - i != 3)
+        usage();
+
+    if (gen_make(&d, argv[i], size, block_len, seed))
+        return 2;
+    write_file(argv[i + 1], d.old, d.old_len);
+    write_file(argv[i + 2], d.new, d.new_len);
+    gen_free(&d);
+    return 0;
+}
@@ -0,0 +1,154 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * sigshare_test -- many threads making deltas against one signature.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Usage: sigshare_test [ROUNDS [MAX_THREADS]]
+ *
+ * Each thread runs ROUNDS delta jobs against the same signature and
+ * checks that every delta and its match statistics are the same as
+ * those made by a single job.  Nothing may be written to the signature,
+ * so this should be clean under ThreadSanitizer (configure with
+ * -DENABLE_THREAD_SANITIZER=ON) and the total rate should grow with the
+ * number of threads.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "librsync.h"
+#include "gen.h"
+#include "memjob.h"
+
+#define DATA_LEN        (1 << 20)
+#define OUT_LEN         (2 * DATA_LEN)
+#define BLOCK_LEN       512
+#define MAX_THREADS     64
+
+
+static char             *old, *new;
+static rs_signature_t   *sumset;
+static char             *ref_delta;
+static size_t           ref_len;
+static rs_stats_t       ref_stats;
+static int              rounds;
+
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/* Run JOB over IN in one go, returning the output length and freeing
+ * the job. */
+static size_t run(rs_job_t *job, char *in, size_t in_len, char *out,
+                  rs_stats_t *stats)
+{
+    return memjob_run(job, in, in_len, in_len, out, OUT_LEN, stats);
+}
+
+
+static void *delta_thread(void *arg)
+{
+    char        *out = malloc(OUT_LEN);
+    rs_stats_t  stats;
+    int         i;
+
+    for (i = 0; i < rounds; i++) {
+        assert(run(rs_delta_begin(sumset), new, DATA_LEN, out, &stats)
+               == ref_len);
+        assert(!memcmp(out, ref_delta, ref_len));
+        assert(stats.find_count == ref_stats.find_count);
+        assert(stats.match_count == ref_stats.match_count);
+        assert(stats.calc_strong_count == ref_stats.calc_strong_count);
+    }
+    free(out);
+    return NULL;
+}
+
+
+int main(int argc, char **argv)
+{
+    pthread_t   threads[MAX_THREADS];
+    char        *sig;
+    size_t      sig_len;
+    gen_rng_t   rng;
+    double      start, secs, rate, base = 0;
+    int         i, n, max_threads;
+
+    rounds = argc > 1 ? atoi(argv[1]) : 4;
+    max_threads = argc > 2 ? atoi(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_threads < 2)
+        max_threads = 2;
+    if (max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+
+    old = malloc(DATA_LEN);
+    new = malloc(DATA_LEN);
+    sig = malloc(OUT_LEN);
+    ref_delta = malloc(OUT_LEN);
+
+    /* Half the new file is moved blocks of the old, and half is new
+     * data, so there are plenty of both matches and misses. */
+    gen_seed(&rng, 1);
+    gen_fill(&rng, (unsigned char *) old, DATA_LEN);
+    gen_fill(&rng, (unsigned char *) new, DATA_LEN);
+    for (i = 0; i + BLOCK_LEN <= DATA_LEN; i += 2 * BLOCK_LEN + 7)
+        memcpy(new + i, old + (DATA_LEN - i - BLOCK_LEN), BLOCK_LEN);
+
+    sig_len = run(rs_sig_begin(BLOCK_LEN, 8, RS_BLAKE2_SIG_MAGIC),
+                  old, DATA_LEN, sig, NULL);
+    run(rs_loadsig_begin(&sumset), sig, sig_len, ref_delta, NULL);
+    assert(rs_build_hash_table(sumset) == RS_DONE);
+    ref_len = run(rs_delta_begin(sumset), new, DATA_LEN, ref_delta,
+                  &ref_stats);
+    assert(ref_stats.find_count > 0);
+    assert(ref_stats.match_count > 0);
+
+    for (n = 1; n <= max_threads; n *= 2) {
+        start = now();
+        for (i = 0; i < n; i++)
+            assert(!pthread_create(&threads[i], NULL, delta_thread, NULL));
+        for (i = 0; i < n; i++)
+            pthread_join(threads[i], NULL);
+        secs = now() - start;
+        rate = (double) n * rounds * DATA_LEN / 1e6 / secs;
+        if (n == 1)
+            base = rate;
+        printf("%2d threads: %8.1f MB/s, %.2fx one thread\n", n, rate,
+               rate / base);
+    }
+
+    rs_free_sumset(sumset);
+    free(old);
+    free(new);
+    free(sig);
+    free(ref_delta);
+    return 0;
+}
@@ -0,0 +1,177 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * smallfile_bench -- throughput of many small signature, delta and
+ * patch jobs, with new jobs for every file and with reused ones.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * Usage: smallfile_bench [FILES [SIZE]]
+ *
+ * Every file goes through signature, loadsig, delta and patch in
+ * memory, and the patched result is checked.  Allocations are counted
+ * through rs_set_allocator(); with reused jobs the signature and patch
+ * steps must not allocate anything after the first file.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/time.h>
+#include "librsync.h"
+#include "gen.h"
+#include "memjob.h"
+
+#define BLOCK_LEN       256
+
+
+static long allocs;
+
+
+static void *count_alloc(void *opaque, size_t size)
+{
+    allocs++;
+    return malloc(size);
+}
+
+
+static void *count_realloc(void *opaque, void *ptr, size_t size)
+{
+    allocs++;
+    return realloc(ptr, size);
+}
+
+
+static void count_free(void *opaque, void *ptr)
+{
+    free(ptr);
+}
+
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/* Make the next pair of basis and new files. */
+static void make_files(gen_rng_t *rng, char *old, char *new, size_t size)
+{
+    int         i;
+
+    gen_fill(rng, (unsigned char *) old, size);
+    memcpy(new, old, size);
+    for (i = 0; i < 4; i++)
+        new[gen_rand(rng) % size] ^= 1;
+}
+
+
+static void bench(int files, size_t size, int reuse)
+{
+    size_t      out_len = 2 * size + 1024, sig_len, delta_len;
+    char        *old = malloc(size), *new = malloc(size);
+    char        *sig = malloc(out_len), *delta = malloc(out_len);
+    char        *out = malloc(out_len);
+    rs_job_t    *sig_job = NULL, *patch_job = NULL, *job;
+    rs_signature_t *sumset;
+    gen_rng_t   rng;
+    long        steady = 0, before;
+    double      start, secs;
+    int         i;
+
+    gen_seed(&rng, 1);
+    allocs = 0;
+    start = now();
+    for (i = 0; i < files; i++) {
+        make_files(&rng, old, new, size);
+
+        before = allocs;
+        if (!reuse || !sig_job)
+            sig_job = rs_sig_begin(BLOCK_LEN, 8, RS_BLAKE2_SIG_MAGIC);
+        else
+            assert(rs_job_reset(sig_job) == RS_DONE);
+        sig_len = memjob_iter(sig_job, old, size, sig, out_len);
+        if (!reuse)
+            rs_job_free(sig_job);
+        if (i)
+            steady += allocs - before;
+
+        job = rs_loadsig_begin(&sumset);
+        memjob_iter(job, sig, sig_len, out, out_len);
+        rs_job_free(job);
+        /* The hash table and its entries come from our allocator too. */
+        before = allocs;
+        assert(rs_build_hash_table(sumset) == RS_DONE);
+        assert(allocs - before == 2);
+        job = rs_delta_begin(sumset);
+        delta_len = memjob_iter(job, new, size, delta, out_len);
+        rs_job_free(job);
+        rs_free_sumset(sumset);
+
+        before = allocs;
+        if (!reuse || !patch_job)
+            patch_job = rs_patch_begin(memjob_copy_cb, old);
+        else
+            assert(rs_job_reset(patch_job) == RS_DONE);
+        assert(memjob_iter(patch_job, delta, delta_len, out, out_len) == size);
+        if (!reuse)
+            rs_job_free(patch_job);
+        if (i)
+            steady += allocs - before;
+
+        assert(!memcmp(out, new, size));
+    }
+    secs = now() - start;
+    if (reuse) {
+        rs_job_free(sig_job);
+        rs_job_free(patch_job);
+        assert(steady == 0);
+    }
+
+    printf("%-6s jobs: %d files of %lu bytes in %.3fs, %.0f files/s, "
+           "%.1f allocations/file, %.1f in signature and patch\n",
+           reuse ? "reused" : "new", files, (unsigned long) size, secs,
+           secs > 0 ? files / secs : 0.0, (double) allocs / files,
+           files > 1 ? (double) steady / (files - 1) : 0.0);
+
+    free(old);
+    free(new);
+    free(sig);
+    free(delta);
+    free(out);
+}
+
+
+int main(int argc, char **argv)
+{
+    rs_allocator_t counter = { count_alloc, count_realloc, count_free, NULL };
+    int         files = argc > 1 ? atoi(argv[1]) : 10000;
+    size_t      size = argc > 2 ? (size_t) atol(argv[2]) : 2000;
+
+    assert(files > 0 && size > 0);
+    rs_set_allocator(&counter);
+    bench(files, size, 0);
+    bench(files, size, 1);
+    rs_set_allocator(NULL);
+    return 0;
+}
@@ -0,0 +1,149 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * stats_test -- check the counts of how jobs were driven.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "librsync.h"
+#include "gen.h"
+#include "memjob.h"
+
+#define DATA_LEN        (64 << 10)
+#define OUT_LEN         (2 * DATA_LEN + 1024)
+
+
+/* Run JOB with memjob_run(), checking that every call but the last
+ * blocked. */
+static size_t run(rs_job_t *job, void const *in, size_t in_len,
+                  size_t in_chunk, void *out, size_t out_chunk,
+                  rs_stats_t *stats)
+{
+    size_t      len = memjob_run(job, in, in_len, in_chunk, out, out_chunk,
+                                 stats);
+
+    assert(stats->iter_count > 0);
+    assert(stats->blocked_in_count + stats->blocked_out_count
+           == stats->iter_count - 1);
+    return len;
+}
+
+
+int main(int argc, char **argv)
+{
+    static char     sig[OUT_LEN], delta[OUT_LEN], out[OUT_LEN];
+    gen_data_t      data;
+    unsigned char   *old, *new;
+    rs_signature_t  *sumset;
+    rs_context_t    ctx;
+    rs_stats_t      stats;
+    size_t          sig_len, delta_len;
+    char            text[2000];
+
+    /* The new file is the second half of the old one followed by new
+     * data. */
+    assert(!gen_make(&data, "random,delete=32K@0,append=32K", DATA_LEN,
+                     1024, 1));
+    assert(data.new_len == DATA_LEN);
+    old = data.old;
+    new = data.new;
+
+    /* With all the input and room for all the output it runs at once,
+     * writing everything straight out. */
+    sig_len = run(rs_sig_begin(1024, 8, RS_BLAKE2_SIG_MAGIC), old, DATA_LEN,
+                  DATA_LEN, sig, OUT_LEN, &stats);
+    assert(stats.iter_count == 1);
+    assert(stats.tube_buffered_bytes == 0);
+    assert(stats.tube_direct_bytes == (rs_long_t) sig_len);
+    assert(stats.tube_catchups > 0);
+
+    /* Starved of input it blocks for input, and the scoop must move
+     * partial blocks along. */
+    assert(run(rs_sig_begin(1024, 8, RS_BLAKE2_SIG_MAGIC), old, DATA_LEN,
+               100, sig, OUT_LEN, &stats) == sig_len);
+    assert(stats.blocked_in_count > DATA_LEN / 100 / 2);
+    assert(stats.blocked_out_count == 0);
+    assert(stats.scoop_allocs == 1);
+    assert(stats.scoop_moved_bytes > 0);
+
+    /* Starved of output space it blocks for output, and holds what
+     * doesn't fit. */
+    assert(run(rs_sig_begin(1024, 8, RS_BLAKE2_SIG_MAGIC), old, DATA_LEN,
+               DATA_LEN, sig, 5, &stats) == sig_len);
+    assert(stats.blocked_out_count > 0);
+    assert(stats.tube_buffered_bytes > 0);
+    assert(stats.tube_buffered_bytes + stats.tube_direct_bytes
+           >= (rs_long_t) sig_len);
+
+    /* Scoops of several input buffers are kept in a mirrored ring where
+     * the data never has to be moved; smaller ones are moved down. */
+    rs_context_init(&ctx);
+    ctx.inbuflen = 1000;
+    run(rs_sig_begin(4096, 8, RS_BLAKE2_SIG_MAGIC), old, DATA_LEN, 100, sig,
+        OUT_LEN, &stats);
+    assert(stats.scoop_moved_bytes > 0);
+    run(rs_sig_begin_ctx(&ctx, 4096, 8, RS_BLAKE2_SIG_MAGIC), old, DATA_LEN,
+        100, sig, OUT_LEN, &stats);
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_SYS_MMAN_H)
+    assert(stats.scoop_moved_bytes == 0);
+#endif
+
+    /* With the default buffer sizes, readahead of a 32K block is large
+     * enough to be mirrored. */
+    run(rs_sig_begin(32 << 10, 8, RS_BLAKE2_SIG_MAGIC), old, DATA_LEN, 100,
+        sig, OUT_LEN, &stats);
+    assert(stats.scoop_allocs == 1);
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_SYS_MMAN_H)
+    assert(stats.scoop_moved_bytes == 0);
+#else
+    assert(stats.scoop_moved_bytes > 0);
+#endif
+
+    run(rs_loadsig_begin(&sumset), sig, sig_len, 1000, out, OUT_LEN,
+        &stats);
+    assert(rs_build_hash_table(sumset) == RS_DONE);
+    delta_len = run(rs_delta_begin(sumset), new, DATA_LEN, 1000, delta,
+                    1000, &stats);
+    rs_free_sumset(sumset);
+    assert(stats.blocked_in_count > 0);
+
+    /* A patch with all its input but little room for output blocks for
+     * output, including where a copy stops with the tube empty. */
+    assert(run(rs_patch_begin(memjob_copy_cb, old), delta, delta_len,
+               delta_len, out, 100, &stats) == DATA_LEN);
+    assert(!memcmp(out, new, DATA_LEN));
+    assert(stats.blocked_out_count >= DATA_LEN / 100 - 1);
+    assert(stats.blocked_in_count == 0);
+
+    /* Literal data in a patch is copied from the input when there is
+     * room. */
+    assert(run(rs_patch_begin(memjob_copy_cb, old), delta, delta_len,
+               delta_len, out, OUT_LEN, &stats) == DATA_LEN);
+    assert(!memcmp(out, new, DATA_LEN));
+    assert(stats.tube_direct_bytes >= stats.lit_bytes);
+
+    rs_format_stats(&stats, text, sizeof text - 1);
+    assert(strstr(text, " iter[1 calls, 0 blocked on input, 0 on output]"));
+    assert(strstr(text, " tube["));
+    gen_free(&data);
+    return 0;
+}
@@ -31,10 +31,13 @@
 int main(int argc, char **argv)
 {
     rs_signature_t sig;
+    rs_match_stats_t stats;
+    rs_signature_stats_t sig_stats;
     rs_result res;
     rs_weak_sum_t weak = 0x12345678;
     rs_strong_sum_t strong = "ABCDEF";
     int i;
+    rs_long_t n;
     unsigned char buf[256];
 
     /* Initialize test buffer. */
@@ -52,9 +55,6 @@ int main(int argc, char **argv)
     assert(sig.size == 0);
     assert(sig.block_sigs == NULL);
     assert(sig.hashtable == NULL);
-#ifndef HASHTABLE_NSTATS
-    assert(sig.calc_strong_count == 0);
-#endif
 
     /* Blake2 magic. */
     res = rs_signature_init(&sig, RS_BLAKE2_SIG_MAGIC, 16, 6, 0);
@@ -121,16 +121,136 @@ int main(int argc, char **argv)
     assert(sig.hashtable->count == 16);
 
     /* Test rs_signature_find_match(). */
+    memset(&stats, 0, sizeof stats);
     /* different weak, different block. */
-    assert(rs_signature_find_match(&sig, 0x12345678, &buf[2], 16) == -1);
+    assert(rs_signature_find_match(&sig, &stats, 0x12345678, &buf[2], 16) == -1);
     /* Matching weak, different block. */
-    assert(rs_signature_find_match(&sig, weak, &buf[2], 16) == -1);
+    assert(rs_signature_find_match(&sig, &stats, weak, &buf[2], 16) == -1);
     /* Matching weak, matching block. */
-    assert(rs_signature_find_match(&sig, weak, &buf[15*16], 16) == 15*16);
+    assert(rs_signature_find_match(&sig, &stats, weak, &buf[15*16], 16) == 15*16);
+#ifndef HASHTABLE_NSTATS
+    assert(stats.calc_strong_count == 2);
+    assert(stats.find.find_count == 3);
+    assert(stats.find.match_count == 1);
+#endif
+
+    /* Test rs_signature_get_stats(). */
+    /* Add a duplicate of the last block and one with only its weak sum. */
+    hashtable_free(sig.hashtable);
+    sig.hashtable = NULL;
+    rs_signature_add_block(&sig, weak, &strong);
+    strong[0] ^= 1;
+    rs_signature_add_block(&sig, weak, &strong);
+    res = rs_signature_get_stats(&sig, &sig_stats);
+    assert(res == RS_DONE);
+    assert(sig_stats.block_count == 18);
+    assert(sig_stats.distinct_weak_sums == 16);
+    assert(sig_stats.duplicate_blocks == 1);
+    assert(sig_stats.weak_collisions == 1);
+    assert(sig_stats.table_size == 0);  /* No hashtable yet. */
+    rs_build_hash_table(&sig);
+    res = rs_signature_get_stats(&sig, &sig_stats);
+    assert(res == RS_DONE);
+    assert(sig_stats.table_size == sig.hashtable->size);
+    assert(sig_stats.load == 18.0 / sig.hashtable->size);
+    for (i = n = 0; i < RS_PROBE_HIST_LEN; i++)
+        n += sig_stats.build_probes[i];
+    assert(n == 18);
+    for (i = n = 0; i < RS_PROBE_HIST_LEN; i++)
+        n += sig_stats.miss_probes[i];
+    assert(n == sig.hashtable->size);
 #ifndef HASHTABLE_NSTATS
-    assert(sig.calc_strong_count == 2);
+    for (i = n = 0; i < RS_PROBE_HIST_LEN; i++)
+        n += sig_stats.hit_probes[i];
+    assert(n == 18);
+    /* The block that only shares a weak sum is checked against the
+     * blocks added before it. */
+    assert(sig_stats.false_weak_matches >= 2);
 #endif
     rs_signature_done(&sig);
 
+    /* Test content-defined chunk signatures. */
+    res = rs_signature_init(&sig, RS_CDC_BLAKE2_SIG_MAGIC, 32, 0, 0);
+    assert(res == RS_PARAM_ERROR);  /* Too short an average. */
+    res = rs_signature_init(&sig, RS_CDC_BLAKE2_SIG_MAGIC, 64, 0, 0);
+    assert(res == RS_DONE);
+    assert(sig.strong_sum_len == RS_BLAKE2_SUM_LENGTH);
+    assert(sig.cdc.min == 16 && sig.cdc.max == 512);
+    assert(sig.block_offs[0] == 0);
+    /* Chunks of 10, 20, ... bytes, more than fit in the first allocation. */
+    for (i = n = 0; i < 20; i++) {
+        weak = rs_calc_weak_sum(&buf[n], 10 + i);
+        rs_signature_calc_strong_sum(&sig, &buf[n], 10 + i, &strong);
+        rs_signature_add_chunk(&sig, 10 + i, weak, &strong);
+        n += 10 + i;
+    }
+    assert(sig.count == 20);
+    assert(sig.block_offs[20] == n);
+    rs_build_hash_table(&sig);
+    memset(&stats, 0, sizeof stats);
+    /* Matching chunks are found at their offset. */
+    assert(rs_signature_find_match(&sig, &stats, rs_calc_weak_sum(&buf[10], 11), &buf[10], 11) == 10);
+    assert(rs_signature_find_match(&sig, &stats, weak, &buf[n - 29], 29) == n - 29);
+    /* Part of a chunk isn't. */
+    assert(rs_signature_find_match(&sig, &stats, rs_calc_weak_sum(&buf[10], 10), &buf[10], 10) == -1);
+    rs_signature_done(&sig);
+
+    /* Signatures of chunks are preallocated with room for the lengths. */
+    res = rs_signature_init(&sig, RS_CDC_BLAKE2_SIG_MAGIC, 64, 8, 12 + 10 * 16);
+    assert(res == RS_DONE);
+    assert(sig.size == 10);
+    rs_signature_done(&sig);
+
+    /* Test multi-level signatures. */
+    res = rs_signature_init(&sig, RS_MULTI_BLAKE2_SIG_MAGIC, 16, 0, 0);
+    assert(res == RS_DONE);
+    assert(rs_signature_levels(&sig) == 0);
+    /* Each level must be a longer multiple of the last. */
+    assert(rs_signature_add_level(&sig, 40) == RS_PARAM_ERROR);
+    assert(rs_signature_add_level(&sig, 16) == RS_PARAM_ERROR);
+    assert(rs_signature_add_level(&sig, 64) == RS_DONE);
+    assert(rs_signature_add_level(&sig, 96) == RS_PARAM_ERROR);
+    assert(rs_signature_add_level(&sig, 128) == RS_DONE);
+    assert(rs_signature_levels(&sig) == 2);
+    assert(rs_signature_level(&sig, 0) == &sig);
+    assert(rs_signature_level(&sig, 2)->block_len == 128);
+    assert(rs_signature_level(&sig, 2)->strong_sum_len == RS_BLAKE2_SUM_LENGTH);
+    /* Sums come coarsest first, then those of the blocks inside. */
+    i = 2;
+    n = 0;
+    assert((i = rs_signature_next_sum(&sig, i, &n)) == 1 && n == 0);
+    assert((i = rs_signature_next_sum(&sig, i, &n)) == 0 && n == 0);
+    assert((i = rs_signature_next_sum(&sig, i, &n)) == 0 && n == 16);
+    n = 48;
+    assert((i = rs_signature_next_sum(&sig, i, &n)) == 1 && n == 64);
+    n = 112;
+    assert((i = rs_signature_next_sum(&sig, 0, &n)) == 2 && n == 128);
+    /* Add the sums of buf in that order. */
+    for (i = 2, n = 0; n < 256; i = rs_signature_next_sum(&sig, i, &n)) {
+        rs_signature_t *level = rs_signature_level(&sig, i);
+
+        weak = rs_calc_weak_sum(&buf[n], level->block_len);
+        rs_signature_calc_strong_sum(level, &buf[n], level->block_len, &strong);
+        rs_signature_add_block(level, weak, &strong);
+    }
+    assert(sig.count == 16);
+    assert(rs_signature_level(&sig, 1)->count == 4);
+    assert(rs_signature_level(&sig, 2)->count == 2);
+    /* Every level gets a table, and blocks are found at their own. */
+    assert(rs_build_hash_table(&sig) == RS_DONE);
+    assert(rs_signature_level(&sig, 2)->hashtable);
+    memset(&stats, 0, sizeof stats);
+    assert(rs_signature_find_match(rs_signature_level(&sig, 1), &stats, rs_calc_weak_sum(&buf[64], 64), &buf[64], 64)
+           == 64);
+    assert(rs_signature_find_match(rs_signature_level(&sig, 2), &stats, rs_calc_weak_sum(&buf[128], 128), &buf[128],
+                                   128) == 128);
+    assert(rs_signature_find_match(&sig, &stats, rs_calc_weak_sum(&buf[64], 64), &buf[64], 64) == -1);
+    /* There are at most RS_MAX_SIG_LEVELS. */
+    assert(rs_signature_add_level(&sig, 256) == RS_DONE);
+    assert(rs_signature_add_level(&sig, 512) == RS_DONE);
+    assert(rs_signature_add_level(&sig, 1024) == RS_PARAM_ERROR);
+    rs_signature_done(&sig);
+    assert(sig.coarse == NULL);
+
     return 0;
 }
@@ -81,6 +81,18 @@ check_compare() {
     fi
 }
 
+# Fail if the -s statistics in $1 claim an output rate no disk or page
+# cache could reach, as they do when the time misses most of the work.
+check_speed() {
+    rate=`sed -n 's/.* (\([0-9.]*\) MB\/s) out.*/\1/p' "$1"`
+    if test -z "$rate" || awk "BEGIN { exit !($rate > 50000) }"
+    then
+        echo "$test_name: bad speed '$rate' MB/s from command: $2" >&2
+        cat "$1" >&2
+        exit 2
+    fi
+}
+
 triple_test () {
     buf="$1"
     old="$2"
@@ -92,6 +104,20 @@ triple_test () {
     run_test $bindir/rdiff $debug $hashopt -f -I$buf -O$buf $stats delta $tmpdir/sig $new $tmpdir/delta
     run_test $bindir/rdiff $debug $hashopt -f -I$buf -O$buf $stats patch $old $tmpdir/delta $tmpdir/new
     check_compare $new $tmpdir/new "triple -f -I$buf -O$buf $old $new"
+    run_test $bindir/rdiff $debug $hashopt -f -I$buf -O$buf $stats --async patch $old $tmpdir/delta $tmpdir/new
+    check_compare $new $tmpdir/new "triple --async -f -I$buf -O$buf $old $new"
+    run_test $bindir/rdiff $debug $hashopt -f -I$buf -O$buf $stats --threads=4 patch $old $tmpdir/delta $tmpdir/new
+    check_compare $new $tmpdir/new "triple --threads=4 -f -I$buf -O$buf $old $new"
+    run_test $bindir/rdiff $debug $hashopt -f -I$buf -O$buf $stats --reverse=$tmpdir/reverse patch $old $tmpdir/delta $tmpdir/new
+    run_test $bindir/rdiff $debug $hashopt -f -I$buf -O$buf $stats patch $tmpdir/new $tmpdir/reverse $tmpdir/rold
+    check_compare $old $tmpdir/rold "triple --reverse -f -I$buf -O$buf $old $new"
+    run_test $bindir/rdiff $debug $hashopt -f -I$buf -O$buf $stats --pipeline signature --block-size=$block_len \
+             $old $tmpdir/psig
+    check_compare $tmpdir/sig $tmpdir/psig "triple --pipeline signature -f -I$buf -O$buf $old"
+    run_test $bindir/rdiff $debug $hashopt -f -I$buf -O$buf $stats --pipeline delta $tmpdir/sig $new $tmpdir/pdelta
+    check_compare $tmpdir/delta $tmpdir/pdelta "triple --pipeline delta -f -I$buf -O$buf $new"
+    run_test $bindir/rdiff $debug $hashopt -f -I$buf -O$buf $stats --pipeline patch $old $tmpdir/delta $tmpdir/new
+    check_compare $new $tmpdir/new "triple --pipeline -f -I$buf -O$buf $old $new"
 }
 
 make_input () {